@@ -0,0 +1,403 @@
+"""
+Benchmark the C++ extension kernels.
+
+This invokes the registered ``metacells.extensions`` functions directly on synthetic dense and
+compressed inputs of realistic sizes and sparsities, so the results do not include any of the
+``numpy``, ``scipy`` or ``anndata`` overheads of the Python wrappers (or of preparing the inputs
+and outputs). Each kernel is run for each of a sweep of threads counts, reporting the best time of
+a few repeats, the throughput in rows (cells, genes or nodes) per second and in gigabytes (of the
+inputs and outputs) per second, and the speedup compared to the smallest threads count, as a CSV
+file.
+"""
+
+import os
+import re
+import sys
+from argparse import ArgumentParser
+from time import perf_counter_ns
+from typing import Any
+from typing import Callable
+from typing import List
+from typing import NamedTuple
+from typing import Optional
+from typing import Tuple
+
+import numpy as np
+import scipy.sparse as sp  # type: ignore
+
+import metacells.extensions as xt  # type: ignore
+
+#: The random seed used for generating the inputs and for the randomized kernels.
+SEED = 123456
+
+
+class Benchmark(NamedTuple):
+    """
+    A single kernel benchmark.
+    """
+
+    #: The name of the benchmark (the name of the kernel, possibly with a suffix).
+    name: str
+
+    #: The number of rows (cells, genes or nodes) processed by the kernel.
+    rows: int
+
+    #: The number of bytes of the inputs and outputs of the kernel.
+    nbytes: int
+
+    #: Prepare the arguments of a single invocation (not timed).
+    prepare: Callable[[], Tuple[Any, ...]]
+
+    #: The kernel itself.
+    kernel: Callable[..., Any]
+
+
+def main() -> None:
+    """
+    Benchmark the C++ extension kernels.
+    """
+    parser = ArgumentParser(description="Benchmark the C++ extension kernels.")
+    parser.add_argument(
+        "-t",
+        "--threads",
+        metavar="COUNTS",
+        help="The comma-separated threads counts to sweep (default: powers of two up to the number of CPUs).",
+    )
+    parser.add_argument(
+        "-s", "--scale", type=float, default=1.0, help="Scale the number of rows of the inputs (default: 1.0)."
+    )
+    parser.add_argument("-r", "--repeats", type=int, default=3, help="How many times to run each kernel (default: 3).")
+    parser.add_argument("-k", "--kernels", metavar="REGEX", help="Only run the kernels whose name matches this.")
+    parser.add_argument(
+        "-a",
+        "--affinity",
+        choices=("none", "compact", "scatter", "socket"),
+        default="none",
+        help="How to pin the threads to processors (default: none).",
+    )
+    parser.add_argument(
+        "-o",
+        "--output",
+        metavar="OUTPUT",
+        help="The optional path to write the output to (otherwise, writes to the standard output).",
+    )
+    args = parser.parse_args()
+
+    if args.threads is None:
+        threads_counts = [1]
+        while threads_counts[-1] * 2 <= (os.cpu_count() or 1):
+            threads_counts.append(threads_counts[-1] * 2)
+    else:
+        threads_counts = [int(threads_count) for threads_count in args.threads.split(",")]
+
+    benchmarks = _benchmarks(args.scale)
+    if args.kernels is not None:
+        pattern = re.compile(args.kernels)
+        benchmarks = [benchmark for benchmark in benchmarks if pattern.search(benchmark.name)]
+
+    if args.output is None:
+        output_file = sys.stdout
+    else:
+        output_file = open(args.output, "w", encoding="utf8")  # pylint: disable=consider-using-with
+
+    output_file.write("kernel,threads,seconds,rows_per_second,gigabytes_per_second,speedup\n")
+    for benchmark in benchmarks:
+        base_seconds: Optional[float] = None
+        for threads_count in threads_counts:
+            xt.set_threads_count(threads_count, args.affinity)
+            seconds = _run(benchmark, args.repeats)
+            if base_seconds is None:
+                base_seconds = seconds
+            output_file.write(
+                f"{benchmark.name},{threads_count},{seconds:.6f},"
+                f"{benchmark.rows / seconds:.1f},{benchmark.nbytes / seconds / 1e9:.3f},{base_seconds / seconds:.2f}\n"
+            )
+            output_file.flush()
+
+
+def _run(benchmark: Benchmark, repeats: int) -> float:
+    best_ns: Optional[int] = None
+    for _ in range(max(repeats, 1)):
+        args = benchmark.prepare()
+        start_ns = perf_counter_ns()
+        benchmark.kernel(*args)
+        elapsed_ns = perf_counter_ns() - start_ns
+        if best_ns is None or elapsed_ns < best_ns:
+            best_ns = elapsed_ns
+    assert best_ns is not None
+    return max(best_ns, 1) / 1e9
+
+
+def _counts_dense(rows_count: int, columns_count: int) -> np.ndarray:
+    random = np.random.default_rng(SEED)
+    return random.poisson(0.3, size=(rows_count, columns_count)).astype("float32")
+
+
+def _counts_compressed(rows_count: int, columns_count: int, density: float) -> sp.csr_matrix:
+    random = np.random.default_rng(SEED)
+    compressed = sp.random(rows_count, columns_count, density=density, format="csr", dtype="float32", random_state=SEED)
+    compressed.data[:] = random.integers(1, 10, size=compressed.nnz)
+    compressed.indices = compressed.indices.astype("int32")
+    compressed.indptr = compressed.indptr.astype("int32")
+    compressed.sort_indices()
+    return compressed
+
+
+def _nbytes(*arrays: Any) -> int:
+    return sum(array.nbytes for array in arrays)
+
+
+def _benchmarks(scale: float) -> List[Benchmark]:
+    def scaled(rows_count: int) -> int:
+        return max(int(rows_count * scale), 2)
+
+    benchmarks: List[Benchmark] = []
+    benchmarks.extend(_correlate_benchmarks(scaled(1_000), 5_000))
+    benchmarks.extend(_downsample_benchmarks(scaled(10_000), 5_000))
+    benchmarks.extend(_rank_benchmarks(scaled(10_000), 2_000))
+    benchmarks.extend(_auroc_benchmarks(scaled(5_000), 5_000))
+    benchmarks.extend(_relayout_benchmarks(scaled(20_000), 10_000))
+    benchmarks.append(_gaps_benchmark(scaled(5_000), 1_000))
+    benchmarks.append(_partitions_benchmark(scaled(5_000), 30))
+    return benchmarks
+
+
+def _correlate_benchmarks(rows_count: int, columns_count: int) -> List[Benchmark]:
+    dense = _counts_dense(rows_count, columns_count)
+    compressed = _counts_compressed(rows_count, columns_count, 0.05)
+    result = np.empty((rows_count, rows_count), dtype="float32")
+    return [
+        Benchmark(
+            "correlate_dense_float32_t",
+            rows_count,
+            _nbytes(dense, result),
+            lambda: (dense, result),
+            xt.correlate_dense_float32_t,
+        ),
+        Benchmark(
+            "correlate_compressed_float32_t_int32_t_int32_t",
+            rows_count,
+            _nbytes(compressed.data, compressed.indices, compressed.indptr, result),
+            lambda: (compressed.data, compressed.indices, compressed.indptr, columns_count, result),
+            xt.correlate_compressed_float32_t_int32_t_int32_t,
+        ),
+    ]
+
+
+def _downsample_benchmarks(rows_count: int, columns_count: int) -> List[Benchmark]:
+    compressed = _counts_compressed(rows_count, columns_count, 0.05)
+    dense = compressed.toarray()
+    samples = np.full(rows_count, int(np.median(np.asarray(compressed.sum(axis=1))) / 2), dtype="int32")
+    dense_output = np.empty_like(dense)
+    compressed_output = np.empty_like(compressed.data)
+    benchmarks: List[Benchmark] = []
+    for hypergeometric in (False, True):
+        suffix = ".hypergeometric" if hypergeometric else ""
+        benchmarks.append(
+            Benchmark(
+                "downsample_dense_float32_t_float32_t" + suffix,
+                rows_count,
+                _nbytes(dense, dense_output),
+                lambda hypergeometric=hypergeometric: (dense, dense_output, samples, SEED, hypergeometric),
+                xt.downsample_dense_float32_t_float32_t,
+            )
+        )
+        benchmarks.append(
+            Benchmark(
+                "downsample_compressed_float32_t_int32_t_float32_t" + suffix,
+                rows_count,
+                _nbytes(compressed.data, compressed.indptr, compressed_output),
+                lambda hypergeometric=hypergeometric: (
+                    compressed.data,
+                    compressed.indptr,
+                    compressed_output,
+                    samples,
+                    SEED,
+                    hypergeometric,
+                ),
+                xt.downsample_compressed_float32_t_int32_t_float32_t,
+            )
+        )
+    return benchmarks
+
+
+def _rank_benchmarks(rows_count: int, columns_count: int) -> List[Benchmark]:
+    dense = np.random.default_rng(SEED).random((rows_count, columns_count), dtype="float32")
+    output = np.empty(rows_count, dtype="float32")
+    top = 30
+    top_indices = np.empty(rows_count * top, dtype="int32")
+    top_data = np.empty(rows_count * top, dtype="float32")
+    return [
+        Benchmark(
+            "rank_rows_float32_t",
+            rows_count,
+            _nbytes(dense, output),
+            lambda: (dense, output, columns_count // 2),
+            xt.rank_rows_float32_t,
+        ),
+        Benchmark(
+            "rank_matrix_float32_t",
+            rows_count,
+            _nbytes(dense),
+            lambda: (dense.copy(), True),
+            xt.rank_matrix_float32_t,
+        ),
+        Benchmark(
+            "collect_top_float32_t",
+            rows_count,
+            _nbytes(dense, top_indices, top_data),
+            lambda: (top, dense, top_indices, top_data, False),
+            xt.collect_top_float32_t,
+        ),
+    ]
+
+
+def _auroc_benchmarks(rows_count: int, columns_count: int) -> List[Benchmark]:
+    # The rows are genes and the columns are cells, as in ``matrix_rows_folds_and_aurocs``.
+    compressed = _counts_compressed(rows_count, columns_count, 0.05)
+    dense = compressed.toarray()
+    columns_subset = np.zeros(columns_count, dtype="bool")
+    columns_subset[: columns_count // 10] = True
+    columns_scale = np.full(columns_count, 1.0, dtype="float32")
+    rows_folds = np.empty(rows_count, dtype="float64")
+    rows_aurocs = np.empty(rows_count, dtype="float64")
+    return [
+        Benchmark(
+            "auroc_dense_matrix_float32_t",
+            rows_count,
+            _nbytes(dense, rows_folds, rows_aurocs),
+            lambda: (dense, columns_subset, columns_scale, 1.0, rows_folds, rows_aurocs),
+            xt.auroc_dense_matrix_float32_t,
+        ),
+        Benchmark(
+            "auroc_compressed_matrix_float32_t_int32_t_int32_t",
+            rows_count,
+            _nbytes(compressed.data, compressed.indices, compressed.indptr, rows_folds, rows_aurocs),
+            lambda: (
+                compressed.data,
+                compressed.indices,
+                compressed.indptr,
+                columns_count,
+                columns_subset,
+                columns_scale,
+                1.0,
+                rows_folds,
+                rows_aurocs,
+            ),
+            xt.auroc_compressed_matrix_float32_t_int32_t_int32_t,
+        ),
+    ]
+
+
+def _relayout_benchmarks(rows_count: int, columns_count: int) -> List[Benchmark]:
+    compressed = _counts_compressed(rows_count, columns_count, 0.05)
+    output_indptr = np.zeros(columns_count + 1, dtype="int32")
+    output_indptr[1:] = np.cumsum(np.bincount(compressed.indices, minlength=columns_count))
+    output_data = np.empty_like(compressed.data)
+    output_indices = np.empty_like(compressed.indices)
+    nbytes = 2 * _nbytes(compressed.data, compressed.indices, compressed.indptr)
+    shuffled = compressed.copy()
+    random = np.random.default_rng(SEED)
+    for row_index in range(rows_count):
+        start, stop = shuffled.indptr[row_index], shuffled.indptr[row_index + 1]
+        permutation = random.permutation(stop - start) + start
+        shuffled.indices[start:stop] = shuffled.indices[permutation]
+        shuffled.data[start:stop] = shuffled.data[permutation]
+    return [
+        Benchmark(
+            "transpose_compressed_float32_t_int32_t_int32_t",
+            rows_count,
+            nbytes,
+            lambda: (
+                compressed.data,
+                compressed.indices,
+                compressed.indptr,
+                output_data,
+                output_indices,
+                output_indptr,
+                0,
+                columns_count,
+            ),
+            xt.transpose_compressed_float32_t_int32_t_int32_t,
+        ),
+        Benchmark(
+            "sort_compressed_indices_float32_t_int32_t_int32_t",
+            rows_count,
+            nbytes,
+            lambda: (shuffled.data.copy(), shuffled.indices.copy(), shuffled.indptr, columns_count),
+            xt.sort_compressed_indices_float32_t_int32_t_int32_t,
+        ),
+    ]
+
+
+def _gaps_benchmark(cells_count: int, genes_count: int) -> Benchmark:
+    umis = _counts_dense(cells_count, genes_count) * 3
+    fractions = umis / np.maximum(umis.sum(axis=1), 1)[:, np.newaxis]
+    log_fractions = np.log2(fractions + 1e-5).astype("float32")
+    candidates_count = max(cells_count // 100, 1)
+    candidate_per_cell = np.random.default_rng(SEED).integers(0, candidates_count, cells_count).astype("int32")
+    deviant_per_cell = np.zeros(cells_count, dtype="bool")
+    active_per_cell = np.ones(cells_count, dtype="bool")
+    min_gap_per_gene = np.full(genes_count, 1.0, dtype="float32")
+    max_gap_per_cell = np.empty(cells_count, dtype="float32")
+    return Benchmark(
+        "compute_cell_gaps",
+        cells_count,
+        _nbytes(umis, fractions, log_fractions, max_gap_per_cell),
+        lambda: (
+            umis,
+            fractions,
+            log_fractions,
+            candidate_per_cell,
+            deviant_per_cell,
+            active_per_cell,
+            min_gap_per_gene,
+            candidates_count,
+            1,
+            3,
+            0.1,
+            8.0,
+            max_gap_per_cell,
+        ),
+        xt.compute_cell_gaps,
+    )
+
+
+def _partitions_benchmark(nodes_count: int, degree: int) -> Benchmark:
+    random = np.random.default_rng(SEED)
+    rows = np.repeat(np.arange(nodes_count), degree)
+    columns = (rows + random.integers(1, nodes_count, size=rows.size)) % nodes_count
+    weights = random.random(rows.size, dtype="float32")
+    outgoing = sp.csr_matrix((weights, (rows, columns)), shape=(nodes_count, nodes_count))
+    outgoing.data /= np.repeat(np.asarray(outgoing.sum(axis=1)).flatten(), np.diff(outgoing.indptr))
+    incoming = outgoing.tocsc()
+    outgoing_arrays = [outgoing.data, outgoing.indices.astype("int32"), outgoing.indptr.astype("int32")]
+    incoming_arrays = [incoming.data, incoming.indices.astype("int32"), incoming.indptr.astype("int32")]
+    node_sizes = np.ones(nodes_count, dtype="float32")
+    target_partition_size = 80
+    partition_of_nodes = random.integers(0, max(nodes_count // target_partition_size, 1), nodes_count).astype("int32")
+    return Benchmark(
+        "optimize_partitions",
+        nodes_count,
+        _nbytes(*outgoing_arrays, *incoming_arrays, partition_of_nodes),
+        lambda: (
+            *outgoing_arrays,
+            *incoming_arrays,
+            SEED,
+            target_partition_size / 2,
+            target_partition_size,
+            target_partition_size * 2,
+            node_sizes,
+            0.02,
+            0.25,
+            partition_of_nodes.copy(),
+            0,
+            0.02,
+            0,
+        ),
+        xt.optimize_partitions,
+    )
+
+
+if __name__ == "__main__":
+    main()
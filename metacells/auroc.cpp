@@ -2,13 +2,22 @@
 
 namespace metacells {
 
+// Compute the AUROC given the non-zero values of the elements in and out of the subset, and the number of zero values
+// of each. Only the non-zero values are sorted, and all the zero values are a single tie between the positive and
+// negative values.
 static float64_t
-auroc_data(std::vector<float64_t>& in_values, std::vector<float64_t>& out_values) {
+auroc_data(std::vector<float64_t>& in_values,
+           const size_t in_zeros_count,
+           std::vector<float64_t>& out_values,
+           const size_t out_zeros_count) {
     std::sort(in_values.rbegin(), in_values.rend());
     std::sort(out_values.rbegin(), out_values.rend());
 
-    const size_t in_size = in_values.size();
-    const size_t out_size = out_values.size();
+    const size_t in_nonzeros_count = in_values.size();
+    const size_t out_nonzeros_count = out_values.size();
+
+    const size_t in_size = in_nonzeros_count + in_zeros_count;
+    const size_t out_size = out_nonzeros_count + out_zeros_count;
 
     if (in_size == 0) {
         FastAssertCompare(out_size, >, 0);
@@ -29,24 +38,39 @@ auroc_data(std::vector<float64_t>& in_values, std::vector<float64_t>& out_values
     size_t in_index = 0;
     size_t out_index = 0;
 
+    bool are_zeros_pending = true;
+
     float64_t area = 0;
 
-    do {
-        float64_t value = std::max(in_values[in_index], out_values[out_index]);
-        while (in_index < in_size && in_values[in_index] >= value)
+    while (out_count < out_size) {
+        float64_t value = are_zeros_pending ? 0.0 : std::numeric_limits<float64_t>::lowest();
+        if (in_index < in_nonzeros_count) {
+            value = std::max(value, in_values[in_index]);
+        }
+        if (out_index < out_nonzeros_count) {
+            value = std::max(value, out_values[out_index]);
+        }
+
+        size_t next_in_count = in_count;
+        size_t next_out_count = out_count;
+        while (in_index < in_nonzeros_count && in_values[in_index] >= value) {
             ++in_index;
-        while (out_index < out_size && out_values[out_index] >= value)
+            ++next_in_count;
+        }
+        while (out_index < out_nonzeros_count && out_values[out_index] >= value) {
             ++out_index;
-        area += (out_index - out_count) * out_scale * (in_index + in_count) * in_scale / 2;
-        in_count = in_index;
-        out_count = out_index;
-    } while (in_count < in_size && out_count < out_size);
-
-    const bool is_all_in = in_count == in_size;
-    const bool is_all_out = out_count == out_size;
-    FastAssertCompare((is_all_in || is_all_out), ==, true);
+            ++next_out_count;
+        }
+        if (are_zeros_pending && value <= 0) {
+            next_in_count += in_zeros_count;
+            next_out_count += out_zeros_count;
+            are_zeros_pending = false;
+        }
 
-    area += (out_size - out_count) * out_scale * (in_count + in_size) * in_scale / 2;
+        area += (next_out_count - out_count) * out_scale * (next_in_count + in_count) * in_scale / 2;
+        in_count = next_in_count;
+        out_count = next_out_count;
+    }
 
     return area;
 }
@@ -63,36 +87,47 @@ auroc_dense_vector(const ConstArraySlice<D>& values,
     FastAssertCompare(values.size(), ==, size);
 
     TmpVectorFloat64 raii_in_values;
-    auto tmp_in_values = raii_in_values.vector();
+    auto& tmp_in_values = raii_in_values.vector();
 
     TmpVectorFloat64 raii_out_values;
-    auto tmp_out_values = raii_out_values.vector();
+    auto& tmp_out_values = raii_out_values.vector();
 
     tmp_in_values.reserve(size);
     tmp_out_values.reserve(size);
 
+    size_t in_zeros_count = 0;
+    size_t out_zeros_count = 0;
+
     float64_t sum_in = 0.0;
     float64_t sum_out = 0.0;
 
     for (size_t index = 0; index < size; ++index) {
         const auto value = values[index] / scales[index];
         if (labels[index]) {
-            tmp_in_values.push_back(value);
-            sum_in += value;
+            if (value == 0) {
+                ++in_zeros_count;
+            } else {
+                tmp_in_values.push_back(value);
+                sum_in += value;
+            }
         } else {
-            tmp_out_values.push_back(value);
-            sum_out += value;
+            if (value == 0) {
+                ++out_zeros_count;
+            } else {
+                tmp_out_values.push_back(value);
+                sum_out += value;
+            }
         }
     }
 
-    FastAssertCompare(tmp_in_values.size() + tmp_out_values.size(), ==, size);
+    size_t num_in = tmp_in_values.size() + in_zeros_count;
+    size_t num_out = tmp_out_values.size() + out_zeros_count;
+    FastAssertCompare(num_in + num_out, ==, size);
 
-    size_t num_in = tmp_in_values.size();
-    size_t num_out = tmp_out_values.size();
     num_in += !num_in;
     num_out += !num_out;
     *fold = (sum_in / num_in + normalization) / (sum_out / num_out + normalization);
-    *auroc = auroc_data(tmp_in_values, tmp_out_values);
+    *auroc = auroc_data(tmp_in_values, in_zeros_count, tmp_out_values, out_zeros_count);
 }
 
 template<typename D>
@@ -132,6 +167,7 @@ static void
 auroc_compressed_vector(const ConstArraySlice<D>& values,
                         const ConstArraySlice<I>& indices,
                         const ConstArraySlice<bool>& labels,
+                        const size_t in_elements_count,
                         const ConstArraySlice<float32_t>& scales,
                         const float64_t normalization,
                         float64_t* fold,
@@ -139,35 +175,30 @@ auroc_compressed_vector(const ConstArraySlice<D>& values,
     const size_t size = labels.size();
     const size_t nnz_count = values.size();
     FastAssertCompare(nnz_count, <=, size);
+    FastAssertCompare(in_elements_count, <=, size);
 
     TmpVectorFloat64 raii_in_values;
-    auto tmp_in_values = raii_in_values.vector();
+    auto& tmp_in_values = raii_in_values.vector();
 
     TmpVectorFloat64 raii_out_values;
-    auto tmp_out_values = raii_out_values.vector();
+    auto& tmp_out_values = raii_out_values.vector();
 
-    tmp_in_values.reserve(size);
-    tmp_out_values.reserve(size);
+    tmp_in_values.reserve(nnz_count);
+    tmp_out_values.reserve(nnz_count);
+
+    size_t in_nnz_count = 0;
 
     float64_t sum_in = 0.0;
     float64_t sum_out = 0.0;
 
-    size_t prev_index = 0;
     for (size_t position = 0; position < nnz_count; ++position) {
         size_t index = size_t(indices[position]);
+        SlowAssertCompare(index, <, size);
         auto value = values[position] / scales[index];
-
-        SlowAssertCompare(prev_index, <=, index);
-        while (prev_index < index) {
-            if (labels[prev_index]) {
-                tmp_in_values.push_back(0.0);
-            } else {
-                tmp_out_values.push_back(0.0);
-            }
-            ++prev_index;
+        in_nnz_count += size_t(labels[index]);
+        if (value == 0) {
+            continue;
         }
-
-        SlowAssertCompare(prev_index, ==, index);
         if (labels[index]) {
             tmp_in_values.push_back(value);
             sum_in += value;
@@ -175,28 +206,20 @@ auroc_compressed_vector(const ConstArraySlice<D>& values,
             tmp_out_values.push_back(value);
             sum_out += value;
         }
-        ++prev_index;
     }
 
-    FastAssertCompare(prev_index, <=, size);
-    while (prev_index < size) {
-        if (labels[prev_index]) {
-            tmp_in_values.push_back(0.0);
-        } else {
-            tmp_out_values.push_back(0.0);
-        }
-        ++prev_index;
-    }
+    FastAssertCompare(in_nnz_count, <=, in_elements_count);
+    FastAssertCompare(nnz_count - in_nnz_count, <=, size - in_elements_count);
 
-    FastAssertCompare(prev_index, ==, size);
-    FastAssertCompare(tmp_in_values.size() + tmp_out_values.size(), ==, size);
+    size_t num_in = in_elements_count;
+    size_t num_out = size - in_elements_count;
+    const size_t in_zeros_count = num_in - tmp_in_values.size();
+    const size_t out_zeros_count = num_out - tmp_out_values.size();
 
-    size_t num_in = tmp_in_values.size();
-    size_t num_out = tmp_out_values.size();
     num_in += !num_in;
     num_out += !num_out;
     *fold = (sum_in / num_in + normalization) / (sum_out / num_out + normalization);
-    *auroc = auroc_data(tmp_in_values, tmp_out_values);
+    *auroc = auroc_data(tmp_in_values, in_zeros_count, tmp_out_values, out_zeros_count);
 }
 
 template<typename D, typename I, typename P>
@@ -221,10 +244,13 @@ auroc_compressed_matrix(const pybind11::array_t<D>& values_data_array,
     ArraySlice<float64_t> band_folds(band_folds_array, "band_folds");
     ArraySlice<float64_t> band_aurocs(band_aurocs_array, "band_aurocs");
 
+    const size_t in_elements_count = std::count(element_labels.begin(), element_labels.end(), true);
+
     parallel_loop(values.bands_count(), [&](size_t band_index) {
         auroc_compressed_vector(values.get_band_data(band_index),
                                 values.get_band_indices(band_index),
                                 element_labels,
+                                in_elements_count,
                                 element_scales,
                                 normalization,
                                 &band_folds[band_index],
@@ -232,10 +258,278 @@ auroc_compressed_matrix(const pybind11::array_t<D>& values_data_array,
     });
 }
 
+// Compute the fold and AUROC of each group of elements (compared to all the other elements), given the non-zero values
+// of some band and the group of each one (`groups_count` for elements which are not in any group).
+//
+// This sorts just the non-zero values (by descending value, then by group), and makes a single pass over the ties of
+// equal values, where all the zeros are a single tie between the positive and negative values. For each group we sum,
+// over its elements, the number of other elements with a higher value (counting ties as half), so the AUROC is one
+// minus this sum divided by the number of pairs of in and out elements.
+static void
+auroc_groups_data(const std::vector<float64_t>& values,
+                  const std::vector<size_t>& groups,
+                  const std::vector<size_t>& elements_count_of_groups,
+                  const float64_t normalization,
+                  ArraySlice<float64_t> folds,
+                  ArraySlice<float64_t> aurocs) {
+    const size_t nonzeros_count = values.size();
+    const size_t groups_count = folds.size();
+    FastAssertCompare(groups.size(), ==, nonzeros_count);
+    FastAssertCompare(aurocs.size(), ==, groups_count);
+    FastAssertCompare(elements_count_of_groups.size(), ==, groups_count + 1);
+
+    const size_t elements_count =
+        std::accumulate(elements_count_of_groups.begin(), elements_count_of_groups.end(), size_t(0));
+    FastAssertCompare(nonzeros_count, <=, elements_count);
+    const size_t zeros_count = elements_count - nonzeros_count;
+
+    // Sort the (value, group) pairs themselves, which is faster than sorting positions into them.
+    FastAssertCompare(groups_count, <=, size_t(std::numeric_limits<int32_t>::max()));
+    TmpVector<IndexedValue<float64_t>> raii_grouped_values;
+    auto& tmp_grouped_values = raii_grouped_values.vector(nonzeros_count);
+    for (size_t position = 0; position < nonzeros_count; ++position) {
+        tmp_grouped_values[position].value = values[position];
+        tmp_grouped_values[position].index = int32_t(groups[position]);
+    }
+    std::sort(tmp_grouped_values.begin(),
+              tmp_grouped_values.end(),
+              [](const IndexedValue<float64_t>& left, const IndexedValue<float64_t>& right) {
+                  return left.value > right.value || (left.value == right.value && left.index < right.index);
+              });
+
+    TmpVectorSizeT raii_nonzeros_count_of_groups;
+    auto& tmp_nonzeros_count_of_groups = raii_nonzeros_count_of_groups.vector(groups_count + 1);
+
+    TmpVectorFloat64 raii_sum_of_groups;
+    auto& tmp_sum_of_groups = raii_sum_of_groups.vector(groups_count + 1);
+
+    float64_t total_sum = 0.0;
+    for (size_t position = 0; position < nonzeros_count; ++position) {
+        ++tmp_nonzeros_count_of_groups[groups[position]];
+        tmp_sum_of_groups[groups[position]] += values[position];
+        total_sum += values[position];
+    }
+
+    TmpVectorSizeT raii_seen_count_of_groups;
+    auto& tmp_seen_count_of_groups = raii_seen_count_of_groups.vector(groups_count);
+
+    TmpVectorFloat64 raii_higher_of_groups;
+    auto& tmp_higher_of_groups = raii_higher_of_groups.vector(groups_count);
+
+    size_t seen_count = 0;
+
+    const auto add_tie = [&](const size_t group_index, const size_t group_tie_count, const size_t tie_count) {
+        const size_t higher_count = seen_count - tmp_seen_count_of_groups[group_index];
+        tmp_higher_of_groups[group_index] += group_tie_count * (higher_count + 0.5 * (tie_count - group_tie_count));
+        tmp_seen_count_of_groups[group_index] += group_tie_count;
+    };
+
+    const auto add_zeros = [&]() {
+        for (size_t group_index = 0; group_index < groups_count; ++group_index) {
+            FastAssertCompare(tmp_nonzeros_count_of_groups[group_index], <=, elements_count_of_groups[group_index]);
+            add_tie(group_index,
+                    elements_count_of_groups[group_index] - tmp_nonzeros_count_of_groups[group_index],
+                    zeros_count);
+        }
+        seen_count += zeros_count;
+    };
+
+    bool are_zeros_pending = true;
+    size_t tie_start = 0;
+    while (tie_start < nonzeros_count) {
+        const auto value = tmp_grouped_values[tie_start].value;
+        if (are_zeros_pending && value < 0) {
+            add_zeros();
+            are_zeros_pending = false;
+        }
+
+        size_t tie_stop = tie_start + 1;
+        while (tie_stop < nonzeros_count && tmp_grouped_values[tie_stop].value == value) {
+            ++tie_stop;
+        }
+        const size_t tie_count = tie_stop - tie_start;
+
+        size_t run_start = tie_start;
+        while (run_start < tie_stop) {
+            const size_t group_index = size_t(tmp_grouped_values[run_start].index);
+            size_t run_stop = run_start + 1;
+            while (run_stop < tie_stop && size_t(tmp_grouped_values[run_stop].index) == group_index) {
+                ++run_stop;
+            }
+            if (group_index < groups_count) {
+                add_tie(group_index, run_stop - run_start, tie_count);
+            }
+            run_start = run_stop;
+        }
+
+        seen_count += tie_count;
+        tie_start = tie_stop;
+    }
+
+    if (are_zeros_pending) {
+        add_zeros();
+    }
+    FastAssertCompare(seen_count, ==, elements_count);
+
+    for (size_t group_index = 0; group_index < groups_count; ++group_index) {
+        size_t num_in = elements_count_of_groups[group_index];
+        size_t num_out = elements_count - num_in;
+        if (num_in == 0) {
+            aurocs[group_index] = 0.0;
+        } else if (num_out == 0) {
+            aurocs[group_index] = 1.0;
+        } else {
+            aurocs[group_index] = 1.0 - tmp_higher_of_groups[group_index] / (float64_t(num_in) * float64_t(num_out));
+        }
+
+        const float64_t sum_in = tmp_sum_of_groups[group_index];
+        const float64_t sum_out = total_sum - sum_in;
+        num_in += !num_in;
+        num_out += !num_out;
+        folds[group_index] = (sum_in / num_in + normalization) / (sum_out / num_out + normalization);
+    }
+}
+
+static std::vector<size_t>
+count_elements_of_groups(const ConstArraySlice<int32_t>& element_groups, const size_t groups_count) {
+    std::vector<size_t> elements_count_of_groups(groups_count + 1, 0);
+    for (const auto group_index : element_groups) {
+        FastAssertCompare(group_index, <, int32_t(groups_count));
+        ++elements_count_of_groups[group_index < 0 ? groups_count : size_t(group_index)];
+    }
+    return elements_count_of_groups;
+}
+
+template<typename D>
+static void
+auroc_groups_dense_matrix(const pybind11::array_t<D>& values_array,
+                          const pybind11::array_t<int32_t>& column_groups_array,
+                          const pybind11::array_t<float32_t>& column_scales_array,
+                          const float64_t normalization,
+                          pybind11::array_t<float64_t>& folds_array,
+                          pybind11::array_t<float64_t>& aurocs_array) {
+    WithoutGil without_gil{};
+    ConstMatrixSlice<D> values(values_array, "values");
+    ConstArraySlice<int32_t> column_groups(column_groups_array, "column_groups");
+    ConstArraySlice<float32_t> column_scales(column_scales_array, "column_scales");
+    MatrixSlice<float64_t> row_folds(folds_array, "row_folds");
+    MatrixSlice<float64_t> row_aurocs(aurocs_array, "row_aurocs");
+    FastAssertCompare(normalization, >, 0);
+
+    const size_t columns_count = values.columns_count();
+    const size_t rows_count = values.rows_count();
+    const size_t groups_count = row_folds.columns_count();
+
+    FastAssertCompare(column_groups.size(), ==, columns_count);
+    FastAssertCompare(column_scales.size(), ==, columns_count);
+    FastAssertCompare(row_folds.rows_count(), ==, rows_count);
+    FastAssertCompare(row_aurocs.rows_count(), ==, rows_count);
+    FastAssertCompare(row_aurocs.columns_count(), ==, groups_count);
+
+    const auto columns_count_of_groups = count_elements_of_groups(column_groups, groups_count);
+
+    parallel_loop(rows_count, [&](size_t row_index) {
+        const auto row_values = values.get_row(row_index);
+
+        TmpVectorFloat64 raii_values;
+        auto& tmp_values = raii_values.vector();
+        tmp_values.reserve(columns_count);
+
+        TmpVectorSizeT raii_groups;
+        auto& tmp_groups = raii_groups.vector();
+        tmp_groups.reserve(columns_count);
+
+        for (size_t column_index = 0; column_index < columns_count; ++column_index) {
+            const float64_t value = row_values[column_index] / column_scales[column_index];
+            if (value != 0) {
+                const auto group_index = column_groups[column_index];
+                tmp_values.push_back(value);
+                tmp_groups.push_back(group_index < 0 ? groups_count : size_t(group_index));
+            }
+        }
+
+        auroc_groups_data(tmp_values,
+                          tmp_groups,
+                          columns_count_of_groups,
+                          normalization,
+                          row_folds.get_row(row_index),
+                          row_aurocs.get_row(row_index));
+    });
+}
+
+template<typename D, typename I, typename P>
+static void
+auroc_groups_compressed_matrix(const pybind11::array_t<D>& values_data_array,
+                               const pybind11::array_t<I>& values_indices_array,
+                               const pybind11::array_t<P>& values_indptr_array,
+                               size_t elements_count,
+                               const pybind11::array_t<int32_t>& element_groups_array,
+                               const pybind11::array_t<float32_t>& element_scales_array,
+                               float64_t normalization,
+                               pybind11::array_t<float64_t>& band_folds_array,
+                               pybind11::array_t<float64_t>& band_aurocs_array) {
+    WithoutGil without_gil{};
+    ConstCompressedMatrix<D, I, P> values(ConstArraySlice<D>(values_data_array, "values_data"),
+                                          ConstArraySlice<I>(values_indices_array, "values_indices"),
+                                          ConstArraySlice<P>(values_indptr_array, "values_indptr"),
+                                          elements_count,
+                                          "values");
+    ConstArraySlice<int32_t> element_groups(element_groups_array, "element_groups");
+    ConstArraySlice<float32_t> element_scales(element_scales_array, "element_scales");
+    MatrixSlice<float64_t> band_folds(band_folds_array, "band_folds");
+    MatrixSlice<float64_t> band_aurocs(band_aurocs_array, "band_aurocs");
+    FastAssertCompare(normalization, >, 0);
+
+    const size_t bands_count = values.bands_count();
+    const size_t groups_count = band_folds.columns_count();
+
+    FastAssertCompare(element_groups.size(), ==, elements_count);
+    FastAssertCompare(element_scales.size(), ==, elements_count);
+    FastAssertCompare(band_folds.rows_count(), ==, bands_count);
+    FastAssertCompare(band_aurocs.rows_count(), ==, bands_count);
+    FastAssertCompare(band_aurocs.columns_count(), ==, groups_count);
+
+    const auto elements_count_of_groups = count_elements_of_groups(element_groups, groups_count);
+
+    parallel_loop(bands_count, [&](size_t band_index) {
+        const auto band_indices = values.get_band_indices(band_index);
+        const auto band_data = values.get_band_data(band_index);
+        const size_t nnz_count = band_indices.size();
+
+        TmpVectorFloat64 raii_values;
+        auto& tmp_values = raii_values.vector();
+        tmp_values.reserve(nnz_count);
+
+        TmpVectorSizeT raii_groups;
+        auto& tmp_groups = raii_groups.vector();
+        tmp_groups.reserve(nnz_count);
+
+        for (size_t position = 0; position < nnz_count; ++position) {
+            const size_t element_index = size_t(band_indices[position]);
+            const float64_t value = band_data[position] / element_scales[element_index];
+            if (value != 0) {
+                const auto group_index = element_groups[element_index];
+                tmp_values.push_back(value);
+                tmp_groups.push_back(group_index < 0 ? groups_count : size_t(group_index));
+            }
+        }
+
+        auroc_groups_data(tmp_values,
+                          tmp_groups,
+                          elements_count_of_groups,
+                          normalization,
+                          band_folds.get_row(band_index),
+                          band_aurocs.get_row(band_index));
+    });
+}
+
 void
 register_auroc(pybind11::module& module) {
-#define REGISTER_D(D) \
-    module.def("auroc_dense_matrix_" #D, &metacells::auroc_dense_matrix<D>, "AUROC for dense matrix.");
+#define REGISTER_D(D)                                                                                \
+    module.def("auroc_dense_matrix_" #D, &metacells::auroc_dense_matrix<D>, "AUROC for dense matrix."); \
+    module.def("auroc_groups_dense_matrix_" #D,                                                          \
+               &metacells::auroc_groups_dense_matrix<D>,                                                 \
+               "AUROC of each group for dense matrix.");
 
     REGISTER_D(int8_t)
     REGISTER_D(int16_t)
@@ -248,10 +542,13 @@ register_auroc(pybind11::module& module) {
     REGISTER_D(float32_t)
     REGISTER_D(float64_t)
 
-#define REGISTER_D_I_P(D, I, P)                              \
-    module.def("auroc_compressed_matrix_" #D "_" #I "_" #P,  \
-               &metacells::auroc_compressed_matrix<D, I, P>, \
-               "AUROC for compressed matrix.");
+#define REGISTER_D_I_P(D, I, P)                                     \
+    module.def("auroc_compressed_matrix_" #D "_" #I "_" #P,         \
+               &metacells::auroc_compressed_matrix<D, I, P>,        \
+               "AUROC for compressed matrix.");                     \
+    module.def("auroc_groups_compressed_matrix_" #D "_" #I "_" #P,  \
+               &metacells::auroc_groups_compressed_matrix<D, I, P>, \
+               "AUROC of each group for compressed matrix.");
 
 #define REGISTER_DS_I_P(I, P)       \
     REGISTER_D_I_P(int8_t, I, P)    \
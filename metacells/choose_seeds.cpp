@@ -2,40 +2,98 @@
 
 namespace metacells {
 
-static std::vector<std::vector<int32_t>>
-collect_connected_nodes(ConstCompressedMatrix<float32_t, int32_t, int32_t>& incoming_weights,
-                        ConstArraySlice<int32_t> seed_of_nodes) {
-    const size_t nodes_count = seed_of_nodes.size();
-    std::vector<std::vector<int32_t>> connected_nodes(nodes_count);
+// The unseeded nodes which may become seeds, ordered by the number of their "connected" nodes (unseeded incoming
+// neighbors, which may join them).
+//
+// The nodes are kept in a single array sorted by this count, with the first position of the bucket of each count.
+// Decrementing the count of a node just swaps it with the first node of its bucket and moves the start of the bucket,
+// so keeping the order costs O(1) per removed edge, and finding the node of some rank is a simple lookup. Nodes with no
+// connected nodes (including the seeded ones) are in the first bucket and are not candidates.
+class SeedCandidates {
+private:
+    std::vector<int32_t> m_connected_count_of_nodes;
+    std::vector<int32_t> m_position_of_nodes;
+    std::vector<int32_t> m_sorted_nodes;
+    std::vector<int32_t> m_first_position_of_counts;
+
+public:
+    SeedCandidates(ConstCompressedMatrix<float32_t, int32_t, int32_t>& incoming_weights,
+                   ConstArraySlice<int32_t> seed_of_nodes)
+      : m_connected_count_of_nodes(seed_of_nodes.size(), 0)
+      , m_position_of_nodes(seed_of_nodes.size())
+      , m_sorted_nodes(seed_of_nodes.size()) {
+        const size_t nodes_count = seed_of_nodes.size();
+        int32_t max_connected_count = 0;
+        for (size_t node_index = 0; node_index < nodes_count; ++node_index) {
+            if (seed_of_nodes[node_index] >= 0) {
+                continue;
+            }
+            auto node_incoming = incoming_weights.get_band_indices(node_index);
+            const auto connected_count =
+                std::count_if(node_incoming.begin(), node_incoming.end(), [&](int32_t other_node_index) {
+                    return seed_of_nodes[other_node_index] < 0;
+                });
+            m_connected_count_of_nodes[node_index] = int32_t(connected_count);
+            max_connected_count = std::max(max_connected_count, int32_t(connected_count));
+        }
 
-    for (size_t node_index = 0; node_index < nodes_count; ++node_index) {
-        if (seed_of_nodes[node_index] >= 0) {
-            continue;
+        m_first_position_of_counts.resize(max_connected_count + 2, 0);
+        for (size_t node_index = 0; node_index < nodes_count; ++node_index) {
+            ++m_first_position_of_counts[m_connected_count_of_nodes[node_index] + 1];
+        }
+        std::partial_sum(m_first_position_of_counts.begin(),
+                         m_first_position_of_counts.end(),
+                         m_first_position_of_counts.begin());
+
+        std::vector<int32_t> next_position_of_counts(m_first_position_of_counts);
+        for (size_t node_index = 0; node_index < nodes_count; ++node_index) {
+            const auto position = next_position_of_counts[m_connected_count_of_nodes[node_index]]++;
+            m_sorted_nodes[position] = int32_t(node_index);
+            m_position_of_nodes[node_index] = position;
         }
-        auto node_incoming = incoming_weights.get_band_indices(node_index);
-        auto& node_connected = connected_nodes[node_index];
-        node_connected.resize(node_incoming.size());
-        auto copied = std::copy_if(node_incoming.begin(),
-                                   node_incoming.end(),
-                                   node_connected.begin(),
-                                   [&](int32_t other_node_index) { return seed_of_nodes[other_node_index] < 0; });
-        node_connected.resize(copied - node_connected.begin());
     }
 
-    return connected_nodes;
-}
+    /// The number of candidate nodes (which have at least one connected node).
+    size_t size() const { return m_sorted_nodes.size() - size_t(m_first_position_of_counts[1]); }
+
+    /// The number of connected nodes of a node.
+    size_t connected_count(const size_t node_index) const { return size_t(m_connected_count_of_nodes[node_index]); }
+
+    /// The candidate node of some rank (in the order of the number of their connected nodes).
+    size_t node_of_rank(const size_t rank) const {
+        FastAssertCompare(rank, <, size());
+        return size_t(m_sorted_nodes[m_first_position_of_counts[1] + rank]);
+    }
+
+    /// Remove one of the connected nodes of a node.
+    void decrement(const size_t node_index) {
+        auto& connected_count = m_connected_count_of_nodes[node_index];
+        FastAssertCompare(connected_count, >, 0);
+        auto& first_position = m_first_position_of_counts[connected_count];
+        const auto position = m_position_of_nodes[node_index];
+        const auto other_node_index = m_sorted_nodes[first_position];
+        m_sorted_nodes[position] = other_node_index;
+        m_position_of_nodes[other_node_index] = position;
+        m_sorted_nodes[first_position] = int32_t(node_index);
+        m_position_of_nodes[node_index] = first_position;
+        ++first_position;
+        --connected_count;
+    }
+
+    /// Remove a node which became a seed, or joined one, from the candidates.
+    void remove(const size_t node_index) {
+        while (m_connected_count_of_nodes[node_index] > 0) {
+            decrement(node_index);
+        }
+    }
+};
 
 static size_t
-choose_seed_node(const std::vector<size_t>& tmp_candidates,
-                 const std::vector<std::vector<int32_t>>& connected_nodes,
+choose_seed_node(const SeedCandidates& candidates,
                  const float32_t min_seed_size_quantile,
                  const float32_t max_seed_size_quantile,
-                 std::minstd_rand& random) {
-    size_t size = tmp_candidates.size();
-
-    TmpVectorSizeT raii_positions;
-    auto tmp_positions = raii_positions.array_slice("tmp_positions", size);
-    std::iota(tmp_positions.begin(), tmp_positions.end(), 0);
+                 PhiloxRandom& random) {
+    size_t size = candidates.size();
 
     size_t min_seed_rank = size_t(floor((size - 1) * min_seed_size_quantile));
     size_t max_seed_rank = size_t(ceil((size - 1) * max_seed_size_quantile));
@@ -43,62 +101,24 @@ choose_seed_node(const std::vector<size_t>& tmp_candidates,
     FastAssertCompare(min_seed_rank, <=, max_seed_rank);
     FastAssertCompare(max_seed_rank, <=, size - 1);
 
-    std::nth_element(tmp_positions.begin(),
-                     tmp_positions.begin() + min_seed_rank,
-                     tmp_positions.end(),
-                     [&](const size_t left_position, const size_t right_position) {
-                         const auto left_node_index = tmp_candidates[left_position];
-                         const auto right_node_index = tmp_candidates[right_position];
-                         const auto left_size = connected_nodes[left_node_index].size();
-                         const auto right_size = connected_nodes[right_node_index].size();
-                         return left_size < right_size;
-                     });
-
-    std::nth_element(tmp_positions.begin() + min_seed_rank,
-                     tmp_positions.begin() + max_seed_rank,
-                     tmp_positions.end(),
-                     [&](const size_t left_position, const size_t right_position) {
-                         const auto left_node_index = tmp_candidates[left_position];
-                         const auto right_node_index = tmp_candidates[right_position];
-                         const auto left_size = connected_nodes[left_node_index].size();
-                         const auto right_size = connected_nodes[right_node_index].size();
-                         return left_size < right_size;
-                     });
-
-    const size_t selected = random() % (max_seed_rank + 1 - min_seed_rank);
-    const size_t position = tmp_positions[min_seed_rank + selected];
-    size_t seed_node_index = tmp_candidates[position];
-
-    LOCATED_LOG(false)                                           //
-        << " node: " << seed_node_index                          //
-        << " size: " << connected_nodes[seed_node_index].size()  //
+    const size_t selected = random.below(max_seed_rank + 1 - min_seed_rank);
+    size_t seed_node_index = candidates.node_of_rank(min_seed_rank + selected);
+
+    LOCATED_LOG(false)                                              //
+        << " node: " << seed_node_index                             //
+        << " size: " << candidates.connected_count(seed_node_index)  //
         << std::endl;
     return seed_node_index;
 }
 
-template<typename T>
-static void
-remove_sorted(std::vector<T>& vector, T value) {
-    auto position = std::lower_bound(vector.begin(), vector.end(), value);
-    if (position != vector.end() && *position == value) {
-        vector.erase(position);
-    } else {
-        LOCATED_LOG(true) << " OOPS! removing nonexistent value" << std::endl;
-        assert(false);
-    }
-}
-
 static void
 store_seed_node(ConstCompressedMatrix<float32_t, int32_t, int32_t>& outgoing_weights,
                 ConstCompressedMatrix<float32_t, int32_t, int32_t>& incoming_weights,
                 const size_t seed_index,
                 const size_t seed_node_index,
-                std::vector<size_t>& tmp_candidates,
-                std::vector<std::vector<int32_t>>& connected_nodes,
+                SeedCandidates& candidates,
                 ArraySlice<int32_t> seed_of_nodes,
                 const size_t seed_size) {
-    remove_sorted(tmp_candidates, seed_node_index);
-
     auto seed_incoming_nodes = incoming_weights.get_band_indices(seed_node_index);
     auto seed_incoming_weights = incoming_weights.get_band_data(seed_node_index);
 
@@ -124,18 +144,18 @@ store_seed_node(ConstCompressedMatrix<float32_t, int32_t, int32_t>& outgoing_wei
 
     FastAssertCompare(seed_of_nodes[seed_node_index], <, 0);
     seed_of_nodes[seed_node_index] = int32_t(seed_index);
-    connected_nodes[seed_node_index].clear();
+    candidates.remove(seed_node_index);
 
     for (auto position : tmp_positions) {
         auto node_index = seed_incoming_nodes[position];
-        connected_nodes[node_index].clear();
+        candidates.remove(node_index);
         seed_of_nodes[node_index] = int32_t(seed_index);
     }
 
     auto outgoing_nodes = outgoing_weights.get_band_indices(seed_node_index);
     for (size_t node_index : outgoing_nodes) {
         if (seed_of_nodes[node_index] < 0) {
-            remove_sorted(connected_nodes[node_index], int32_t(seed_node_index));
+            candidates.decrement(node_index);
         }
     }
 
@@ -144,23 +164,12 @@ store_seed_node(ConstCompressedMatrix<float32_t, int32_t, int32_t>& outgoing_wei
         auto outgoing_nodes = outgoing_weights.get_band_indices(node_index);
         for (size_t other_node_index : outgoing_nodes) {
             if (seed_of_nodes[other_node_index] < 0) {
-                remove_sorted(connected_nodes[other_node_index], node_index);
+                candidates.decrement(other_node_index);
             }
         }
     }
 }
 
-static bool
-keep_large_candidates(std::vector<size_t>& tmp_candidates, const std::vector<std::vector<int32_t>>& connected_nodes) {
-    tmp_candidates.erase(std::remove_if(tmp_candidates.begin(),
-                                        tmp_candidates.end(),
-                                        [&](size_t candidate_node_index) {
-                                            return connected_nodes[candidate_node_index].size() == 0;
-                                        }),
-                         tmp_candidates.end());
-    return tmp_candidates.size() > 0;
-}
-
 static bool
 connect_node(size_t node_index,
              ArraySlice<int32_t> seed_of_nodes,
@@ -272,41 +281,34 @@ choose_seeds(const pybind11::array_t<float32_t>& outgoing_weights_data_array,
     FastAssertCompare(min_seed_size_quantile, <=, max_seed_size_quantile);
     FastAssertCompare(max_seed_size_quantile, <=, 1.0);
 
-    std::vector<std::vector<int32_t>> connected_nodes = collect_connected_nodes(incoming_weights, seed_of_nodes);
-
-    TmpVectorSizeT tmp_candidates_raii;
-    auto tmp_candidates = tmp_candidates_raii.vector(nodes_count);
-    tmp_candidates.clear();
-    for (size_t node_index = 0; node_index < nodes_count; ++node_index) {
-        if (seed_of_nodes[node_index] < 0) {
-            tmp_candidates.push_back(node_index);
-        }
-    }
+    SeedCandidates candidates(incoming_weights, seed_of_nodes);
 
-    std::minstd_rand random(random_seed);
+    PhiloxRandom random(random_seed);
     size_t given_seeds_count = size_t(*std::max_element(seed_of_nodes.begin(), seed_of_nodes.end()) + 1);
     size_t seeds_count = given_seeds_count;
 
-    FastAssertCompare(tmp_candidates.size(), >=, max_seeds_count - given_seeds_count);
-    size_t mean_seed_size = size_t(ceil(tmp_candidates.size() / (max_seeds_count - given_seeds_count)));
+    const size_t unseeded_nodes_count = size_t(
+        std::count_if(seed_of_nodes.begin(), seed_of_nodes.end(), [](int32_t node_seed) { return node_seed < 0; }));
+    FastAssertCompare(unseeded_nodes_count, >=, max_seeds_count - given_seeds_count);
+    size_t mean_seed_size = size_t(ceil(unseeded_nodes_count / (max_seeds_count - given_seeds_count)));
     FastAssertCompare(mean_seed_size, >=, 1);
 
-    while (seeds_count < max_seeds_count && keep_large_candidates(tmp_candidates, connected_nodes)) {
-        size_t seed_node_index =
-            choose_seed_node(tmp_candidates, connected_nodes, min_seed_size_quantile, max_seed_size_quantile, random);
+    while (seeds_count < max_seeds_count && candidates.size() > 0) {
+        size_t seed_node_index = choose_seed_node(candidates, min_seed_size_quantile, max_seed_size_quantile, random);
 
         store_seed_node(outgoing_weights,
                         incoming_weights,
                         seeds_count,
                         seed_node_index,
-                        tmp_candidates,
-                        connected_nodes,
+                        candidates,
                         seed_of_nodes,
                         mean_seed_size);
         ++seeds_count;
     }
 
     if (seeds_count < max_seeds_count) {
+        TmpVectorSizeT tmp_candidates_raii;
+        auto tmp_candidates = tmp_candidates_raii.vector(nodes_count);
         tmp_candidates.clear();
         for (size_t node_index = 0; node_index < nodes_count; ++node_index) {
             if (seed_of_nodes[node_index] < 0) {
@@ -1,6 +1,6 @@
 #include "metacells/extensions.h"
 
-#ifdef USE_AVX2
+#ifdef HAS_SIMD_DISPATCH
 #    include <immintrin.h>
 #endif
 
@@ -26,254 +26,546 @@ sum_row_values(ConstArraySlice<F> input_row) {
     return Sums{ sum_values, sum_squared };
 }
 
+#define MANY_ROWS 2
+
+/// Compute the dot product of two rows.
 template<typename F>
-static float32_t
-correlate_two_dense_rows(ConstArraySlice<F> some_values,
-                         float64_t some_sum_values,
-                         float64_t some_sum_squared,
-                         ConstArraySlice<F> other_values,
-                         float64_t other_sum_values,
-                         float64_t other_sum_squared) {
-    const size_t columns_count = some_values.size();
-    const F* const some_values_data = some_values.begin();
-    const F* const other_values_data = other_values.begin();
+using DotFunction = float64_t (*)(const F* some_data, const F* other_data, size_t size);
+
+/// Compute the dot products of one row with `MANY_ROWS` other rows.
+template<typename F>
+using ManyDotsFunction = void (*)(const F* some_data, const F* const* others_data, size_t size, float64_t* results);
+
+#define GROUP_ROWS 4
+
+/// Compute the dot products of each of `GROUP_ROWS` rows with each of `GROUP_ROWS` other rows.
+template<typename F>
+using GroupDotsFunction = void (*)(const F* const* some_data,
+                                   const F* const* others_data,
+                                   size_t size,
+                                   float64_t* results);
 
-    float64_t both_sum_values = 0;
-    size_t column_index = 0;
+template<typename F>
+static float64_t
+generic_dot(const F* const some_data, const F* const other_data, const size_t size) {
+    float64_t result = 0;
 #ifdef __INTEL_COMPILER
 #    pragma simd
 #endif
-    for (; column_index < columns_count; ++column_index) {
-        const float64_t some_values = float64_t(some_values_data[column_index]);
-        const float64_t other_values = float64_t(other_values_data[column_index]);
-        both_sum_values = fma(some_values, other_values, both_sum_values);
-    }
-
-    float64_t correlation = columns_count * both_sum_values - some_sum_values * other_sum_values;
-    float64_t some_factor = columns_count * some_sum_squared - some_sum_values * some_sum_values;
-    float64_t other_factor = columns_count * other_sum_squared - other_sum_values * other_sum_values;
-    float64_t both_factors = sqrt(some_factor * other_factor);
-    if (both_factors != 0) {
-        correlation /= both_factors;
-        return std::max(std::min(float32_t(correlation), float32_t(1.0)), float32_t(-1.0));
-    } else {
-        return 0.0;
+    for (size_t index = 0; index < size; ++index) {
+        result = fma(float64_t(some_data[index]), float64_t(other_data[index]), result);
     }
+    return result;
 }
 
-#ifdef USE_AVX2
-template<>
-float32_t
-correlate_two_dense_rows(ConstArraySlice<float64_t> some_values,
-                         float64_t some_sum_values,
-                         float64_t some_sum_squared,
-                         ConstArraySlice<float64_t> other_values,
-                         float64_t other_sum_values,
-                         float64_t other_sum_squared) {
-    const size_t columns_count = some_values.size();
-    const float64_t* const some_values_data = some_values.begin();
-    const float64_t* const other_values_data = other_values.begin();
-
-    float64_t both_sum_values = 0;
-    size_t column_index = 0;
-    size_t avx2_columns_count = (columns_count / 4) * 4;
-    __m256d both_sum_avx2 = _mm256_set_pd(0.0, 0.0, 0.0, 0.0);
-    for (; column_index < avx2_columns_count; column_index += 4) {
-        __m256d some_values_avx2 = _mm256_loadu_pd(some_values_data + column_index);
-        __m256d other_values_avx2 = _mm256_loadu_pd(other_values_data + column_index);
-        both_sum_avx2 = _mm256_fmadd_pd(some_values_avx2, other_values_avx2, both_sum_avx2);
-    }
-    both_sum_values = *(float64_t*)&both_sum_avx2[0] + *(float64_t*)&both_sum_avx2[1] + *(float64_t*)&both_sum_avx2[2]
-                      + *(float64_t*)&both_sum_avx2[3];
-#    ifdef __INTEL_COMPILER
-#        pragma simd
-#    endif
-    for (; column_index < columns_count; ++column_index) {
-        const float64_t some_values = float64_t(some_values_data[column_index]);
-        const float64_t other_values = float64_t(other_values_data[column_index]);
-        both_sum_values = fma(some_values, other_values, both_sum_values);
+template<typename F>
+static void
+generic_many_dots(const F* const some_data, const F* const* const others_data, const size_t size, float64_t* results) {
+    typedef typename AccumulatorType<F>::type A;
+    A sums[MANY_ROWS];
+    for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
+        sums[which_other] = 0;
     }
-
-    float64_t correlation = columns_count * both_sum_values - some_sum_values * other_sum_values;
-    float64_t some_factor = columns_count * some_sum_squared - some_sum_values * some_sum_values;
-    float64_t other_factor = columns_count * other_sum_squared - other_sum_values * other_sum_values;
-    float64_t both_factors = sqrt(some_factor * other_factor);
-    if (both_factors != 0) {
-        correlation /= both_factors;
-        return std::max(std::min(float32_t(correlation), float32_t(1.0)), float32_t(-1.0));
-    } else {
-        return 0.0;
+#ifdef __INTEL_COMPILER
+#    pragma simd
+#endif
+    for (size_t index = 0; index < size; ++index) {
+        // Multiply in the accumulator type, as `uint16_t` values would be promoted to (overflowing) `int`.
+        const A some_value = A(some_data[index]);
+        for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
+            sums[which_other] += some_value * A(others_data[which_other][index]);
+        }
+    }
+    for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
+        results[which_other] = sums[which_other];
     }
 }
 
-template<>
-float32_t
-correlate_two_dense_rows(ConstArraySlice<float32_t> some_values,
-                         float64_t some_sum_values,
-                         float64_t some_sum_squared,
-                         ConstArraySlice<float32_t> other_values,
-                         float64_t other_sum_values,
-                         float64_t other_sum_squared) {
-    const size_t columns_count = some_values.size();
-    const float32_t* const some_values_data = some_values.begin();
-    const float32_t* const other_values_data = other_values.begin();
-
-    size_t column_index = 0;
-    size_t avx2_columns_count = (columns_count / 8) * 8;
-    __m256 both_sum_avx2 = _mm256_set_ps(0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0);
-    for (; column_index < avx2_columns_count; column_index += 8) {
-        __m256 some_values_avx2 = _mm256_loadu_ps(some_values_data + column_index);
-        __m256 other_values_avx2 = _mm256_loadu_ps(other_values_data + column_index);
-        both_sum_avx2 = _mm256_fmadd_ps(some_values_avx2, other_values_avx2, both_sum_avx2);
-    }
-    float64_t both_sum_values = *(float32_t*)&both_sum_avx2[0] + *(float32_t*)&both_sum_avx2[1]
-                                + *(float32_t*)&both_sum_avx2[2] + *(float32_t*)&both_sum_avx2[3]
-                                + *(float32_t*)&both_sum_avx2[4] + *(float32_t*)&both_sum_avx2[5]
-                                + *(float32_t*)&both_sum_avx2[6] + *(float32_t*)&both_sum_avx2[7];
-#    ifdef __INTEL_COMPILER
-#        pragma simd
-#    endif
-    for (; column_index < columns_count; ++column_index) {
-        const float32_t some_values = some_values_data[column_index];
-        const float32_t other_values = other_values_data[column_index];
-        both_sum_values = fma(some_values, other_values, both_sum_values);
+template<typename F>
+static void
+generic_group_dots(const F* const* const some_data,
+                   const F* const* const others_data,
+                   const size_t size,
+                   float64_t* results) {
+    for (size_t which_some = 0; which_some < GROUP_ROWS; ++which_some) {
+        generic_many_dots(some_data[which_some], others_data, size, results + which_some * GROUP_ROWS);
+        generic_many_dots(some_data[which_some],
+                          others_data + MANY_ROWS,
+                          size,
+                          results + which_some * GROUP_ROWS + MANY_ROWS);
     }
+}
 
-    float64_t correlation = columns_count * both_sum_values - some_sum_values * other_sum_values;
-    float64_t some_factor = columns_count * some_sum_squared - some_sum_values * some_sum_values;
-    float64_t other_factor = columns_count * other_sum_squared - other_sum_values * other_sum_values;
-    float64_t both_factors = sqrt(some_factor * other_factor);
-    if (both_factors != 0) {
-        correlation /= both_factors;
-        return std::max(std::min(float32_t(correlation), float32_t(1.0)), float32_t(-1.0));
-    } else {
-        return 0.0;
-    }
+#ifdef HAS_SIMD_DISPATCH
+
+__attribute__((target("avx2,fma"))) static inline float64_t
+avx2_sum(const __m256d sums) {
+    const __m128d pair_sums = _mm_add_pd(_mm256_castpd256_pd128(sums), _mm256_extractf128_pd(sums, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(pair_sums, _mm_unpackhi_pd(pair_sums, pair_sums)));
 }
-#endif
 
-#define MANY_ROWS 2
+__attribute__((target("avx2,fma"))) static inline float64_t
+avx2_sum(const __m256 sums) {
+    return avx2_sum(_mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(sums)),
+                                  _mm256_cvtps_pd(_mm256_extractf128_ps(sums, 1))));
+}
 
-struct ManyCorrelations {
-    float64_t correlations[MANY_ROWS];
-};
+__attribute__((target("avx2,fma"))) static float64_t
+avx2_dot(const float64_t* const some_data, const float64_t* const other_data, const size_t size) {
+    __m256d first_sums = _mm256_setzero_pd();
+    __m256d second_sums = _mm256_setzero_pd();
+    size_t index = 0;
+    for (; index + 8 <= size; index += 8) {
+        first_sums = _mm256_fmadd_pd(_mm256_loadu_pd(some_data + index),
+                                     _mm256_loadu_pd(other_data + index),
+                                     first_sums);
+        second_sums = _mm256_fmadd_pd(_mm256_loadu_pd(some_data + index + 4),
+                                      _mm256_loadu_pd(other_data + index + 4),
+                                      second_sums);
+    }
+    if (index + 4 <= size) {
+        first_sums = _mm256_fmadd_pd(_mm256_loadu_pd(some_data + index),
+                                     _mm256_loadu_pd(other_data + index),
+                                     first_sums);
+        index += 4;
+    }
+    float64_t result = avx2_sum(_mm256_add_pd(first_sums, second_sums));
+    for (; index < size; ++index) {
+        result = fma(some_data[index], other_data[index], result);
+    }
+    return result;
+}
 
-template<typename F>
-static ManyCorrelations
-correlate_many_dense_rows(const F* const some_values_data,
-                          ConstMatrixSlice<F> values,
-                          const float64_t some_sum_values,
-                          const float64_t some_sum_squared,
-                          const std::vector<float64_t>& row_sum_values,
-                          const std::vector<float64_t>& row_sum_squared,
-                          const size_t other_begin_index) {
-    const size_t columns_count = values.columns_count();
+__attribute__((target("avx2,fma"))) static float64_t
+avx2_dot(const float32_t* const some_data, const float32_t* const other_data, const size_t size) {
+    __m256 first_sums = _mm256_setzero_ps();
+    __m256 second_sums = _mm256_setzero_ps();
+    size_t index = 0;
+    for (; index + 16 <= size; index += 16) {
+        first_sums = _mm256_fmadd_ps(_mm256_loadu_ps(some_data + index),
+                                     _mm256_loadu_ps(other_data + index),
+                                     first_sums);
+        second_sums = _mm256_fmadd_ps(_mm256_loadu_ps(some_data + index + 8),
+                                      _mm256_loadu_ps(other_data + index + 8),
+                                      second_sums);
+    }
+    if (index + 8 <= size) {
+        first_sums = _mm256_fmadd_ps(_mm256_loadu_ps(some_data + index),
+                                     _mm256_loadu_ps(other_data + index),
+                                     first_sums);
+        index += 8;
+    }
+    float64_t result = avx2_sum(first_sums) + avx2_sum(second_sums);
+    for (; index < size; ++index) {
+        result = fma(float64_t(some_data[index]), float64_t(other_data[index]), result);
+    }
+    return result;
+}
 
-    const F* other_values_data[MANY_ROWS];
-    F both_sum_values[MANY_ROWS];
+__attribute__((target("avx2,fma"))) static void
+avx2_many_dots(const float64_t* const some_data,
+               const float64_t* const* const others_data,
+               const size_t size,
+               float64_t* results) {
+    __m256d sums[MANY_ROWS];
     for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
-        other_values_data[which_other] = values.get_row(other_begin_index + which_other).begin();
-        both_sum_values[which_other] = 0;
+        sums[which_other] = _mm256_setzero_pd();
     }
-#ifdef __INTEL_COMPILER
-#    pragma simd
-#endif
-    for (size_t column_index = 0; column_index < columns_count; ++column_index) {
-        const F some_value = some_values_data[column_index];
+    size_t index = 0;
+    for (; index + 4 <= size; index += 4) {
+        const __m256d some_values = _mm256_loadu_pd(some_data + index);
         for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
-            both_sum_values[which_other] += some_value * other_values_data[which_other][column_index];
+            sums[which_other] =
+                _mm256_fmadd_pd(some_values, _mm256_loadu_pd(others_data[which_other] + index), sums[which_other]);
         }
     }
+    for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
+        results[which_other] = avx2_sum(sums[which_other]);
+    }
+    for (; index < size; ++index) {
+        for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
+            results[which_other] = fma(some_data[index], others_data[which_other][index], results[which_other]);
+        }
+    }
+}
 
-    ManyCorrelations results;
+__attribute__((target("avx2,fma"))) static void
+avx2_many_dots(const float32_t* const some_data,
+               const float32_t* const* const others_data,
+               const size_t size,
+               float64_t* results) {
+    __m256 sums[MANY_ROWS];
     for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
-        const float64_t other_sum_values = row_sum_values[other_begin_index + which_other];
-        const float64_t other_sum_squared = row_sum_squared[other_begin_index + which_other];
-        results.correlations[which_other] =
-            columns_count * float64_t(both_sum_values[which_other]) - some_sum_values * other_sum_values;
-        const float64_t some_factor = columns_count * some_sum_squared - some_sum_values * some_sum_values;
-        const float64_t other_factor = columns_count * other_sum_squared - other_sum_values * other_sum_values;
-        const float64_t both_factors = sqrt(some_factor * other_factor);
-        if (both_factors != 0) {
-            results.correlations[which_other] /= both_factors;
-            results.correlations[which_other] = std::max(std::min(results.correlations[which_other], 1.0), -1.0);
-        } else {
-            results.correlations[which_other] = 0.0;
+        sums[which_other] = _mm256_setzero_ps();
+    }
+    size_t index = 0;
+    for (; index + 8 <= size; index += 8) {
+        const __m256 some_values = _mm256_loadu_ps(some_data + index);
+        for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
+            sums[which_other] =
+                _mm256_fmadd_ps(some_values, _mm256_loadu_ps(others_data[which_other] + index), sums[which_other]);
         }
     }
+    for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
+        results[which_other] = avx2_sum(sums[which_other]);
+    }
+    for (; index < size; ++index) {
+        for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
+            results[which_other] = fma(float64_t(some_data[index]),
+                                       float64_t(others_data[which_other][index]),
+                                       results[which_other]);
+        }
+    }
+}
 
-    return results;
+__attribute__((target("avx512f"))) static inline float64_t
+avx512_sum(const __m512 sums) {
+    return _mm512_reduce_add_pd(_mm512_add_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(sums)),
+                                              _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(
+                                                  _mm512_castps_pd(sums), 1)))));
 }
 
-#ifdef USE_AVX2
-template<>
-ManyCorrelations
-correlate_many_dense_rows(const float64_t* const some_values_data,
-                          ConstMatrixSlice<float64_t> values,
-                          const float64_t some_sum_values,
-                          const float64_t some_sum_squared,
-                          const std::vector<float64_t>& row_sum_values,
-                          const std::vector<float64_t>& row_sum_squared,
-                          const size_t other_begin_index) {
-    const size_t columns_count = values.columns_count();
+__attribute__((target("avx512f"))) static float64_t
+avx512_dot(const float64_t* const some_data, const float64_t* const other_data, const size_t size) {
+    __m512d first_sums = _mm512_setzero_pd();
+    __m512d second_sums = _mm512_setzero_pd();
+    size_t index = 0;
+    for (; index + 16 <= size; index += 16) {
+        first_sums = _mm512_fmadd_pd(_mm512_loadu_pd(some_data + index),
+                                     _mm512_loadu_pd(other_data + index),
+                                     first_sums);
+        second_sums = _mm512_fmadd_pd(_mm512_loadu_pd(some_data + index + 8),
+                                      _mm512_loadu_pd(other_data + index + 8),
+                                      second_sums);
+    }
+    if (index + 8 <= size) {
+        first_sums = _mm512_fmadd_pd(_mm512_loadu_pd(some_data + index),
+                                     _mm512_loadu_pd(other_data + index),
+                                     first_sums);
+        index += 8;
+    }
+    if (index < size) {
+        const __mmask8 mask = __mmask8((1U << (size - index)) - 1);
+        second_sums = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, some_data + index),
+                                      _mm512_maskz_loadu_pd(mask, other_data + index),
+                                      second_sums);
+    }
+    return _mm512_reduce_add_pd(_mm512_add_pd(first_sums, second_sums));
+}
 
-    const float64_t* other_values_data[MANY_ROWS];
-    __m256d both_sum_avx2[MANY_ROWS];
-    for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
-        other_values_data[which_other] = values.get_row(other_begin_index + which_other).begin();
-        both_sum_avx2[which_other] = _mm256_set_pd(0.0, 0.0, 0.0, 0.0);
+__attribute__((target("avx512f"))) static float64_t
+avx512_dot(const float32_t* const some_data, const float32_t* const other_data, const size_t size) {
+    __m512 first_sums = _mm512_setzero_ps();
+    __m512 second_sums = _mm512_setzero_ps();
+    size_t index = 0;
+    for (; index + 32 <= size; index += 32) {
+        first_sums = _mm512_fmadd_ps(_mm512_loadu_ps(some_data + index),
+                                     _mm512_loadu_ps(other_data + index),
+                                     first_sums);
+        second_sums = _mm512_fmadd_ps(_mm512_loadu_ps(some_data + index + 16),
+                                      _mm512_loadu_ps(other_data + index + 16),
+                                      second_sums);
     }
+    if (index + 16 <= size) {
+        first_sums = _mm512_fmadd_ps(_mm512_loadu_ps(some_data + index),
+                                     _mm512_loadu_ps(other_data + index),
+                                     first_sums);
+        index += 16;
+    }
+    if (index < size) {
+        const __mmask16 mask = __mmask16((1U << (size - index)) - 1);
+        second_sums = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, some_data + index),
+                                      _mm512_maskz_loadu_ps(mask, other_data + index),
+                                      second_sums);
+    }
+    return avx512_sum(first_sums) + avx512_sum(second_sums);
+}
 
-    size_t column_index = 0;
-    size_t avx2_columns_count = (columns_count / 4) * 4;
-    for (; column_index < avx2_columns_count; column_index += 4) {
-        __m256d some_values_avx2 = _mm256_loadu_pd(some_values_data + column_index);
+__attribute__((target("avx512f"))) static void
+avx512_many_dots(const float64_t* const some_data,
+                 const float64_t* const* const others_data,
+                 const size_t size,
+                 float64_t* results) {
+    __m512d sums[MANY_ROWS];
+    for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
+        sums[which_other] = _mm512_setzero_pd();
+    }
+    size_t index = 0;
+    for (; index + 8 <= size; index += 8) {
+        const __m512d some_values = _mm512_loadu_pd(some_data + index);
         for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
-            __m256d other_values_avx2 = _mm256_loadu_pd(other_values_data[which_other] + column_index);
-            both_sum_avx2[which_other] =
-                _mm256_fmadd_pd(some_values_avx2, other_values_avx2, both_sum_avx2[which_other]);
+            sums[which_other] =
+                _mm512_fmadd_pd(some_values, _mm512_loadu_pd(others_data[which_other] + index), sums[which_other]);
         }
     }
-    float64_t both_sum_values[MANY_ROWS];
-    for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
-        both_sum_values[which_other] =
-            *(float64_t*)&both_sum_avx2[which_other][0] + *(float64_t*)&both_sum_avx2[which_other][1]
-            + *(float64_t*)&both_sum_avx2[which_other][2] + *(float64_t*)&both_sum_avx2[which_other][3];
-    }
-#    ifdef __INTEL_COMPILER
-#        pragma simd
-#    endif
-    for (; column_index < columns_count; ++column_index) {
-        const float64_t some_value = some_values_data[column_index];
+    if (index < size) {
+        const __mmask8 mask = __mmask8((1U << (size - index)) - 1);
+        const __m512d some_values = _mm512_maskz_loadu_pd(mask, some_data + index);
         for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
-            both_sum_values[which_other] += some_value * other_values_data[which_other][column_index];
+            sums[which_other] = _mm512_fmadd_pd(some_values,
+                                                _mm512_maskz_loadu_pd(mask, others_data[which_other] + index),
+                                                sums[which_other]);
         }
     }
+    for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
+        results[which_other] = _mm512_reduce_add_pd(sums[which_other]);
+    }
+}
 
-    ManyCorrelations results;
+__attribute__((target("avx512f"))) static void
+avx512_many_dots(const float32_t* const some_data,
+                 const float32_t* const* const others_data,
+                 const size_t size,
+                 float64_t* results) {
+    __m512 sums[MANY_ROWS];
     for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
-        const float64_t other_sum_values = row_sum_values[other_begin_index + which_other];
-        const float64_t other_sum_squared = row_sum_squared[other_begin_index + which_other];
-        results.correlations[which_other] =
-            columns_count * float64_t(both_sum_values[which_other]) - some_sum_values * other_sum_values;
-        const float64_t some_factor = columns_count * some_sum_squared - some_sum_values * some_sum_values;
-        const float64_t other_factor = columns_count * other_sum_squared - other_sum_values * other_sum_values;
-        const float64_t both_factors = sqrt(some_factor * other_factor);
-        if (both_factors != 0) {
-            results.correlations[which_other] /= both_factors;
-            results.correlations[which_other] = std::max(std::min(results.correlations[which_other], 1.0), -1.0);
-        } else {
-            results.correlations[which_other] = 0.0;
+        sums[which_other] = _mm512_setzero_ps();
+    }
+    size_t index = 0;
+    for (; index + 16 <= size; index += 16) {
+        const __m512 some_values = _mm512_loadu_ps(some_data + index);
+        for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
+            sums[which_other] =
+                _mm512_fmadd_ps(some_values, _mm512_loadu_ps(others_data[which_other] + index), sums[which_other]);
         }
     }
+    if (index < size) {
+        const __mmask16 mask = __mmask16((1U << (size - index)) - 1);
+        const __m512 some_values = _mm512_maskz_loadu_ps(mask, some_data + index);
+        for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
+            sums[which_other] = _mm512_fmadd_ps(some_values,
+                                                _mm512_maskz_loadu_ps(mask, others_data[which_other] + index),
+                                                sums[which_other]);
+        }
+    }
+    for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
+        results[which_other] = avx512_sum(sums[which_other]);
+    }
+}
 
-    return results;
+__attribute__((target("avx2,fma"))) static void
+avx2_group_dots(const float64_t* const* const some_data,
+                const float64_t* const* const others_data,
+                const size_t size,
+                float64_t* results) {
+    // Only 16 registers, so do two passes of two rows each.
+    for (size_t which_some = 0; which_some < GROUP_ROWS; which_some += 2) {
+        __m256d sums[2][GROUP_ROWS];
+        for (size_t which_half = 0; which_half < 2; ++which_half) {
+            for (size_t which_other = 0; which_other < GROUP_ROWS; ++which_other) {
+                sums[which_half][which_other] = _mm256_setzero_pd();
+            }
+        }
+        size_t index = 0;
+        for (; index + 4 <= size; index += 4) {
+            const __m256d first_values = _mm256_loadu_pd(some_data[which_some] + index);
+            const __m256d second_values = _mm256_loadu_pd(some_data[which_some + 1] + index);
+            for (size_t which_other = 0; which_other < GROUP_ROWS; ++which_other) {
+                const __m256d other_values = _mm256_loadu_pd(others_data[which_other] + index);
+                sums[0][which_other] = _mm256_fmadd_pd(first_values, other_values, sums[0][which_other]);
+                sums[1][which_other] = _mm256_fmadd_pd(second_values, other_values, sums[1][which_other]);
+            }
+        }
+        for (size_t which_half = 0; which_half < 2; ++which_half) {
+            const float64_t* const row_data = some_data[which_some + which_half];
+            for (size_t which_other = 0; which_other < GROUP_ROWS; ++which_other) {
+                float64_t result = avx2_sum(sums[which_half][which_other]);
+                for (size_t tail_index = index; tail_index < size; ++tail_index) {
+                    result = fma(row_data[tail_index], others_data[which_other][tail_index], result);
+                }
+                results[(which_some + which_half) * GROUP_ROWS + which_other] = result;
+            }
+        }
+    }
+}
+
+__attribute__((target("avx2,fma"))) static void
+avx2_group_dots(const float32_t* const* const some_data,
+                const float32_t* const* const others_data,
+                const size_t size,
+                float64_t* results) {
+    // Only 16 registers, so do two passes of two rows each.
+    for (size_t which_some = 0; which_some < GROUP_ROWS; which_some += 2) {
+        __m256 sums[2][GROUP_ROWS];
+        for (size_t which_half = 0; which_half < 2; ++which_half) {
+            for (size_t which_other = 0; which_other < GROUP_ROWS; ++which_other) {
+                sums[which_half][which_other] = _mm256_setzero_ps();
+            }
+        }
+        size_t index = 0;
+        for (; index + 8 <= size; index += 8) {
+            const __m256 first_values = _mm256_loadu_ps(some_data[which_some] + index);
+            const __m256 second_values = _mm256_loadu_ps(some_data[which_some + 1] + index);
+            for (size_t which_other = 0; which_other < GROUP_ROWS; ++which_other) {
+                const __m256 other_values = _mm256_loadu_ps(others_data[which_other] + index);
+                sums[0][which_other] = _mm256_fmadd_ps(first_values, other_values, sums[0][which_other]);
+                sums[1][which_other] = _mm256_fmadd_ps(second_values, other_values, sums[1][which_other]);
+            }
+        }
+        for (size_t which_half = 0; which_half < 2; ++which_half) {
+            const float32_t* const row_data = some_data[which_some + which_half];
+            for (size_t which_other = 0; which_other < GROUP_ROWS; ++which_other) {
+                float64_t result = avx2_sum(sums[which_half][which_other]);
+                for (size_t tail_index = index; tail_index < size; ++tail_index) {
+                    result = fma(float64_t(row_data[tail_index]),
+                                 float64_t(others_data[which_other][tail_index]),
+                                 result);
+                }
+                results[(which_some + which_half) * GROUP_ROWS + which_other] = result;
+            }
+        }
+    }
+}
+
+__attribute__((target("avx512f"))) static void
+avx512_group_dots(const float64_t* const* const some_data,
+                  const float64_t* const* const others_data,
+                  const size_t size,
+                  float64_t* results) {
+    __m512d sums[GROUP_ROWS][GROUP_ROWS];
+    for (size_t which_some = 0; which_some < GROUP_ROWS; ++which_some) {
+        for (size_t which_other = 0; which_other < GROUP_ROWS; ++which_other) {
+            sums[which_some][which_other] = _mm512_setzero_pd();
+        }
+    }
+    for (size_t index = 0; index < size; index += 8) {
+        const __mmask8 mask = size - index >= 8 ? __mmask8(0xFF) : __mmask8((1U << (size - index)) - 1);
+        __m512d other_values[GROUP_ROWS];
+        for (size_t which_other = 0; which_other < GROUP_ROWS; ++which_other) {
+            other_values[which_other] = _mm512_maskz_loadu_pd(mask, others_data[which_other] + index);
+        }
+        for (size_t which_some = 0; which_some < GROUP_ROWS; ++which_some) {
+            const __m512d some_values = _mm512_maskz_loadu_pd(mask, some_data[which_some] + index);
+            for (size_t which_other = 0; which_other < GROUP_ROWS; ++which_other) {
+                sums[which_some][which_other] =
+                    _mm512_fmadd_pd(some_values, other_values[which_other], sums[which_some][which_other]);
+            }
+        }
+    }
+    for (size_t which_some = 0; which_some < GROUP_ROWS; ++which_some) {
+        for (size_t which_other = 0; which_other < GROUP_ROWS; ++which_other) {
+            results[which_some * GROUP_ROWS + which_other] = _mm512_reduce_add_pd(sums[which_some][which_other]);
+        }
+    }
 }
 
-template<>
-ManyCorrelations
-correlate_many_dense_rows(const float32_t* const some_values_data,
-                          ConstMatrixSlice<float32_t> values,
+__attribute__((target("avx512f"))) static void
+avx512_group_dots(const float32_t* const* const some_data,
+                  const float32_t* const* const others_data,
+                  const size_t size,
+                  float64_t* results) {
+    __m512 sums[GROUP_ROWS][GROUP_ROWS];
+    for (size_t which_some = 0; which_some < GROUP_ROWS; ++which_some) {
+        for (size_t which_other = 0; which_other < GROUP_ROWS; ++which_other) {
+            sums[which_some][which_other] = _mm512_setzero_ps();
+        }
+    }
+    for (size_t index = 0; index < size; index += 16) {
+        const __mmask16 mask = size - index >= 16 ? __mmask16(0xFFFF) : __mmask16((1U << (size - index)) - 1);
+        __m512 other_values[GROUP_ROWS];
+        for (size_t which_other = 0; which_other < GROUP_ROWS; ++which_other) {
+            other_values[which_other] = _mm512_maskz_loadu_ps(mask, others_data[which_other] + index);
+        }
+        for (size_t which_some = 0; which_some < GROUP_ROWS; ++which_some) {
+            const __m512 some_values = _mm512_maskz_loadu_ps(mask, some_data[which_some] + index);
+            for (size_t which_other = 0; which_other < GROUP_ROWS; ++which_other) {
+                sums[which_some][which_other] =
+                    _mm512_fmadd_ps(some_values, other_values[which_other], sums[which_some][which_other]);
+            }
+        }
+    }
+    for (size_t which_some = 0; which_some < GROUP_ROWS; ++which_some) {
+        for (size_t which_other = 0; which_other < GROUP_ROWS; ++which_other) {
+            results[which_some * GROUP_ROWS + which_other] = avx512_sum(sums[which_some][which_other]);
+        }
+    }
+}
+
+#endif
+
+/// The dot product kernels to use, chosen by `select_dot_kernels` according to the available instructions.
+template<typename F>
+struct DotKernels {
+    static DotFunction<F> dot;
+    static ManyDotsFunction<F> many_dots;
+    static GroupDotsFunction<F> group_dots;
+};
+
+template<typename F>
+DotFunction<F> DotKernels<F>::dot = generic_dot<F>;
+
+template<typename F>
+ManyDotsFunction<F> DotKernels<F>::many_dots = generic_many_dots<F>;
+
+template<typename F>
+GroupDotsFunction<F> DotKernels<F>::group_dots = generic_group_dots<F>;
+
+template<typename F>
+static void
+select_dot_kernels() {
+#ifdef HAS_SIMD_DISPATCH
+    switch (simd_level()) {
+    case SIMD_AVX512:
+        DotKernels<F>::dot = avx512_dot;
+        DotKernels<F>::many_dots = avx512_many_dots;
+        DotKernels<F>::group_dots = avx512_group_dots;
+        break;
+    case SIMD_AVX2:
+        DotKernels<F>::dot = avx2_dot;
+        DotKernels<F>::many_dots = avx2_many_dots;
+        DotKernels<F>::group_dots = avx2_group_dots;
+        break;
+    case SIMD_GENERIC:
+        break;
+    }
+#endif
+}
+
+static float32_t
+correlation_of_sums(const size_t columns_count,
+                    const float64_t both_sum_values,
+                    const float64_t some_sum_values,
+                    const float64_t some_sum_squared,
+                    const float64_t other_sum_values,
+                    const float64_t other_sum_squared) {
+    float64_t correlation = columns_count * both_sum_values - some_sum_values * other_sum_values;
+    float64_t some_factor = columns_count * some_sum_squared - some_sum_values * some_sum_values;
+    float64_t other_factor = columns_count * other_sum_squared - other_sum_values * other_sum_values;
+    float64_t both_factors = sqrt(some_factor * other_factor);
+    if (both_factors != 0) {
+        correlation /= both_factors;
+        return std::max(std::min(float32_t(correlation), float32_t(1.0)), float32_t(-1.0));
+    } else {
+        return 0.0;
+    }
+}
+
+template<typename F>
+static float32_t
+correlate_two_dense_rows(ConstArraySlice<F> some_values,
+                         float64_t some_sum_values,
+                         float64_t some_sum_squared,
+                         ConstArraySlice<F> other_values,
+                         float64_t other_sum_values,
+                         float64_t other_sum_squared) {
+    const size_t columns_count = some_values.size();
+    const float64_t both_sum_values = DotKernels<F>::dot(some_values.begin(), other_values.begin(), columns_count);
+    return correlation_of_sums(columns_count,
+                               both_sum_values,
+                               some_sum_values,
+                               some_sum_squared,
+                               other_sum_values,
+                               other_sum_squared);
+}
+
+struct ManyCorrelations {
+    float64_t correlations[MANY_ROWS];
+};
+
+template<typename F>
+static ManyCorrelations
+correlate_many_dense_rows(const F* const some_values_data,
+                          ConstMatrixSlice<F> values,
                           const float64_t some_sum_values,
                           const float64_t some_sum_squared,
                           const std::vector<float64_t>& row_sum_values,
@@ -281,61 +573,26 @@ correlate_many_dense_rows(const float32_t* const some_values_data,
                           const size_t other_begin_index) {
     const size_t columns_count = values.columns_count();
 
-    const float32_t* other_values_data[MANY_ROWS];
-    __m256 both_sum_avx2[MANY_ROWS];
+    const F* other_values_data[MANY_ROWS];
     for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
         other_values_data[which_other] = values.get_row(other_begin_index + which_other).begin();
-        both_sum_avx2[which_other] = _mm256_set_ps(0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0);
     }
 
-    size_t column_index = 0;
-    size_t avx2_columns_count = (columns_count / 8) * 8;
-    for (; column_index < avx2_columns_count; column_index += 8) {
-        __m256 some_values_avx2 = _mm256_loadu_ps(some_values_data + column_index);
-        for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
-            __m256 other_values_avx2 = _mm256_loadu_ps(other_values_data[which_other] + column_index);
-            both_sum_avx2[which_other] =
-                _mm256_fmadd_ps(some_values_avx2, other_values_avx2, both_sum_avx2[which_other]);
-        }
-    }
     float64_t both_sum_values[MANY_ROWS];
-    for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
-        both_sum_values[which_other] =
-            *(float32_t*)&both_sum_avx2[which_other][0] + *(float32_t*)&both_sum_avx2[which_other][1]
-            + *(float32_t*)&both_sum_avx2[which_other][2] + *(float32_t*)&both_sum_avx2[which_other][3]
-            + *(float32_t*)&both_sum_avx2[which_other][4] + *(float32_t*)&both_sum_avx2[which_other][5]
-            + *(float32_t*)&both_sum_avx2[which_other][6] + *(float32_t*)&both_sum_avx2[which_other][7];
-    }
-#    ifdef __INTEL_COMPILER
-#        pragma simd
-#    endif
-    for (; column_index < columns_count; ++column_index) {
-        const float32_t some_value = some_values_data[column_index];
-        for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
-            both_sum_values[which_other] += some_value * other_values_data[which_other][column_index];
-        }
-    }
+    DotKernels<F>::many_dots(some_values_data, other_values_data, columns_count, both_sum_values);
 
     ManyCorrelations results;
     for (size_t which_other = 0; which_other < MANY_ROWS; ++which_other) {
-        const float64_t other_sum_values = row_sum_values[other_begin_index + which_other];
-        const float64_t other_sum_squared = row_sum_squared[other_begin_index + which_other];
-        results.correlations[which_other] =
-            columns_count * float64_t(both_sum_values[which_other]) - some_sum_values * other_sum_values;
-        const float64_t some_factor = columns_count * some_sum_squared - some_sum_values * some_sum_values;
-        const float64_t other_factor = columns_count * other_sum_squared - other_sum_values * other_sum_values;
-        const float64_t both_factors = sqrt(some_factor * other_factor);
-        if (both_factors != 0) {
-            results.correlations[which_other] /= both_factors;
-            results.correlations[which_other] = std::max(std::min(results.correlations[which_other], 1.0), -1.0);
-        } else {
-            results.correlations[which_other] = 0.0;
-        }
+        results.correlations[which_other] = correlation_of_sums(columns_count,
+                                                                both_sum_values[which_other],
+                                                                some_sum_values,
+                                                                some_sum_squared,
+                                                                row_sum_values[other_begin_index + which_other],
+                                                                row_sum_squared[other_begin_index + which_other]);
     }
 
     return results;
 }
-#endif
 
 static size_t
 unrolled_iterations_count(const size_t rows_count, const size_t unroll_size) {
@@ -347,6 +604,195 @@ unrolled_iterations_count(const size_t rows_count, const size_t unroll_size) {
     return iterations_count;
 }
 
+/// Use the tiled algorithm when correlating at least this many rows.
+static const size_t TILED_MIN_ROWS = 256;
+
+/// The number of rows in each tile (a multiple of `GROUP_ROWS`).
+static const size_t TILE_ROWS = 64;
+
+/// The (approximate) size of the part of a tile which is processed in one block of columns.
+static const size_t TILE_BLOCK_BYTES = 64 * 1024;
+
+/// The number of rows of a matrix, padded to a multiple of `GROUP_ROWS` rows.
+static size_t
+padded_rows_count_of(const size_t rows_count) {
+    return ((rows_count + GROUP_ROWS - 1) / GROUP_ROWS) * GROUP_ROWS;
+}
+
+/// Center each row and scale it to a unit norm, so correlations become dot products.
+///
+/// The result is padded with zero rows to `padded_rows_count_of` rows. Constant rows become all-zero rows, so their
+/// correlation with any other row is zero. Compact (`float16_t` or `uint16_t`) input is widened to `float32_t`.
+///
+/// The result is not initialized when allocated, so its pages are first touched (and placed in the memory of the
+/// socket) by the threads which normalize its rows, rather than all by the invoking thread.
+template<typename F, typename A = typename AccumulatorType<F>::type>
+static std::unique_ptr<A[]>
+normalized_rows(ConstMatrixSlice<F>& input) {
+    const size_t rows_count = input.rows_count();
+    const size_t columns_count = input.columns_count();
+    const size_t padded_rows_count = padded_rows_count_of(rows_count);
+    std::unique_ptr<A[]> normalized(new A[padded_rows_count * columns_count]);
+
+    parallel_loop(padded_rows_count, [&](size_t row_index) {
+        A* const normalized_row = &normalized[row_index * columns_count];
+        if (row_index >= rows_count) {
+            std::fill(normalized_row, normalized_row + columns_count, A(0));
+            return;
+        }
+        const auto input_row = input.get_row(row_index);
+
+        float64_t sum_values = 0;
+        for (size_t column_index = 0; column_index < columns_count; ++column_index) {
+            sum_values += input_row[column_index];
+        }
+        const float64_t mean = sum_values / columns_count;
+
+        float64_t sum_squared = 0;
+        for (size_t column_index = 0; column_index < columns_count; ++column_index) {
+            const float64_t centered = input_row[column_index] - mean;
+            sum_squared = fma(centered, centered, sum_squared);
+        }
+        const float64_t scale = sum_squared > 0 ? 1.0 / sqrt(sum_squared) : 0.0;
+
+        for (size_t column_index = 0; column_index < columns_count; ++column_index) {
+            normalized_row[column_index] = A((input_row[column_index] - mean) * scale);
+        }
+    });
+
+    return normalized;
+}
+
+/// Compute the dot products between the tiles of two normalized (and padded) matrices.
+///
+/// The tiles start at the `some_begin` and `other_begin` rows, and contain up to `TILE_ROWS` rows (a multiple of
+/// `GROUP_ROWS`, up to the padded rows count of each matrix). The dot product of row `some_begin + i` with row
+/// `other_begin + j` is placed in `sums[i * TILE_ROWS + j]`. If `is_lower_triangle`, only the lower triangle (including
+/// the diagonal groups) is computed, which is only meaningful when the tiles are the same.
+template<typename F>
+static void
+tile_cross_dots(const F* const some_normalized,
+                const size_t some_padded_rows_count,
+                const F* const other_normalized,
+                const size_t other_padded_rows_count,
+                const size_t columns_count,
+                const size_t some_begin,
+                const size_t other_begin,
+                const bool is_lower_triangle,
+                std::vector<float64_t>& sums) {
+    const size_t some_end = std::min(some_begin + TILE_ROWS, some_padded_rows_count);
+    const size_t other_end = std::min(other_begin + TILE_ROWS, other_padded_rows_count);
+    const size_t block_columns = std::max(TILE_BLOCK_BYTES / (TILE_ROWS * sizeof(F)), size_t(16));
+
+    std::fill(sums.begin(), sums.end(), 0.0);
+
+    float64_t group_results[GROUP_ROWS * GROUP_ROWS];
+    const F* some_data[GROUP_ROWS];
+    const F* others_data[GROUP_ROWS];
+
+    for (size_t block_begin = 0; block_begin < columns_count; block_begin += block_columns) {
+        const size_t block_size = std::min(block_columns, columns_count - block_begin);
+        for (size_t some_group = some_begin; some_group < some_end; some_group += GROUP_ROWS) {
+            for (size_t which_some = 0; which_some < GROUP_ROWS; ++which_some) {
+                some_data[which_some] = &some_normalized[(some_group + which_some) * columns_count + block_begin];
+            }
+            const size_t other_groups_end = is_lower_triangle ? some_group + GROUP_ROWS : other_end;
+            for (size_t other_group = other_begin; other_group < other_groups_end; other_group += GROUP_ROWS) {
+                for (size_t which_other = 0; which_other < GROUP_ROWS; ++which_other) {
+                    others_data[which_other] =
+                        &other_normalized[(other_group + which_other) * columns_count + block_begin];
+                }
+                DotKernels<F>::group_dots(some_data, others_data, block_size, group_results);
+                for (size_t which_some = 0; which_some < GROUP_ROWS; ++which_some) {
+                    float64_t* const sums_row = &sums[(some_group - some_begin + which_some) * TILE_ROWS];
+                    for (size_t which_other = 0; which_other < GROUP_ROWS; ++which_other) {
+                        sums_row[other_group - other_begin + which_other] +=
+                            group_results[which_some * GROUP_ROWS + which_other];
+                    }
+                }
+            }
+        }
+    }
+}
+
+/// Compute the dot products between the normalized rows of two tiles of the same matrix.
+///
+/// If the tiles are the same, only the lower triangle (including the diagonal groups) is computed.
+template<typename F>
+static void
+tile_dots(const F* const normalized,
+          const size_t columns_count,
+          const size_t padded_rows_count,
+          const size_t some_begin,
+          const size_t other_begin,
+          std::vector<float64_t>& sums) {
+    tile_cross_dots(normalized,
+                    padded_rows_count,
+                    normalized,
+                    padded_rows_count,
+                    columns_count,
+                    some_begin,
+                    other_begin,
+                    some_begin == other_begin,
+                    sums);
+}
+
+static float32_t
+clamp_correlation(const float64_t correlation) {
+    return std::max(std::min(float32_t(correlation), float32_t(1.0)), float32_t(-1.0));
+}
+
+/// Correlate the rows of a large matrix using a symmetric rank-k update of the normalized rows.
+///
+/// Each pair of tiles is computed by a separate task, which iterates over blocks of columns small enough for both tiles
+/// to fit in the cache. The results do not depend on the number of threads.
+template<typename F>
+static void
+correlate_dense_tiled(ConstMatrixSlice<F>& input, MatrixSlice<float32_t>& output) {
+    const size_t rows_count = input.rows_count();
+    const size_t columns_count = input.columns_count();
+    const size_t tiles_count = (rows_count + TILE_ROWS - 1) / TILE_ROWS;
+
+    const auto normalized = normalized_rows(input);
+    const size_t padded_rows_count = padded_rows_count_of(rows_count);
+
+    const size_t tasks_count = (tiles_count * (tiles_count + 1)) / 2;
+    parallel_loop(tasks_count, 1, [&](size_t task_index) {
+        size_t some_tile = size_t((sqrt(8.0 * task_index + 1.0) - 1.0) / 2.0);
+        while ((some_tile * (some_tile + 1)) / 2 > task_index) {
+            --some_tile;
+        }
+        while (((some_tile + 1) * (some_tile + 2)) / 2 <= task_index) {
+            ++some_tile;
+        }
+        const size_t other_tile = task_index - (some_tile * (some_tile + 1)) / 2;
+
+        const size_t some_begin = some_tile * TILE_ROWS;
+        const size_t other_begin = other_tile * TILE_ROWS;
+
+        TmpVectorFloat64 sums_raii;
+        auto& sums = sums_raii.vector(TILE_ROWS * TILE_ROWS);
+        tile_dots(normalized.get(), columns_count, padded_rows_count, some_begin, other_begin, sums);
+
+        const size_t some_end = std::min(some_begin + TILE_ROWS, rows_count);
+        const size_t other_end = std::min(other_begin + TILE_ROWS, rows_count);
+        for (size_t some_index = some_begin; some_index < some_end; ++some_index) {
+            auto output_row = output.get_row(some_index);
+            const float64_t* const sums_row = &sums[(some_index - some_begin) * TILE_ROWS];
+            const size_t others_end = some_tile == other_tile ? some_index : other_end;
+            for (size_t other_index = other_begin; other_index < others_end; ++other_index) {
+                const float32_t correlation = clamp_correlation(sums_row[other_index - other_begin]);
+                output_row[other_index] = correlation;
+                output.get_row(other_index)[some_index] = correlation;
+            }
+        }
+    });
+
+    for (size_t entry_index = 0; entry_index < rows_count; ++entry_index) {
+        output.get_row(entry_index)[entry_index] = 1.0;
+    }
+}
+
 template<typename F>
 static void
 correlate_dense(const pybind11::array_t<F>& input_array, pybind11::array_t<float32_t>& output_array) {
@@ -359,6 +805,11 @@ correlate_dense(const pybind11::array_t<F>& input_array, pybind11::array_t<float
     FastAssertCompare(output.rows_count(), ==, input.rows_count());
     FastAssertCompare(output.columns_count(), ==, input.rows_count());
 
+    if (rows_count >= TILED_MIN_ROWS) {
+        correlate_dense_tiled(input, output);
+        return;
+    }
+
     TmpVectorFloat64 row_sum_values_raii;
     auto row_sum_values = row_sum_values_raii.vector(rows_count);
 
@@ -430,6 +881,129 @@ correlate_dense(const pybind11::array_t<F>& input_array, pybind11::array_t<float
     });
 }
 
+/// Order correlations from best to worst, breaking ties by preferring the lower index.
+struct BetterCorrelation {
+    bool operator()(const std::pair<float32_t, int32_t>& left, const std::pair<float32_t, int32_t>& right) const {
+        return left.first > right.first || (left.first == right.first && left.second < right.second);
+    }
+};
+
+typedef std::vector<std::pair<float32_t, int32_t>>::iterator TopCorrelationsIterator;
+
+/// Add a correlation to a bounded heap of the best `degree` correlations, which currently holds `heap_size` entries.
+static void
+keep_top_correlation(const TopCorrelationsIterator heap_begin,
+                     size_t& heap_size,
+                     const size_t degree,
+                     const std::pair<float32_t, int32_t>& entry) {
+    const BetterCorrelation better;
+    if (heap_size < degree) {
+        heap_begin[heap_size] = entry;
+        ++heap_size;
+        std::push_heap(heap_begin, heap_begin + heap_size, better);
+    } else if (better(entry, heap_begin[0])) {
+        std::pop_heap(heap_begin, heap_begin + degree, better);
+        heap_begin[degree - 1] = entry;
+        std::push_heap(heap_begin, heap_begin + degree, better);
+    }
+}
+
+/// Store a full heap of the best `degree` correlations of a row in the output, sorted by the index of the other rows.
+static void
+store_top_correlations(const TopCorrelationsIterator heap_begin,
+                       const size_t degree,
+                       const size_t row_index,
+                       ArraySlice<int32_t>& output_indices,
+                       ArraySlice<float32_t>& output_data) {
+    std::sort(heap_begin,
+              heap_begin + degree,
+              [](const std::pair<float32_t, int32_t>& left, const std::pair<float32_t, int32_t>& right) {
+                  return left.second < right.second;
+              });
+    const size_t start_position = row_index * degree;
+    for (size_t location = 0; location < degree; ++location) {
+        output_data[start_position + location] = heap_begin[location].first;
+        output_indices[start_position + location] = heap_begin[location].second;
+    }
+}
+
+/// See the Python `metacell.utilities.computation.corrcoef_top_per` function.
+///
+/// This computes the same tiled dot products as `correlate_dense_tiled`, except that each task covers a single tile of
+/// rows against all the other tiles (computing each pair of tiles twice), and keeps only a bounded heap of the best
+/// `degree` correlations of each of its rows, so the full correlations matrix is never materialized.
+template<typename F>
+static void
+correlate_top_dense(const size_t degree,
+                    const pybind11::array_t<F>& input_array,
+                    pybind11::array_t<int32_t>& output_indices_array,
+                    pybind11::array_t<float32_t>& output_data_array) {
+    WithoutGil without_gil{};
+    ConstMatrixSlice<F> input(input_array, "input");
+    ArraySlice<int32_t> output_indices(output_indices_array, "output_indices");
+    ArraySlice<float32_t> output_data(output_data_array, "output_data");
+
+    const size_t rows_count = input.rows_count();
+    const size_t columns_count = input.columns_count();
+
+    FastAssertCompare(0, <, degree);
+    FastAssertCompare(degree, <, rows_count);
+
+    FastAssertCompare(output_indices.size(), ==, degree * rows_count);
+    FastAssertCompare(output_data.size(), ==, degree * rows_count);
+
+    const auto normalized = normalized_rows(input);
+    const size_t padded_rows_count = padded_rows_count_of(rows_count);
+    const size_t tiles_count = (rows_count + TILE_ROWS - 1) / TILE_ROWS;
+
+    parallel_loop(tiles_count, 1, [&](size_t some_tile) {
+        const size_t some_begin = some_tile * TILE_ROWS;
+        const size_t some_end = std::min(some_begin + TILE_ROWS, rows_count);
+
+        std::vector<std::pair<float32_t, int32_t>> heaps(TILE_ROWS * degree);
+        std::vector<size_t> heap_sizes(TILE_ROWS, 0);
+        TmpVectorFloat64 sums_raii;
+        auto& sums = sums_raii.vector(TILE_ROWS * TILE_ROWS);
+
+        for (size_t other_tile = 0; other_tile < tiles_count; ++other_tile) {
+            const size_t other_begin = other_tile * TILE_ROWS;
+            const size_t other_end = std::min(other_begin + TILE_ROWS, rows_count);
+            tile_dots(normalized.get(), columns_count, padded_rows_count, some_begin, other_begin, sums);
+
+            for (size_t some_index = some_begin; some_index < some_end; ++some_index) {
+                const size_t some_offset = some_index - some_begin;
+                auto heap_begin = heaps.begin() + some_offset * degree;
+                size_t& heap_size = heap_sizes[some_offset];
+
+                for (size_t other_index = other_begin; other_index < other_end; ++other_index) {
+                    const size_t other_offset = other_index - other_begin;
+                    float64_t correlation;
+                    if (other_index == some_index) {
+                        correlation = 1.0;
+                    } else if (some_tile == other_tile && other_index > some_index) {
+                        correlation = sums[other_offset * TILE_ROWS + some_offset];
+                    } else {
+                        correlation = sums[some_offset * TILE_ROWS + other_offset];
+                    }
+                    keep_top_correlation(heap_begin,
+                                         heap_size,
+                                         degree,
+                                         std::pair<float32_t, int32_t>(clamp_correlation(correlation),
+                                                                       int32_t(other_index)));
+                }
+            }
+        }
+
+        for (size_t some_index = some_begin; some_index < some_end; ++some_index) {
+            store_top_correlations(heaps.begin() + (some_index - some_begin) * degree,
+                                   degree,
+                                   some_index,
+                                   output_indices,
+                                   output_data);
+        }
+    });
+}
+
 template<typename F>
 static void
 cross_correlate_dense(const pybind11::array_t<F>& first_input_array,
@@ -526,19 +1100,441 @@ pairs_correlate_dense(const pybind11::array_t<F>& first_input_array,
     });
 }
 
+/// The normalized rows of a fixed matrix (e.g., the metacells of an atlas), prepared once for correlating many batches
+/// of query rows with them.
+///
+/// The rows are centered and scaled to a unit norm (see `normalized_rows`) when this is constructed, so their `Sums`
+/// are implicitly zero and one, and nothing refers to the original matrix afterwards. Each batch of query rows then
+/// only normalizes its own rows and computes the tiled dot products with the kept rows. This is immutable so it may be
+/// used by several threads at once.
+template<typename F>
+class PreparedRows {
+private:
+    typedef typename AccumulatorType<F>::type A;
+
+    size_t m_rows_count;                ///< Number of prepared rows.
+    size_t m_columns_count;             ///< Number of columns in each row.
+    std::unique_ptr<A[]> m_normalized;  ///< The normalized rows, padded to `padded_rows_count_of` rows.
+
+public:
+    PreparedRows(const pybind11::array_t<F>& input_array) {
+        WithoutGil without_gil{};
+        ConstMatrixSlice<F> input(input_array, "input");
+        m_rows_count = input.rows_count();
+        m_columns_count = input.columns_count();
+        m_normalized = normalized_rows(input);
+    }
+
+    size_t rows_count() const { return m_rows_count; }
+
+    size_t columns_count() const { return m_columns_count; }
+
+    /// See the Python `metacell.utilities.computation.prepared_cross_corrcoef_rows` function.
+    void cross_correlate(const pybind11::array_t<F>& query_array, pybind11::array_t<float32_t>& output_array) const {
+        WithoutGil without_gil{};
+        ConstMatrixSlice<F> query(query_array, "query");
+        MatrixSlice<float32_t> output(output_array, "output");
+
+        const size_t query_rows_count = query.rows_count();
+        FastAssertCompare(query.columns_count(), ==, m_columns_count);
+        FastAssertCompare(output.rows_count(), ==, query_rows_count);
+        FastAssertCompare(output.columns_count(), ==, m_rows_count);
+
+        const auto query_normalized = normalized_rows(query);
+        const size_t query_padded_rows_count = padded_rows_count_of(query_rows_count);
+        const size_t padded_rows_count = padded_rows_count_of(m_rows_count);
+        const size_t query_tiles_count = (query_rows_count + TILE_ROWS - 1) / TILE_ROWS;
+        const size_t tiles_count = (m_rows_count + TILE_ROWS - 1) / TILE_ROWS;
+
+        parallel_loop(query_tiles_count * tiles_count, 1, [&](size_t task_index) {
+            const size_t query_begin = (task_index / tiles_count) * TILE_ROWS;
+            const size_t other_begin = (task_index % tiles_count) * TILE_ROWS;
+
+            TmpVectorFloat64 sums_raii;
+            auto& sums = sums_raii.vector(TILE_ROWS * TILE_ROWS);
+            tile_cross_dots(query_normalized.get(),
+                            query_padded_rows_count,
+                            m_normalized.get(),
+                            padded_rows_count,
+                            m_columns_count,
+                            query_begin,
+                            other_begin,
+                            false,
+                            sums);
+
+            const size_t query_end = std::min(query_begin + TILE_ROWS, query_rows_count);
+            const size_t other_end = std::min(other_begin + TILE_ROWS, m_rows_count);
+            for (size_t query_index = query_begin; query_index < query_end; ++query_index) {
+                auto output_row = output.get_row(query_index);
+                const float64_t* const sums_row = &sums[(query_index - query_begin) * TILE_ROWS];
+                for (size_t other_index = other_begin; other_index < other_end; ++other_index) {
+                    output_row[other_index] = clamp_correlation(sums_row[other_index - other_begin]);
+                }
+            }
+        });
+    }
+
+    /// See the Python `metacell.utilities.computation.prepared_top_corrcoef_rows` function.
+    ///
+    /// Like `correlate_top_dense`, each task covers a single tile of query rows against all the tiles of the prepared
+    /// rows, and keeps only a bounded heap of the best `degree` correlations of each of its rows.
+    void correlate_top(const size_t degree,
+                       const pybind11::array_t<F>& query_array,
+                       pybind11::array_t<int32_t>& output_indices_array,
+                       pybind11::array_t<float32_t>& output_data_array) const {
+        WithoutGil without_gil{};
+        ConstMatrixSlice<F> query(query_array, "query");
+        ArraySlice<int32_t> output_indices(output_indices_array, "output_indices");
+        ArraySlice<float32_t> output_data(output_data_array, "output_data");
+
+        const size_t query_rows_count = query.rows_count();
+        FastAssertCompare(query.columns_count(), ==, m_columns_count);
+        FastAssertCompare(0, <, degree);
+        FastAssertCompare(degree, <=, m_rows_count);
+        FastAssertCompare(output_indices.size(), ==, degree * query_rows_count);
+        FastAssertCompare(output_data.size(), ==, degree * query_rows_count);
+
+        const auto query_normalized = normalized_rows(query);
+        const size_t query_padded_rows_count = padded_rows_count_of(query_rows_count);
+        const size_t padded_rows_count = padded_rows_count_of(m_rows_count);
+        const size_t query_tiles_count = (query_rows_count + TILE_ROWS - 1) / TILE_ROWS;
+        const size_t tiles_count = (m_rows_count + TILE_ROWS - 1) / TILE_ROWS;
+
+        parallel_loop(query_tiles_count, 1, [&](size_t query_tile) {
+            const size_t query_begin = query_tile * TILE_ROWS;
+            const size_t query_end = std::min(query_begin + TILE_ROWS, query_rows_count);
+
+            std::vector<std::pair<float32_t, int32_t>> heaps(TILE_ROWS * degree);
+            std::vector<size_t> heap_sizes(TILE_ROWS, 0);
+
+            TmpVectorFloat64 sums_raii;
+            auto& sums = sums_raii.vector(TILE_ROWS * TILE_ROWS);
+
+            for (size_t other_tile = 0; other_tile < tiles_count; ++other_tile) {
+                const size_t other_begin = other_tile * TILE_ROWS;
+                const size_t other_end = std::min(other_begin + TILE_ROWS, m_rows_count);
+                tile_cross_dots(query_normalized.get(),
+                                query_padded_rows_count,
+                                m_normalized.get(),
+                                padded_rows_count,
+                                m_columns_count,
+                                query_begin,
+                                other_begin,
+                                false,
+                                sums);
+
+                for (size_t query_index = query_begin; query_index < query_end; ++query_index) {
+                    const size_t query_offset = query_index - query_begin;
+                    const float64_t* const sums_row = &sums[query_offset * TILE_ROWS];
+                    for (size_t other_index = other_begin; other_index < other_end; ++other_index) {
+                        keep_top_correlation(heaps.begin() + query_offset * degree,
+                                             heap_sizes[query_offset],
+                                             degree,
+                                             std::pair<float32_t, int32_t>(
+                                                 clamp_correlation(sums_row[other_index - other_begin]),
+                                                 int32_t(other_index)));
+                    }
+                }
+            }
+
+            for (size_t query_index = query_begin; query_index < query_end; ++query_index) {
+                store_top_correlations(heaps.begin() + (query_index - query_begin) * degree,
+                                       degree,
+                                       query_index,
+                                       output_indices,
+                                       output_data);
+            }
+        });
+    }
+};
+
+template<typename D, typename I, typename P>
+static Sums
+sum_band_values(const ConstCompressedMatrix<D, I, P>& input, const size_t band_index) {
+    const auto band_data = input.get_band_data(band_index);
+    const size_t nnz_count = band_data.size();
+    float64_t sum_values = 0;
+    float64_t sum_squared = 0;
+    for (size_t position = 0; position < nnz_count; ++position) {
+        const float64_t value = band_data[position];
+        sum_values += value;
+        sum_squared = fma(value, value, sum_squared);
+    }
+    return Sums{ sum_values, sum_squared };
+}
+
+template<typename D, typename I, typename P>
+static void
+scatter_band(const ConstCompressedMatrix<D, I, P>& input, const size_t band_index, std::vector<float64_t>& dense) {
+    const auto band_indices = input.get_band_indices(band_index);
+    const auto band_data = input.get_band_data(band_index);
+    const size_t nnz_count = band_data.size();
+    for (size_t position = 0; position < nnz_count; ++position) {
+        dense[band_indices[position]] += band_data[position];
+    }
+}
+
+template<typename D, typename I, typename P>
+static void
+unscatter_band(const ConstCompressedMatrix<D, I, P>& input, const size_t band_index, std::vector<float64_t>& dense) {
+    const auto band_indices = input.get_band_indices(band_index);
+    const size_t nnz_count = band_indices.size();
+    for (size_t position = 0; position < nnz_count; ++position) {
+        dense[band_indices[position]] = 0;
+    }
+}
+
+template<typename D, typename I, typename P>
+static float64_t
+dot_band(const std::vector<float64_t>& dense, const ConstCompressedMatrix<D, I, P>& input, const size_t band_index) {
+    const auto band_indices = input.get_band_indices(band_index);
+    const auto band_data = input.get_band_data(band_index);
+    const size_t nnz_count = band_data.size();
+    float64_t result = 0;
+    for (size_t position = 0; position < nnz_count; ++position) {
+        result = fma(dense[band_indices[position]], float64_t(band_data[position]), result);
+    }
+    return result;
+}
+
+/// See the Python `metacell.utilities.computation._corrcoef_compressed` function.
+template<typename D, typename I, typename P>
+static void
+correlate_compressed(const pybind11::array_t<D>& input_data_array,
+                     const pybind11::array_t<I>& input_indices_array,
+                     const pybind11::array_t<P>& input_indptr_array,
+                     const size_t elements_count,
+                     pybind11::array_t<float32_t>& output_array) {
+    WithoutGil without_gil{};
+    ConstCompressedMatrix<D, I, P> input(ConstArraySlice<D>(input_data_array, "input_data"),
+                                         ConstArraySlice<I>(input_indices_array, "input_indices"),
+                                         ConstArraySlice<P>(input_indptr_array, "input_indptr"),
+                                         elements_count,
+                                         "input");
+    MatrixSlice<float32_t> output(output_array, "output");
+
+    const size_t rows_count = input.bands_count();
+
+    FastAssertCompare(output.rows_count(), ==, rows_count);
+    FastAssertCompare(output.columns_count(), ==, rows_count);
+
+    TmpVectorFloat64 row_sum_values_raii;
+    auto& row_sum_values = row_sum_values_raii.vector(rows_count);
+
+    TmpVectorFloat64 row_sum_squared_raii;
+    auto& row_sum_squared = row_sum_squared_raii.vector(rows_count);
+
+    parallel_loop(rows_count, [&](size_t row_index) {
+        const auto sums = sum_band_values(input, row_index);
+        row_sum_values[row_index] = sums.values;
+        row_sum_squared[row_index] = sums.squared;
+    });
+
+    // Row `some_index` is correlated with all the rows before it, so pair the short and long rows of the triangle
+    // to balance the amount of work per task.
+    parallel_loop((rows_count + 1) / 2, [&](size_t task_index) {
+        TmpVectorFloat64 dense_raii;
+        auto& dense = dense_raii.vector(elements_count);
+
+        const auto correlate_row = [&](const size_t some_index) {
+            scatter_band(input, some_index, dense);
+            auto output_row = output.get_row(some_index);
+            output_row[some_index] = 1.0;
+            for (size_t other_index = 0; other_index < some_index; ++other_index) {
+                const float32_t correlation = correlation_of_sums(elements_count,
+                                                                  dot_band(dense, input, other_index),
+                                                                  row_sum_values[some_index],
+                                                                  row_sum_squared[some_index],
+                                                                  row_sum_values[other_index],
+                                                                  row_sum_squared[other_index]);
+                output_row[other_index] = correlation;
+                output.get_row(other_index)[some_index] = correlation;
+            }
+            unscatter_band(input, some_index, dense);
+        };
+
+        correlate_row(task_index);
+        const size_t mirror_index = rows_count - 1 - task_index;
+        if (mirror_index != task_index) {
+            correlate_row(mirror_index);
+        }
+    });
+}
+
+/// See the Python `metacell.utilities.computation.cross_corrcoef_rows` function.
+template<typename D, typename I, typename P>
+static void
+cross_correlate_compressed(const pybind11::array_t<D>& first_input_data_array,
+                           const pybind11::array_t<I>& first_input_indices_array,
+                           const pybind11::array_t<P>& first_input_indptr_array,
+                           const pybind11::array_t<D>& second_input_data_array,
+                           const pybind11::array_t<I>& second_input_indices_array,
+                           const pybind11::array_t<P>& second_input_indptr_array,
+                           const size_t elements_count,
+                           pybind11::array_t<float32_t>& output_array) {
+    WithoutGil without_gil{};
+    ConstCompressedMatrix<D, I, P> first_input(ConstArraySlice<D>(first_input_data_array, "first_input_data"),
+                                               ConstArraySlice<I>(first_input_indices_array, "first_input_indices"),
+                                               ConstArraySlice<P>(first_input_indptr_array, "first_input_indptr"),
+                                               elements_count,
+                                               "first_input");
+    ConstCompressedMatrix<D, I, P> second_input(ConstArraySlice<D>(second_input_data_array, "second_input_data"),
+                                                ConstArraySlice<I>(second_input_indices_array, "second_input_indices"),
+                                                ConstArraySlice<P>(second_input_indptr_array, "second_input_indptr"),
+                                                elements_count,
+                                                "second_input");
+    MatrixSlice<float32_t> output(output_array, "output");
+
+    const size_t first_rows_count = first_input.bands_count();
+    const size_t second_rows_count = second_input.bands_count();
+
+    FastAssertCompare(output.rows_count(), ==, first_rows_count);
+    FastAssertCompare(output.columns_count(), ==, second_rows_count);
+
+    TmpVectorFloat64 second_row_sum_values_raii;
+    auto& second_row_sum_values = second_row_sum_values_raii.vector(second_rows_count);
+
+    TmpVectorFloat64 second_row_sum_squared_raii;
+    auto& second_row_sum_squared = second_row_sum_squared_raii.vector(second_rows_count);
+
+    parallel_loop(second_rows_count, [&](size_t second_row_index) {
+        const auto sums = sum_band_values(second_input, second_row_index);
+        second_row_sum_values[second_row_index] = sums.values;
+        second_row_sum_squared[second_row_index] = sums.squared;
+    });
+
+    parallel_loop(first_rows_count, [&](size_t first_row_index) {
+        TmpVectorFloat64 dense_raii;
+        auto& dense = dense_raii.vector(elements_count);
+
+        const auto sums = sum_band_values(first_input, first_row_index);
+        scatter_band(first_input, first_row_index, dense);
+
+        auto output_row = output.get_row(first_row_index);
+        for (size_t second_row_index = 0; second_row_index < second_rows_count; ++second_row_index) {
+            output_row[second_row_index] = correlation_of_sums(elements_count,
+                                                               dot_band(dense, second_input, second_row_index),
+                                                               sums.values,
+                                                               sums.squared,
+                                                               second_row_sum_values[second_row_index],
+                                                               second_row_sum_squared[second_row_index]);
+        }
+    });
+}
+
+/// See the Python `metacell.utilities.computation.pairs_corrcoef_rows` function.
+template<typename D, typename I, typename P>
+static void
+pairs_correlate_compressed(const pybind11::array_t<D>& first_input_data_array,
+                           const pybind11::array_t<I>& first_input_indices_array,
+                           const pybind11::array_t<P>& first_input_indptr_array,
+                           const pybind11::array_t<D>& second_input_data_array,
+                           const pybind11::array_t<I>& second_input_indices_array,
+                           const pybind11::array_t<P>& second_input_indptr_array,
+                           const size_t elements_count,
+                           pybind11::array_t<float32_t>& output_array) {
+    WithoutGil without_gil{};
+    ConstCompressedMatrix<D, I, P> first_input(ConstArraySlice<D>(first_input_data_array, "first_input_data"),
+                                               ConstArraySlice<I>(first_input_indices_array, "first_input_indices"),
+                                               ConstArraySlice<P>(first_input_indptr_array, "first_input_indptr"),
+                                               elements_count,
+                                               "first_input");
+    ConstCompressedMatrix<D, I, P> second_input(ConstArraySlice<D>(second_input_data_array, "second_input_data"),
+                                                ConstArraySlice<I>(second_input_indices_array, "second_input_indices"),
+                                                ConstArraySlice<P>(second_input_indptr_array, "second_input_indptr"),
+                                                elements_count,
+                                                "second_input");
+    ArraySlice<float32_t> output(output_array, "output");
+
+    const size_t rows_count = first_input.bands_count();
+
+    FastAssertCompare(second_input.bands_count(), ==, rows_count);
+    FastAssertCompare(output.size(), ==, rows_count);
+
+    parallel_loop(rows_count, [&](size_t row_index) {
+        TmpVectorFloat64 dense_raii;
+        auto& dense = dense_raii.vector(elements_count);
+
+        const auto first_sums = sum_band_values(first_input, row_index);
+        const auto second_sums = sum_band_values(second_input, row_index);
+        scatter_band(first_input, row_index, dense);
+
+        output[row_index] = correlation_of_sums(elements_count,
+                                                dot_band(dense, second_input, row_index),
+                                                first_sums.values,
+                                                first_sums.squared,
+                                                second_sums.values,
+                                                second_sums.squared);
+    });
+}
+
 void
 register_correlate(pybind11::module& module) {
-#define REGISTER_F(F)                                                                                       \
-    module.def("correlate_dense_" #F, &metacells::correlate_dense<F>, "Correlate rows of dense matrices."); \
-    module.def("cross_correlate_dense_" #F,                                                                 \
-               &metacells::cross_correlate_dense<F>,                                                        \
-               "Cross-correlate rows of dense matrices.");                                                  \
-    module.def("pairs_correlate_dense_" #F,                                                                 \
-               &metacells::pairs_correlate_dense<F>,                                                        \
-               "Pairs-correlate rows of dense matrices.");
+#define REGISTER_F(F)                                                                                          \
+    module.def("correlate_dense_" #F, &metacells::correlate_dense<F>, "Correlate rows of dense matrices.");    \
+    module.def("cross_correlate_dense_" #F,                                                                    \
+               &metacells::cross_correlate_dense<F>,                                                           \
+               "Cross-correlate rows of dense matrices.");                                                     \
+    module.def("pairs_correlate_dense_" #F,                                                                    \
+               &metacells::pairs_correlate_dense<F>,                                                           \
+               "Pairs-correlate rows of dense matrices.");                                                     \
+    module.def("correlate_top_dense_" #F,                                                                      \
+               &metacells::correlate_top_dense<F>,                                                             \
+               "Collect the top correlations of rows of dense matrices.");                                     \
+    pybind11::class_<metacells::PreparedRows<F>>(module,                                                       \
+                                                 "PreparedRows_" #F,                                           \
+                                                 "Rows of a dense matrix prepared for repeated correlations.") \
+        .def(pybind11::init<const pybind11::array_t<F>&>())                                                    \
+        .def_property_readonly("rows_count", &metacells::PreparedRows<F>::rows_count, "The number of rows.")   \
+        .def_property_readonly("columns_count",                                                                \
+                               &metacells::PreparedRows<F>::columns_count,                                     \
+                               "The number of columns.")                                                       \
+        .def("cross_correlate",                                                                                \
+             &metacells::PreparedRows<F>::cross_correlate,                                                     \
+             "Cross-correlate rows of a dense matrix with the prepared rows.")                                 \
+        .def("correlate_top",                                                                                  \
+             &metacells::PreparedRows<F>::correlate_top,                                                       \
+             "Collect the top correlations of rows of a dense matrix with the prepared rows.");
 
+    REGISTER_F(float16_t)
+    REGISTER_F(uint16_t)
     REGISTER_F(float32_t)
     REGISTER_F(float64_t)
+
+#define REGISTER_D_I_P(D, I, P)                                     \
+    module.def("correlate_compressed_" #D "_" #I "_" #P,            \
+               &metacells::correlate_compressed<D, I, P>,           \
+               "Correlate rows of compressed matrices.");           \
+    module.def("cross_correlate_compressed_" #D "_" #I "_" #P,      \
+               &metacells::cross_correlate_compressed<D, I, P>,     \
+               "Cross-correlate rows of compressed matrices.");     \
+    module.def("pairs_correlate_compressed_" #D "_" #I "_" #P,      \
+               &metacells::pairs_correlate_compressed<D, I, P>,     \
+               "Pairs-correlate rows of compressed matrices.");
+
+#define REGISTER_DS_I_P(I, P)       \
+    REGISTER_D_I_P(float16_t, I, P) \
+    REGISTER_D_I_P(uint16_t, I, P)  \
+    REGISTER_D_I_P(float32_t, I, P) \
+    REGISTER_D_I_P(float64_t, I, P)
+
+#define REGISTER_DS_IS_P(P)      \
+    REGISTER_DS_I_P(int8_t, P)   \
+    REGISTER_DS_I_P(int16_t, P)  \
+    REGISTER_DS_I_P(int32_t, P)  \
+    REGISTER_DS_I_P(int64_t, P)  \
+    REGISTER_DS_I_P(uint8_t, P)  \
+    REGISTER_DS_I_P(uint16_t, P) \
+    REGISTER_DS_I_P(uint32_t, P) \
+    REGISTER_DS_I_P(uint64_t, P)
+
+    REGISTER_DS_IS_P(int32_t)
+    REGISTER_DS_IS_P(int64_t)
+    REGISTER_DS_IS_P(uint32_t)
+    REGISTER_DS_IS_P(uint64_t)
+
+    select_dot_kernels<float32_t>();
+    select_dot_kernels<float64_t>();
 }
 
 }
@@ -16,12 +16,378 @@ static const ssize_t DELTAS[2][DELTAS_COUNT][2] = {
 };
 
 static size_t
-distance(size_t left_x_index, size_t left_y_index, size_t right_x_index, size_t right_y_index) {
+distance(ssize_t left_x_index, ssize_t left_y_index, size_t right_x_index, size_t right_y_index) {
     ssize_t x_distance = ssize_t(left_x_index) - ssize_t(right_x_index);
     ssize_t y_distance = ssize_t(left_y_index) - ssize_t(right_y_index);
     return size_t(x_distance * x_distance + y_distance * y_distance);
 }
 
+/// The size of the side of a (square) tile of grid locations.
+static const size_t COVER_TILE_SIZE = 32;
+
+/// The size of the side of a (square) block of grid locations, for which we keep a mask of the free locations.
+static const size_t COVER_BLOCK_SIZE = 8;
+
+/// The rectangle of grid locations a task may modify.
+struct CoverWindow {
+    ssize_t x_start;
+    ssize_t x_stop;
+    ssize_t y_start;
+    ssize_t y_stop;
+
+    bool contains(const ssize_t x_index, const ssize_t y_index) const {
+        return x_start <= x_index && x_index < x_stop && y_start <= y_index && y_index < y_stop;
+    }
+};
+
+/// A flat hexagonal layout grid holding the index of the point placed in each location (or -1).
+///
+/// The locations are stored tile by tile, so that nearby locations are nearby in memory. We also keep a bit mask of
+/// the free locations of each block, to quickly find the free location nearest to a point.
+class CoverGrid {
+private:
+    size_t m_x_size;
+    size_t m_y_size;
+    size_t m_x_tiles_count;
+    size_t m_y_tiles_count;
+    size_t m_x_blocks_count;
+    size_t m_y_blocks_count;
+    std::vector<ssize_t> m_point_index_of_locations;
+    std::vector<uint64_t> m_free_mask_of_blocks;
+
+    size_t location_index(const size_t x_index, const size_t y_index) const {
+        SlowAssertCompare(x_index, <, m_x_size);
+        SlowAssertCompare(y_index, <, m_y_size);
+        const size_t tile_index = (y_index / COVER_TILE_SIZE) * m_x_tiles_count + x_index / COVER_TILE_SIZE;
+        return tile_index * COVER_TILE_SIZE * COVER_TILE_SIZE + (y_index % COVER_TILE_SIZE) * COVER_TILE_SIZE
+               + x_index % COVER_TILE_SIZE;
+    }
+
+    size_t block_of(const size_t x_index, const size_t y_index) const {
+        return (y_index / COVER_BLOCK_SIZE) * m_x_blocks_count + x_index / COVER_BLOCK_SIZE;
+    }
+
+    static uint64_t bit_of(const size_t x_index, const size_t y_index) {
+        return uint64_t(1) << ((y_index % COVER_BLOCK_SIZE) * COVER_BLOCK_SIZE + x_index % COVER_BLOCK_SIZE);
+    }
+
+public:
+    CoverGrid(const size_t x_size, const size_t y_size)
+      : m_x_size(x_size)
+      , m_y_size(y_size)
+      , m_x_tiles_count((x_size + COVER_TILE_SIZE - 1) / COVER_TILE_SIZE)
+      , m_y_tiles_count((y_size + COVER_TILE_SIZE - 1) / COVER_TILE_SIZE)
+      , m_x_blocks_count((x_size + COVER_BLOCK_SIZE - 1) / COVER_BLOCK_SIZE)
+      , m_y_blocks_count((y_size + COVER_BLOCK_SIZE - 1) / COVER_BLOCK_SIZE)
+      , m_point_index_of_locations(m_x_tiles_count * m_y_tiles_count * COVER_TILE_SIZE * COVER_TILE_SIZE, -1)
+      , m_free_mask_of_blocks(m_x_blocks_count * m_y_blocks_count, 0) {
+        for (size_t y_index = 0; y_index < y_size; ++y_index) {
+            for (size_t x_index = 0; x_index < x_size; ++x_index) {
+                m_free_mask_of_blocks[block_of(x_index, y_index)] |= bit_of(x_index, y_index);
+            }
+        }
+    }
+
+    size_t x_size() const { return m_x_size; }
+
+    size_t y_size() const { return m_y_size; }
+
+    /// The mask of the free locations in the block with some x and y block indices. Bit `y * 8 + x` is set if the
+    /// location at offset `x, y` in the block is free.
+    uint64_t free_mask_of_block(const size_t x_block_index, const size_t y_block_index) const {
+        return m_free_mask_of_blocks[y_block_index * m_x_blocks_count + x_block_index];
+    }
+
+    /// The number of free locations in a window (whose start must be aligned to blocks).
+    size_t free_count(const CoverWindow& window) const {
+        const size_t x_blocks_stop = (window.x_stop + COVER_BLOCK_SIZE - 1) / COVER_BLOCK_SIZE;
+        const size_t y_blocks_stop = (window.y_stop + COVER_BLOCK_SIZE - 1) / COVER_BLOCK_SIZE;
+        size_t count = 0;
+        for (size_t y_block_index = window.y_start / COVER_BLOCK_SIZE; y_block_index < y_blocks_stop; ++y_block_index) {
+            for (size_t x_block_index = window.x_start / COVER_BLOCK_SIZE; x_block_index < x_blocks_stop;
+                 ++x_block_index) {
+                count += __builtin_popcountll(free_mask_of_block(x_block_index, y_block_index));
+            }
+        }
+        return count;
+    }
+
+    ssize_t point_index(const size_t x_index, const size_t y_index) const {
+        return m_point_index_of_locations[location_index(x_index, y_index)];
+    }
+
+    void set_point_index(const size_t x_index, const size_t y_index, const ssize_t point_index) {
+        auto& free_mask = m_free_mask_of_blocks[block_of(x_index, y_index)];
+        if (point_index < 0) {
+            free_mask |= bit_of(x_index, y_index);
+        } else {
+            free_mask &= ~bit_of(x_index, y_index);
+        }
+        m_point_index_of_locations[location_index(x_index, y_index)] = point_index;
+    }
+};
+
+/// A split of the grid into (square) tiles, for processing points in parallel.
+///
+/// The task processing a tile may modify locations in its window, which is the tile itself with a margin of half a
+/// tile around it. Tiles are processed in four phases, where in each one only tiles with the same parity of both the x
+/// and the y tile indices are processed in parallel. Such tiles are a whole tile apart from each other, so their
+/// windows do not overlap. Since the margin is a multiple of the block size, each block is also inside at most one
+/// window of a phase, and the windows are aligned to blocks.
+class CoverTiling {
+private:
+    size_t m_tile_size;
+    size_t m_x_size;
+    size_t m_y_size;
+    size_t m_x_tiles_count;
+    size_t m_y_tiles_count;
+
+public:
+    CoverTiling(const CoverGrid& grid, const size_t tile_size)
+      : m_tile_size(tile_size)
+      , m_x_size(grid.x_size())
+      , m_y_size(grid.y_size())
+      , m_x_tiles_count((grid.x_size() + tile_size - 1) / tile_size)
+      , m_y_tiles_count((grid.y_size() + tile_size - 1) / tile_size) {
+        FastAssertCompare(tile_size % (2 * COVER_BLOCK_SIZE), ==, 0);
+    }
+
+    size_t tiles_count() const { return m_x_tiles_count * m_y_tiles_count; }
+
+    size_t tile_of(const size_t x_index, const size_t y_index) const {
+        return (y_index / m_tile_size) * m_x_tiles_count + x_index / m_tile_size;
+    }
+
+    bool is_tile_of_phase(const size_t tile_index, const size_t phase_index) const {
+        const size_t x_tile_index = tile_index % m_x_tiles_count;
+        const size_t y_tile_index = tile_index / m_x_tiles_count;
+        return x_tile_index % 2 == phase_index % 2 && y_tile_index % 2 == phase_index / 2;
+    }
+
+    CoverWindow window_of(const size_t tile_index) const {
+        const ssize_t tile_size = ssize_t(m_tile_size);
+        const ssize_t x_tile_index = ssize_t(tile_index % m_x_tiles_count);
+        const ssize_t y_tile_index = ssize_t(tile_index / m_x_tiles_count);
+        return CoverWindow{ std::max(ssize_t(0), x_tile_index * tile_size - tile_size / 2),
+                            std::min(ssize_t(m_x_size), (x_tile_index + 1) * tile_size + tile_size / 2),
+                            std::max(ssize_t(0), y_tile_index * tile_size - tile_size / 2),
+                            std::min(ssize_t(m_y_size), (y_tile_index + 1) * tile_size + tile_size / 2) };
+    }
+};
+
+/// Place a point at (nearly) the free location nearest to its preferred location.
+///
+/// We scan the rings of blocks around the block of the preferred location until we find a block with free locations,
+/// then pick the nearest free location in this ring and the one after it. Only locations inside the window are used.
+/// Returns whether such a free location was found (it always is if the window has any free locations).
+static bool
+place_point(const size_t point_index,
+            const size_t preferred_x_index,
+            const size_t preferred_y_index,
+            CoverGrid& grid,
+            const CoverWindow& window,
+            std::vector<std::array<size_t, 2>>& location_of_points) {
+    size_t x_index = preferred_x_index;
+    size_t y_index = preferred_y_index;
+
+    if (grid.point_index(x_index, y_index) >= 0) {
+        const ssize_t block_size = ssize_t(COVER_BLOCK_SIZE);
+        const ssize_t x_blocks_start = window.x_start / block_size;
+        const ssize_t x_blocks_stop = (window.x_stop + block_size - 1) / block_size;
+        const ssize_t y_blocks_start = window.y_start / block_size;
+        const ssize_t y_blocks_stop = (window.y_stop + block_size - 1) / block_size;
+        const ssize_t x_home_block_index = ssize_t(preferred_x_index) / block_size;
+        const ssize_t y_home_block_index = ssize_t(preferred_y_index) / block_size;
+        const ssize_t rings_count = 1
+                                    + std::max(std::max(x_home_block_index - x_blocks_start,
+                                                        x_blocks_stop - 1 - x_home_block_index),
+                                               std::max(y_home_block_index - y_blocks_start,
+                                                        y_blocks_stop - 1 - y_home_block_index));
+
+        ssize_t found_ring_index = -1;
+        size_t nearest_distance = std::numeric_limits<size_t>::max();
+
+        auto visit_block = [&](const ssize_t x_block_index, const ssize_t y_block_index) {
+            if (x_block_index < x_blocks_start || x_blocks_stop <= x_block_index || y_block_index < y_blocks_start
+                || y_blocks_stop <= y_block_index) {
+                return false;
+            }
+
+            uint64_t free_mask = grid.free_mask_of_block(x_block_index, y_block_index);
+            if (free_mask == 0) {
+                return false;
+            }
+
+            while (free_mask != 0) {
+                const size_t bit_index = size_t(__builtin_ctzll(free_mask));
+                free_mask &= free_mask - 1;
+                const ssize_t near_x_index = x_block_index * block_size + ssize_t(bit_index % COVER_BLOCK_SIZE);
+                const ssize_t near_y_index = y_block_index * block_size + ssize_t(bit_index / COVER_BLOCK_SIZE);
+                if (!window.contains(near_x_index, near_y_index)) {
+                    continue;
+                }
+                const auto near_distance = distance(near_x_index, near_y_index, preferred_x_index, preferred_y_index);
+                if (near_distance < nearest_distance) {
+                    nearest_distance = near_distance;
+                    x_index = size_t(near_x_index);
+                    y_index = size_t(near_y_index);
+                }
+            }
+            return true;
+        };
+
+        for (ssize_t ring_index = 0; ring_index < rings_count; ++ring_index) {
+            if (found_ring_index >= 0 && ring_index > found_ring_index + 1) {
+                break;
+            }
+
+            bool did_find = false;
+            for (ssize_t delta_y = -ring_index; delta_y <= ring_index; ++delta_y) {
+                const ssize_t y_block_index = y_home_block_index + delta_y;
+                if (delta_y == -ring_index || delta_y == ring_index) {
+                    for (ssize_t delta_x = -ring_index; delta_x <= ring_index; ++delta_x) {
+                        did_find = visit_block(x_home_block_index + delta_x, y_block_index) || did_find;
+                    }
+                } else {
+                    did_find = visit_block(x_home_block_index - ring_index, y_block_index) || did_find;
+                    did_find = visit_block(x_home_block_index + ring_index, y_block_index) || did_find;
+                }
+            }
+
+            if (did_find && found_ring_index < 0) {
+                found_ring_index = ring_index;
+            }
+        }
+
+        if (found_ring_index < 0) {
+            return false;
+        }
+    }
+
+    grid.set_point_index(x_index, y_index, ssize_t(point_index));
+    location_of_points[point_index] = { x_index, y_index };
+    return true;
+}
+
+/// Move a point towards its preferred location by swapping it with its neighbors, as long as this does not move them
+/// away from their own preferred locations. Only locations inside the window are used.
+static void
+improve_point(const size_t point_index,
+              CoverGrid& grid,
+              const CoverWindow& window,
+              const std::vector<std::array<size_t, 2>>& preferred_location_of_points,
+              std::vector<std::array<size_t, 2>>& location_of_points,
+              PhiloxRandom& random) {
+    std::array<size_t, DELTAS_COUNT> delta_indices;
+    std::iota(delta_indices.begin(), delta_indices.end(), 0);
+
+    auto x_index = ssize_t(location_of_points[point_index][0]);
+    auto y_index = ssize_t(location_of_points[point_index][1]);
+    FastAssertCompare(window.contains(x_index, y_index), ==, true);
+
+    const auto preferred_x_index = preferred_location_of_points[point_index][0];
+    const auto preferred_y_index = preferred_location_of_points[point_index][1];
+
+    bool did_move = true;
+    while (did_move) {
+        did_move = false;
+        auto current_distance = distance(x_index, y_index, preferred_x_index, preferred_y_index);
+
+        random.shuffle(delta_indices.begin(), delta_indices.end());
+        for (auto delta_index : delta_indices) {
+            const auto near_x_index = x_index + DELTAS[y_index % 2][delta_index][0];
+            const auto near_y_index = y_index + DELTAS[y_index % 2][delta_index][1];
+            if (!window.contains(near_x_index, near_y_index)) {
+                continue;
+            }
+
+            auto near_distance = distance(near_x_index, near_y_index, preferred_x_index, preferred_y_index);
+            if (near_distance > current_distance) {
+                continue;
+            }
+
+            auto other_point_index = grid.point_index(near_x_index, near_y_index);
+            if (other_point_index < 0) {
+                continue;
+            }
+
+            auto other_preferred_x_index = preferred_location_of_points[other_point_index][0];
+            auto other_preferred_y_index = preferred_location_of_points[other_point_index][1];
+
+            auto other_current_distance = distance(x_index, y_index, other_preferred_x_index, other_preferred_y_index);
+            auto other_near_distance =
+                distance(near_x_index, near_y_index, other_preferred_x_index, other_preferred_y_index);
+            if (other_current_distance > other_near_distance
+                || (near_distance == current_distance && other_current_distance == other_near_distance)) {
+                continue;
+            }
+
+            grid.set_point_index(x_index, y_index, other_point_index);
+            location_of_points[other_point_index] = { size_t(x_index), size_t(y_index) };
+
+            grid.set_point_index(near_x_index, near_y_index, ssize_t(point_index));
+            location_of_points[point_index] = { size_t(near_x_index), size_t(near_y_index) };
+
+            x_index = near_x_index;
+            y_index = near_y_index;
+            current_distance = near_distance;
+            did_move = true;
+        }
+    }
+}
+
+/// Group the (indices of the) pending points by their tiles, keeping them in increasing index order within each tile.
+static void
+group_points_by_tiles(const CoverTiling& tiling,
+                      const std::vector<std::array<size_t, 2>>& location_of_points,
+                      const std::vector<uint8_t>& is_pending_of_points,
+                      std::vector<size_t>& first_position_of_tiles,
+                      std::vector<size_t>& point_index_of_positions) {
+    const size_t points_count = location_of_points.size();
+
+    TmpVectorSizeT raii_tile_of_points;
+    auto tmp_tile_of_points = raii_tile_of_points.array_slice("tmp_tile_of_points", points_count);
+
+    first_position_of_tiles.assign(tiling.tiles_count() + 1, 0);
+    for (size_t point_index = 0; point_index < points_count; ++point_index) {
+        if (is_pending_of_points[point_index]) {
+            const auto& location = location_of_points[point_index];
+            tmp_tile_of_points[point_index] = tiling.tile_of(location[0], location[1]);
+            ++first_position_of_tiles[tmp_tile_of_points[point_index] + 1];
+        }
+    }
+    std::partial_sum(first_position_of_tiles.begin(), first_position_of_tiles.end(), first_position_of_tiles.begin());
+
+    point_index_of_positions.resize(first_position_of_tiles.back());
+    TmpVectorSizeT raii_next_positions;
+    auto& tmp_next_positions = raii_next_positions.vector(first_position_of_tiles.size());
+    std::copy(first_position_of_tiles.begin(), first_position_of_tiles.end(), tmp_next_positions.begin());
+    for (size_t point_index = 0; point_index < points_count; ++point_index) {
+        if (is_pending_of_points[point_index]) {
+            point_index_of_positions[tmp_next_positions[tmp_tile_of_points[point_index]]++] = point_index;
+        }
+    }
+}
+
+/// Invoke `body(tile_index)` for each non-empty tile of a phase, in parallel.
+static void
+parallel_phase_tiles(const CoverTiling& tiling,
+                     const size_t phase_index,
+                     const std::vector<size_t>& first_position_of_tiles,
+                     std::function<void(size_t)> body) {
+    TmpVectorSizeT raii_phase_tiles;
+    auto& tmp_phase_tiles = raii_phase_tiles.vector();
+    for (size_t tile_index = 0; tile_index < tiling.tiles_count(); ++tile_index) {
+        if (tiling.is_tile_of_phase(tile_index, phase_index)
+            && first_position_of_tiles[tile_index] < first_position_of_tiles[tile_index + 1]) {
+            tmp_phase_tiles.push_back(tile_index);
+        }
+    }
+    parallel_loop(tmp_phase_tiles.size(), 1, [&](size_t phase_tile_position) {
+        body(tmp_phase_tiles[phase_tile_position]);
+    });
+}
+
 template<typename D>
 static void
 cover_coordinates(const pybind11::array_t<D>& raw_x_coordinates_array,
@@ -47,9 +413,6 @@ cover_coordinates(const pybind11::array_t<D>& raw_x_coordinates_array,
     FastAssertCompare(spaced_x_coordinates.size(), ==, points_count);
     FastAssertCompare(spaced_y_coordinates.size(), ==, points_count);
 
-    std::minstd_rand random(random_seed);
-    std::normal_distribution<float64_t> noise(0.0, noise_fraction);
-
     const auto x_min = *std::min_element(raw_x_coordinates.begin(), raw_x_coordinates.end());
     const auto y_min = *std::min_element(raw_y_coordinates.begin(), raw_y_coordinates.end());
     const auto x_max = *std::max_element(raw_x_coordinates.begin(), raw_x_coordinates.end());
@@ -67,19 +430,14 @@ cover_coordinates(const pybind11::array_t<D>& raw_x_coordinates_array,
     const size_t x_layout_grid_size = 2 + size_t((x_max - x_min) / x_step);
     const size_t y_layout_grid_size = 2 + size_t((y_max - y_min) / y_step);
 
-    std::vector<std::vector<ssize_t>> point_index_of_location;
-    for (size_t x_index = 0; x_index < x_layout_grid_size; ++x_index) {
-        point_index_of_location.emplace_back(y_layout_grid_size, -1);
-    }
+    FastAssertCompare(x_layout_grid_size * y_layout_grid_size, >=, points_count);
+
+    CoverGrid grid(x_layout_grid_size, y_layout_grid_size);
 
     std::vector<std::array<size_t, 2>> preferred_location_of_points(points_count);
     std::vector<std::array<size_t, 2>> location_of_points(points_count);
 
-    std::vector<size_t> delta_indices(DELTAS_COUNT);
-    std::iota(delta_indices.begin(), delta_indices.end(), 0);
-
-    for (size_t each_point_index = 0; each_point_index < points_count; ++each_point_index) {
-        ssize_t point_index = ssize_t(each_point_index);
+    parallel_loop(points_count, [&](size_t point_index) {
         size_t y_index = size_t(round((raw_y_coordinates[point_index] - y_min) / y_step));
         size_t x_index;
         if (y_index % 2 == 0) {
@@ -88,61 +446,55 @@ cover_coordinates(const pybind11::array_t<D>& raw_x_coordinates_array,
             x_index = size_t(round((raw_x_coordinates[point_index] - x_min) / x_step + 0.5));
         }
         preferred_location_of_points[point_index] = { x_index, y_index };
+    });
+
+    std::vector<size_t> first_position_of_tiles;
+    std::vector<size_t> point_index_of_positions;
+    std::vector<uint8_t> is_pending_of_points(points_count, 1);
+
+    // Points that can't be placed inside the window of their tile (in dense regions) are placed in the next round,
+    // using larger tiles. Eventually a single tile covers the whole grid, which has room for all the points.
+    for (size_t tile_size = COVER_TILE_SIZE;; tile_size *= 2) {
+        const CoverTiling tiling(grid, tile_size);
+        group_points_by_tiles(tiling,
+                              preferred_location_of_points,
+                              is_pending_of_points,
+                              first_position_of_tiles,
+                              point_index_of_positions);
+        if (point_index_of_positions.empty()) {
+            break;
+        }
 
-        while (point_index >= 0) {
-            ssize_t other_point_index = point_index_of_location[x_index][y_index];
-            if (other_point_index >= 0) {
-                std::shuffle(delta_indices.begin(), delta_indices.end(), random);
-                for (auto delta_index : delta_indices) {
-                    auto delta_x = DELTAS[y_index % 2][delta_index][0];
-                    auto delta_y = DELTAS[y_index % 2][delta_index][1];
-
-                    auto other_x_index = x_index + delta_x;
-                    auto other_y_index = y_index + delta_y;
-                    if (other_x_index < 0 || x_layout_grid_size <= other_x_index || other_y_index < 0
-                        || y_layout_grid_size <= other_y_index) {
-                        continue;
-                    }
-
-                    other_point_index = point_index_of_location[other_x_index][other_y_index];
-                    if (other_point_index < 0) {
-                        x_index = other_x_index;
-                        y_index = other_y_index;
-                        break;
-                    }
-                }
-            }
-
-            if (other_point_index >= 0) {
-                std::shuffle(delta_indices.begin(), delta_indices.end(), random);
-                for (auto delta_index : delta_indices) {
-                    auto delta_x = DELTAS[y_index % 2][delta_index][0];
-                    auto delta_y = DELTAS[y_index % 2][delta_index][1];
-
-                    auto other_x_index = x_index + delta_x;
-                    auto other_y_index = y_index + delta_y;
-                    if (other_x_index < 0 || x_layout_grid_size <= other_x_index || other_y_index < 0
-                        || y_layout_grid_size <= other_y_index) {
-                        continue;
-                    }
-
-                    other_point_index = point_index_of_location[other_x_index][other_y_index];
-                    x_index = other_x_index;
-                    y_index = other_y_index;
-                    break;
+        for (size_t phase_index = 0; phase_index < 4; ++phase_index) {
+            parallel_phase_tiles(tiling, phase_index, first_position_of_tiles, [&](size_t tile_index) {
+                const auto window = tiling.window_of(tile_index);
+                size_t free_count = grid.free_count(window);
+                for (size_t position = first_position_of_tiles[tile_index];
+                     free_count > 0 && position < first_position_of_tiles[tile_index + 1];
+                     ++position, --free_count) {
+                    const size_t point_index = point_index_of_positions[position];
+                    const bool did_place = place_point(point_index,
+                                                       preferred_location_of_points[point_index][0],
+                                                       preferred_location_of_points[point_index][1],
+                                                       grid,
+                                                       window,
+                                                       location_of_points);
+                    FastAssertCompare(did_place, ==, true);
+                    is_pending_of_points[point_index] = 0;
                 }
-            }
+            });
+        }
 
-            point_index_of_location[x_index][y_index] = point_index;
-            location_of_points[point_index] = { x_index, y_index };
-            point_index = other_point_index;
+        if (tiling.tiles_count() == 1) {
+            FastAssertCompare(std::count(is_pending_of_points.begin(), is_pending_of_points.end(), 1), ==, 0);
+            break;
         }
     }
 
     auto verify_indices = [&]() {
         for (size_t x_index = 0; x_index < x_layout_grid_size; ++x_index) {
             for (size_t y_index = 0; y_index < y_layout_grid_size; ++y_index) {
-                const auto point_index = point_index_of_location[x_index][y_index];
+                const auto point_index = grid.point_index(x_index, y_index);
                 if (point_index >= 0) {
                     const auto point_x_index = location_of_points[point_index][0];
                     const auto point_y_index = location_of_points[point_index][1];
@@ -155,84 +507,64 @@ cover_coordinates(const pybind11::array_t<D>& raw_x_coordinates_array,
         for (size_t point_index = 0; point_index < points_count; ++point_index) {
             const auto x_index = location_of_points[point_index][0];
             const auto y_index = location_of_points[point_index][1];
-            const auto location_point_index = point_index_of_location[x_index][y_index];
+            const auto location_point_index = grid.point_index(x_index, y_index);
             FastAssertCompare(location_point_index, ==, point_index);
         }
     };
 
     verify_indices();
 
-    for (size_t point_index = 0; point_index < points_count; ++point_index) {
-        auto x_index = location_of_points[point_index][0];
-        auto y_index = location_of_points[point_index][1];
-
-        auto preferred_x_index = preferred_location_of_points[point_index][0];
-        auto preferred_y_index = preferred_location_of_points[point_index][1];
-
-        bool did_move = true;
-        while (did_move) {
-            did_move = false;
-            auto current_distance = distance(x_index, y_index, preferred_x_index, preferred_y_index);
-
-            std::shuffle(delta_indices.begin(), delta_indices.end(), random);
-            for (auto delta_index : delta_indices) {
-                auto delta_x = DELTAS[y_index % 2][delta_index][0];
-                auto delta_y = DELTAS[y_index % 2][delta_index][1];
-
-                auto near_x_index = x_index + delta_x;
-                auto near_y_index = y_index + delta_y;
-                if (near_x_index < 0 || x_layout_grid_size <= near_x_index || near_y_index < 0
-                    || y_layout_grid_size <= near_y_index) {
-                    continue;
-                }
-
-                auto near_distance = distance(near_x_index, near_y_index, preferred_x_index, preferred_y_index);
-                if (near_distance > current_distance) {
-                    continue;
-                }
-
-                auto other_point_index = point_index_of_location[near_x_index][near_y_index];
-                if (other_point_index < 0) {
-                    continue;
-                }
-
-                auto other_preferred_x_index = preferred_location_of_points[other_point_index][0];
-                auto other_preferred_y_index = preferred_location_of_points[other_point_index][1];
-
-                auto other_current_distance =
-                    distance(x_index, y_index, other_preferred_x_index, other_preferred_y_index);
-                auto other_near_distance =
-                    distance(near_x_index, near_y_index, other_preferred_x_index, other_preferred_y_index);
-                if (other_current_distance > other_near_distance
-                    || (near_distance == current_distance && other_current_distance == other_near_distance)) {
-                    continue;
-                }
-
-                point_index_of_location[x_index][y_index] = other_point_index;
-                location_of_points[other_point_index] = { x_index, y_index };
-
-                point_index_of_location[near_x_index][near_y_index] = point_index;
-                location_of_points[point_index] = { near_x_index, near_y_index };
+    // Each tile uses its own random stream, so the results do not depend on the number of threads.
+    const CoverTiling tiling(grid, COVER_TILE_SIZE);
+    const size_t serial_stream = tiling.tiles_count();
+    const size_t noise_stream = serial_stream + 1;
+
+    // Each phase improves the pending points which are currently in its tiles. Points that were moved to tiles of
+    // earlier phases before their turn came are improved serially at the end (still inside the window of their tile).
+    std::fill(is_pending_of_points.begin(), is_pending_of_points.end(), 1);
+    for (size_t phase_index = 0; phase_index < 4; ++phase_index) {
+        group_points_by_tiles(
+            tiling, location_of_points, is_pending_of_points, first_position_of_tiles, point_index_of_positions);
+
+        parallel_phase_tiles(tiling, phase_index, first_position_of_tiles, [&](size_t tile_index) {
+            const auto window = tiling.window_of(tile_index);
+            PhiloxRandom random(random_seed, tile_index, phase_index << 32);
+            for (size_t position = first_position_of_tiles[tile_index];
+                 position < first_position_of_tiles[tile_index + 1];
+                 ++position) {
+                const size_t point_index = point_index_of_positions[position];
+                improve_point(point_index, grid, window, preferred_location_of_points, location_of_points, random);
+                is_pending_of_points[point_index] = 0;
+            }
+        });
+    }
 
-                x_index = near_x_index;
-                y_index = near_y_index;
-                did_move = true;
+    {
+        PhiloxRandom random(random_seed, serial_stream);
+        for (size_t point_index = 0; point_index < points_count; ++point_index) {
+            if (is_pending_of_points[point_index]) {
+                const auto& location = location_of_points[point_index];
+                const auto window = tiling.window_of(tiling.tile_of(location[0], location[1]));
+                improve_point(point_index, grid, window, preferred_location_of_points, location_of_points, random);
             }
         }
     }
 
     verify_indices();
 
-    for (size_t point_index = 0; point_index < points_count; ++point_index) {
+    parallel_loop(points_count, [&](size_t point_index) {
+        PhiloxRandom random(random_seed, noise_stream + point_index);
         const auto x_index = location_of_points[point_index][0];
         const auto y_index = location_of_points[point_index][1];
-        spaced_y_coordinates[point_index] = D((y_index + noise(random)) * y_step + y_min);
+        const auto y_noise = random.normal(0.0, noise_fraction);
+        const auto x_noise = random.normal(0.0, noise_fraction);
+        spaced_y_coordinates[point_index] = D((y_index + y_noise) * y_step + y_min);
         if (y_index % 2 == 0) {
-            spaced_x_coordinates[point_index] = D((x_index + noise(random)) * x_step + x_min);
+            spaced_x_coordinates[point_index] = D((x_index + x_noise) * x_step + x_min);
         } else {
-            spaced_x_coordinates[point_index] = D((x_index + noise(random) - 0.5) * x_step + x_min);
+            spaced_x_coordinates[point_index] = D((x_index + x_noise - 0.5) * x_step + x_min);
         }
-    }
+    });
 }
 
 void
@@ -78,9 +78,135 @@ random_sample(ArraySlice<size_t> tree, ssize_t random) {
     }
 }
 
+/// The log of the number of ways to choose `chosen` out of `size`.
+static float64_t
+log_choose(const size_t size, const size_t chosen) {
+    return lgamma(float64_t(size) + 1) - lgamma(float64_t(chosen) + 1) - lgamma(float64_t(size - chosen) + 1);
+}
+
+/// Above this expected number of successes, `random_hypergeometric` searches from the mode instead of from zero.
+static const float64_t HYPERGEOMETRIC_SEARCH_FROM_MODE = 16;
+
+/// Above this number of terms, `random_hypergeometric` computes the probability of zero using `lgamma`.
+static const size_t HYPERGEOMETRIC_PRODUCT_TERMS = 32;
+
+/// Sample the number of successes when making `draws` (without replacement) out of `total` items, of which
+/// `successes` are successes.
+///
+/// This uses inversion, which takes `O(1 + sqrt(variance))` steps when started from the mode, and `O(1 + mean)` steps
+/// when started from zero (which we only use when the mean is small).
+static size_t
+random_hypergeometric(const size_t successes, const size_t total, const size_t draws, PhiloxRandom& random) {
+    SlowAssertCompare(successes, <=, total);
+    SlowAssertCompare(draws, <=, total);
+
+    if (successes == 0 || draws == 0) {
+        return 0;
+    }
+    if (successes == total) {
+        return draws;
+    }
+    if (draws == total) {
+        return successes;
+    }
+    if (2 * draws > total) {
+        return successes - random_hypergeometric(successes, total, total - draws, random);
+    }
+    if (2 * successes > total) {
+        return draws - random_hypergeometric(total - successes, total, draws, random);
+    }
+
+    // Now `successes` and `draws` are at most half of `total`, so the minimal result is zero.
+    const size_t failures = total - successes;
+    const size_t max_result = std::min(successes, draws);
+    const auto up_ratio = [&](const size_t result) {  // P(result + 1) / P(result)
+        return (float64_t(successes - result) * float64_t(draws - result))
+               / (float64_t(result + 1) * float64_t(failures - draws + result + 1));
+    };
+    float64_t fraction = random.fraction();
+
+    const float64_t mean = float64_t(successes) * float64_t(draws) / float64_t(total);
+    if (mean < HYPERGEOMETRIC_SEARCH_FROM_MODE) {
+        float64_t probability;
+        if (max_result <= HYPERGEOMETRIC_PRODUCT_TERMS) {
+            probability = 1;
+            for (size_t index = 0; index < max_result; ++index) {
+                probability *= float64_t(total - successes - draws + max_result - index) / float64_t(total - index);
+            }
+        } else {
+            probability = exp(log_choose(failures, draws) - log_choose(total, draws));
+        }
+
+        size_t result = 0;
+        fraction -= probability;
+        while (fraction > 0 && result < max_result) {
+            probability *= up_ratio(result);
+            ++result;
+            fraction -= probability;
+        }
+        return result;
+    }
+
+    const size_t mode = size_t((float64_t(draws) + 1) * (float64_t(successes) + 1) / (float64_t(total) + 2));
+    const float64_t mode_probability =
+        exp(log_choose(successes, mode) + log_choose(failures, draws - mode) - log_choose(total, draws));
+
+    fraction -= mode_probability;
+    size_t low = mode;
+    size_t high = mode;
+    float64_t low_probability = mode_probability;
+    float64_t high_probability = mode_probability;
+    while (fraction > 0 && (low > 0 || high < max_result)) {
+        if (high < max_result) {
+            high_probability *= up_ratio(high);
+            ++high;
+            fraction -= high_probability;
+            if (fraction <= 0) {
+                return high;
+            }
+        }
+        if (low > 0) {
+            --low;
+            low_probability /= up_ratio(low);
+            fraction -= low_probability;
+            if (fraction <= 0) {
+                return low;
+            }
+        }
+    }
+    return mode;
+}
+
+/// Downsample by sampling the count of each element in turn, conditioned on the counts of the previous elements.
+///
+/// The count of each element follows a univariate hypergeometric distribution given the remaining total and the
+/// remaining samples, so this gives the same distribution as sampling the items one by one, in `O(size + samples)`
+/// time.
 template<typename D, typename O>
 static void
-downsample_slice(ConstArraySlice<D> input, ArraySlice<O> output, const int32_t samples, const size_t random_seed) {
+hypergeometric_downsample_slice(ConstArraySlice<D> input,
+                                ArraySlice<O> output,
+                                size_t samples,
+                                size_t remaining_total,
+                                PhiloxRandom& random) {
+    for (size_t index = 0; index < input.size(); ++index) {
+        const size_t value = size_t(input[index]);
+        const size_t sampled = random_hypergeometric(value, remaining_total, samples, random);
+        remaining_total -= value;
+        samples -= sampled;
+        output[index] = O(sampled);
+    }
+    FastAssertCompare(samples, ==, 0);
+}
+
+template<typename D, typename O>
+static void
+downsample_slice(ConstArraySlice<D> input,
+                 ArraySlice<O> output,
+                 const int32_t samples,
+                 const size_t random_seed,
+                 const size_t random_stream,
+                 const bool hypergeometric) {
     FastAssertCompare(output.size(), ==, input.size());
 
     if (samples < 0 || input.size() == 0) {
@@ -88,7 +214,23 @@ downsample_slice(ConstArraySlice<D> input, ArraySlice<O> output, const int32_t s
     }
 
     if (input.size() == 1) {
-        output[0] = O(float64_t(samples) < float64_t(input[0]) ? samples : input[0]);
+        output[0] = float64_t(samples) < float64_t(input[0]) ? O(samples) : O(input[0]);
+        return;
+    }
+
+    if (hypergeometric) {
+        size_t total = 0;
+        for (const auto value : input) {
+            total += size_t(value);
+        }
+        if (total <= size_t(samples)) {
+            if (static_cast<const void*>(output.begin()) != static_cast<const void*>(input.begin())) {
+                std::copy(input.begin(), input.end(), output.begin());
+            }
+        } else {
+            PhiloxRandom random(random_seed, random_stream);
+            hypergeometric_downsample_slice(input, output, size_t(samples), total, random);
+        }
         return;
     }
 
@@ -106,9 +248,9 @@ downsample_slice(ConstArraySlice<D> input, ArraySlice<O> output, const int32_t s
 
     std::fill(output.begin(), output.end(), O(0));
 
-    std::minstd_rand random(random_seed);
+    PhiloxRandom random(random_seed, random_stream);
     for (size_t index = 0; index < size_t(samples); ++index) {
-        ++output[random_sample(tree, random() % total)];
+        ++output[random_sample(tree, ssize_t(random.below(total)))];
     }
 }
 
@@ -118,13 +260,14 @@ static void
 downsample_array(const pybind11::array_t<D>& input_array,
                  pybind11::array_t<O>& output_array,
                  const int32_t samples,
-                 const size_t random_seed) {
+                 const size_t random_seed,
+                 const bool hypergeometric) {
     WithoutGil without_gil{};
 
     ConstArraySlice<D> input{ input_array, "input_array" };
     ArraySlice<O> output{ output_array, "output_array" };
 
-    downsample_slice(input, output, samples, random_seed);
+    downsample_slice(input, output, samples, random_seed, 0, hypergeometric);
 }
 
 /// See the Python `metacell.utilities.computation.downsample_matrix` function.
@@ -133,7 +276,8 @@ static void
 downsample_dense(const pybind11::array_t<D>& input_matrix,
                  pybind11::array_t<O>& output_array,
                  const pybind11::array_t<int32_t>& samples_array,
-                 const size_t random_seed) {
+                 const size_t random_seed,
+                 const bool hypergeometric) {
     WithoutGil without_gil{};
 
     ConstMatrixSlice<D> input{ input_matrix, "input_matrix" };
@@ -145,8 +289,12 @@ downsample_dense(const pybind11::array_t<D>& input_matrix,
     FastAssertCompare(samples.size(), ==, input.rows_count());
 
     parallel_loop(input.rows_count(), [&](const size_t row_index) {
-        size_t slice_seed = random_seed == 0 ? 0 : random_seed + row_index * 997;
-        downsample_slice(input.get_row(row_index), output.get_row(row_index), samples[row_index], slice_seed);
+        downsample_slice(input.get_row(row_index),
+                         output.get_row(row_index),
+                         samples[row_index],
+                         random_seed,
+                         row_index,
+                         hypergeometric);
     });
 }
 
@@ -157,14 +305,15 @@ downsample_band(const size_t band_index,
                 ConstArraySlice<P> input_indptr,
                 ArraySlice<O> output,
                 const int32_t samples,
-                const size_t random_seed) {
+                const size_t random_seed,
+                const bool hypergeometric) {
     auto start_element_offset = input_indptr[band_index];
     auto stop_element_offset = input_indptr[band_index + 1];
 
     auto band_input = input_data.slice(start_element_offset, stop_element_offset);
     auto band_output = output.slice(start_element_offset, stop_element_offset);
 
-    downsample_slice(band_input, band_output, samples, random_seed);
+    downsample_slice(band_input, band_output, samples, random_seed, band_index, hypergeometric);
 }
 
 /// See the Python `metacell.utilities.computation.downsample_matrix` function.
@@ -174,7 +323,8 @@ downsample_compressed(const pybind11::array_t<D>& input_data_array,
                       const pybind11::array_t<P>& input_indptr_array,
                       pybind11::array_t<O>& output_array,
                       const pybind11::array_t<int32_t>& samples_array,
-                      const size_t random_seed) {
+                      const size_t random_seed,
+                      const bool hypergeometric) {
     WithoutGil without_gil{};
 
     ConstArraySlice<D> input_data{ input_data_array, "input_data_array" };
@@ -186,11 +336,58 @@ downsample_compressed(const pybind11::array_t<D>& input_data_array,
     FastAssertCompare(samples.size(), ==, input_indptr.size() - 1);
 
     parallel_loop(input_indptr.size() - 1, [&](size_t band_index) {
-        size_t band_seed = random_seed == 0 ? 0 : random_seed + band_index * 997;
-        downsample_band(band_index, input_data, input_indptr, output, samples[band_index], band_seed);
+        downsample_band(band_index,
+                        input_data,
+                        input_indptr,
+                        output,
+                        samples[band_index],
+                        random_seed,
+                        hypergeometric);
     });
 }
 
+/// See the Python `metacell.utilities.computation.stream_downsample_mapped` function.
+template<typename D, typename P, typename O>
+static void
+stream_downsample_compressed(const MappedCompressed& input,
+                             const std::string& output_path,
+                             const pybind11::array_t<int32_t>& samples_array,
+                             const size_t random_seed,
+                             const bool hypergeometric,
+                             const size_t memory_budget) {
+    WithoutGil without_gil{};
+
+    const auto input_data = input.slice<D>(MappedCompressed::DATA);
+    const auto input_indptr = input.slice<P>(MappedCompressed::INDPTR);
+    ConstArraySlice<int32_t> samples{ samples_array, "samples_array" };
+
+    FastAssertCompare(samples.size(), ==, input.bands_count());
+
+    stream_mapped_bands(input,
+                        output_path,
+                        dtype_name<O>(),
+                        sizeof(O),
+                        memory_budget,
+                        [&](size_t start_band_index, size_t stop_band_index, char* output_bytes) {
+                            const size_t start_position = input_indptr[start_band_index];
+                            ArraySlice<O> output(reinterpret_cast<O*>(output_bytes),
+                                                 input_indptr[stop_band_index] - start_position,
+                                                 "output");
+                            parallel_loop(stop_band_index - start_band_index, [&](size_t chunk_band_index) {
+                                const size_t band_index = start_band_index + chunk_band_index;
+                                const size_t start_band_position = input_indptr[band_index];
+                                const size_t stop_band_position = input_indptr[band_index + 1];
+                                downsample_slice(input_data.slice(start_band_position, stop_band_position),
+                                                 output.slice(start_band_position - start_position,
+                                                              stop_band_position - start_position),
+                                                 samples[band_index],
+                                                 random_seed,
+                                                 band_index,
+                                                 hypergeometric);
+                            });
+                        });
+}
+
 void
 register_downsample(pybind11::module& module) {
 #define REGISTER_D_O(D, O)                                                                        \
@@ -206,6 +403,7 @@ register_downsample(pybind11::module& module) {
     REGISTER_D_O(uint16_t, O)  \
     REGISTER_D_O(uint32_t, O)  \
     REGISTER_D_O(uint64_t, O)  \
+    REGISTER_D_O(float16_t, O) \
     REGISTER_D_O(float32_t, O) \
     REGISTER_D_O(float64_t, O)
 
@@ -217,13 +415,17 @@ register_downsample(pybind11::module& module) {
     REGISTER_DS_O(uint16_t)
     REGISTER_DS_O(uint32_t)
     REGISTER_DS_O(uint64_t)
+    REGISTER_DS_O(float16_t)
     REGISTER_DS_O(float32_t)
     REGISTER_DS_O(float64_t)
 
-#define REGISTER_D_P_O(D, P, O)                           \
-    module.def("downsample_compressed_" #D "_" #P "_" #O, \
-               &downsample_compressed<D, P, O>,           \
-               "Downsample compressed matrix data.");
+#define REGISTER_D_P_O(D, P, O)                                  \
+    module.def("downsample_compressed_" #D "_" #P "_" #O,        \
+               &downsample_compressed<D, P, O>,                  \
+               "Downsample compressed matrix data.");            \
+    module.def("stream_downsample_compressed_" #D "_" #P "_" #O, \
+               &stream_downsample_compressed<D, P, O>,           \
+               "Downsample mapped compressed matrix data.");
 
 #define REGISTER_DS_P_O(P, O)       \
     REGISTER_D_P_O(int8_t, P, O)    \
@@ -234,6 +436,7 @@ register_downsample(pybind11::module& module) {
     REGISTER_D_P_O(uint16_t, P, O)  \
     REGISTER_D_P_O(uint32_t, P, O)  \
     REGISTER_D_P_O(uint64_t, P, O)  \
+    REGISTER_D_P_O(float16_t, P, O) \
     REGISTER_D_P_O(float32_t, P, O) \
     REGISTER_D_P_O(float64_t, P, O)
 
@@ -251,6 +454,7 @@ register_downsample(pybind11::module& module) {
     REGISTER_DS_PS_O(uint16_t)
     REGISTER_DS_PS_O(uint32_t)
     REGISTER_DS_PS_O(uint64_t)
+    REGISTER_DS_PS_O(float16_t)
     REGISTER_DS_PS_O(float32_t)
     REGISTER_DS_PS_O(float64_t)
 }
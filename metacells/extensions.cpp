@@ -1,5 +1,19 @@
 #include "metacells/extensions.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <pthread.h>
+
+#ifdef HAS_SIMD_DISPATCH
+#    include <immintrin.h>
+#endif
+
+#ifdef __linux__
+#    include <sched.h>
+#endif
+
 namespace metacells {
 
 std::mutex writer_mutex;
@@ -10,61 +24,969 @@ thread_local AtomicWriter writer;
 std::mutex io_mutex;
 #endif
 
-static size_t threads_count = 1;
+#if NATIVE_COUNTERS
+std::atomic<uint64_t> g_native_counters[COUNTERS_COUNT];
+
+thread_local uint64_t g_tmp_bytes_of_thread = 0;
 
+thread_local uint64_t g_tmp_vectors_of_thread = 0;
+
+/// The names of the global native counters (in the order of `NativeCounter`).
+static const char* const NATIVE_COUNTER_NAMES[COUNTERS_COUNT] = {
+    "loops", "array_bytes", "tmp_vectors", "tmp_allocations", "tmp_high_water_bytes",
+};
+
+/// The maximal number of threads whose counters are collected separately (the rest share the last slot).
+static const size_t MAX_COUNTED_THREADS = 256;
+
+/// The native counters of a single thread of the pool (all the external threads invoking loops share slot zero).
+struct alignas(64) ThreadCounters {
+    /// The time spent executing the body of loops (excluding nested loops).
+    std::atomic<uint64_t> busy_ns;
+    /// The number of executed loop indices.
+    std::atomic<uint64_t> iterations;
+    /// The number of executed loop ranges.
+    std::atomic<uint64_t> ranges;
+    /// The number of ranges stolen from other threads.
+    std::atomic<uint64_t> steals;
+    /// The number of ranges stolen from threads pinned to another socket.
+    std::atomic<uint64_t> remote_steals;
+    /// The number of temporary vectors used (added from `g_tmp_vectors_of_thread` after each loop range).
+    std::atomic<uint64_t> tmp_vectors;
+};
+
+static ThreadCounters g_thread_counters[MAX_COUNTED_THREADS];
+
+/// How many loop ranges the current thread is nested in (only the outermost is timed).
+static thread_local size_t g_ranges_depth_of_thread = 0;
+
+static ThreadCounters&
+counters_of_queue(const size_t queue_index) {
+    return g_thread_counters[std::min(queue_index, MAX_COUNTED_THREADS - 1)];
+}
+#endif
+
+/// Execute the body of a loop for a range of indices, counting them for the thread (if counters are collected).
 static void
-set_threads_count(size_t count) {
-    threads_count = count;
+run_indices(const std::function<void(size_t)>& body, const size_t start, const size_t stop, const size_t queue_index) {
+#if NATIVE_COUNTERS
+    const bool is_outermost = g_ranges_depth_of_thread++ == 0;
+    const auto start_time = std::chrono::steady_clock::now();
+#else
+    (void)queue_index;
+#endif
+
+    for (size_t index = start; index < stop; ++index) {
+        body(index);
+    }
+
+#if NATIVE_COUNTERS
+    --g_ranges_depth_of_thread;
+    auto& counters = counters_of_queue(queue_index);
+    counters.iterations.fetch_add(stop - start, std::memory_order_relaxed);
+    counters.ranges.fetch_add(1, std::memory_order_relaxed);
+    if (g_tmp_vectors_of_thread > 0) {
+        counters.tmp_vectors.fetch_add(g_tmp_vectors_of_thread, std::memory_order_relaxed);
+        g_tmp_vectors_of_thread = 0;
+    }
+    if (is_outermost) {
+        const auto busy_time = std::chrono::steady_clock::now() - start_time;
+        counters.busy_ns.fetch_add(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(busy_time).count()),
+                                   std::memory_order_relaxed);
+    }
+#endif
 }
 
-static std::atomic<size_t> next_loop_index;
-static size_t loop_size;
+/// The state of a single invocation of a parallel loop.
+///
+/// This lives on the stack of the invoking thread, which waits until all the indices were executed.
+struct Loop {
+    const std::function<void(size_t)>& body;
+    const size_t grain;
+    std::atomic<size_t> pending;
+    std::mutex done_mutex;
+    std::condition_variable done_condition;
+    bool is_done = false;
+
+    Loop(const std::function<void(size_t)>& body_, const size_t size, const size_t grain_)
+      : body(body_), grain(grain_), pending(size) {}
 
-const void
-worker(std::function<void(size_t)> parallel_body) {
-    for (size_t index = next_loop_index++; index < loop_size; index = next_loop_index++) {
-        parallel_body(index);
+    void executed(const size_t count) {
+        if (pending.fetch_sub(count) == count) {
+            std::lock_guard<std::mutex> lock(done_mutex);
+            is_done = true;
+            done_condition.notify_all();
+        }
     }
+};
+
+/// A range of indices of a parallel loop which was not executed yet.
+struct LoopRange {
+    Loop* loop;
+    size_t start;
+    size_t stop;
+};
+
+/// The queue of pending ranges owned by a single thread of the pool.
+///
+/// The owner pushes and pops ranges at the back (the smallest, most recently split ones), while idle threads steal
+/// from the front (the oldest, largest ones), so stealing is rare and each steal moves a lot of work. A thread waiting
+/// for a loop to complete only takes ranges of this loop (if `loop` is not `nullptr`).
+class WorkQueue {
+private:
+    std::mutex m_mutex;
+    std::deque<LoopRange> m_ranges;
+
+public:
+    void push(const LoopRange range) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_ranges.push_back(range);
+    }
+
+    bool pop(LoopRange& range, const Loop* const loop) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto position = m_ranges.rbegin(); position != m_ranges.rend(); ++position) {
+            if (loop == nullptr || position->loop == loop) {
+                range = *position;
+                m_ranges.erase(std::next(position).base());
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool steal(LoopRange& range, const Loop* const loop) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto position = m_ranges.begin(); position != m_ranges.end(); ++position) {
+            if (loop == nullptr || position->loop == loop) {
+                range = *position;
+                m_ranges.erase(position);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+/// How many times an idle thread scans the queues before going to sleep.
+static const size_t IDLE_SCANS_COUNT = 64;
+
+/// How long a thread waiting for a loop to complete sleeps before looking for more work in it.
+static const std::chrono::microseconds WAIT_INTERVAL(100);
+
+/// How many ranges (on average) each thread should execute if the grain size is not specified.
+static const size_t AUTO_GRAIN_RANGES_PER_THREAD = 16;
+
+/// How to pin the threads of the pool to processors (see `set_threads_count`).
+enum AffinityPolicy {
+    /// Let the operating system place (and move) the threads.
+    AFFINITY_NONE,
+    /// Pin each thread to a single processor, filling up each socket before moving to the next one.
+    AFFINITY_COMPACT,
+    /// Pin each thread to a single processor, placing consecutive threads on different sockets.
+    AFFINITY_SCATTER,
+    /// Pin each thread to all the processors of a socket, filling up each socket before moving to the next one.
+    AFFINITY_SOCKET,
+};
+
+static AffinityPolicy
+affinity_policy_of(const std::string& name) {
+    if (name == "none") {
+        return AFFINITY_NONE;
+    }
+    if (name == "compact") {
+        return AFFINITY_COMPACT;
+    }
+    if (name == "scatter") {
+        return AFFINITY_SCATTER;
+    }
+    if (name == "socket") {
+        return AFFINITY_SOCKET;
+    }
+    throw std::invalid_argument("unknown affinity policy: " + name);
 }
 
-void
-parallel_loop(const size_t size, std::function<void(size_t)> parallel_body, std::function<void(size_t)> serial_body) {
-    size_t used_threads_count = std::min(threads_count, size);
+/// Parse a list of processors or NUMA nodes in the Linux format (e.g. `0-3,8-11`).
+static std::vector<int>
+parse_ids_list(const std::string& text) {
+    std::vector<int> ids;
+    std::istringstream stream(text);
+    std::string part;
+    while (std::getline(stream, part, ',')) {
+        if (part.empty() || part[0] < '0' || part[0] > '9') {
+            continue;
+        }
+        const size_t dash_position = part.find('-');
+        const int first_id = std::stoi(part.substr(0, dash_position));
+        const int last_id = dash_position == std::string::npos ? first_id : std::stoi(part.substr(dash_position + 1));
+        for (int id = first_id; id <= last_id; ++id) {
+            ids.push_back(id);
+        }
+    }
+    return ids;
+}
+
+static std::string
+read_first_line(const std::string& path) {
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+/// The processors this process may use, grouped by their NUMA node (socket).
+///
+/// This is empty if the topology is not known (on other operating systems than Linux).
+static const std::vector<std::vector<int>>&
+numa_nodes() {
+    static const std::vector<std::vector<int>> nodes = [] {
+        std::vector<std::vector<int>> nodes;
+#ifdef __linux__
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            return nodes;
+        }
+        const auto is_allowed = [&](const int cpu) {
+            return 0 <= cpu && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed);
+        };
 
-    if (used_threads_count < 2) {
-        for (size_t index = 0; index < size; ++index) {
-            serial_body(index);
+        for (const int node_id : parse_ids_list(read_first_line("/sys/devices/system/node/online"))) {
+            const std::string path = "/sys/devices/system/node/node" + std::to_string(node_id) + "/cpulist";
+            std::vector<int> cpus;
+            for (const int cpu : parse_ids_list(read_first_line(path))) {
+                if (is_allowed(cpu)) {
+                    cpus.push_back(cpu);
+                }
+            }
+            if (!cpus.empty()) {
+                nodes.push_back(cpus);
+            }
         }
+
+        if (nodes.empty()) {
+            nodes.emplace_back();
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (is_allowed(cpu)) {
+                    nodes.back().push_back(cpu);
+                }
+            }
+        }
+#endif
+        return nodes;
+    }();
+    return nodes;
+}
+
+/// Where a thread of the pool runs.
+struct ThreadPlacement {
+    /// The index of the NUMA node (in `numa_nodes`), or -1 if the thread is not pinned.
+    int node = -1;
+    /// The processors the thread is pinned to (empty if it is not pinned).
+    std::vector<int> cpus;
+};
+
+/// Compute the placement of each of the threads of a pool.
+///
+/// The threads are placed on the processors starting at `first_processor` (in the order given by the policy), so that
+/// the pools of multiple processes sharing a machine (see `metacells.utilities.parallel.parallel_map`) do not overlap.
+static std::vector<ThreadPlacement>
+threads_placements(const size_t threads_count, const AffinityPolicy policy, const size_t first_processor) {
+    std::vector<ThreadPlacement> placements(threads_count);
+    const auto& nodes = numa_nodes();
+    if (policy == AFFINITY_NONE || nodes.empty()) {
+        return placements;
+    }
+
+    std::vector<std::pair<int, int>> compact_cpus;
+    for (size_t node_index = 0; node_index < nodes.size(); ++node_index) {
+        for (const int cpu : nodes[node_index]) {
+            compact_cpus.emplace_back(int(node_index), cpu);
+        }
+    }
+
+    for (size_t thread_index = 0; thread_index < threads_count; ++thread_index) {
+        const size_t processor_index = first_processor + thread_index;
+        auto& placement = placements[thread_index];
+        if (policy == AFFINITY_SCATTER) {
+            const size_t node_index = processor_index % nodes.size();
+            const auto& node_cpus = nodes[node_index];
+            placement.node = int(node_index);
+            placement.cpus.push_back(node_cpus[(processor_index / nodes.size()) % node_cpus.size()]);
+        } else {
+            const auto& compact_cpu = compact_cpus[processor_index % compact_cpus.size()];
+            placement.node = compact_cpu.first;
+            if (policy == AFFINITY_SOCKET) {
+                placement.cpus = nodes[size_t(compact_cpu.first)];
+            } else {
+                placement.cpus.push_back(compact_cpu.second);
+            }
+        }
+    }
+
+    return placements;
+}
+
+/// Pin the current thread to some processors (if any). This is a best effort which silently ignores failures.
+static void
+pin_current_thread(const std::vector<int>& cpus) {
+#ifdef __linux__
+    if (cpus.empty()) {
         return;
     }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpus;
+#endif
+}
+
+class ThreadsPool;
+
+/// The pool (if any) the current thread is executing loops in.
+static thread_local ThreadsPool* g_pool_of_thread = nullptr;
+
+/// The index of the queue of the current thread in its pool.
+static thread_local size_t g_queue_of_thread = 0;
+
+/// A persistent pool of threads for executing parallel loops.
+///
+/// Each worker thread owns a queue of ranges, and queue zero is shared by all the external threads invoking loops. A
+/// thread repeatedly takes a range from its own queue, splits off its upper half back into its queue until it is no
+/// larger than the loop's grain size, and executes it. When its own queue is empty, it steals a range from some other
+/// thread's queue.
+///
+/// Any number of loops may be active at the same time, either because they were invoked from different external
+/// threads, or because the body of one loop invoked a nested loop. The thread invoking a loop helps executing its
+/// ranges (and only its ranges) until it completes, so nested loops do not deadlock.
+///
+/// The worker threads may be pinned to processors (the external threads are never pinned). Each loop is initially
+/// split into one contiguous range per thread, so with a compact placement, consecutive threads (and therefore
+/// consecutive parts of the data they first touch and later process) are on the same socket. Idle threads prefer
+/// stealing ranges from threads on their own socket, so most of the work stays local to the socket.
+class ThreadsPool {
+private:
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    std::vector<std::thread> m_threads;
+    const AffinityPolicy m_policy;
+    const size_t m_first_processor;
+    const std::vector<ThreadPlacement> m_placements;
+    /// For each queue, the other queues to steal from, those of threads on the same socket first.
+    std::vector<std::vector<size_t>> m_steal_orders;
+
+    std::mutex m_wake_mutex;
+    std::condition_variable m_wake_condition;
+    size_t m_wake_epoch = 0;
+    bool m_is_stopping = false;
+    std::atomic<size_t> m_sleeping_count;
+
+public:
+    ThreadsPool(const size_t threads_count, const AffinityPolicy policy, const size_t first_processor)
+      : m_policy(policy)
+      , m_first_processor(first_processor)
+      , m_placements(threads_placements(threads_count, policy, first_processor))
+      , m_sleeping_count(0) {
+        m_queues.reserve(threads_count);
+        m_steal_orders.resize(threads_count);
+        for (size_t queue_index = 0; queue_index < threads_count; ++queue_index) {
+            m_queues.emplace_back(new WorkQueue());
+            for (const bool is_local : { true, false }) {
+                for (size_t offset = 1; offset < threads_count; ++offset) {
+                    const size_t other_index = (queue_index + offset) % threads_count;
+                    if (is_local == (m_placements[other_index].node == m_placements[queue_index].node)) {
+                        m_steal_orders[queue_index].push_back(other_index);
+                    }
+                }
+            }
+        }
+        m_threads.reserve(threads_count - 1);
+        for (size_t queue_index = 1; queue_index < threads_count; ++queue_index) {
+            m_threads.emplace_back(&ThreadsPool::work, this, queue_index);
+        }
+    }
+
+    ~ThreadsPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            m_is_stopping = true;
+        }
+        m_wake_condition.notify_all();
+        for (auto& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    size_t threads_count() const { return m_queues.size(); }
+
+    bool is_placed(const size_t threads_count, const AffinityPolicy policy, const size_t first_processor) const {
+        return m_queues.size() == threads_count && m_policy == policy && m_first_processor == first_processor;
+    }
+
+    /// The NUMA node of the thread of each queue, or -1 if it is not pinned.
+    std::vector<int> threads_nodes() const {
+        std::vector<int> nodes;
+        for (size_t queue_index = 0; queue_index < m_placements.size(); ++queue_index) {
+            nodes.push_back(queue_index == 0 ? -1 : m_placements[queue_index].node);
+        }
+        return nodes;
+    }
+
+    void loop(const size_t size, const size_t grain, const std::function<void(size_t)>& parallel_body) {
+        Loop loop(parallel_body, size, grain);
+
+        const bool is_nested = g_pool_of_thread == this;
+        if (is_nested) {
+            m_queues[g_queue_of_thread]->push(LoopRange{ &loop, 0, size });
+            wake(false);
+        } else {
+            g_pool_of_thread = this;
+            g_queue_of_thread = 0;
+            const size_t threads_count = m_queues.size();
+            const size_t ranges_count = std::min(threads_count, (size + grain - 1) / grain);
+            for (size_t range_index = 0; range_index < ranges_count; ++range_index) {
+                const size_t start = (size * range_index) / ranges_count;
+                const size_t stop = (size * (range_index + 1)) / ranges_count;
+                m_queues[range_index]->push(LoopRange{ &loop, start, stop });
+            }
+            wake(true);
+        }
+
+        const size_t queue_index = g_queue_of_thread;
+        LoopRange range;
+        while (loop.pending > 0) {
+            if (find_range(queue_index, range, &loop)) {
+                run_range(queue_index, range);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(loop.done_mutex);
+            loop.done_condition.wait_for(lock, WAIT_INTERVAL, [&] { return loop.is_done; });
+        }
+
+        {
+            // Wait until the thread which executed the last range no longer references the loop.
+            std::unique_lock<std::mutex> lock(loop.done_mutex);
+            loop.done_condition.wait(lock, [&] { return loop.is_done; });
+        }
+
+        if (!is_nested) {
+            g_pool_of_thread = nullptr;
+        }
+    }
+
+private:
+    void wake(const bool all) {
+        if (m_sleeping_count == 0) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            ++m_wake_epoch;
+        }
+        if (all) {
+            m_wake_condition.notify_all();
+        } else {
+            m_wake_condition.notify_one();
+        }
+    }
+
+    void work(const size_t queue_index) {
+        pin_current_thread(m_placements[queue_index].cpus);
+        g_pool_of_thread = this;
+        g_queue_of_thread = queue_index;
+        LoopRange range;
+        while (true) {
+            for (size_t scan_index = 0; scan_index < IDLE_SCANS_COUNT; ++scan_index) {
+                if (find_range(queue_index, range, nullptr)) {
+                    run_range(queue_index, range);
+                    scan_index = 0;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+
+            // Announce we are about to sleep before the final scan, so no pushed range is missed.
+            ++m_sleeping_count;
+            size_t seen_epoch;
+            {
+                std::lock_guard<std::mutex> lock(m_wake_mutex);
+                seen_epoch = m_wake_epoch;
+            }
+            if (find_range(queue_index, range, nullptr)) {
+                --m_sleeping_count;
+                run_range(queue_index, range);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_wake_mutex);
+            m_wake_condition.wait(lock, [&] { return m_is_stopping || m_wake_epoch != seen_epoch; });
+            --m_sleeping_count;
+            if (m_is_stopping) {
+                return;
+            }
+        }
+    }
+
+    bool find_range(const size_t queue_index, LoopRange& range, const Loop* const loop) {
+        if (m_queues[queue_index]->pop(range, loop)) {
+            return true;
+        }
+        for (const size_t other_index : m_steal_orders[queue_index]) {
+            if (m_queues[other_index]->steal(range, loop)) {
+#if NATIVE_COUNTERS
+                auto& counters = counters_of_queue(queue_index);
+                counters.steals.fetch_add(1, std::memory_order_relaxed);
+                if (m_placements[other_index].node != m_placements[queue_index].node) {
+                    counters.remote_steals.fetch_add(1, std::memory_order_relaxed);
+                }
+#endif
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run_range(const size_t queue_index, LoopRange range) {
+        Loop& loop = *range.loop;
+        WorkQueue& queue = *m_queues[queue_index];
+        while (range.stop - range.start > loop.grain) {
+            const size_t middle = range.start + (range.stop - range.start) / 2;
+            queue.push(LoopRange{ &loop, middle, range.stop });
+            wake(false);
+            range.stop = middle;
+        }
+
+        run_indices(loop.body, range.start, range.stop, queue_index);
+
+        loop.executed(range.stop - range.start);
+    }
+};
+
+static SimdLevel
+detected_simd_level() {
+#ifdef HAS_SIMD_DISPATCH
+    static const SimdLevel level = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            return SIMD_AVX512;
+        }
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            return SIMD_AVX2;
+        }
+        return SIMD_GENERIC;
+    }();
+    return level;
+#else
+    return SIMD_GENERIC;
+#endif
+}
+
+/// The maximal SIMD level to use (see `set_simd_level`).
+static std::atomic<int> g_max_simd_level(SIMD_AVX512);
+
+SimdLevel
+simd_level() {
+    return SimdLevel(std::min(int(detected_simd_level()), g_max_simd_level.load(std::memory_order_relaxed)));
+}
+
+/// Limit the SIMD instructions used by the kernels which dispatch on each call (the selection of `float32_t` values),
+/// which allows testing the generic versions on any machine. The kernels which are selected when the module is loaded
+/// are not affected.
+static void
+set_simd_level(const std::string& name) {
+    if (name == "avx512") {
+        g_max_simd_level = SIMD_AVX512;
+    } else if (name == "avx2") {
+        g_max_simd_level = SIMD_AVX2;
+    } else if (name == "generic") {
+        g_max_simd_level = SIMD_GENERIC;
+    } else {
+        throw std::invalid_argument("invalid SIMD level: " + name);
+    }
+}
+
+static std::string
+simd_level_name() {
+    switch (simd_level()) {
+    case SIMD_AVX512:
+        return "avx512";
+    case SIMD_AVX2:
+        return "avx2";
+    case SIMD_GENERIC:
+        break;
+    }
+    return "generic";
+}
+
+/// Copy the values which are less than the `pivot` to `below` and the rest (including NaNs) to `above`, preserving their
+/// order, and return the number of values copied to `below`. Both outputs need room for `PARTITION_PADDING` values more
+/// than `size`, as the vectorized versions store whole vectors.
+typedef size_t (*PartitionBelowFunction)(const float32_t* values,
+                                         size_t size,
+                                         float32_t pivot,
+                                         float32_t* below,
+                                         float32_t* above);
+
+static const size_t PARTITION_PADDING = 16;
+
+static size_t
+generic_partition_below(const float32_t* const values,
+                        const size_t size,
+                        const float32_t pivot,
+                        float32_t* const below,
+                        float32_t* const above) {
+    size_t below_count = 0;
+    size_t above_count = 0;
+    for (size_t index = 0; index < size; ++index) {
+        const float32_t value = values[index];
+        const size_t is_below = value < pivot;
+        below[below_count] = value;
+        above[above_count] = value;
+        below_count += is_below;
+        above_count += 1 - is_below;
+    }
+    return below_count;
+}
+
+#ifdef HAS_SIMD_DISPATCH
+
+/// For each 8-bit mask, the permutation of an AVX2 vector which moves the lanes of the set bits to its beginning.
+struct CompressPermutations {
+    alignas(32) int32_t lanes[256][8];
+
+    CompressPermutations() {
+        for (size_t mask = 0; mask < 256; ++mask) {
+            size_t position = 0;
+            for (int32_t lane = 0; lane < 8; ++lane) {
+                if (mask & (size_t(1) << lane)) {
+                    lanes[mask][position++] = lane;
+                }
+            }
+            while (position < 8) {
+                lanes[mask][position++] = 0;
+            }
+        }
+    }
+};
+
+static const CompressPermutations g_compress_permutations;
+
+__attribute__((target("avx2"))) static size_t
+avx2_partition_below(const float32_t* const values,
+                     const size_t size,
+                     const float32_t pivot,
+                     float32_t* const below,
+                     float32_t* const above) {
+    const __m256 pivots = _mm256_set1_ps(pivot);
+    size_t below_count = 0;
+    size_t above_count = 0;
+    size_t index = 0;
+    for (; index + 8 <= size; index += 8) {
+        const __m256 block = _mm256_loadu_ps(values + index);
+        const int below_mask = _mm256_movemask_ps(_mm256_cmp_ps(block, pivots, _CMP_LT_OQ));
+        const int above_mask = ~below_mask & 0xFF;
+        const __m256i below_lanes =
+            _mm256_load_si256(reinterpret_cast<const __m256i*>(g_compress_permutations.lanes[below_mask]));
+        const __m256i above_lanes =
+            _mm256_load_si256(reinterpret_cast<const __m256i*>(g_compress_permutations.lanes[above_mask]));
+        _mm256_storeu_ps(below + below_count, _mm256_permutevar8x32_ps(block, below_lanes));
+        _mm256_storeu_ps(above + above_count, _mm256_permutevar8x32_ps(block, above_lanes));
+        const size_t block_below_count = size_t(__builtin_popcount(below_mask));
+        below_count += block_below_count;
+        above_count += 8 - block_below_count;
+    }
+    return below_count
+           + generic_partition_below(values + index, size - index, pivot, below + below_count, above + above_count);
+}
+
+__attribute__((target("avx512f"))) static size_t
+avx512_partition_below(const float32_t* const values,
+                       const size_t size,
+                       const float32_t pivot,
+                       float32_t* const below,
+                       float32_t* const above) {
+    const __m512 pivots = _mm512_set1_ps(pivot);
+    size_t below_count = 0;
+    size_t above_count = 0;
+    size_t index = 0;
+    for (; index + 16 <= size; index += 16) {
+        const __m512 block = _mm512_loadu_ps(values + index);
+        const __mmask16 below_mask = _mm512_cmp_ps_mask(block, pivots, _CMP_LT_OQ);
+        const __mmask16 above_mask = __mmask16(~below_mask);
+        // Compressing into a register and storing the whole vector is faster than a compressing store on some
+        // processors.
+        _mm512_storeu_ps(below + below_count, _mm512_maskz_compress_ps(below_mask, block));
+        _mm512_storeu_ps(above + above_count, _mm512_maskz_compress_ps(above_mask, block));
+        const size_t block_below_count = size_t(__builtin_popcount(below_mask));
+        below_count += block_below_count;
+        above_count += 16 - block_below_count;
+    }
+    return below_count
+           + generic_partition_below(values + index, size - index, pivot, below + below_count, above + above_count);
+}
+
+#endif
+
+static PartitionBelowFunction
+partition_below_function() {
+#ifdef HAS_SIMD_DISPATCH
+    switch (simd_level()) {
+    case SIMD_AVX512:
+        return avx512_partition_below;
+    case SIMD_AVX2:
+        return avx2_partition_below;
+    case SIMD_GENERIC:
+        break;
+    }
+#endif
+    return generic_partition_below;
+}
+
+/// Below this size, the branchy but in-place `std::nth_element` is faster than partitioning through the temporary
+/// vectors.
+static const size_t MIN_PARTITION_SELECT_SIZE = 256;
+
+/// Bound the number of partitions of adversarial values, where the median of three pivot does not shrink the range.
+static const size_t MAX_PARTITION_SELECT_LEVELS = 64;
+
+float32_t
+select_float32_value(ArraySlice<float32_t> values, const size_t rank) {
+    const PartitionBelowFunction partition_below = partition_below_function();
+
+    const size_t size = values.size();
+    FastAssertCompare(rank, <, size);
+    float32_t* const data = values.begin();
+    size_t start = 0;
+    size_t stop = size;
+
+    if (size >= MIN_PARTITION_SELECT_SIZE) {
+        TmpVector<float32_t> raii_below;
+        TmpVector<float32_t> raii_above;
+        float32_t* const below = raii_below.vector(size + PARTITION_PADDING).data();
+        float32_t* const above = raii_above.vector(size + PARTITION_PADDING).data();
+
+        for (size_t level = 0; level < MAX_PARTITION_SELECT_LEVELS && stop - start >= MIN_PARTITION_SELECT_SIZE;
+             ++level) {
+            const size_t count = stop - start;
+            const float32_t first = data[start];
+            const float32_t middle = data[start + count / 2];
+            const float32_t last = data[stop - 1];
+            const float32_t pivot = std::max(std::min(first, middle), std::min(std::max(first, middle), last));
+            if (std::isnan(pivot)) {
+                break;
+            }
+
+            size_t below_count = partition_below(data + start, count, pivot, below, above);
+            if (below_count == 0) {
+                // The pivot is the smallest value, so split the values equal to it from the rest.
+                below_count = partition_below(data + start,
+                                              count,
+                                              std::nextafter(pivot, std::numeric_limits<float32_t>::infinity()),
+                                              below,
+                                              above);
+                if (below_count == 0) {
+                    break;
+                }
+                std::copy(below, below + below_count, data + start);
+                std::copy(above, above + count - below_count, data + start + below_count);
+                if (rank < start + below_count) {
+                    return pivot;
+                }
+                start += below_count;
+                continue;
+            }
+
+            std::copy(below, below + below_count, data + start);
+            std::copy(above, above + count - below_count, data + start + below_count);
+            if (rank < start + below_count) {
+                stop = start + below_count;
+            } else {
+                start += below_count;
+            }
+        }
+    }
 
-    next_loop_index = 0;
-    loop_size = size;
+    std::nth_element(data + start, data + rank, data + stop);
+    return data[rank];
+}
+
+static size_t threads_count = 1;
 
-    std::vector<std::thread> used_threads;
-    used_threads.reserve(used_threads_count);
+static AffinityPolicy g_affinity_policy = AFFINITY_NONE;
 
-    while (next_loop_index < loop_size && used_threads.size() < used_threads_count) {
-        used_threads.emplace_back(worker, parallel_body);
+static size_t g_first_processor = 0;
+
+/// The pool used for running parallel loops, created on demand.
+static std::shared_ptr<ThreadsPool> g_threads_pool;
+
+static std::mutex g_threads_pool_mutex;
+
+static void
+forget_threads_pool() {
+    // The child process of a fork does not have any of the pool threads, so we must not join them. Leak the pool
+    // instead, and create a fresh one when one is needed.
+    new std::shared_ptr<ThreadsPool>(std::move(g_threads_pool));
+}
+
+static std::shared_ptr<ThreadsPool>
+get_threads_pool() {
+    std::lock_guard<std::mutex> lock(g_threads_pool_mutex);
+    if (!g_threads_pool || !g_threads_pool->is_placed(threads_count, g_affinity_policy, g_first_processor)) {
+        static bool did_register_fork_handler = false;
+        if (!did_register_fork_handler) {
+            pthread_atfork(nullptr, nullptr, forget_threads_pool);
+            did_register_fork_handler = true;
+        }
+        g_threads_pool.reset();
+        g_threads_pool = std::make_shared<ThreadsPool>(threads_count, g_affinity_policy, g_first_processor);
     }
+    return g_threads_pool;
+}
 
-    for (auto& thread : used_threads) {
-        thread.join();
+/// See the Python `metacells.utilities.parallel.set_processors_count` function.
+static void
+set_threads_count(size_t count, const std::string& affinity, const size_t first_processor) {
+    g_affinity_policy = affinity_policy_of(affinity);
+    g_first_processor = first_processor;
+    threads_count = std::max(count, size_t(1));
+    if (threads_count > 1) {
+        WithoutGil without_gil{};
+        get_threads_pool();
     }
 }
 
-thread_local bool g_size_t_used[size_t_count];
-thread_local std::vector<size_t> g_size_t_vectors[size_t_count];
+void
+parallel_loop(const size_t size,
+              size_t grain,
+              std::function<void(size_t)> parallel_body,
+              std::function<void(size_t)> serial_body) {
+    ThreadsPool* const pool_of_thread = g_pool_of_thread;
+    const size_t used_threads_count = pool_of_thread ? pool_of_thread->threads_count() : threads_count;
+    count_native(COUNTER_LOOPS);
+
+    if (grain == 0) {
+        grain = std::max(size / (used_threads_count * AUTO_GRAIN_RANGES_PER_THREAD), size_t(1));
+    }
 
-thread_local bool g_float64_t_used[float64_t_count];
-thread_local std::vector<float64_t> g_float64_t_vectors[float64_t_count];
+    if (used_threads_count < 2 || size <= grain) {
+        run_indices(serial_body, 0, size, pool_of_thread ? g_queue_of_thread : 0);
+        return;
+    }
+
+    if (pool_of_thread) {
+        pool_of_thread->loop(size, grain, parallel_body);
+    } else {
+        get_threads_pool()->loop(size, grain, parallel_body);
+    }
+}
+
+static pybind11::list
+get_numa_nodes() {
+    pybind11::list nodes;
+    for (const auto& node_cpus : numa_nodes()) {
+        pybind11::list cpus;
+        for (const int cpu : node_cpus) {
+            cpus.append(cpu);
+        }
+        nodes.append(cpus);
+    }
+    return nodes;
+}
+
+static pybind11::dict
+get_native_counters() {
+    pybind11::dict counters;
+    counters["enabled"] = bool(NATIVE_COUNTERS);
+#if NATIVE_COUNTERS
+    for (size_t counter_index = 0; counter_index < COUNTERS_COUNT; ++counter_index) {
+        counters[NATIVE_COUNTER_NAMES[counter_index]] = g_native_counters[counter_index].load();
+    }
+
+    uint64_t tmp_vectors = g_tmp_vectors_of_thread;
+    for (const auto& thread_counters : g_thread_counters) {
+        tmp_vectors += thread_counters.tmp_vectors.load();
+    }
+    counters[NATIVE_COUNTER_NAMES[COUNTER_TMP_VECTORS]] = tmp_vectors;
+
+    pybind11::list busy_ns;
+    pybind11::list iterations;
+    pybind11::list ranges;
+    pybind11::list steals;
+    pybind11::list remote_steals;
+    pybind11::list nodes;
+    std::vector<int> threads_nodes(threads_count, -1);
+    {
+        std::lock_guard<std::mutex> lock(g_threads_pool_mutex);
+        if (g_threads_pool && g_threads_pool->threads_count() == threads_count) {
+            threads_nodes = g_threads_pool->threads_nodes();
+        }
+    }
+    std::vector<uint64_t> node_busy_ns(numa_nodes().size(), 0);
+    const size_t counted_threads_count = std::min(threads_count, MAX_COUNTED_THREADS);
+    for (size_t queue_index = 0; queue_index < counted_threads_count; ++queue_index) {
+        const auto& thread_counters = g_thread_counters[queue_index];
+        busy_ns.append(thread_counters.busy_ns.load());
+        iterations.append(thread_counters.iterations.load());
+        ranges.append(thread_counters.ranges.load());
+        steals.append(thread_counters.steals.load());
+        remote_steals.append(thread_counters.remote_steals.load());
+        nodes.append(threads_nodes[queue_index]);
+        if (threads_nodes[queue_index] >= 0) {
+            node_busy_ns[size_t(threads_nodes[queue_index])] += thread_counters.busy_ns.load();
+        }
+    }
+    pybind11::list nodes_busy_ns;
+    for (const uint64_t node_ns : node_busy_ns) {
+        nodes_busy_ns.append(node_ns);
+    }
+    counters["thread_busy_ns"] = busy_ns;
+    counters["thread_iterations"] = iterations;
+    counters["thread_ranges"] = ranges;
+    counters["thread_steals"] = steals;
+    counters["thread_remote_steals"] = remote_steals;
+    counters["thread_nodes"] = nodes;
+    counters["node_busy_ns"] = nodes_busy_ns;
+#endif
+    return counters;
+}
+
+static void
+reset_native_counters() {
+#if NATIVE_COUNTERS
+    for (auto& counter : g_native_counters) {
+        counter = 0;
+    }
+    for (auto& thread_counters : g_thread_counters) {
+        thread_counters.busy_ns = 0;
+        thread_counters.iterations = 0;
+        thread_counters.ranges = 0;
+        thread_counters.steals = 0;
+        thread_counters.remote_steals = 0;
+        thread_counters.tmp_vectors = 0;
+    }
+    g_tmp_vectors_of_thread = 0;
+#endif
+}
 
 }  // namespace metacells
 
 PYBIND11_MODULE(extensions, module) {
     module.doc() = "C++ extensions to support the metacells package.";
 
-    module.def("set_threads_count", &metacells::set_threads_count, "Specify the number of parallel threads.");
+    module.def("set_threads_count",
+               &metacells::set_threads_count,
+               "Specify the number of parallel threads and how to pin them to processors.",
+               pybind11::arg("count"),
+               pybind11::arg("affinity") = "none",
+               pybind11::arg("first_processor") = 0);
+    module.def("numa_nodes", &metacells::get_numa_nodes, "The processors of each NUMA node (socket).");
+    module.def("simd_level", &metacells::simd_level_name, "The SIMD instructions used by the hand-written kernels.");
+    module.def("set_simd_level", &metacells::set_simd_level, "Limit the SIMD instructions of the per-call kernels.");
+    module.def("get_native_counters", &metacells::get_native_counters, "The counters collected by the kernels.");
+    module.def("reset_native_counters", &metacells::reset_native_counters, "Reset the native counters to zero.");
 
     metacells::register_auroc(module);
     metacells::register_choose_seeds(module);
@@ -74,6 +996,7 @@ PYBIND11_MODULE(extensions, module) {
     metacells::register_folds(module);
     metacells::register_gaps(module);
     metacells::register_logistics(module);
+    metacells::register_mapped(module);
     metacells::register_partitions(module);
     metacells::register_prune_per(module);
     metacells::register_rank(module);
@@ -5,11 +5,16 @@
 
 #include <atomic>
 #include <cmath>
+#include <cstring>
+#include <deque>
+#include <functional>
 #include <iostream>
 #include <mutex>
 #include <random>
 #include <sstream>
+#include <string>
 #include <thread>
+#include <type_traits>
 
 namespace metacells {
 
@@ -88,6 +93,103 @@ typedef double float64_t;
 typedef unsigned char uint8_t;
 typedef unsigned int uint_t;
 
+/// Convert the bits of an IEEE 754 half precision float to a single precision float.
+static float32_t inline float32_of_float16_bits(const uint16_t bits) {
+    const uint32_t sign = uint32_t(bits & 0x8000) << 16;
+    uint32_t exponent = (bits >> 10) & 0x1F;
+    uint32_t mantissa = bits & 0x3FF;
+    uint32_t result;
+    if (exponent == 0x1F) {
+        result = sign | 0x7F800000 | (mantissa << 13);
+    } else if (exponent > 0) {
+        result = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        result = sign;
+    } else {
+        exponent = 113;
+        while (!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            --exponent;
+        }
+        result = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+    }
+    float32_t value;
+    memcpy(&value, &result, sizeof(value));
+    return value;
+}
+
+/// Convert a single precision float to the bits of the nearest (ties to even) IEEE 754 half precision float.
+static uint16_t inline float16_bits_of_float32(const float32_t value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint16_t sign = uint16_t((bits >> 16) & 0x8000);
+    const uint32_t magnitude = bits & 0x7FFFFFFF;
+    if (magnitude > 0x7F800000) {
+        return sign | 0x7E00;
+    }
+    if (magnitude >= 0x477FF000) {
+        return sign | 0x7C00;
+    }
+    if (magnitude >= 0x38800000) {
+        return sign | uint16_t((magnitude + 0xFFF + ((magnitude >> 13) & 1) - 0x38000000) >> 13);
+    }
+    if (magnitude <= 0x33000000) {
+        return sign;
+    }
+    const uint32_t mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+    const uint32_t shift = 126 - (magnitude >> 23);
+    const uint32_t half = uint32_t(1) << (shift - 1);
+    const uint32_t remainder = mantissa & ((half << 1) - 1);
+    uint32_t result = mantissa >> shift;
+    if (remainder > half || (remainder == half && (result & 1))) {
+        ++result;
+    }
+    return sign | uint16_t(result);
+}
+
+/// A half precision float, as stored in `float16` numpy arrays.
+///
+/// This is only a storage type. Values are converted to `float32_t` when read and back when written, so all the
+/// arithmetic is done in (at least) single precision.
+struct float16_t {
+    uint16_t bits;
+
+    float16_t() = default;
+    float16_t(const float32_t value) : bits(float16_bits_of_float32(value)) {}
+    operator float32_t() const { return float32_of_float16_bits(bits); }
+
+    float16_t& operator+=(const float32_t value) { return *this = float32_t(*this) + value; }
+    float16_t& operator-=(const float32_t value) { return *this = float32_t(*this) - value; }
+    float16_t& operator*=(const float32_t value) { return *this = float32_t(*this) * value; }
+    float16_t& operator/=(const float32_t value) { return *this = float32_t(*this) / value; }
+    float16_t& operator++() { return *this += 1; }
+};
+
+/// Whether values of type ``T`` are floating point numbers.
+template<typename T>
+struct is_float : std::is_floating_point<T> {};
+
+template<>
+struct is_float<float16_t> : std::true_type {};
+
+/// The type used to accumulate values of type ``T``, and hold intermediate results computed from them.
+///
+/// The compact `float16_t` and `uint16_t` types are only used to store the inputs, and are widened to `float32_t`.
+template<typename T>
+struct AccumulatorType {
+    typedef T type;
+};
+
+template<>
+struct AccumulatorType<float16_t> {
+    typedef float32_t type;
+};
+
+template<>
+struct AccumulatorType<uint16_t> {
+    typedef float32_t type;
+};
+
 /*
 #ifdef USE_AVX2
 static std::ostream&
@@ -106,10 +208,87 @@ operator<<(std::ostream& os, const __m256& avx2) {
 #endif
 */
 
+#if defined(__x86_64__) && defined(__GNUC__)
+/// Hand-written SIMD kernels are compiled for specific instruction sets and chosen at run time.
+#    define HAS_SIMD_DISPATCH 1
+#endif
+
+/// The SIMD instructions available for the hand-written kernels.
+enum SimdLevel { SIMD_GENERIC = 0, SIMD_AVX2 = 1, SIMD_AVX512 = 2 };
+
+/// The best SIMD instructions supported by the current processor (detected once), up to the `set_simd_level` limit.
+extern SimdLevel
+simd_level();
+
 #if ASSERT_LEVEL > 0
 extern std::mutex io_mutex;
 #endif
 
+#ifndef NATIVE_COUNTERS
+/// Whether to collect the native counters (see `get_native_counters`).
+#    define NATIVE_COUNTERS 0
+#endif
+
+/// The global native counters, reported to Python by `get_native_counters`.
+enum NativeCounter {
+    /// The number of parallel loops.
+    COUNTER_LOOPS = 0,
+    /// The total size in bytes of the numpy arrays wrapped by kernels.
+    COUNTER_ARRAY_BYTES,
+    /// The number of temporary vectors used (counted by each thread and summed when read).
+    COUNTER_TMP_VECTORS,
+    /// The number of times a temporary vector had to grow its capacity (allocate memory). Growth by `push_back` or
+    /// `reserve` after the last call to `TmpVector::vector` is counted once, when the vector is released.
+    COUNTER_TMP_ALLOCATIONS,
+    /// The maximal total size in bytes of the temporary vectors of any single thread.
+    COUNTER_TMP_HIGH_WATER_BYTES,
+    COUNTERS_COUNT
+};
+
+#if NATIVE_COUNTERS
+extern std::atomic<uint64_t> g_native_counters[COUNTERS_COUNT];
+
+/// The total capacity in bytes of the temporary vectors of the current thread.
+extern thread_local uint64_t g_tmp_bytes_of_thread;
+
+/// The number of temporary vectors used by the current thread which were not yet added to its loop counters.
+extern thread_local uint64_t g_tmp_vectors_of_thread;
+#endif
+
+/// Increment one of the native counters (if they are collected).
+static void inline count_native(const NativeCounter counter, const uint64_t amount = 1) {
+#if NATIVE_COUNTERS
+    g_native_counters[counter].fetch_add(amount, std::memory_order_relaxed);
+#else
+    (void)counter;
+    (void)amount;
+#endif
+}
+
+/// Count that the current thread used a temporary vector (if counters are collected).
+///
+/// This is called inside parallel loop bodies, so it only touches a thread-local counter.
+static void inline count_tmp_vector() {
+#if NATIVE_COUNTERS
+    ++g_tmp_vectors_of_thread;
+#endif
+}
+
+/// Count that the temporary vectors of the current thread grew by some number of bytes (if counters are collected).
+static void inline count_tmp_growth(const uint64_t grown_bytes) {
+#if NATIVE_COUNTERS
+    count_native(COUNTER_TMP_ALLOCATIONS);
+    g_tmp_bytes_of_thread += grown_bytes;
+    auto& high_water_bytes = g_native_counters[COUNTER_TMP_HIGH_WATER_BYTES];
+    uint64_t seen_bytes = high_water_bytes.load(std::memory_order_relaxed);
+    while (seen_bytes < g_tmp_bytes_of_thread
+           && !high_water_bytes.compare_exchange_weak(seen_bytes, g_tmp_bytes_of_thread, std::memory_order_relaxed)) {
+    }
+#else
+    (void)grown_bytes;
+#endif
+}
+
 /// Release the GIL to allow for actual parallelism.
 class WithoutGil {
 private:
@@ -154,6 +333,7 @@ public:
 
     ConstArraySlice(const pybind11::array_t<T>& array, const char* const name)
       : ConstArraySlice(array.data(), array.size(), name) {
+        count_native(COUNTER_ARRAY_BYTES, array.size() * sizeof(T));
         FastAssertCompareWhat(array.ndim(), ==, 1, name);
         if (array.size() > 0) {
             FastAssertCompareWhat(array.data(1) - array.data(0), ==, 1, name);
@@ -202,6 +382,7 @@ public:
 
     ArraySlice(pybind11::array_t<T>& array, const char* const name)
       : ArraySlice(array.mutable_data(), array.size(), name) {
+        count_native(COUNTER_ARRAY_BYTES, array.size() * sizeof(T));
         FastAssertCompareWhat(array.ndim(), ==, 1, name);
         if (array.size() > 0) {
             FastAssertCompareWhat(array.data(1) - array.data(0), ==, 1, name);
@@ -240,6 +421,8 @@ matrix_step(const pybind11::array_t<T>& array, const char* const name) {
     FastAssertCompareWhat(array.ndim(), ==, 2, name);
     if (array.shape(0) == 0 || array.shape(1) == 0) {
         return 0;
+    } else if (array.shape(0) == 1) {
+        return array.shape(1);
     } else {
         return array.data(1, 0) - array.data(0, 0);
     }
@@ -269,6 +452,7 @@ public:
 
     ConstMatrixSlice(const pybind11::array_t<T>& array, const char* const name)
       : ConstMatrixSlice(array.data(), array.shape(0), array.shape(1), matrix_step(array, name), name) {
+        count_native(COUNTER_ARRAY_BYTES, array.size() * sizeof(T));
         FastAssertCompareWhat(array.ndim(), ==, 2, name);
         if (array.shape(0) > 0 && array.shape(1) > 1) {
             FastAssertCompareWhat(array.data(0, 1) - array.data(0, 0), ==, 1, name);
@@ -319,6 +503,7 @@ public:
 
     MatrixSlice(pybind11::array_t<T>& array, const char* const name)
       : MatrixSlice(array.mutable_data(), array.shape(0), array.shape(1), matrix_step(array, name), name) {
+        count_native(COUNTER_ARRAY_BYTES, array.size() * sizeof(T));
         FastAssertCompareWhat(array.ndim(), ==, 2, name);
         if (array.shape(0) > 0 && array.shape(1) > 1) {
             FastAssertCompareWhat(array.data(0, 1) - array.data(0, 0), ==, 1, name);
@@ -455,81 +640,461 @@ public:
     }
 };
 
-static const int size_t_count = 8;
-extern thread_local bool g_size_t_used[size_t_count];
-extern thread_local std::vector<size_t> g_size_t_vectors[size_t_count];
+/// The numpy kind (`f`, `i` or `u`) of the type ``T``.
+template<typename T>
+static char inline dtype_kind() {
+    return is_float<T>::value ? 'f' : std::is_signed<T>::value ? 'i' : 'u';
+}
+
+/// The numpy dtype name (e.g. `float32`) of the type ``T``.
+template<typename T>
+static std::string inline dtype_name() {
+    const char* const prefix = is_float<T>::value ? "float" : std::is_signed<T>::value ? "int" : "uint";
+    return prefix + std::to_string(8 * sizeof(T));
+}
 
-class TmpVectorSizeT {
+/// A compressed matrix memory-mapped from a file, written by the Python
+/// `metacells.utilities.computation.write_mapped_compressed` function.
+///
+/// The file starts with a header (see `mapped.cpp`) giving the layout, the dtypes and the shape of the matrix,
+/// followed by the raw data, indices and indptr arrays. The file is mapped copy-on-write, so kernels may modify the
+/// data in-place without changing the file. Only the pages actually used are read from the disk, so this allows
+/// processing matrices larger than the available RAM.
+class MappedCompressed {
 private:
-    int m_index;
+    std::string m_path;
+    void* m_address;
+    size_t m_size;
+    std::string m_layout;
+    std::string m_dtypes[3];
+    char m_kinds[3];
+    size_t m_itemsizes[3];
+    size_t m_offsets[3];
+    size_t m_bands_count;
+    size_t m_elements_count;
+    size_t m_nnz;
+
+    template<typename T>
+    void check_dtype(const size_t array_index) const {
+        FastAssertCompareWhat(m_kinds[array_index], ==, dtype_kind<T>(), m_path.c_str());
+        FastAssertCompareWhat(m_itemsizes[array_index], ==, sizeof(T), m_path.c_str());
+    }
+
+    template<typename T>
+    const T* array(const size_t array_index) const {
+        check_dtype<T>(array_index);
+        return reinterpret_cast<const T*>(address(array_index));
+    }
 
 public:
-    TmpVectorSizeT() : m_index(-1) {
-        for (int index = 0; index < size_t_count; ++index) {
-            if (!g_size_t_used[index]) {
-                g_size_t_used[index] = true;
-                m_index = index;
-                return;
-            }
+    static const size_t DATA = 0;
+    static const size_t INDICES = 1;
+    static const size_t INDPTR = 2;
+
+    explicit MappedCompressed(const std::string& path);
+    ~MappedCompressed();
+
+    MappedCompressed(const MappedCompressed&) = delete;
+    MappedCompressed& operator=(const MappedCompressed&) = delete;
+
+    const std::string& path() const { return m_path; }
+
+    /// Either `row_major` (CSR, where bands are rows) or `column_major` (CSC, where bands are columns).
+    const std::string& layout() const { return m_layout; }
+
+    const std::string& dtype(const size_t array_index) const { return m_dtypes[array_index]; }
+
+    size_t itemsize(const size_t array_index) const { return m_itemsizes[array_index]; }
+
+    size_t bands_count() const { return m_bands_count; }
+
+    size_t elements_count() const { return m_elements_count; }
+
+    size_t nnz() const { return m_nnz; }
+
+    /// The number of entries of one of the arrays.
+    size_t size(const size_t array_index) const { return array_index == INDPTR ? m_bands_count + 1 : m_nnz; }
+
+    char* address(const size_t array_index) const { return static_cast<char*>(m_address) + m_offsets[array_index]; }
+
+    /// The position in the data and indices of the first entry of a band (or of the end of the last band).
+    size_t band_position(const size_t band_index) const;
+
+    /// Advise the OS we are about to read the bands in some range, so it reads them ahead.
+    void prefetch_bands(const size_t start_band_index, const size_t stop_band_index) const;
+
+    /// Read the bands in some range from the disk (if they are not already in memory).
+    void read_bands(const size_t start_band_index, const size_t stop_band_index) const;
+
+    /// Release the memory of the bands in some range (they will be read again from the disk if accessed).
+    void release_bands(const size_t start_band_index, const size_t stop_band_index) const;
+
+    /// Wrap one of the mapped arrays (the type must match the file).
+    template<typename T>
+    ConstArraySlice<T> slice(const size_t array_index) const {
+        return ConstArraySlice<T>(array<T>(array_index), size(array_index), m_path.c_str());
+    }
+
+    /// Wrap the mapped arrays as a compressed matrix (the types must match the file).
+    template<typename D, typename I, typename P>
+    ConstCompressedMatrix<D, I, P> compressed() const {
+        return ConstCompressedMatrix<D, I, P>(slice<D>(DATA),
+                                              slice<I>(INDICES),
+                                              slice<P>(INDPTR),
+                                              m_elements_count,
+                                              m_path.c_str());
+    }
+};
+
+/// Stream the bands of a mapped compressed matrix through a computation, writing the results to a new mapped
+/// compressed file with the same structure (indices and indptr) and a data of the `output_dtype`.
+///
+/// The bands are processed in chunks, each taking at most about `memory_budget` bytes, so the matrix may be much
+/// larger than the available RAM. The next chunk is read while the `compute_chunk` function fills the output data
+/// (of the positions between `band_position(start_band_index)` and `band_position(stop_band_index)`) of the current
+/// one, and the output of the previous one is written to the disk.
+void
+stream_mapped_bands(const MappedCompressed& input,
+                    const std::string& output_path,
+                    const std::string& output_dtype,
+                    const size_t output_itemsize,
+                    const size_t memory_budget,
+                    const std::function<void(size_t start_band_index, size_t stop_band_index, char* output)>&
+                        compute_chunk);
+
+/// A thread-local temporary vector of some type.
+///
+/// Each thread keeps a pool of vectors for each type. Constructing a `TmpVector` reserves one of them (adding a new one
+/// to the pool if they are all in use, so these may be nested to any depth), and destroying it returns it to the pool.
+/// The vectors keep their capacity, so after warming up, kernels do not allocate memory for their temporary data.
+template<typename T>
+class TmpVector {
+private:
+    static thread_local std::deque<std::vector<T>> s_vectors;
+    static thread_local std::vector<bool> s_used;
+
+    size_t m_index;
+    size_t m_counted_capacity;
+
+    void count_growth() {
+        const size_t capacity = s_vectors[m_index].capacity();
+        if (capacity > m_counted_capacity) {
+            count_tmp_growth((capacity - m_counted_capacity) * sizeof(T));
+            m_counted_capacity = capacity;
         }
-        assert(false);
     }
 
-    ~TmpVectorSizeT() {
-        g_size_t_vectors[m_index].clear();
-        g_size_t_used[m_index] = false;
+public:
+    TmpVector() : m_index(0) {
+        while (m_index < s_used.size() && s_used[m_index]) {
+            ++m_index;
+        }
+        if (m_index == s_used.size()) {
+            s_vectors.emplace_back();
+            s_used.push_back(false);
+        }
+        s_used[m_index] = true;
+        m_counted_capacity = s_vectors[m_index].capacity();
+        count_tmp_vector();
+    }
+
+    TmpVector(const TmpVector&) = delete;
+    TmpVector& operator=(const TmpVector&) = delete;
+
+    ~TmpVector() {
+        count_growth();
+        s_vectors[m_index].clear();
+        s_used[m_index] = false;
     }
 
-    std::vector<size_t>& vector(size_t size = 0) {
-        g_size_t_vectors[m_index].resize(size);
-        return g_size_t_vectors[m_index];
+    std::vector<T>& vector(size_t size = 0) {
+        auto& vector = s_vectors[m_index];
+        vector.resize(size);
+        count_growth();
+        return vector;
+    }
+
+    ArraySlice<T> array_slice(const char* const name, size_t size = 0) { return ArraySlice<T>(vector(size), name); }
+};
+
+template<typename T>
+thread_local std::deque<std::vector<T>> TmpVector<T>::s_vectors;
+
+template<typename T>
+thread_local std::vector<bool> TmpVector<T>::s_used;
+
+typedef TmpVector<size_t> TmpVectorSizeT;
+
+typedef TmpVector<float64_t> TmpVectorFloat64;
+
+/// The type used to hold temporary copies of values of type `T` (`std::vector<bool>` is not a contiguous array).
+template<typename T>
+struct TmpValueType {
+    typedef T type;
+};
+
+template<>
+struct TmpValueType<bool> {
+    typedef uint8_t type;
+};
+
+/// Sort the indices (and the matching data) of a band of a compressed matrix.
+template<typename D, typename I, typename P>
+static void
+sort_band(const size_t band_index, CompressedMatrix<D, I, P>& matrix) {
+    if (matrix.indptr()[band_index] == matrix.indptr()[band_index + 1]) {
+        return;
     }
 
-    ArraySlice<size_t> array_slice(const char* const name, size_t size = 0) {
-        return ArraySlice<size_t>(vector(size), name);
+    auto band_indices = matrix.get_band_indices(band_index);
+    auto band_data = matrix.get_band_data(band_index);
+
+    TmpVectorSizeT raii_positions;
+    auto tmp_positions = raii_positions.array_slice("tmp_positions", band_indices.size());
+
+    TmpVector<I> raii_indices;
+    auto tmp_indices = raii_indices.array_slice("tmp_indices", band_indices.size());
+
+    TmpVector<typename TmpValueType<D>::type> raii_values;
+    auto tmp_values = raii_values.array_slice("tmp_values", band_indices.size());
+
+    std::iota(tmp_positions.begin(), tmp_positions.end(), 0);
+    std::sort(tmp_positions.begin(), tmp_positions.end(), [&](const size_t left_position, const size_t right_position) {
+        auto left_index = band_indices[left_position];
+        auto right_index = band_indices[right_position];
+        return left_index < right_index;
+    });
+
+#ifdef __INTEL_COMPILER
+#    pragma simd
+#endif
+    const size_t tmp_size = tmp_positions.size();
+    for (size_t location = 0; location < tmp_size; ++location) {
+        size_t position = tmp_positions[location];
+        tmp_indices[location] = band_indices[position];
+        tmp_values[location] = band_data[position];
     }
+
+    std::copy(tmp_indices.begin(), tmp_indices.end(), band_indices.begin());
+    std::copy(tmp_values.begin(), tmp_values.end(), band_data.begin());
+}
+
+/// A value packed together with its index, so that selecting or sorting values does not need to access them
+/// indirectly through a separate vector of indices. This also halves the size of the sorted elements compared to
+/// sorting `size_t` indices of 32-bit values.
+template<typename D>
+struct IndexedValue {
+    D value;
+    int32_t index;
 };
 
-static const int float64_t_count = 8;
-extern thread_local bool g_float64_t_used[float64_t_count];
-extern thread_local std::vector<float64_t> g_float64_t_vectors[float64_t_count];
+/// Copy values into a vector of indexed values, where the index of each is its position in the input.
+template<typename D>
+static void
+collect_indexed_values(ConstArraySlice<D> values, ArraySlice<IndexedValue<D>> indexed_values) {
+    const size_t size = values.size();
+    FastAssertCompare(indexed_values.size(), ==, size);
+    FastAssertCompare(size, <=, size_t(std::numeric_limits<int32_t>::max()));
+    for (size_t index = 0; index < size; ++index) {
+        indexed_values[index].value = values[index];
+        indexed_values[index].index = int32_t(index);
+    }
+}
+
+/// Reorder the values such that the value at the `rank` position is the one that would be there if they were sorted,
+/// with all the values before it not larger and all the values after it not smaller, and return it.
+template<typename D>
+static D
+select_value(ArraySlice<D> values, const size_t rank) {
+    FastAssertCompare(rank, <, values.size());
+    std::nth_element(values.begin(), values.begin() + rank, values.end());
+    return values[rank];
+}
+
+/// Select the value at some `rank` of 32-bit floating point values (as `select_value`), by repeatedly partitioning them
+/// using the SIMD instructions of the processor (see `simd_level`). The values are copied to one of two temporary
+/// vectors preserving their order, which avoids the unpredictable branch of comparing each value with the pivot.
+extern float32_t
+select_float32_value(ArraySlice<float32_t> values, const size_t rank);
 
-class TmpVectorFloat64 {
+static inline float32_t
+select_value(ArraySlice<float32_t> values, const size_t rank) {
+    return select_float32_value(values, rank);
+}
+
+/// Return the value at some `rank` (in increasing order) of some values, without modifying them.
+template<typename D>
+static D
+rank_value(ConstArraySlice<D> values, const size_t rank) {
+    TmpVector<typename TmpValueType<D>::type> raii_values;
+    auto tmp_values = raii_values.array_slice("tmp_values", values.size());
+    std::copy(values.begin(), values.end(), tmp_values.begin());
+    return select_value(tmp_values, rank);
+}
+
+/// Reorder the indexed values such that the first `count` ones have the largest values, in increasing index order.
+template<typename D>
+static void
+select_largest(ArraySlice<IndexedValue<D>> indexed_values, const size_t count) {
+    FastAssertCompare(count, <=, indexed_values.size());
+    if (count < indexed_values.size()) {
+        std::nth_element(indexed_values.begin(),
+                         indexed_values.begin() + count,
+                         indexed_values.end(),
+                         [](const IndexedValue<D>& left, const IndexedValue<D>& right) {
+                             return left.value > right.value;
+                         });
+    }
+    std::sort(indexed_values.begin(),
+              indexed_values.begin() + count,
+              [](const IndexedValue<D>& left, const IndexedValue<D>& right) { return left.index < right.index; });
+}
+
+/// Sort indexed values by their values, in increasing or decreasing order.
+template<typename D>
+static void
+sort_values(ArraySlice<IndexedValue<D>> indexed_values, const bool ascending) {
+    if (ascending) {
+        std::sort(indexed_values.begin(),
+                  indexed_values.end(),
+                  [](const IndexedValue<D>& left, const IndexedValue<D>& right) { return left.value < right.value; });
+    } else {
+        std::sort(indexed_values.begin(),
+                  indexed_values.end(),
+                  [](const IndexedValue<D>& left, const IndexedValue<D>& right) { return left.value > right.value; });
+    }
+}
+
+/// A counter-based random number generator (Philox4x32-10, from "Parallel random numbers: as easy as 1, 2, 3").
+///
+/// The generated numbers are a pure function of the `seed`, a logical `stream` (e.g., the index of a row) and the
+/// position in the stream. Kernels use one generator per logical unit of work (rather than per thread), so the results
+/// do not depend on the number of threads or on the way the work is split between them. A single stream may also be
+/// split by starting each part at a different `block` (each block provides four 32-bit numbers).
+///
+/// To get identical results on all platforms, use the methods of this class rather than `std::shuffle` or the `std`
+/// distributions, whose algorithms differ between standard library implementations.
+class PhiloxRandom {
 private:
-    int m_index;
+    uint32_t m_key[2];
+    uint32_t m_counter[4];
+    uint32_t m_block[4];
+    size_t m_used;
+
+    static uint32_t multiply_high_low(const uint32_t left, const uint32_t right, uint32_t& high) {
+        const uint64_t product = uint64_t(left) * uint64_t(right);
+        high = uint32_t(product >> 32);
+        return uint32_t(product);
+    }
 
-public:
-    TmpVectorFloat64() : m_index(-1) {
-        for (int index = 0; index < float64_t_count; ++index) {
-            if (!g_float64_t_used[index]) {
-                g_float64_t_used[index] = true;
-                m_index = index;
-                return;
+    void generate_block() {
+        uint32_t key[2] = { m_key[0], m_key[1] };
+        uint32_t block[4] = { m_counter[0], m_counter[1], m_counter[2], m_counter[3] };
+        for (int round = 0; round < 10; ++round) {
+            if (round > 0) {
+                key[0] += 0x9E3779B9;
+                key[1] += 0xBB67AE85;
             }
+            uint32_t high0;
+            uint32_t high1;
+            const uint32_t low0 = multiply_high_low(0xD2511F53, block[0], high0);
+            const uint32_t low1 = multiply_high_low(0xCD9E8D57, block[2], high1);
+            block[0] = high1 ^ block[1] ^ key[0];
+            block[1] = low1;
+            block[2] = high0 ^ block[3] ^ key[1];
+            block[3] = low0;
+        }
+        std::copy(block, block + 4, m_block);
+        m_used = 0;
+        if (++m_counter[0] == 0) {
+            ++m_counter[1];
         }
-        assert(false);
     }
 
-    ~TmpVectorFloat64() {
-        g_float64_t_vectors[m_index].clear();
-        g_float64_t_used[m_index] = false;
+public:
+    typedef uint32_t result_type;
+
+    PhiloxRandom(const uint64_t seed, const uint64_t stream = 0, const uint64_t block = 0)
+      : m_key{ uint32_t(seed), uint32_t(seed >> 32) }
+      , m_counter{ uint32_t(block), uint32_t(block >> 32), uint32_t(stream), uint32_t(stream >> 32) }
+      , m_block{ 0, 0, 0, 0 }
+      , m_used(4) {}
+
+    static constexpr result_type min() { return 0; }
+
+    static constexpr result_type max() { return 0xFFFFFFFF; }
+
+    /// A uniform random 32-bit number.
+    result_type operator()() {
+        if (m_used == 4) {
+            generate_block();
+        }
+        return m_block[m_used++];
     }
 
-    std::vector<float64_t>& vector(size_t size = 0) {
-        g_float64_t_vectors[m_index].resize(size);
-        return g_float64_t_vectors[m_index];
+    /// A uniform random 64-bit number.
+    uint64_t next64() {
+        const uint64_t high = (*this)();
+        return (high << 32) | (*this)();
     }
 
-    ArraySlice<float64_t> array_slice(const char* const name, size_t size = 0) {
-        return ArraySlice<float64_t>(vector(size), name);
+    /// A uniform random integer in `0 .. size - 1`.
+    size_t below(const size_t size) {
+        FastAssertCompare(size, >, 0);
+        const uint64_t limit = uint64_t(-uint64_t(size)) % uint64_t(size);  // 2^64 % size
+        while (true) {
+            const uint64_t value = next64();
+            if (value >= limit) {
+                return size_t(value % uint64_t(size));
+            }
+        }
+    }
+
+    /// A uniform random number in `[0, 1)` (using 53 random bits).
+    float64_t fraction() { return float64_t(next64() >> 11) / 9007199254740992.0; }
+
+    /// A uniform random number in `[low, high)`.
+    float64_t uniform(const float64_t low, const float64_t high) { return low + (high - low) * fraction(); }
+
+    /// A normally distributed random number (Box-Muller).
+    float64_t normal(const float64_t mean, const float64_t deviation) {
+        const float64_t radius = sqrt(-2.0 * log(1.0 - fraction()));
+        return mean + deviation * radius * cos(2.0 * M_PI * fraction());
+    }
+
+    /// Randomly shuffle the elements in `[begin, end)` (Fisher-Yates).
+    template<typename I>
+    void shuffle(I begin, I end) {
+        const size_t size = size_t(end - begin);
+        for (size_t index = size; index > 1; --index) {
+            std::swap(begin[index - 1], begin[below(index)]);
+        }
     }
 };
 
+/// Invoke `parallel_body` for each index in `0 .. size - 1`, in parallel, using `serial_body` if running serially.
+///
+/// Consecutive indices are executed in ranges of up to `grain` indices by the same thread. If `grain` is zero, it is
+/// chosen automatically so each thread executes several ranges. Parallel loops may be nested (that is, the body of
+/// one loop may invoke another) and may be invoked concurrently from different threads.
 extern void
-parallel_loop(const size_t size, std::function<void(size_t)> parallel_body, std::function<void(size_t)> serial_body);
+parallel_loop(const size_t size,
+              size_t grain,
+              std::function<void(size_t)> parallel_body,
+              std::function<void(size_t)> serial_body);
+
+static void inline parallel_loop(const size_t size,
+                                 std::function<void(size_t)> parallel_body,
+                                 std::function<void(size_t)> serial_body) {
+    parallel_loop(size, 0, parallel_body, serial_body);
+}
+
+static void inline parallel_loop(const size_t size, const size_t grain, std::function<void(size_t)> parallel_body) {
+    parallel_loop(size, grain, parallel_body, parallel_body);
+}
 
 static void inline parallel_loop(const size_t size, std::function<void(size_t)> parallel_body) {
-    parallel_loop(size, parallel_body, parallel_body);
+    parallel_loop(size, 0, parallel_body, parallel_body);
 }
 
 /*
@@ -558,6 +1123,8 @@ register_gaps(pybind11::module& module);
 extern void
 register_logistics(pybind11::module& module);
 extern void
+register_mapped(pybind11::module& module);
+extern void
 register_partitions(pybind11::module& module);
 extern void
 register_prune_per(pybind11::module& module);
@@ -571,3 +1138,25 @@ extern void
 register_top_per(pybind11::module& module);
 
 }  // namespace metacells
+
+namespace pybind11 {
+namespace detail {
+
+/// Allow passing `float16` numpy arrays to kernels taking `pybind11::array_t<metacells::float16_t>`.
+template<>
+struct npy_format_descriptor<metacells::float16_t> {
+    static constexpr int type_num = 23;  // `NPY_HALF`
+    static constexpr auto name = _("float16");
+    static pybind11::dtype dtype() {
+        return reinterpret_steal<pybind11::dtype>(npy_api::get().PyArray_DescrFromType_(type_num));
+    }
+};
+
+}  // namespace detail
+
+template<>
+struct format_descriptor<metacells::float16_t> {
+    static std::string format() { return "e"; }
+};
+
+}  // namespace pybind11
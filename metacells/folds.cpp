@@ -3,15 +3,15 @@
 namespace metacells {
 
 /// See the Python `metacell.tools.outlier_cells._collect_fold_factors` function.
-template<typename D>
+template<typename D, typename A = typename AccumulatorType<D>::type>
 static void
 fold_factor_dense(pybind11::array_t<D>& data_array,
-                  const pybind11::array_t<D>& total_of_rows_array,
-                  const pybind11::array_t<D>& fraction_of_columns_array) {
+                  const pybind11::array_t<A>& total_of_rows_array,
+                  const pybind11::array_t<A>& fraction_of_columns_array) {
     WithoutGil without_gil{};
     MatrixSlice<D> data(data_array, "data");
-    ConstArraySlice<D> total_of_rows(total_of_rows_array, "total_of_rows");
-    ConstArraySlice<D> fraction_of_columns(fraction_of_columns_array, "fraction_of_columns");
+    ConstArraySlice<A> total_of_rows(total_of_rows_array, "total_of_rows");
+    ConstArraySlice<A> fraction_of_columns(fraction_of_columns_array, "fraction_of_columns");
 
     FastAssertCompare(total_of_rows.size(), ==, data.rows_count());
     FastAssertCompare(fraction_of_columns.size(), ==, data.columns_count());
@@ -26,22 +26,22 @@ fold_factor_dense(pybind11::array_t<D>& data_array,
             const auto expected = row_total * column_fraction;
             auto& value = row_data[column_index];
             const auto actual = row_total * value;
-            value = abs(D(log((actual + 1.0) / (expected + 1.0)) * LOG2_SCALE));
+            value = abs(A(log((actual + 1.0) / (expected + 1.0)) * LOG2_SCALE));
         }
     });
 }
 
 /// See the Python `metacell.tools.outlier_cells._collect_fold_factors` function.
-template<typename D, typename I, typename P>
+template<typename D, typename I, typename P, typename A = typename AccumulatorType<D>::type>
 static void
 fold_factor_compressed(pybind11::array_t<D>& data_array,
                        pybind11::array_t<I>& indices_array,
                        pybind11::array_t<P>& indptr_array,
-                       const pybind11::array_t<D>& total_of_bands_array,
-                       const pybind11::array_t<D>& fraction_of_elements_array) {
+                       const pybind11::array_t<A>& total_of_bands_array,
+                       const pybind11::array_t<A>& fraction_of_elements_array) {
     WithoutGil without_gil{};
-    ConstArraySlice<D> total_of_bands(total_of_bands_array, "total_of_bands");
-    ConstArraySlice<D> fraction_of_elements(fraction_of_elements_array, "fraction_of_elements");
+    ConstArraySlice<A> total_of_bands(total_of_bands_array, "total_of_bands");
+    ConstArraySlice<A> fraction_of_elements(fraction_of_elements_array, "fraction_of_elements");
 
     const size_t bands_count = total_of_bands.size();
     const size_t elements_count = fraction_of_elements.size();
@@ -66,11 +66,53 @@ fold_factor_compressed(pybind11::array_t<D>& data_array,
             const auto expected = band_total * element_fraction;
             auto& value = band_data[position];
             const auto actual = band_total * value;
-            value = abs(D(log((actual + 1.0) / (expected + 1.0)) * LOG2_SCALE));
+            value = abs(A(log((actual + 1.0) / (expected + 1.0)) * LOG2_SCALE));
         }
     });
 }
 
+/// See the Python `metacell.utilities.computation.stream_fold_factors_mapped` function.
+template<typename D, typename I, typename P, typename A = typename AccumulatorType<D>::type>
+static void
+stream_fold_factor_compressed(const MappedCompressed& input,
+                              const std::string& output_path,
+                              const pybind11::array_t<A>& total_of_bands_array,
+                              const pybind11::array_t<A>& fraction_of_elements_array,
+                              const size_t memory_budget) {
+    WithoutGil without_gil{};
+    ConstArraySlice<A> total_of_bands(total_of_bands_array, "total_of_bands");
+    ConstArraySlice<A> fraction_of_elements(fraction_of_elements_array, "fraction_of_elements");
+
+    const auto data = input.compressed<D, I, P>();
+    FastAssertCompare(data.bands_count(), ==, total_of_bands.size());
+    FastAssertCompare(data.elements_count(), ==, fraction_of_elements.size());
+
+    stream_mapped_bands(input,
+                        output_path,
+                        dtype_name<D>(),
+                        sizeof(D),
+                        memory_budget,
+                        [&](size_t start_band_index, size_t stop_band_index, char* output_bytes) {
+                            const size_t start_position = input.band_position(start_band_index);
+                            D* const output = reinterpret_cast<D*>(output_bytes);
+                            parallel_loop(stop_band_index - start_band_index, [&](size_t chunk_band_index) {
+                                const size_t band_index = start_band_index + chunk_band_index;
+                                const auto band_total = total_of_bands[band_index];
+                                const auto band_indices = data.get_band_indices(band_index);
+                                const auto band_data = data.get_band_data(band_index);
+                                D* const band_output = output + input.band_position(band_index) - start_position;
+
+                                const size_t band_elements_count = band_indices.size();
+                                for (size_t position = 0; position < band_elements_count; ++position) {
+                                    const auto element_fraction = fraction_of_elements[band_indices[position]];
+                                    const auto expected = band_total * element_fraction;
+                                    const auto actual = band_total * band_data[position];
+                                    band_output[position] = abs(A(log((actual + 1.0) / (expected + 1.0)) * LOG2_SCALE));
+                                }
+                            });
+                        });
+}
+
 template<typename D>
 static void
 collect_distinct_folds(ArraySlice<int32_t> gene_indices,
@@ -130,6 +172,149 @@ top_distinct(pybind11::array_t<int32_t>& gene_indices_array,
     });
 }
 
+/// Collect the `gene_indices.size()` largest fold factors of a cell (in decreasing order).
+template<typename D>
+static void
+collect_top_folds(ArraySlice<int32_t> gene_indices,
+                  ArraySlice<float32_t> gene_folds,
+                  ArraySlice<IndexedValue<D>> indexed_folds) {
+    const size_t distinct_count = gene_indices.size();
+    std::nth_element(indexed_folds.begin(),
+                     indexed_folds.begin() + distinct_count,
+                     indexed_folds.end(),
+                     [](const IndexedValue<D>& left, const IndexedValue<D>& right) {
+                         return left.value > right.value;
+                     });
+    sort_values(indexed_folds.slice(0, distinct_count), false);
+
+    for (size_t position = 0; position < distinct_count; ++position) {
+        gene_indices[position] = indexed_folds[position].index;
+        gene_folds[position] = float32_t(indexed_folds[position].value);
+    }
+}
+
+/// Compute the fold factors of dense data and collect the topmost distinct genes of each row in a single pass.
+///
+/// This is equivalent to `fold_factor_dense` followed by `top_distinct`, but only reads the data once. The fold
+/// factors are written back into the data only if `write_back` is set.
+template<typename D, typename A = typename AccumulatorType<D>::type>
+static void
+top_distinct_fold_factor_dense(pybind11::array_t<int32_t>& gene_indices_array,
+                               pybind11::array_t<float32_t>& gene_folds_array,
+                               pybind11::array_t<D>& data_array,
+                               const pybind11::array_t<A>& total_of_rows_array,
+                               const pybind11::array_t<A>& fraction_of_columns_array,
+                               const bool write_back) {
+    WithoutGil without_gil{};
+    MatrixSlice<int32_t> gene_indices(gene_indices_array, "gene_indices");
+    MatrixSlice<float32_t> gene_folds(gene_folds_array, "gene_folds");
+    MatrixSlice<D> data(data_array, "data");
+    ConstArraySlice<A> total_of_rows(total_of_rows_array, "total_of_rows");
+    ConstArraySlice<A> fraction_of_columns(fraction_of_columns_array, "fraction_of_columns");
+
+    const size_t rows_count = data.rows_count();
+    const size_t columns_count = data.columns_count();
+    const size_t distinct_count = gene_indices.columns_count();
+
+    FastAssertCompare(total_of_rows.size(), ==, rows_count);
+    FastAssertCompare(fraction_of_columns.size(), ==, columns_count);
+    FastAssertCompare(distinct_count, <, columns_count);
+    FastAssertCompare(columns_count, <=, size_t(std::numeric_limits<int32_t>::max()));
+    FastAssertCompare(gene_indices.rows_count(), ==, rows_count);
+    FastAssertCompare(gene_folds.rows_count(), ==, rows_count);
+    FastAssertCompare(gene_folds.columns_count(), ==, distinct_count);
+
+    parallel_loop(rows_count, [&](size_t row_index) {
+        const auto row_total = total_of_rows[row_index];
+        auto row_data = data.get_row(row_index);
+
+        TmpVector<IndexedValue<A>> raii_indexed_folds;
+        auto tmp_indexed_folds = raii_indexed_folds.array_slice("tmp_indexed_folds", columns_count);
+
+        for (size_t column_index = 0; column_index < columns_count; ++column_index) {
+            const auto expected = row_total * fraction_of_columns[column_index];
+            const auto actual = row_total * row_data[column_index];
+            const auto fold = abs(A(log((actual + 1.0) / (expected + 1.0)) * LOG2_SCALE));
+            tmp_indexed_folds[column_index].value = fold;
+            tmp_indexed_folds[column_index].index = int32_t(column_index);
+            if (write_back) {
+                row_data[column_index] = fold;
+            }
+        }
+
+        collect_top_folds(gene_indices.get_row(row_index), gene_folds.get_row(row_index), tmp_indexed_folds);
+    });
+}
+
+/// Compute the fold factors of compressed data and collect the topmost distinct genes of each band in a single pass.
+///
+/// This is equivalent to densifying the data, then `fold_factor_dense`, then `top_distinct`, but only reads the data
+/// once. That is, implicit zero elements have a zero fraction, so their (absolute) fold factor is that of a zero
+/// actual value, and they may be among the top genes (unlike in `fold_factor_compressed`, which leaves them as zeros).
+/// The fold factors of the stored elements are written back into the data only if `write_back` is set.
+template<typename D, typename I, typename P, typename A = typename AccumulatorType<D>::type>
+static void
+top_distinct_fold_factor_compressed(pybind11::array_t<int32_t>& gene_indices_array,
+                                    pybind11::array_t<float32_t>& gene_folds_array,
+                                    pybind11::array_t<D>& data_array,
+                                    pybind11::array_t<I>& indices_array,
+                                    pybind11::array_t<P>& indptr_array,
+                                    const pybind11::array_t<A>& total_of_bands_array,
+                                    const pybind11::array_t<A>& fraction_of_elements_array,
+                                    const bool write_back) {
+    WithoutGil without_gil{};
+    MatrixSlice<int32_t> gene_indices(gene_indices_array, "gene_indices");
+    MatrixSlice<float32_t> gene_folds(gene_folds_array, "gene_folds");
+    ConstArraySlice<A> total_of_bands(total_of_bands_array, "total_of_bands");
+    ConstArraySlice<A> fraction_of_elements(fraction_of_elements_array, "fraction_of_elements");
+
+    const size_t bands_count = total_of_bands.size();
+    const size_t elements_count = fraction_of_elements.size();
+    const size_t distinct_count = gene_indices.columns_count();
+
+    CompressedMatrix<D, I, P> data(ArraySlice<D>(data_array, "data"),
+                                   ArraySlice<I>(indices_array, "indices"),
+                                   ArraySlice<P>(indptr_array, "indptr"),
+                                   elements_count,
+                                   "data");
+    FastAssertCompare(data.bands_count(), ==, bands_count);
+    FastAssertCompare(data.elements_count(), ==, elements_count);
+    FastAssertCompare(distinct_count, <, elements_count);
+    FastAssertCompare(elements_count, <=, size_t(std::numeric_limits<int32_t>::max()));
+    FastAssertCompare(gene_indices.rows_count(), ==, bands_count);
+    FastAssertCompare(gene_folds.rows_count(), ==, bands_count);
+    FastAssertCompare(gene_folds.columns_count(), ==, distinct_count);
+
+    parallel_loop(bands_count, [&](size_t band_index) {
+        const auto band_total = total_of_bands[band_index];
+        auto band_indices = data.get_band_indices(band_index);
+        auto band_data = data.get_band_data(band_index);
+
+        TmpVector<IndexedValue<A>> raii_indexed_folds;
+        auto tmp_indexed_folds = raii_indexed_folds.array_slice("tmp_indexed_folds", elements_count);
+
+        for (size_t element_index = 0; element_index < elements_count; ++element_index) {
+            const auto expected = band_total * fraction_of_elements[element_index];
+            tmp_indexed_folds[element_index].value = abs(A(log(1.0 / (expected + 1.0)) * LOG2_SCALE));
+            tmp_indexed_folds[element_index].index = int32_t(element_index);
+        }
+
+        const size_t band_elements_count = band_indices.size();
+        for (size_t position = 0; position < band_elements_count; ++position) {
+            const auto element_index = band_indices[position];
+            const auto expected = band_total * fraction_of_elements[element_index];
+            const auto actual = band_total * band_data[position];
+            const auto fold = abs(A(log((actual + 1.0) / (expected + 1.0)) * LOG2_SCALE));
+            tmp_indexed_folds[element_index].value = fold;
+            if (write_back) {
+                band_data[position] = fold;
+            }
+        }
+
+        collect_top_folds(gene_indices.get_row(band_index), gene_folds.get_row(band_index), tmp_indexed_folds);
+    });
+}
+
 /// See the Python `metacell.utilities.computation._median_sparse` function.
 template<typename D, typename I, typename P>
 static void
@@ -164,16 +349,7 @@ median_compressed(const pybind11::array_t<D>& data_array,
                 medians[band_index] = 0;
             } else {
                 size_t median_position = median_rank - zeros_count;
-
-                TmpVectorSizeT raii_indices;
-                auto tmp_indices = raii_indices.array_slice("tmp_indices", nnz_count);
-                std::iota(tmp_indices.begin(), tmp_indices.end(), 0);
-
-                std::nth_element(tmp_indices.begin(),
-                                 tmp_indices.begin() + median_position,
-                                 tmp_indices.end(),
-                                 [&](auto left, auto right) { return band_data[left] < band_data[right]; });
-                medians[band_index] = band_data[tmp_indices[median_position]];
+                medians[band_index] = rank_value(band_data, median_position);
             }
         });
 
@@ -190,23 +366,14 @@ median_compressed(const pybind11::array_t<D>& data_array,
             } else {
                 size_t high_position = high_rank - zeros_count;
 
-                TmpVectorSizeT raii_indices;
-                auto tmp_indices = raii_indices.array_slice("tmp_indices", nnz_count);
-                std::iota(tmp_indices.begin(), tmp_indices.end(), 0);
-
-                std::nth_element(tmp_indices.begin(),
-                                 tmp_indices.begin() + high_position,
-                                 tmp_indices.end(),
-                                 [&](auto left, auto right) { return band_data[left] < band_data[right]; });
-                auto high_value = band_data[tmp_indices[high_position]];
+                TmpVector<D> raii_values;
+                auto tmp_values = raii_values.array_slice("tmp_values", nnz_count);
+                std::copy(band_data.begin(), band_data.end(), tmp_values.begin());
+                auto high_value = select_value(tmp_values, high_position);
 
                 D low_value = 0;
                 if (low_rank >= zeros_count) {
-                    size_t low_index =
-                        *std::max_element(tmp_indices.begin(),
-                                          tmp_indices.begin() + high_position,
-                                          [&](auto left, auto right) { return band_data[left] < band_data[right]; });
-                    low_value = band_data[low_index];
+                    low_value = *std::max_element(tmp_values.begin(), tmp_values.begin() + high_position);
                 }
                 medians[band_index] = (low_value + high_value) / 2;
             }
@@ -216,22 +383,33 @@ median_compressed(const pybind11::array_t<D>& data_array,
 
 void
 register_folds(pybind11::module& module) {
-#define REGISTER_F(F)                                                                                   \
-    module.def("top_distinct_" #F, &metacells::top_distinct<F>, "Collect the topmost distinct genes."); \
-    module.def("fold_factor_dense_" #F, &metacells::fold_factor_dense<F>, "Fold factors of dense data.");
-
+#define REGISTER_F(F)                                                                                     \
+    module.def("top_distinct_" #F, &metacells::top_distinct<F>, "Collect the topmost distinct genes.");   \
+    module.def("fold_factor_dense_" #F, &metacells::fold_factor_dense<F>, "Fold factors of dense data."); \
+    module.def("top_distinct_fold_factor_dense_" #F,                                                      \
+               &metacells::top_distinct_fold_factor_dense<F>,                                             \
+               "Topmost distinct genes of the fold factors of dense data.");
+
+    REGISTER_F(float16_t)
     REGISTER_F(float32_t)
     REGISTER_F(float64_t)
 
-#define REGISTER_F_I_P(F, I, P)                             \
-    module.def("fold_factor_compressed_" #F "_" #I "_" #P,  \
-               &metacells::fold_factor_compressed<F, I, P>, \
-               "Fold factors of compressed data.");         \
-    module.def("median_compressed_" #F "_" #I "_" #P,       \
-               &metacells::median_compressed<F, I, P>,      \
+#define REGISTER_F_I_P(F, I, P)                                                   \
+    module.def("fold_factor_compressed_" #F "_" #I "_" #P,                        \
+               &metacells::fold_factor_compressed<F, I, P>,                       \
+               "Fold factors of compressed data.");                               \
+    module.def("stream_fold_factor_compressed_" #F "_" #I "_" #P,                 \
+               &metacells::stream_fold_factor_compressed<F, I, P>,                \
+               "Fold factors of mapped compressed data.");                        \
+    module.def("top_distinct_fold_factor_compressed_" #F "_" #I "_" #P,           \
+               &metacells::top_distinct_fold_factor_compressed<F, I, P>,          \
+               "Topmost distinct genes of the fold factors of compressed data."); \
+    module.def("median_compressed_" #F "_" #I "_" #P,                             \
+               &metacells::median_compressed<F, I, P>,                            \
                "Medians of compressed data.");
 
 #define REGISTER_FS_I_P(I, P)       \
+    REGISTER_F_I_P(float16_t, I, P) \
     REGISTER_F_I_P(float32_t, I, P) \
     REGISTER_F_I_P(float64_t, I, P)
 
@@ -2,6 +2,9 @@
 
 namespace metacells {
 
+// The number of genes whose data we gather at a time for the cells of each candidate.
+static const size_t GAPS_GENES_TILE_SIZE = 256;
+
 /// See the Python `metacell.tools.deviants.find_deviant_cells` function.
 static void
 compute_cell_gaps(const pybind11::array_t<float32_t>& umis_per_gene_per_cell_array,
@@ -42,142 +45,180 @@ compute_cell_gaps(const pybind11::array_t<float32_t>& umis_per_gene_per_cell_arr
     FastAssertCompare(gap_skip_cells, >=, 1);
     FastAssertCompare(gap_skip_cells, <=, 3);
 
-    parallel_loop(candidates_count, [&](size_t candidate_index) {
-        TmpVectorSizeT cell_indices_raii;
-        auto cell_index_of_position = cell_indices_raii.vector(cells_count);
-        cell_index_of_position.clear();
-        bool active_candidate = false;
-        for (size_t cell_index = 0; cell_index < cells_count; ++cell_index) {
-            if (size_t(candidate_index_per_cell[cell_index]) == candidate_index) {
-                if (active_per_cell[cell_index]) {
-                    active_candidate = true;
-                }
-                if (!deviant_per_cell[cell_index]) {
-                    cell_index_of_position.push_back(cell_index);
-                }
-            }
+    std::vector<size_t> first_position_of_candidates(candidates_count + 1, 0);
+    std::vector<bool> is_active_of_candidates(candidates_count, false);
+    for (size_t cell_index = 0; cell_index < cells_count; ++cell_index) {
+        const auto candidate_index = candidate_index_per_cell[cell_index];
+        if (candidate_index < 0 || size_t(candidate_index) >= candidates_count) {
+            continue;
+        }
+        if (active_per_cell[cell_index]) {
+            is_active_of_candidates[candidate_index] = true;
+        }
+        if (!deviant_per_cell[cell_index]) {
+            ++first_position_of_candidates[candidate_index + 1];
+        }
+    }
+    std::partial_sum(first_position_of_candidates.begin(),
+                     first_position_of_candidates.end(),
+                     first_position_of_candidates.begin());
+
+    std::vector<size_t> cell_index_of_positions(first_position_of_candidates[candidates_count]);
+    std::vector<size_t> next_position_of_candidates(first_position_of_candidates);
+    for (size_t cell_index = 0; cell_index < cells_count; ++cell_index) {
+        const auto candidate_index = candidate_index_per_cell[cell_index];
+        if (candidate_index >= 0 && size_t(candidate_index) < candidates_count && !deviant_per_cell[cell_index]) {
+            cell_index_of_positions[next_position_of_candidates[candidate_index]++] = cell_index;
         }
-        const size_t candidate_cells_count = cell_index_of_position.size();
-        if (!active_candidate || candidate_cells_count < 4) {
+    }
+
+    parallel_loop(candidates_count, [&](size_t candidate_index) {
+        const size_t first_position = first_position_of_candidates[candidate_index];
+        const size_t candidate_cells_count = first_position_of_candidates[candidate_index + 1] - first_position;
+        if (!is_active_of_candidates[candidate_index] || candidate_cells_count < 4) {
             return;
         }
+        const size_t* cell_index_of_candidate_positions = &cell_index_of_positions[first_position];
 
         const size_t max_deviant_cells_count_of_candidate =
             std::min(candidate_cells_count - gap_skip_cells,
                      std::max(max_deviant_cells_count,
                               size_t(max_deviant_cells_fraction * candidate_cells_count + 0.5)));
 
-        for (size_t gene_index = 0; gene_index < genes_count; ++gene_index) {
-            const float32_t min_gap_of_gene = min_gap_per_gene[gene_index];
+        // The candidate positions of the cells, sorted by the log fraction of the current gene (ties are sorted by
+        // position, to make the results independent of the order of the previous gene).
+        TmpVectorSizeT positions_raii;
+        auto& tmp_position_of_ranks = positions_raii.vector(candidate_cells_count);
+        std::iota(tmp_position_of_ranks.begin(), tmp_position_of_ranks.end(), 0);
+
+        // The UMIs and log fraction of each cell of the candidate for a tile of genes, such that the data of each gene
+        // is contiguous.
+        const size_t tile_size = std::min(GAPS_GENES_TILE_SIZE, genes_count) * candidate_cells_count;
+        std::vector<float32_t> umis_tile(tile_size);
+        std::vector<float32_t> log_fraction_tile(tile_size);
+
+        for (size_t tile_gene_index = 0; tile_gene_index < genes_count; tile_gene_index += GAPS_GENES_TILE_SIZE) {
+            const size_t tile_genes_count = std::min(GAPS_GENES_TILE_SIZE, genes_count - tile_gene_index);
 
-            bool has_significant_umis = false;
             for (size_t cell_position = 0; cell_position < candidate_cells_count; ++cell_position) {
-                const auto umis = umis_per_gene_per_cell(cell_index_of_position[cell_position], gene_index);
-                if (umis * 2 + 1e-6 > min_compare_umis) {
-                    has_significant_umis = true;
-                    break;
+                const size_t cell_index = cell_index_of_candidate_positions[cell_position];
+                const auto umis_per_gene = umis_per_gene_per_cell.get_row(cell_index);
+                const auto log_fraction_per_gene = log_fraction_per_gene_per_cell.get_row(cell_index);
+                for (size_t gene_offset = 0; gene_offset < tile_genes_count; ++gene_offset) {
+                    const size_t tile_index = gene_offset * candidate_cells_count + cell_position;
+                    umis_tile[tile_index] = umis_per_gene[tile_gene_index + gene_offset];
+                    log_fraction_tile[tile_index] = log_fraction_per_gene[tile_gene_index + gene_offset];
                 }
             }
 
-            if (!has_significant_umis) {
-                continue;
-            }
-
-            // TODO: It may be faster to partition to low, middle and high regions and only sort the low and high
-            // regions; fully sort only if the middle region is empty.
-            std::sort(cell_index_of_position.begin(),
-                      cell_index_of_position.end(),
-                      [&](const size_t left_cell_index, const size_t right_cell_index) {
-                          const auto left_fraction = log_fraction_per_gene_per_cell(left_cell_index, gene_index);
-                          const auto right_fraction = log_fraction_per_gene_per_cell(right_cell_index, gene_index);
-                          if (left_fraction < right_fraction) {
-                              return true;
-                          }
-                          if (left_fraction > right_fraction) {
-                              return false;
-                          }
-                          return log_fraction_per_gene_per_cell(left_cell_index, gene_index)
-                                 < log_fraction_per_gene_per_cell(right_cell_index, gene_index);
-                      });
-
-            const size_t max_cell_position =
-                std::min((candidate_cells_count - 1) / 2, max_deviant_cells_count_of_candidate);
-
-            for (size_t cell_position = 0; cell_position < max_cell_position; ++cell_position) {
-                const size_t first_cell_index = cell_index_of_position[cell_position];
-                const size_t second_cell_index = cell_index_of_position[cell_position + gap_skip_cells];
-
-                const float32_t first_cell_umis = umis_per_gene_per_cell(first_cell_index, gene_index);
-                const float32_t second_cell_umis = umis_per_gene_per_cell(second_cell_index, gene_index);
-                if (first_cell_umis + second_cell_umis + 1e-6 < min_compare_umis) {
-                    continue;
+            for (size_t gene_offset = 0; gene_offset < tile_genes_count; ++gene_offset) {
+                const size_t gene_index = tile_gene_index + gene_offset;
+                const float32_t min_gap_of_gene = min_gap_per_gene[gene_index];
+                const float32_t* umis_of_positions = &umis_tile[gene_offset * candidate_cells_count];
+                const float32_t* log_fraction_of_positions = &log_fraction_tile[gene_offset * candidate_cells_count];
+                const auto umis_of_rank = [&](const size_t rank) {
+                    return umis_of_positions[tmp_position_of_ranks[rank]];
+                };
+                const auto log_fraction_of_rank = [&](const size_t rank) {
+                    return log_fraction_of_positions[tmp_position_of_ranks[rank]];
+                };
+                const auto cell_index_of_rank = [&](const size_t rank) {
+                    return cell_index_of_candidate_positions[tmp_position_of_ranks[rank]];
+                };
+
+                bool has_significant_umis = false;
+                for (size_t cell_position = 0; cell_position < candidate_cells_count; ++cell_position) {
+                    const auto umis = umis_of_positions[cell_position];
+                    if (umis * 2 + 1e-6 > min_compare_umis) {
+                        has_significant_umis = true;
+                        break;
+                    }
                 }
 
-                const float32_t first_cell_log_fraction = log_fraction_per_gene_per_cell(first_cell_index, gene_index);
-                const float32_t second_cell_log_fraction =
-                    log_fraction_per_gene_per_cell(second_cell_index, gene_index);
-                const float32_t full_gap = second_cell_log_fraction - first_cell_log_fraction - min_gap_of_gene;
-                if (full_gap < 0.0) {
+                if (!has_significant_umis) {
                     continue;
                 }
 
-                size_t stop_cell_position = cell_position + 1;
-                if (gap_skip_cells > 1) {
-                    const size_t middle_cell_index = cell_index_of_position[cell_position + 1];
-                    const float32_t middle_cell_log_fraction =
-                        log_fraction_per_gene_per_cell(middle_cell_index, gene_index);
-                    const float32_t start_gap =
-                        2.0 * (middle_cell_log_fraction - first_cell_log_fraction) - min_gap_of_gene;
+                // TODO: It may be faster to partition to low, middle and high regions and only sort the low and high
+                // regions; fully sort only if the middle region is empty.
+                std::sort(tmp_position_of_ranks.begin(),
+                          tmp_position_of_ranks.end(),
+                          [&](const size_t left_cell_position, const size_t right_cell_position) {
+                              const float32_t left_log_fraction = log_fraction_of_positions[left_cell_position];
+                              const float32_t right_log_fraction = log_fraction_of_positions[right_cell_position];
+                              return left_log_fraction < right_log_fraction
+                                     || (left_log_fraction == right_log_fraction
+                                         && left_cell_position < right_cell_position);
+                          });
+
+                const size_t max_cell_rank =
+                    std::min((candidate_cells_count - 1) / 2, max_deviant_cells_count_of_candidate);
+
+                for (size_t cell_rank = 0; cell_rank < max_cell_rank; ++cell_rank) {
+                    const float32_t first_cell_umis = umis_of_rank(cell_rank);
+                    const float32_t second_cell_umis = umis_of_rank(cell_rank + gap_skip_cells);
+                    if (first_cell_umis + second_cell_umis + 1e-6 < min_compare_umis) {
+                        continue;
+                    }
 
-                    if (start_gap < full_gap) {
-                        stop_cell_position += 1;
+                    const float32_t first_cell_log_fraction = log_fraction_of_rank(cell_rank);
+                    const float32_t second_cell_log_fraction = log_fraction_of_rank(cell_rank + gap_skip_cells);
+                    const float32_t full_gap = second_cell_log_fraction - first_cell_log_fraction - min_gap_of_gene;
+                    if (full_gap < 0.0) {
+                        continue;
                     }
-                }
 
-                for (size_t gap_cell_position = 0; gap_cell_position <= stop_cell_position; ++gap_cell_position) {
-                    const size_t gap_cell_index = cell_index_of_position[gap_cell_position];
-                    max_gap_per_cell[gap_cell_index] = std::max(max_gap_per_cell[gap_cell_index], full_gap);
-                }
-            }
+                    size_t stop_cell_rank = cell_rank + 1;
+                    if (gap_skip_cells > 1) {
+                        const float32_t middle_cell_log_fraction = log_fraction_of_rank(cell_rank + 1);
+                        const float32_t start_gap =
+                            2.0 * (middle_cell_log_fraction - first_cell_log_fraction) - min_gap_of_gene;
 
-            for (size_t cell_offset = 0; cell_offset < max_cell_position; ++cell_offset) {
-                const size_t cell_position = candidate_cells_count - 1 - cell_offset - gap_skip_cells;
-                const size_t first_cell_index = cell_index_of_position[cell_position];
-                const size_t second_cell_index = cell_index_of_position[cell_position + gap_skip_cells];
+                        if (start_gap < full_gap) {
+                            stop_cell_rank += 1;
+                        }
+                    }
 
-                const float32_t first_cell_umis = umis_per_gene_per_cell(first_cell_index, gene_index);
-                const float32_t second_cell_umis = umis_per_gene_per_cell(second_cell_index, gene_index);
-                if (first_cell_umis + second_cell_umis < min_compare_umis) {
-                    continue;
+                    for (size_t gap_cell_rank = 0; gap_cell_rank <= stop_cell_rank; ++gap_cell_rank) {
+                        const size_t gap_cell_index = cell_index_of_rank(gap_cell_rank);
+                        max_gap_per_cell[gap_cell_index] = std::max(max_gap_per_cell[gap_cell_index], full_gap);
+                    }
                 }
 
-                const float32_t first_cell_log_fraction = log_fraction_per_gene_per_cell(first_cell_index, gene_index);
-                const float32_t second_cell_log_fraction =
-                    log_fraction_per_gene_per_cell(second_cell_index, gene_index);
+                for (size_t cell_offset = 0; cell_offset < max_cell_rank; ++cell_offset) {
+                    const size_t cell_rank = candidate_cells_count - 1 - cell_offset - gap_skip_cells;
 
-                const float32_t full_gap = second_cell_log_fraction - first_cell_log_fraction - min_gap_of_gene;
-                if (full_gap <= 0.0) {
-                    continue;
-                }
+                    const float32_t first_cell_umis = umis_of_rank(cell_rank);
+                    const float32_t second_cell_umis = umis_of_rank(cell_rank + gap_skip_cells);
+                    if (first_cell_umis + second_cell_umis < min_compare_umis) {
+                        continue;
+                    }
 
-                size_t start_cell_position = cell_position + 1;
+                    const float32_t first_cell_log_fraction = log_fraction_of_rank(cell_rank);
+                    const float32_t second_cell_log_fraction = log_fraction_of_rank(cell_rank + gap_skip_cells);
+
+                    const float32_t full_gap = second_cell_log_fraction - first_cell_log_fraction - min_gap_of_gene;
+                    if (full_gap <= 0.0) {
+                        continue;
+                    }
 
-                if (gap_skip_cells > 1) {
-                    const size_t middle_cell_index = cell_index_of_position[cell_position + 1];
-                    const float32_t middle_cell_log_fraction =
-                        log_fraction_per_gene_per_cell(middle_cell_index, gene_index);
-                    const float32_t start_gap =
-                        2.0 * (middle_cell_log_fraction - first_cell_log_fraction) - min_gap_of_gene;
+                    size_t start_cell_rank = cell_rank + 1;
 
-                    if (start_gap < full_gap) {
-                        start_cell_position += 1;
+                    if (gap_skip_cells > 1) {
+                        const float32_t middle_cell_log_fraction = log_fraction_of_rank(cell_rank + 1);
+                        const float32_t start_gap =
+                            2.0 * (middle_cell_log_fraction - first_cell_log_fraction) - min_gap_of_gene;
+
+                        if (start_gap < full_gap) {
+                            start_cell_rank += 1;
+                        }
                     }
-                }
 
-                for (size_t gap_cell_position = start_cell_position; gap_cell_position < candidate_cells_count;
-                     ++gap_cell_position) {
-                    const size_t gap_cell_index = cell_index_of_position[gap_cell_position];
-                    max_gap_per_cell[gap_cell_index] = std::max(max_gap_per_cell[gap_cell_index], full_gap);
+                    for (size_t gap_cell_rank = start_cell_rank; gap_cell_rank < candidate_cells_count;
+                         ++gap_cell_rank) {
+                        const size_t gap_cell_index = cell_index_of_rank(gap_cell_rank);
+                        max_gap_per_cell[gap_cell_index] = std::max(max_gap_per_cell[gap_cell_index], full_gap);
+                    }
                 }
             }
         }
@@ -1,14 +1,291 @@
 #include "metacells/extensions.h"
 
+#ifdef HAS_SIMD_DISPATCH
+#    include <immintrin.h>
+#endif
+
 namespace metacells {
 
+/// Sum the logistic function of the absolute differences between the elements of two rows.
+template<typename F>
+using LogisticsFunction = float64_t (*)(const F* first_data,
+                                        const F* second_data,
+                                        size_t size,
+                                        float64_t location,
+                                        float64_t slope);
+
+template<typename F>
+static float64_t
+exact_logistics_sum(const F* const first_data,
+                    const F* const second_data,
+                    const size_t size,
+                    const float64_t location,
+                    const float64_t slope) {
+    float64_t result = 0;
+
+#ifdef __INTEL_COMPILER
+#    pragma simd
+#endif
+    for (size_t index = 0; index < size; ++index) {
+        float64_t diff = fabs(first_data[index] - second_data[index]);
+        result += 1 / (1 + exp(slope * (location - diff)));
+    }
+
+    return result;
+}
+
+// The fast logistic function computes `1 / (1 + exp(z))` in single precision, where `exp(z) = 2^n * 2^f` for an
+// integer `n` and `f` in `[-0.5, 0.5]`. The `2^f` factor is approximated by the Taylor series of `exp(f * ln(2))` up to
+// the 6th power, whose truncation error is below 1.2e-7 (relative). Together with the single precision rounding,
+// each logistic term is within 2e-7 (absolute) of the exact value, and so is the average over the row elements.
+
+static const float32_t FAST_LOG2E = 1.4426950408889634f;
+static const float32_t FAST_MAX_EXPONENT = 126.0f;
+static const float32_t FAST_EXP2_C1 = 0.6931471805599453f;
+static const float32_t FAST_EXP2_C2 = 0.2402265069591007f;
+static const float32_t FAST_EXP2_C3 = 0.0555041086648216f;
+static const float32_t FAST_EXP2_C4 = 0.0096181291076285f;
+static const float32_t FAST_EXP2_C5 = 0.0013333558146428f;
+static const float32_t FAST_EXP2_C6 = 0.0001540353039338f;
+
+static inline float32_t
+fast_logistic(const float32_t z) {
+    const float32_t exponent = std::min(std::max(z * FAST_LOG2E, -FAST_MAX_EXPONENT), FAST_MAX_EXPONENT);
+    const float32_t integer = std::nearbyint(exponent);
+    const float32_t fraction = exponent - integer;
+    float32_t power = FAST_EXP2_C6;
+    power = power * fraction + FAST_EXP2_C5;
+    power = power * fraction + FAST_EXP2_C4;
+    power = power * fraction + FAST_EXP2_C3;
+    power = power * fraction + FAST_EXP2_C2;
+    power = power * fraction + FAST_EXP2_C1;
+    power = power * fraction + 1.0f;
+    const int32_t bits = (int32_t(integer) + 127) << 23;
+    float32_t scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return 1.0f / (1.0f + power * scale);
+}
+
+template<typename F>
+static float64_t
+generic_fast_logistics_sum(const F* const first_data,
+                           const F* const second_data,
+                           const size_t size,
+                           const float64_t location,
+                           const float64_t slope) {
+    const float32_t float_location = float32_t(location);
+    const float32_t float_slope = float32_t(slope);
+    float64_t result = 0;
+    for (size_t index = 0; index < size; ++index) {
+        const float32_t diff = float32_t(fabs(first_data[index] - second_data[index]));
+        result += fast_logistic(float_slope * (float_location - diff));
+    }
+    return result;
+}
+
+#ifdef HAS_SIMD_DISPATCH
+
+__attribute__((target("avx2,fma"))) static inline __m256
+avx2_fast_logistic(const __m256 z) {
+    const __m256 exponent = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(z, _mm256_set1_ps(FAST_LOG2E)),
+                                                        _mm256_set1_ps(-FAST_MAX_EXPONENT)),
+                                          _mm256_set1_ps(FAST_MAX_EXPONENT));
+    const __m256 integer = _mm256_round_ps(exponent, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    const __m256 fraction = _mm256_sub_ps(exponent, integer);
+    __m256 power = _mm256_set1_ps(FAST_EXP2_C6);
+    power = _mm256_fmadd_ps(power, fraction, _mm256_set1_ps(FAST_EXP2_C5));
+    power = _mm256_fmadd_ps(power, fraction, _mm256_set1_ps(FAST_EXP2_C4));
+    power = _mm256_fmadd_ps(power, fraction, _mm256_set1_ps(FAST_EXP2_C3));
+    power = _mm256_fmadd_ps(power, fraction, _mm256_set1_ps(FAST_EXP2_C2));
+    power = _mm256_fmadd_ps(power, fraction, _mm256_set1_ps(FAST_EXP2_C1));
+    power = _mm256_fmadd_ps(power, fraction, _mm256_set1_ps(1.0f));
+    const __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(integer), _mm256_set1_epi32(127)), 23);
+    const __m256 exp_z = _mm256_mul_ps(power, _mm256_castsi256_ps(bits));
+    return _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_add_ps(_mm256_set1_ps(1.0f), exp_z));
+}
+
+__attribute__((target("avx2,fma"))) static inline void
+avx2_accumulate(const __m256 values, __m256d& low_sums, __m256d& high_sums) {
+    low_sums = _mm256_add_pd(low_sums, _mm256_cvtps_pd(_mm256_castps256_ps128(values)));
+    high_sums = _mm256_add_pd(high_sums, _mm256_cvtps_pd(_mm256_extractf128_ps(values, 1)));
+}
+
+__attribute__((target("avx2,fma"))) static inline float64_t
+avx2_logistics_total(const __m256d low_sums, const __m256d high_sums) {
+    const __m256d sums = _mm256_add_pd(low_sums, high_sums);
+    const __m128d pair_sums = _mm_add_pd(_mm256_castpd256_pd128(sums), _mm256_extractf128_pd(sums, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(pair_sums, _mm_unpackhi_pd(pair_sums, pair_sums)));
+}
+
+__attribute__((target("avx2,fma"))) static float64_t
+avx2_fast_logistics_sum(const float32_t* const first_data,
+                        const float32_t* const second_data,
+                        const size_t size,
+                        const float64_t location,
+                        const float64_t slope) {
+    const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+    const __m256 location_values = _mm256_set1_ps(float32_t(location));
+    const __m256 slope_values = _mm256_set1_ps(float32_t(slope));
+    __m256d low_sums = _mm256_setzero_pd();
+    __m256d high_sums = _mm256_setzero_pd();
+    size_t index = 0;
+    for (; index + 8 <= size; index += 8) {
+        const __m256 diff = _mm256_andnot_ps(
+            sign_mask,
+            _mm256_sub_ps(_mm256_loadu_ps(first_data + index), _mm256_loadu_ps(second_data + index)));
+        const __m256 z = _mm256_mul_ps(slope_values, _mm256_sub_ps(location_values, diff));
+        avx2_accumulate(avx2_fast_logistic(z), low_sums, high_sums);
+    }
+    return avx2_logistics_total(low_sums, high_sums)
+           + generic_fast_logistics_sum(first_data + index, second_data + index, size - index, location, slope);
+}
+
+__attribute__((target("avx2,fma"))) static float64_t
+avx2_fast_logistics_sum(const float64_t* const first_data,
+                        const float64_t* const second_data,
+                        const size_t size,
+                        const float64_t location,
+                        const float64_t slope) {
+    const __m256d sign_mask = _mm256_set1_pd(-0.0);
+    const __m256 location_values = _mm256_set1_ps(float32_t(location));
+    const __m256 slope_values = _mm256_set1_ps(float32_t(slope));
+    __m256d low_sums = _mm256_setzero_pd();
+    __m256d high_sums = _mm256_setzero_pd();
+    size_t index = 0;
+    for (; index + 8 <= size; index += 8) {
+        const __m128 low_diff = _mm256_cvtpd_ps(_mm256_andnot_pd(
+            sign_mask,
+            _mm256_sub_pd(_mm256_loadu_pd(first_data + index), _mm256_loadu_pd(second_data + index))));
+        const __m128 high_diff = _mm256_cvtpd_ps(_mm256_andnot_pd(
+            sign_mask,
+            _mm256_sub_pd(_mm256_loadu_pd(first_data + index + 4), _mm256_loadu_pd(second_data + index + 4))));
+        const __m256 diff = _mm256_insertf128_ps(_mm256_castps128_ps256(low_diff), high_diff, 1);
+        const __m256 z = _mm256_mul_ps(slope_values, _mm256_sub_ps(location_values, diff));
+        avx2_accumulate(avx2_fast_logistic(z), low_sums, high_sums);
+    }
+    return avx2_logistics_total(low_sums, high_sums)
+           + generic_fast_logistics_sum(first_data + index, second_data + index, size - index, location, slope);
+}
+
+__attribute__((target("avx512f"))) static float64_t
+avx512_fast_logistics_sum(const float32_t* const first_data,
+                          const float32_t* const second_data,
+                          const size_t size,
+                          const float64_t location,
+                          const float64_t slope) {
+    const __m512 location_values = _mm512_set1_ps(float32_t(location));
+    const __m512 slope_values = _mm512_set1_ps(float32_t(slope));
+    __m512d low_sums = _mm512_setzero_pd();
+    __m512d high_sums = _mm512_setzero_pd();
+    for (size_t index = 0; index < size; index += 16) {
+        const __mmask16 mask = size - index >= 16 ? __mmask16(0xFFFF) : __mmask16((1U << (size - index)) - 1);
+        const __m512 diff = _mm512_abs_ps(_mm512_sub_ps(_mm512_maskz_loadu_ps(mask, first_data + index),
+                                                        _mm512_maskz_loadu_ps(mask, second_data + index)));
+        const __m512 z = _mm512_mul_ps(slope_values, _mm512_sub_ps(location_values, diff));
+        const __m512 exponent = _mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(z, _mm512_set1_ps(FAST_LOG2E)),
+                                                            _mm512_set1_ps(-FAST_MAX_EXPONENT)),
+                                              _mm512_set1_ps(FAST_MAX_EXPONENT));
+        const __m512 integer = _mm512_roundscale_ps(exponent, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        const __m512 fraction = _mm512_sub_ps(exponent, integer);
+        __m512 power = _mm512_set1_ps(FAST_EXP2_C6);
+        power = _mm512_fmadd_ps(power, fraction, _mm512_set1_ps(FAST_EXP2_C5));
+        power = _mm512_fmadd_ps(power, fraction, _mm512_set1_ps(FAST_EXP2_C4));
+        power = _mm512_fmadd_ps(power, fraction, _mm512_set1_ps(FAST_EXP2_C3));
+        power = _mm512_fmadd_ps(power, fraction, _mm512_set1_ps(FAST_EXP2_C2));
+        power = _mm512_fmadd_ps(power, fraction, _mm512_set1_ps(FAST_EXP2_C1));
+        power = _mm512_fmadd_ps(power, fraction, _mm512_set1_ps(1.0f));
+        const __m512i bits =
+            _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(integer), _mm512_set1_epi32(127)), 23);
+        const __m512 exp_z = _mm512_mul_ps(power, _mm512_castsi512_ps(bits));
+        const __m512 logistic = _mm512_maskz_div_ps(mask,
+                                                    _mm512_set1_ps(1.0f),
+                                                    _mm512_add_ps(_mm512_set1_ps(1.0f), exp_z));
+        low_sums = _mm512_add_pd(low_sums, _mm512_cvtps_pd(_mm512_castps512_ps256(logistic)));
+        high_sums = _mm512_add_pd(
+            high_sums,
+            _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(logistic), 1))));
+    }
+    return _mm512_reduce_add_pd(_mm512_add_pd(low_sums, high_sums));
+}
+
+#endif
+
+/// The logistics kernels to use, chosen by `select_logistics_kernels` according to the available instructions.
+template<typename F>
+struct LogisticsKernels {
+    static LogisticsFunction<F> fast_sum;
+};
+
+template<typename F>
+LogisticsFunction<F> LogisticsKernels<F>::fast_sum = generic_fast_logistics_sum<F>;
+
+template<typename F>
+static void
+select_logistics_kernels() {
+#ifdef HAS_SIMD_DISPATCH
+    if (simd_level() >= SIMD_AVX2) {
+        LogisticsKernels<F>::fast_sum = avx2_fast_logistics_sum;
+    }
+#endif
+}
+
+template<>
+void
+select_logistics_kernels<float32_t>() {
+#ifdef HAS_SIMD_DISPATCH
+    switch (simd_level()) {
+    case SIMD_AVX512:
+        LogisticsKernels<float32_t>::fast_sum = avx512_fast_logistics_sum;
+        break;
+    case SIMD_AVX2:
+        LogisticsKernels<float32_t>::fast_sum = avx2_fast_logistics_sum;
+        break;
+    case SIMD_GENERIC:
+        break;
+    }
+#endif
+}
+
+template<typename F>
+static LogisticsFunction<F>
+logistics_function(const bool fast) {
+    return fast ? LogisticsKernels<F>::fast_sum : exact_logistics_sum<F>;
+}
+
+template<typename F>
+static float64_t
+logistics_two_dense_rows(ConstArraySlice<F> first_row,
+                         ConstArraySlice<F> second_row,
+                         const float64_t location,
+                         const float64_t slope,
+                         const LogisticsFunction<F> logistics_sum) {
+    FastAssertCompare(second_row.size(), ==, first_row.size());
+
+    const size_t size = first_row.size();
+    return logistics_sum(first_row.begin(), second_row.begin(), size, location, slope) / size;
+}
+
+/// The number of first rows in each tile of `cross_logistics_dense`.
+static const size_t LOGISTICS_FIRST_TILE_ROWS = 16;
+
+/// The number of second rows in each tile of `cross_logistics_dense`.
+static const size_t LOGISTICS_SECOND_TILE_ROWS = 64;
+
+/// The (approximate) size of the part of the rows of a tile which is processed in one block of columns.
+static const size_t LOGISTICS_BLOCK_BYTES = 64 * 1024;
+
+/// See the Python `metacell.utilities.computation.cross_logistics_rows` function.
+///
+/// Each task computes a tile of the output, iterating over blocks of columns small enough for the rows of the tile to
+/// fit in the cache.
 template<typename F>
 static void
 cross_logistics_dense(const pybind11::array_t<F>& first_input_array,
                       const pybind11::array_t<F>& second_input_array,
                       const float64_t location,
                       const float64_t slope,
-                      pybind11::array_t<float32_t>& output_array) {
+                      pybind11::array_t<float32_t>& output_array,
+                      const bool fast) {
     WithoutGil without_gil{};
     ConstMatrixSlice<F> first_input(first_input_array, "input");
     ConstMatrixSlice<F> second_input(second_input_array, "input");
@@ -16,32 +293,65 @@ cross_logistics_dense(const pybind11::array_t<F>& first_input_array,
 
     const auto first_rows_count = first_input.rows_count();
     const auto second_rows_count = second_input.rows_count();
-    FastAssertCompare(second_input.columns_count(), ==, first_input.columns_count());
+    const auto columns_count = first_input.columns_count();
+    FastAssertCompare(second_input.columns_count(), ==, columns_count);
 
     FastAssertCompare(output.rows_count(), ==, first_rows_count);
     FastAssertCompare(output.columns_count(), ==, second_rows_count);
 
+    const LogisticsFunction<F> logistics_sum = logistics_function<F>(fast);
     float64_t min_dist = float32_t(1.0 / (1.0 + exp(slope * location)));
     float64_t scale = 1.0 / (1.0 - min_dist);
-    parallel_loop(first_rows_count, [&](size_t first_row_index) {
-        auto output_row = output.get_row(first_row_index);
-        const auto first_input_row = first_input.get_row(first_row_index);
-
-        for (size_t second_row_index = 0; second_row_index < second_rows_count; ++second_row_index) {
-            const float64_t logistic =
-                logistics_two_dense_rows(first_input_row, second_input.get_row(second_row_index), location, slope);
-            output_row[second_row_index] = float32_t((logistic - min_dist) * scale);
+
+    const size_t first_tiles_count = (first_rows_count + LOGISTICS_FIRST_TILE_ROWS - 1) / LOGISTICS_FIRST_TILE_ROWS;
+    const size_t second_tiles_count =
+        (second_rows_count + LOGISTICS_SECOND_TILE_ROWS - 1) / LOGISTICS_SECOND_TILE_ROWS;
+    const size_t block_columns = std::max(
+        LOGISTICS_BLOCK_BYTES / ((LOGISTICS_FIRST_TILE_ROWS + LOGISTICS_SECOND_TILE_ROWS) * sizeof(F)),
+        size_t(16));
+
+    parallel_loop(first_tiles_count * second_tiles_count, 1, [&](size_t task_index) {
+        const size_t first_begin = (task_index / second_tiles_count) * LOGISTICS_FIRST_TILE_ROWS;
+        const size_t first_end = std::min(first_begin + LOGISTICS_FIRST_TILE_ROWS, first_rows_count);
+        const size_t second_begin = (task_index % second_tiles_count) * LOGISTICS_SECOND_TILE_ROWS;
+        const size_t second_end = std::min(second_begin + LOGISTICS_SECOND_TILE_ROWS, second_rows_count);
+
+        TmpVectorFloat64 sums_raii;
+        auto& sums = sums_raii.vector(LOGISTICS_FIRST_TILE_ROWS * LOGISTICS_SECOND_TILE_ROWS);
+
+        for (size_t block_begin = 0; block_begin < columns_count; block_begin += block_columns) {
+            const size_t block_size = std::min(block_columns, columns_count - block_begin);
+            for (size_t first_row_index = first_begin; first_row_index < first_end; ++first_row_index) {
+                const F* const first_data = first_input.get_row(first_row_index).begin() + block_begin;
+                float64_t* const sums_row = &sums[(first_row_index - first_begin) * LOGISTICS_SECOND_TILE_ROWS];
+                for (size_t second_row_index = second_begin; second_row_index < second_end; ++second_row_index) {
+                    const F* const second_data = second_input.get_row(second_row_index).begin() + block_begin;
+                    sums_row[second_row_index - second_begin] +=
+                        logistics_sum(first_data, second_data, block_size, location, slope);
+                }
+            }
+        }
+
+        for (size_t first_row_index = first_begin; first_row_index < first_end; ++first_row_index) {
+            auto output_row = output.get_row(first_row_index);
+            const float64_t* const sums_row = &sums[(first_row_index - first_begin) * LOGISTICS_SECOND_TILE_ROWS];
+            for (size_t second_row_index = second_begin; second_row_index < second_end; ++second_row_index) {
+                const float64_t logistic = sums_row[second_row_index - second_begin] / columns_count;
+                output_row[second_row_index] = float32_t((logistic - min_dist) * scale);
+            }
         }
     });
 }
 
+/// See the Python `metacell.utilities.computation.pairs_logistics_rows` function.
 template<typename F>
 static void
 pairs_logistics_dense(const pybind11::array_t<F>& first_input_array,
                       const pybind11::array_t<F>& second_input_array,
                       const float64_t location,
                       const float64_t slope,
-                      pybind11::array_t<float32_t>& output_array) {
+                      pybind11::array_t<float32_t>& output_array,
+                      const bool fast) {
     WithoutGil without_gil{};
     ConstMatrixSlice<F> first_input(first_input_array, "input");
     ConstMatrixSlice<F> second_input(second_input_array, "input");
@@ -54,44 +364,27 @@ pairs_logistics_dense(const pybind11::array_t<F>& first_input_array,
     FastAssertCompare(second_input.columns_count(), ==, columns_count);
     FastAssertCompare(output.size(), ==, rows_count);
 
+    const LogisticsFunction<F> logistics_sum = logistics_function<F>(fast);
     float64_t min_dist = float32_t(1.0 / (1.0 + exp(slope * location)));
     float64_t scale = 1.0 / (1.0 - min_dist);
     parallel_loop(rows_count, [&](size_t row_index) {
-        const float32_t logistic =
-            logistics_two_dense_rows(first_input.get_row(row_index), second_input.get_row(row_index), location, slope);
+        const float32_t logistic = logistics_two_dense_rows(first_input.get_row(row_index),
+                                                            second_input.get_row(row_index),
+                                                            location,
+                                                            slope,
+                                                            logistics_sum);
         output[row_index] = float32_t((logistic - min_dist) * scale);
     });
 }
 
-template<typename F>
-static float64_t
-logistics_two_dense_rows(ConstArraySlice<F> first_row,
-                         ConstArraySlice<F> second_row,
-                         const float64_t location,
-                         const float64_t slope) {
-    FastAssertCompare(second_row.size(), ==, first_row.size());
-
-    const size_t size = first_row.size();
-
-    float64_t result = 0;
-
-#ifdef __INTEL_COMPILER
-#    pragma simd
-#endif
-    for (size_t index = 0; index < size; ++index) {
-        float64_t diff = fabs(first_row[index] - second_row[index]);
-        result += 1 / (1 + exp(slope * (location - diff)));
-    }
-
-    return result / size;
-}
-
+/// See the Python `metacell.utilities.computation.logistics` function.
 template<typename F>
 static void
 logistics_dense(const pybind11::array_t<F>& input_array,
                 pybind11::array_t<float32_t>& output_array,
                 const float64_t location,
-                const float64_t slope) {
+                const float64_t slope,
+                const bool fast) {
     WithoutGil without_gil{};
     ConstMatrixSlice<F> input(input_array, "input");
     MatrixSlice<float32_t> output(output_array, "output");
@@ -107,6 +400,7 @@ logistics_dense(const pybind11::array_t<F>& input_array,
         output.get_row(entry_index)[entry_index] = 0;
     }
 
+    const LogisticsFunction<F> logistics_sum = logistics_function<F>(fast);
     float64_t min_dist = float32_t(1.0 / (1.0 + exp(slope * location)));
     float64_t scale = 1.0 / (1.0 - min_dist);
     parallel_loop(iterations_count, [&](size_t iteration_index) {
@@ -117,8 +411,11 @@ logistics_dense(const pybind11::array_t<F>& input_array,
         } else {
             other_index = rows_count - 2 - other_index;
         }
-        float64_t logistic =
-            logistics_two_dense_rows(input.get_row(some_index), input.get_row(other_index), location, slope);
+        float64_t logistic = logistics_two_dense_rows(input.get_row(some_index),
+                                                      input.get_row(other_index),
+                                                      location,
+                                                      slope,
+                                                      logistics_sum);
         logistic = (logistic - min_dist) * scale;
         output.get_row(some_index)[other_index] = float32_t(logistic);
         output.get_row(other_index)[some_index] = float32_t(logistic);
@@ -138,6 +435,9 @@ register_logistics(pybind11::module& module) {
 
     REGISTER_F(float32_t)
     REGISTER_F(float64_t)
+
+    select_logistics_kernels<float32_t>();
+    select_logistics_kernels<float64_t>();
 }
 
 }
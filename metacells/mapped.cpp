@@ -0,0 +1,449 @@
+#include "metacells/extensions.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace metacells {
+
+/// The alignment of the arrays in a mapped compressed matrix file.
+static const size_t MAPPED_ALIGNMENT = 4096;
+
+/// The first bytes of a mapped compressed matrix file.
+static const char MAPPED_MAGIC[8] = { 'M', 'C', 'C', 'S', 'R', '\0', '\0', '\1' };
+
+/// The header of a mapped compressed matrix file (all numbers are little-endian). Each of the `layout` and the dtypes
+/// is a zero-padded string; the arrays are at the specified byte offsets (which are aligned to pages).
+struct MappedHeader {
+    char magic[8];
+    char layout[16];
+    char dtypes[3][16];
+    uint64_t bands_count;
+    uint64_t elements_count;
+    uint64_t nnz;
+    uint64_t offsets[3];
+};
+
+static std::string
+header_string(const char* const text, const size_t size) {
+    return std::string(text, strnlen(text, size));
+}
+
+/// Read the whole header of a mapped compressed matrix file.
+static bool
+read_header(const int fd, MappedHeader& header) {
+    char* bytes = reinterpret_cast<char*>(&header);
+    size_t offset = 0;
+    while (offset < sizeof(header)) {
+        const ssize_t read_size = pread(fd, bytes + offset, sizeof(header) - offset, off_t(offset));
+        if (read_size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read_size <= 0) {
+            return false;
+        }
+        offset += size_t(read_size);
+    }
+    return true;
+}
+
+MappedCompressed::MappedCompressed(const std::string& path) : m_path(path), m_address(nullptr), m_size(0) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("failed to open: " + path + ": " + strerror(errno));
+    }
+
+    // Validate the header before mapping the file, as the destructor is not invoked if the constructor throws.
+    MappedHeader header;
+    struct stat status;
+    if (fstat(fd, &status) != 0 || size_t(status.st_size) < sizeof(MappedHeader) || !read_header(fd, header)
+        || memcmp(header.magic, MAPPED_MAGIC, sizeof(MAPPED_MAGIC)) != 0) {
+        close(fd);
+        throw std::runtime_error("not a mapped compressed matrix: " + path);
+    }
+    m_size = size_t(status.st_size);
+
+    m_layout = header_string(header.layout, sizeof(header.layout));
+    m_bands_count = header.bands_count;
+    m_elements_count = header.elements_count;
+    m_nnz = header.nnz;
+
+    for (size_t array_index = 0; array_index < 3; ++array_index) {
+        m_dtypes[array_index] = header_string(header.dtypes[array_index], sizeof(header.dtypes[array_index]));
+        try {
+            const pybind11::dtype dtype(m_dtypes[array_index]);
+            m_kinds[array_index] = dtype.kind();
+            m_itemsizes[array_index] = size_t(dtype.itemsize());
+        } catch (...) {
+            close(fd);
+            throw std::runtime_error("invalid dtype: " + m_dtypes[array_index]
+                                     + " of mapped compressed matrix: " + path);
+        }
+        m_offsets[array_index] = header.offsets[array_index];
+        const size_t entries_count = size(array_index);
+        const size_t itemsize = m_itemsizes[array_index];
+        if (itemsize == 0 || m_bands_count >= m_size || m_offsets[array_index] > m_size
+            || entries_count > (m_size - m_offsets[array_index]) / itemsize) {
+            close(fd);
+            throw std::runtime_error("truncated mapped compressed matrix: " + path);
+        }
+    }
+    if ((m_kinds[INDPTR] != 'i' && m_kinds[INDPTR] != 'u') || (m_itemsizes[INDPTR] != 4 && m_itemsizes[INDPTR] != 8)) {
+        close(fd);
+        throw std::runtime_error("invalid indptr dtype: " + m_dtypes[INDPTR] + " of mapped compressed matrix: " + path);
+    }
+
+    m_address = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m_address == MAP_FAILED) {
+        m_address = nullptr;
+        throw std::runtime_error("failed to map: " + path + ": " + strerror(errno));
+    }
+
+    // The positions of the bands are trusted by all the accesses to the data and indices, so verify them.
+    size_t previous_position = band_position(0);
+    bool are_positions_valid = previous_position == 0;
+    for (size_t band_index = 1; are_positions_valid && band_index <= m_bands_count; ++band_index) {
+        const size_t position = band_position(band_index);
+        are_positions_valid = previous_position <= position;
+        previous_position = position;
+    }
+    if (!are_positions_valid || previous_position != m_nnz) {
+        munmap(m_address, m_size);
+        m_address = nullptr;
+        throw std::runtime_error("invalid indptr of mapped compressed matrix: " + path);
+    }
+
+    madvise(m_address, m_size, MADV_SEQUENTIAL);
+}
+
+MappedCompressed::~MappedCompressed() {
+    if (m_address != nullptr) {
+        munmap(m_address, m_size);
+    }
+}
+
+size_t
+MappedCompressed::band_position(const size_t band_index) const {
+    FastAssertCompare(band_index, <=, m_bands_count);
+    const char* const indptr = address(INDPTR) + band_index * m_itemsizes[INDPTR];
+    if (m_itemsizes[INDPTR] == 4) {
+        uint32_t position;
+        memcpy(&position, indptr, 4);
+        return position;
+    } else {
+        FastAssertCompare(m_itemsizes[INDPTR], ==, 8);
+        uint64_t position;
+        memcpy(&position, indptr, 8);
+        return position;
+    }
+}
+
+static size_t
+round_up(const size_t value, const size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static size_t
+page_size() {
+    static const size_t s_page_size = size_t(sysconf(_SC_PAGESIZE));
+    return s_page_size;
+}
+
+/// Advise the OS we are about to read a range of bytes of the mapping.
+static void
+prefetch_range(char* const base, const size_t start_offset, const size_t stop_offset) {
+    if (start_offset >= stop_offset) {
+        return;
+    }
+    const size_t page_start_offset = start_offset - start_offset % page_size();
+    madvise(base + page_start_offset, stop_offset - page_start_offset, MADV_WILLNEED);
+}
+
+/// Touch each page of a range of bytes of the mapping, so it is read from the disk.
+static void
+read_range(const char* const base, const size_t start_offset, const size_t stop_offset) {
+    if (start_offset >= stop_offset) {
+        return;
+    }
+    volatile char sink = 0;
+    for (size_t offset = start_offset - start_offset % page_size(); offset < stop_offset; offset += page_size()) {
+        sink = sink + base[offset];
+    }
+}
+
+/// Release the pages which are entirely inside a range of bytes of the mapping.
+static void
+release_range(char* const base, const size_t start_offset, const size_t stop_offset) {
+    const size_t page_start_offset = round_up(start_offset, page_size());
+    const size_t page_stop_offset = stop_offset - stop_offset % page_size();
+    if (page_start_offset < page_stop_offset) {
+        madvise(base + page_start_offset, page_stop_offset - page_start_offset, MADV_DONTNEED);
+    }
+}
+
+template<typename F>
+static void
+for_bands_ranges(const MappedCompressed& mapped,
+                 const size_t* const offsets,
+                 const size_t start_band_index,
+                 const size_t stop_band_index,
+                 F function) {
+    FastAssertCompare(start_band_index, <=, stop_band_index);
+    FastAssertCompare(stop_band_index, <=, mapped.bands_count());
+
+    const size_t start_position = mapped.band_position(start_band_index);
+    const size_t stop_position = mapped.band_position(stop_band_index);
+    for (size_t array_index = MappedCompressed::DATA; array_index <= MappedCompressed::INDICES; ++array_index) {
+        const size_t itemsize = mapped.itemsize(array_index);
+        function(offsets[array_index] + start_position * itemsize, offsets[array_index] + stop_position * itemsize);
+    }
+}
+
+void
+MappedCompressed::prefetch_bands(const size_t start_band_index, const size_t stop_band_index) const {
+    char* const base = static_cast<char*>(m_address);
+    prefetch_range(base,
+                   m_offsets[INDPTR] + start_band_index * m_itemsizes[INDPTR],
+                   m_offsets[INDPTR] + (stop_band_index + 1) * m_itemsizes[INDPTR]);
+    for_bands_ranges(*this, m_offsets, start_band_index, stop_band_index, [&](size_t start_offset, size_t stop_offset) {
+        prefetch_range(base, start_offset, stop_offset);
+    });
+}
+
+void
+MappedCompressed::read_bands(const size_t start_band_index, const size_t stop_band_index) const {
+    const char* const base = static_cast<char*>(m_address);
+    for_bands_ranges(*this, m_offsets, start_band_index, stop_band_index, [&](size_t start_offset, size_t stop_offset) {
+        read_range(base, start_offset, stop_offset);
+    });
+}
+
+void
+MappedCompressed::release_bands(const size_t start_band_index, const size_t stop_band_index) const {
+    char* const base = static_cast<char*>(m_address);
+    for_bands_ranges(*this, m_offsets, start_band_index, stop_band_index, [&](size_t start_offset, size_t stop_offset) {
+        release_range(base, start_offset, stop_offset);
+    });
+}
+
+/// Write all the bytes to an offset in a file.
+static void
+write_bytes(const int fd, const char* bytes, size_t size, size_t offset, const std::string& path) {
+    while (size > 0) {
+        const ssize_t written = pwrite(fd, bytes, size, off_t(offset));
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            throw std::runtime_error("failed to write: " + path + ": " + strerror(errno));
+        }
+        bytes += written;
+        size -= size_t(written);
+        offset += size_t(written);
+    }
+}
+
+/// Plan the chunks of bands such that each one has at most `chunk_positions` entries (unless it is a single band).
+static std::vector<size_t>
+chunks_bands(const MappedCompressed& input, const size_t chunk_positions) {
+    std::vector<size_t> chunks_bands{ 0 };
+    while (chunks_bands.back() < input.bands_count()) {
+        const size_t start_band_index = chunks_bands.back();
+        const size_t stop_position = input.band_position(start_band_index) + chunk_positions;
+        size_t stop_band_index = start_band_index + 1;
+        while (stop_band_index < input.bands_count() && input.band_position(stop_band_index + 1) <= stop_position) {
+            ++stop_band_index;
+        }
+        chunks_bands.push_back(stop_band_index);
+    }
+    return chunks_bands;
+}
+
+void
+stream_mapped_bands(const MappedCompressed& input,
+                    const std::string& output_path,
+                    const std::string& output_dtype,
+                    const size_t output_itemsize,
+                    const size_t memory_budget,
+                    const std::function<void(size_t start_band_index, size_t stop_band_index, char* output)>&
+                        compute_chunk) {
+    FastAssertCompare(output_dtype.size(), <, sizeof(MappedHeader::dtypes[0]));
+
+    MappedHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAPPED_MAGIC, sizeof(MAPPED_MAGIC));
+    strncpy(header.layout, input.layout().c_str(), sizeof(header.layout) - 1);
+    strncpy(header.dtypes[MappedCompressed::DATA], output_dtype.c_str(), sizeof(header.dtypes[0]) - 1);
+    strncpy(header.dtypes[MappedCompressed::INDICES],
+            input.dtype(MappedCompressed::INDICES).c_str(),
+            sizeof(header.dtypes[0]) - 1);
+    strncpy(header.dtypes[MappedCompressed::INDPTR],
+            input.dtype(MappedCompressed::INDPTR).c_str(),
+            sizeof(header.dtypes[0]) - 1);
+    header.bands_count = input.bands_count();
+    header.elements_count = input.elements_count();
+    header.nnz = input.nnz();
+
+    size_t offset = sizeof(header);
+    for (size_t array_index = 0; array_index < 3; ++array_index) {
+        const size_t itemsize = array_index == MappedCompressed::DATA ? output_itemsize : input.itemsize(array_index);
+        offset = round_up(offset, MAPPED_ALIGNMENT);
+        header.offsets[array_index] = offset;
+        offset += input.size(array_index) * itemsize;
+    }
+
+    const int fd = open(output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        throw std::runtime_error("failed to create: " + output_path + ": " + strerror(errno));
+    }
+
+    // Each entry is resident twice in the input (computing one chunk while reading the next) and twice in the output
+    // (computing one chunk while writing the previous one).
+    const size_t input_entry_size = input.itemsize(MappedCompressed::DATA) + input.itemsize(MappedCompressed::INDICES);
+    const size_t chunk_positions = std::max(memory_budget / (2 * (input_entry_size + output_itemsize)), size_t(1));
+    const auto chunks_band_indices = chunks_bands(input, chunk_positions);
+    const size_t chunks_count = chunks_band_indices.size() - 1;
+
+    size_t max_chunk_positions = 0;
+    for (size_t chunk_index = 0; chunk_index < chunks_count; ++chunk_index) {
+        max_chunk_positions = std::max(max_chunk_positions,
+                                       input.band_position(chunks_band_indices[chunk_index + 1])
+                                           - input.band_position(chunks_band_indices[chunk_index]));
+    }
+    std::vector<char> output_buffers[2];
+    output_buffers[0].resize(max_chunk_positions * output_itemsize);
+    output_buffers[1].resize(max_chunk_positions * output_itemsize);
+
+    std::thread reader;
+    std::thread writer;
+    std::string write_error;
+
+    const auto write_chunk = [&](const size_t chunk_index) {
+        try {
+            const size_t start_position = input.band_position(chunks_band_indices[chunk_index]);
+            const size_t stop_position = input.band_position(chunks_band_indices[chunk_index + 1]);
+            const size_t indices_itemsize = input.itemsize(MappedCompressed::INDICES);
+            write_bytes(fd,
+                        output_buffers[chunk_index % 2].data(),
+                        (stop_position - start_position) * output_itemsize,
+                        header.offsets[MappedCompressed::DATA] + start_position * output_itemsize,
+                        output_path);
+            write_bytes(fd,
+                        input.address(MappedCompressed::INDICES) + start_position * indices_itemsize,
+                        (stop_position - start_position) * indices_itemsize,
+                        header.offsets[MappedCompressed::INDICES] + start_position * indices_itemsize,
+                        output_path);
+        } catch (const std::exception& exception) {
+            write_error = exception.what();
+        }
+    };
+
+    try {
+        write_bytes(fd, reinterpret_cast<const char*>(&header), sizeof(header), 0, output_path);
+        write_bytes(fd,
+                    input.address(MappedCompressed::INDPTR),
+                    input.size(MappedCompressed::INDPTR) * input.itemsize(MappedCompressed::INDPTR),
+                    header.offsets[MappedCompressed::INDPTR],
+                    output_path);
+
+        if (chunks_count > 0) {
+            input.read_bands(chunks_band_indices[0], chunks_band_indices[1]);
+        }
+
+        for (size_t chunk_index = 0; chunk_index < chunks_count; ++chunk_index) {
+            if (chunk_index + 1 < chunks_count) {
+                input.prefetch_bands(chunks_band_indices[chunk_index + 1], chunks_band_indices[chunk_index + 2]);
+                reader = std::thread([&input, &chunks_band_indices, chunk_index]() {
+                    input.read_bands(chunks_band_indices[chunk_index + 1], chunks_band_indices[chunk_index + 2]);
+                });
+            }
+
+            compute_chunk(chunks_band_indices[chunk_index],
+                          chunks_band_indices[chunk_index + 1],
+                          output_buffers[chunk_index % 2].data());
+
+            if (writer.joinable()) {
+                writer.join();
+                input.release_bands(chunks_band_indices[chunk_index - 1], chunks_band_indices[chunk_index]);
+            }
+            if (write_error.empty()) {
+                writer = std::thread(write_chunk, chunk_index);
+            }
+
+            if (reader.joinable()) {
+                reader.join();
+            }
+            if (!write_error.empty()) {
+                break;
+            }
+        }
+
+        if (writer.joinable()) {
+            writer.join();
+            input.release_bands(chunks_band_indices[chunks_count - 1], chunks_band_indices[chunks_count]);
+        }
+    } catch (...) {
+        if (reader.joinable()) {
+            reader.join();
+        }
+        if (writer.joinable()) {
+            writer.join();
+        }
+        close(fd);
+        throw;
+    }
+
+    if (close(fd) != 0 && write_error.empty()) {
+        write_error = "failed to write: " + output_path + ": " + strerror(errno);
+    }
+    if (!write_error.empty()) {
+        throw std::runtime_error(write_error);
+    }
+}
+
+/// A numpy array viewing one of the mapped arrays (which keeps the mapping alive).
+static pybind11::array
+mapped_array(const pybind11::object& mapped_object, const size_t array_index) {
+    const auto& mapped = mapped_object.cast<const MappedCompressed&>();
+    const auto itemsize = ssize_t(mapped.itemsize(array_index));
+    return pybind11::array(pybind11::dtype(mapped.dtype(array_index)),
+                           { ssize_t(mapped.size(array_index)) },
+                           { itemsize },
+                           mapped.address(array_index),
+                           mapped_object);
+}
+
+void
+register_mapped(pybind11::module& module) {
+    pybind11::class_<MappedCompressed>(module, "MappedCompressed", "A compressed matrix memory-mapped from a file.")
+        .def(pybind11::init<const std::string&>())
+        .def_property_readonly("path", &MappedCompressed::path, "The path of the mapped file.")
+        .def_property_readonly("layout", &MappedCompressed::layout, "The layout (row_major or column_major).")
+        .def_property_readonly("bands_count", &MappedCompressed::bands_count, "The number of bands.")
+        .def_property_readonly("elements_count", &MappedCompressed::elements_count, "The number of elements.")
+        .def_property_readonly("nnz", &MappedCompressed::nnz, "The number of non-zero entries.")
+        .def_property_readonly(
+            "data",
+            [](const pybind11::object& self) { return mapped_array(self, MappedCompressed::DATA); },
+            "The mapped data array.")
+        .def_property_readonly(
+            "indices",
+            [](const pybind11::object& self) { return mapped_array(self, MappedCompressed::INDICES); },
+            "The mapped indices array.")
+        .def_property_readonly(
+            "indptr",
+            [](const pybind11::object& self) { return mapped_array(self, MappedCompressed::INDPTR); },
+            "The mapped indptr array.")
+        .def("prefetch_bands",
+             [](const MappedCompressed& self, const size_t start_band_index, const size_t stop_band_index) {
+                 WithoutGil without_gil{};
+                 self.prefetch_bands(start_band_index, stop_band_index);
+             },
+             "Advise the OS to read ahead the data of a range of bands.");
+}
+
+}
@@ -78,8 +78,9 @@ relative_variance_window_size: int = 100
 
 #: The method to use to compute similarities. See
 #: :py:func:`metacells.tools.similarity.compute_obs_obs_similarity`,
+#: :py:func:`metacells.tools.similarity.compute_var_var_similarity`
 #: and
-#: :py:func:`metacells.tools.similarity.compute_var_var_similarity`.
+#: :py:func:`metacells.tools.knn_graph.extend_obs_obs_knn_graph`.
 similarity_method: str = "abs_pearson"
 
 #: The default location for the logistics function. See
@@ -564,6 +565,7 @@ min_knn_k: Optional[int] = 30
 #: K-Nearest-Neighbors graph. See
 #: :py:func:`metacells.tools.knn_graph.compute_obs_obs_knn_graph`,
 #: :py:func:`metacells.tools.knn_graph.compute_var_var_knn_graph`,
+#: :py:func:`metacells.tools.knn_graph.extend_obs_obs_knn_graph`,
 #: :py:func:`metacells.pipeline.direct.compute_direct_metacells`,
 #: :py:func:`metacells.pipeline.divide_and_conquer.compute_divide_and_conquer_metacells`,
 #: :py:func:`metacells.pipeline.divide_and_conquer.divide_and_conquer_pipeline`
@@ -575,6 +577,7 @@ knn_balanced_ranks_factor: float = sqrt(10)
 #: graph. See
 #: :py:func:`metacells.tools.knn_graph.compute_obs_obs_knn_graph`,
 #: :py:func:`metacells.tools.knn_graph.compute_var_var_knn_graph`,
+#: :py:func:`metacells.tools.knn_graph.extend_obs_obs_knn_graph`,
 #: :py:func:`metacells.pipeline.direct.compute_direct_metacells`,
 #: :py:func:`metacells.pipeline.divide_and_conquer.compute_divide_and_conquer_metacells`,
 #: :py:func:`metacells.pipeline.divide_and_conquer.divide_and_conquer_pipeline`
@@ -586,6 +589,7 @@ knn_incoming_degree_factor: float = 3.0
 #: graph. See
 #: :py:func:`metacells.tools.knn_graph.compute_obs_obs_knn_graph`,
 #: :py:func:`metacells.tools.knn_graph.compute_var_var_knn_graph`,
+#: :py:func:`metacells.tools.knn_graph.extend_obs_obs_knn_graph`,
 #: :py:func:`metacells.pipeline.direct.compute_direct_metacells`,
 #: :py:func:`metacells.pipeline.divide_and_conquer.compute_divide_and_conquer_metacells`,
 #: :py:func:`metacells.pipeline.divide_and_conquer.divide_and_conquer_pipeline`
@@ -633,6 +637,12 @@ cooldown_node: float = 0.25
 #: :py:func:`metacells.pipeline.divide_and_conquer.divide_and_conquer_pipeline`.
 cooldown_phase: float = 0.75
 
+#: How many nodes to consider in parallel when optimizing the partition of the nodes (if this is zero or one, the nodes
+#: are considered one at a time). See :py:func:`metacells.tools.candidates.compute_candidate_metacells`,
+#: :py:func:`metacells.tools.candidates.optimize_partitions` and
+#: :py:func:`metacells.tools.candidates.optimize_extended_partitions`.
+parallel_batch_size: int = 0
+
 #: The target total cluster size for clustering the nodes of the K-Nearest-Neighbors graph. See
 #: :py:const:`target_metacell_size`,
 #: :py:func:`metacells.tools.candidates.compute_candidate_metacells`,
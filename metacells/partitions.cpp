@@ -85,6 +85,116 @@ operator<<(std::ostream& os, const NodeScore& node_score) {
               << " total_incoming_weights: " << node_score.total_incoming_weights();
 }
 
+// Score information of each node for each partition.
+//
+// Most nodes are only connected to nodes in a few partitions, so we only store the score of each node for the
+// partitions that contain (at least) one of its neighbors. The entries of all the nodes are stored in one contiguous
+// array, where each node has a fixed capacity region (the number of its distinct neighbors, which bounds the number of
+// partitions they can belong to). Finding the entry of a partition is a linear scan of the (short) region.
+class SparseNodeScores {
+private:
+    struct Entry {
+        int32_t partition_index;
+        int32_t edges_count;
+        NodeScore score;
+    };
+
+    std::vector<size_t> m_first_entry_of_nodes;
+    std::vector<size_t> m_entries_count_of_nodes;
+    std::vector<Entry> m_entries;
+    const NodeScore m_empty_score;
+
+    ssize_t find_entry(const size_t node_index, const int32_t partition_index) const {
+        const size_t first_entry_index = m_first_entry_of_nodes[node_index];
+        const size_t stop_entry_index = first_entry_index + m_entries_count_of_nodes[node_index];
+        for (size_t entry_index = first_entry_index; entry_index < stop_entry_index; ++entry_index) {
+            if (m_entries[entry_index].partition_index == partition_index) {
+                return ssize_t(entry_index);
+            }
+        }
+        return -1;
+    }
+
+public:
+    SparseNodeScores(ConstCompressedMatrix<float32_t, int32_t, int32_t> outgoing_weights,
+                     ConstCompressedMatrix<float32_t, int32_t, int32_t> incoming_weights)
+      : m_first_entry_of_nodes(outgoing_weights.bands_count() + 1)
+      , m_entries_count_of_nodes(outgoing_weights.bands_count(), 0) {
+        const size_t nodes_count = m_entries_count_of_nodes.size();
+        m_first_entry_of_nodes[0] = 0;
+        for (size_t node_index = 0; node_index < nodes_count; ++node_index) {
+            const auto& node_outgoing_indices = outgoing_weights.get_band_indices(node_index);
+            const auto& node_incoming_indices = incoming_weights.get_band_indices(node_index);
+            const size_t outgoing_count = node_outgoing_indices.size();
+            const size_t incoming_count = node_incoming_indices.size();
+            size_t outgoing_position = 0;
+            size_t incoming_position = 0;
+            size_t neighbors_count = 0;
+            while (outgoing_position < outgoing_count || incoming_position < incoming_count) {
+                const int32_t no_node_index = int32_t(nodes_count);
+                const int32_t outgoing_node_index =
+                    outgoing_position < outgoing_count ? node_outgoing_indices[outgoing_position] : no_node_index;
+                const int32_t incoming_node_index =
+                    incoming_position < incoming_count ? node_incoming_indices[incoming_position] : no_node_index;
+                const int32_t other_node_index = std::min(outgoing_node_index, incoming_node_index);
+                outgoing_position += size_t(outgoing_node_index == other_node_index);
+                incoming_position += size_t(incoming_node_index == other_node_index);
+                ++neighbors_count;
+            }
+            m_first_entry_of_nodes[node_index + 1] = m_first_entry_of_nodes[node_index] + neighbors_count;
+        }
+        m_entries.resize(m_first_entry_of_nodes[nodes_count]);
+    }
+
+    /// The score of a node for a partition.
+    const NodeScore& get(const size_t node_index, const int32_t partition_index) const {
+        const ssize_t entry_index = find_entry(node_index, partition_index);
+        return entry_index < 0 ? m_empty_score : m_entries[entry_index].score;
+    }
+
+    /// Invoke `function(partition_index, score)` for each partition which contains a neighbor of the node. The score
+    /// of the node for any other partition is that of an empty `NodeScore`.
+    template<typename F>
+    void for_each_partition(const size_t node_index, F function) const {
+        const size_t first_entry_index = m_first_entry_of_nodes[node_index];
+        const size_t stop_entry_index = first_entry_index + m_entries_count_of_nodes[node_index];
+        for (size_t entry_index = first_entry_index; entry_index < stop_entry_index; ++entry_index) {
+            const Entry& entry = m_entries[entry_index];
+            function(entry.partition_index, entry.score);
+        }
+    }
+
+    /// Update the score of a node for a partition and return the new score, given the direction (+1 or -1) of the
+    /// change for each (0 or 1) of the incoming and outgoing edges between it and a node of the partition.
+    float64_t update(const size_t node_index,
+                     const int32_t partition_index,
+                     const int incoming_direction,
+                     const float64_t incoming_edge_weight,
+                     const int outgoing_direction,
+                     const float64_t outgoing_edge_weight) {
+        ssize_t entry_index = find_entry(node_index, partition_index);
+        if (entry_index < 0) {
+            const size_t entries_count = m_entries_count_of_nodes[node_index]++;
+            entry_index = ssize_t(m_first_entry_of_nodes[node_index] + entries_count);
+            FastAssertCompare(size_t(entry_index), <, m_first_entry_of_nodes[node_index + 1]);
+            m_entries[entry_index] = Entry{ partition_index, 0, NodeScore() };
+        }
+
+        Entry& entry = m_entries[entry_index];
+        entry.edges_count += incoming_direction + outgoing_direction;
+        SlowAssertCompare(entry.edges_count, >=, 0);
+        if (entry.edges_count == 0) {
+            const size_t last_entry_index = m_first_entry_of_nodes[node_index] + --m_entries_count_of_nodes[node_index];
+            m_entries[entry_index] = m_entries[last_entry_index];
+            return m_empty_score.score();
+        }
+
+        entry.score.update_incoming(incoming_direction, incoming_edge_weight);
+        entry.score.update_outgoing(outgoing_direction, outgoing_edge_weight);
+        return entry.score.rescore();
+    }
+};
+
 static std::vector<size_t>
 initial_size_of_partitions(ConstArraySlice<int32_t> partitions_of_nodes) {
     std::vector<size_t> size_of_partitions;
@@ -127,7 +237,7 @@ initial_incoming_scale(ConstCompressedMatrix<float32_t, int32_t, int32_t> incomi
     return incoming_scale;
 }
 
-static std::vector<std::vector<NodeScore>>
+static SparseNodeScores
 initial_score_of_nodes_of_partitions(ConstCompressedMatrix<float32_t, int32_t, int32_t> outgoing_weights,
                                      ConstCompressedMatrix<float32_t, int32_t, int32_t> incoming_weights,
                                      ConstArraySlice<int32_t> partition_of_nodes,
@@ -135,10 +245,7 @@ initial_score_of_nodes_of_partitions(ConstCompressedMatrix<float32_t, int32_t, i
     LOCATED_LOG(false) << " initial_score_of_partitions" << std::endl;
     size_t nodes_count = outgoing_weights.bands_count();
 
-    std::vector<std::vector<NodeScore>> score_of_nodes_of_partitions(partitions_count);
-    for (size_t partition_index = 0; partition_index < partitions_count; ++partition_index) {
-        score_of_nodes_of_partitions[partition_index].resize(nodes_count);
-    }
+    SparseNodeScores score_of_nodes_of_partitions(outgoing_weights, incoming_weights);
 
     for (size_t node_index = 0; node_index < nodes_count; ++node_index) {
         const int partition_index = partition_of_nodes[node_index];
@@ -171,11 +278,8 @@ initial_score_of_nodes_of_partitions(ConstCompressedMatrix<float32_t, int32_t, i
                 << " edge weight: " << edge_weight                   //
                 << std::endl;
 
-            score_of_nodes_of_partitions[other_partition_index][node_index].update_outgoing(+1, edge_weight);
-            score_of_nodes_of_partitions[other_partition_index][node_index].rescore();
-
-            score_of_nodes_of_partitions[partition_index][other_node_index].update_incoming(+1, edge_weight);
-            score_of_nodes_of_partitions[partition_index][other_node_index].rescore();
+            score_of_nodes_of_partitions.update(node_index, other_partition_index, 0, 0, +1, edge_weight);
+            score_of_nodes_of_partitions.update(other_node_index, partition_index, +1, edge_weight, 0, 0);
         }
 
 #if ASSERT_LEVEL > 0
@@ -190,13 +294,13 @@ initial_score_of_nodes_of_partitions(ConstCompressedMatrix<float32_t, int32_t, i
                 LOCATED_LOG(false)                                                              //
                     << " node_index: " << node_index                                            //
                     << " current partition_index: " << partition_index                          //
-                    << " score: " << score_of_nodes_of_partitions[partition_index][node_index]  //
+                    << " score: " << score_of_nodes_of_partitions.get(node_index, partition_index)  //
                     << std::endl;
             } else {
                 LOCATED_LOG(false)                                                              //
                     << " node_index: " << node_index                                            //
                     << " other partition_index: " << partition_index                            //
-                    << " score: " << score_of_nodes_of_partitions[partition_index][node_index]  //
+                    << " score: " << score_of_nodes_of_partitions.get(node_index, partition_index)  //
                     << std::endl;
             }
         }
@@ -209,12 +313,12 @@ static std::vector<float64_t>
 initial_score_of_partitions(size_t nodes_count,
                             ConstArraySlice<int32_t> partitions_of_nodes,
                             const size_t partitions_count,
-                            const std::vector<std::vector<NodeScore>>& score_of_nodes_of_partitions) {
+                            const SparseNodeScores& score_of_nodes_of_partitions) {
     std::vector<float64_t> score_of_partitions(partitions_count, 0);
 
     for (size_t node_index = 0; node_index < nodes_count; ++node_index) {
         const int partition_index = partitions_of_nodes[node_index];
-        score_of_partitions[partition_index] += score_of_nodes_of_partitions[partition_index][node_index].score();
+        score_of_partitions[partition_index] += score_of_nodes_of_partitions.get(node_index, partition_index).score();
     }
 
     return score_of_partitions;
@@ -236,9 +340,14 @@ initial_mass_of_partitions(size_t nodes_count,
 }
 
 #if ASSERT_LEVEL > 0
-std::function<void()> g_verify;
+// Invoked after each change to the state of an optimizer. This is per-thread since several piles may be optimized
+// concurrently, each by a single thread (the thread invoking a parallel loop only executes the ranges of this loop).
+thread_local std::function<void()> g_verify;
 #endif
 
+// Marks a node skipped (due to its temperature) in a parallel batch of nodes.
+static const int32_t SKIPPED_NODE = -2;
+
 // Optimize the partition of a graph.
 struct OptimizePartitions {
     ConstCompressedMatrix<float32_t, int32_t, int32_t> outgoing_weights;
@@ -251,41 +360,27 @@ struct OptimizePartitions {
     ArraySlice<int32_t> partition_of_nodes;
     std::vector<float64_t> temperature_of_nodes;
     std::vector<size_t> size_of_partitions;
-    const size_t partitions_count;
+    size_t partitions_count;
     float64_t incoming_scale;
-    std::vector<std::vector<NodeScore>> score_of_nodes_of_partitions;
+    SparseNodeScores score_of_nodes_of_partitions;
     std::vector<float64_t> mass_of_partitions;
     std::vector<float64_t> score_of_partitions;
 
-    OptimizePartitions(const pybind11::array_t<float32_t>& outgoing_weights_array,
-                       const pybind11::array_t<int32_t>& outgoing_indices_array,
-                       const pybind11::array_t<int32_t>& outgoing_indptr_array,
-                       const pybind11::array_t<float32_t>& incoming_weights_array,
-                       const pybind11::array_t<int32_t>& incoming_indices_array,
-                       const pybind11::array_t<int32_t>& incoming_indptr_array,
+    OptimizePartitions(ConstCompressedMatrix<float32_t, int32_t, int32_t> outgoing_weights,
+                       ConstCompressedMatrix<float32_t, int32_t, int32_t> incoming_weights,
                        const float64_t low_mass,
                        const float64_t target_mass,
                        const float64_t high_mass,
-                       const pybind11::array_t<float32_t>& mass_of_nodes_array,
-                       pybind11::array_t<int32_t>& partition_of_nodes_array)
-      : outgoing_weights(ConstCompressedMatrix<float32_t, int32_t, int32_t>(
-          ConstArraySlice<float32_t>(outgoing_weights_array, "outgoing_weights_array"),
-          ConstArraySlice<int32_t>(outgoing_indices_array, "outgoing_indices_array"),
-          ConstArraySlice<int32_t>(outgoing_indptr_array, "outgoing_indptr_array"),
-          int32_t(outgoing_indptr_array.size() - 1),
-          "outgoing_weights"))
-      , incoming_weights(ConstCompressedMatrix<float32_t, int32_t, int32_t>(
-            ConstArraySlice<float32_t>(incoming_weights_array, "incoming_weights_array"),
-            ConstArraySlice<int32_t>(incoming_indices_array, "incoming_indices_array"),
-            ConstArraySlice<int32_t>(incoming_indptr_array, "incoming_indptr_array"),
-            int32_t(incoming_indptr_array.size() - 1),
-            "incoming_weights"))
+                       ConstArraySlice<float32_t> mass_of_nodes,
+                       ArraySlice<int32_t> partition_of_nodes)
+      : outgoing_weights(outgoing_weights)
+      , incoming_weights(incoming_weights)
       , nodes_count(outgoing_weights.bands_count())
       , low_mass(low_mass)
       , target_mass(target_mass)
       , high_mass(high_mass)
-      , mass_of_nodes(mass_of_nodes_array, "mass_of_nodes")
-      , partition_of_nodes(partition_of_nodes_array, "partition_of_nodes")
+      , mass_of_nodes(mass_of_nodes)
+      , partition_of_nodes(partition_of_nodes)
       , temperature_of_nodes(nodes_count, 1.0)
       , size_of_partitions(initial_size_of_partitions(partition_of_nodes))
       , partitions_count(size_of_partitions.size())
@@ -304,6 +399,35 @@ struct OptimizePartitions {
         FastAssertCompare(target_mass, <, high_mass);
     }
 
+    OptimizePartitions(const pybind11::array_t<float32_t>& outgoing_weights_array,
+                       const pybind11::array_t<int32_t>& outgoing_indices_array,
+                       const pybind11::array_t<int32_t>& outgoing_indptr_array,
+                       const pybind11::array_t<float32_t>& incoming_weights_array,
+                       const pybind11::array_t<int32_t>& incoming_indices_array,
+                       const pybind11::array_t<int32_t>& incoming_indptr_array,
+                       const float64_t low_mass,
+                       const float64_t target_mass,
+                       const float64_t high_mass,
+                       const pybind11::array_t<float32_t>& mass_of_nodes_array,
+                       pybind11::array_t<int32_t>& partition_of_nodes_array)
+      : OptimizePartitions(ConstCompressedMatrix<float32_t, int32_t, int32_t>(
+                               ConstArraySlice<float32_t>(outgoing_weights_array, "outgoing_weights_array"),
+                               ConstArraySlice<int32_t>(outgoing_indices_array, "outgoing_indices_array"),
+                               ConstArraySlice<int32_t>(outgoing_indptr_array, "outgoing_indptr_array"),
+                               int32_t(outgoing_indptr_array.size() - 1),
+                               "outgoing_weights"),
+                           ConstCompressedMatrix<float32_t, int32_t, int32_t>(
+                               ConstArraySlice<float32_t>(incoming_weights_array, "incoming_weights_array"),
+                               ConstArraySlice<int32_t>(incoming_indices_array, "incoming_indices_array"),
+                               ConstArraySlice<int32_t>(incoming_indptr_array, "incoming_indptr_array"),
+                               int32_t(incoming_indptr_array.size() - 1),
+                               "incoming_weights"),
+                           low_mass,
+                           target_mass,
+                           high_mass,
+                           ConstArraySlice<float32_t>(mass_of_nodes_array, "mass_of_nodes"),
+                           ArraySlice<int32_t>(partition_of_nodes_array, "partition_of_nodes")) {}
+
     float64_t score(bool with_orphans = true) const {
         float64_t total_score = nodes_count * log2(float64_t(nodes_count)) - incoming_scale;
         size_t orphans_count = nodes_count;
@@ -341,8 +465,8 @@ struct OptimizePartitions {
 
         for (size_t partition_index = 0; partition_index < partitions_count; ++partition_index) {
             for (size_t node_index = 0; node_index < nodes_count; ++node_index) {
-                const auto& this_score_of_node = score_of_nodes_of_partitions[partition_index][node_index];
-                const auto& other_score_of_node = other.score_of_nodes_of_partitions[partition_index][node_index];
+                const auto& this_score_of_node = score_of_nodes_of_partitions.get(node_index, partition_index);
+                const auto& other_score_of_node = other.score_of_nodes_of_partitions.get(node_index, partition_index);
 
 #    define ASSERT_SCORE_FIELD(FIELD)                                                                                \
         if (fabs(this_score_of_node.FIELD() - other_score_of_node.FIELD()) > EPSILON) {                              \
@@ -374,8 +498,9 @@ struct OptimizePartitions {
                   float64_t cooldown_pass,
                   float64_t cooldown_node,
                   int32_t cold_partitions,
-                  float64_t cold_temperature) {
-        std::minstd_rand random(random_seed);
+                  float64_t cold_temperature,
+                  const size_t parallel_batch_size) {
+        PhiloxRandom random(random_seed);
 
         TmpVectorSizeT indices_raii;
         auto tmp_indices = indices_raii.vector(nodes_count);
@@ -423,6 +548,23 @@ struct OptimizePartitions {
         float64_t cooldown_rate = 1.0 - cooldown_pass / nodes_count;
         float64_t temperature = 1.0;
 
+        // In the parallel mode, we choose the target partitions of a batch of nodes in parallel, based on the state
+        // at the start of the batch, and then apply the moves serially (in the same order as the serial mode). A
+        // choice is made again (serially) if the state it was based on was changed by an earlier move in the batch.
+        std::vector<int32_t> chosen_partition_of_batch;
+        std::vector<float64_t> temperature_of_batch;
+        std::vector<size_t> batch_of_moved_nodes;
+        std::vector<size_t> batch_of_touched_partitions;
+        if (parallel_batch_size > 1) {
+            chosen_partition_of_batch.resize(parallel_batch_size);
+            temperature_of_batch.resize(parallel_batch_size);
+            batch_of_moved_nodes.resize(nodes_count, 0);
+            batch_of_touched_partitions.resize(partitions_count, 0);
+        }
+        size_t pass_index = 0;
+        size_t batch_index = 0;
+        size_t rechosen = 0;
+
         bool did_improve = true;
         bool did_skip = false;
         size_t total_unimproved = 0;
@@ -457,52 +599,148 @@ struct OptimizePartitions {
                     << std::endl;
             }
 
-            std::shuffle(tmp_indices.begin(), tmp_indices.end(), random);
+            random.shuffle(tmp_indices.begin(), tmp_indices.end());
             size_t skipped = 0;
             size_t improved = 0;
             size_t unimproved = 0;
-            for (size_t node_index : tmp_indices) {
-                temperature *= cooldown_rate;
+
+            const auto skip_node = [&](const size_t node_index) {
+                did_skip = true;
+                ++skipped;
+                LOCATED_LOG(false)                    //
+                    << " node_index: " << node_index  //
+                    << " skipped"                     //
+                    << std::endl;
+            };
+
+            const auto improved_node = [&](const size_t node_index) {
+                frozen_count -= frozen_nodes[node_index];
+                frozen_nodes[node_index] = uint8_t(0);
+                did_improve = true;
+                ++improved;
+                LOCATED_LOG(false)                    //
+                    << " node_index: " << node_index  //
+                    << " improved"                    //
+                    << std::endl;
+            };
+
+            const auto unimproved_node = [&](const size_t node_index, const float64_t node_temperature) {
+                frozen_count -= frozen_nodes[node_index];
+                frozen_nodes[node_index] = uint8_t(0);
+                temperature_of_nodes[node_index] = node_temperature * (1 - cooldown_node);
+                ++unimproved;
                 LOCATED_LOG(false)                                           //
-                    << " cooldown_rate: " << cooldown_rate                   //
-                    << " temperature: " << temperature                       //
                     << " node_index: " << node_index                         //
+                    << " unimproved"                                         //
                     << " temperature: " << temperature_of_nodes[node_index]  //
                     << std::endl;
-                if (temperature_of_nodes[node_index] < temperature) {
-                    did_skip = true;
-                    ++skipped;
-                    LOCATED_LOG(false)                    //
-                        << " node_index: " << node_index  //
-                        << " skipped"                     //
-                        << std::endl;
-                } else if (improve_node(node_index,
-                                        tmp_candidate_partitions,
-                                        tmp_partition_cold_diffs,
-                                        tmp_partition_hot_diffs,
-                                        tmp_partition_connectivity_diffs,
-                                        random,
-                                        temperature)) {
-                    frozen_count -= frozen_nodes[node_index];
-                    frozen_nodes[node_index] = uint8_t(0);
-                    did_improve = true;
-                    ++improved;
-                    LOCATED_LOG(false)                    //
-                        << " node_index: " << node_index  //
-                        << " improved"                    //
-                        << std::endl;
-                } else {
-                    frozen_count -= frozen_nodes[node_index];
-                    frozen_nodes[node_index] = uint8_t(0);
-                    temperature_of_nodes[node_index] = temperature * (1 - cooldown_node);
-                    ++unimproved;
+            };
+
+            if (parallel_batch_size < 2) {
+                for (size_t node_index : tmp_indices) {
+                    temperature *= cooldown_rate;
                     LOCATED_LOG(false)                                           //
+                        << " cooldown_rate: " << cooldown_rate                   //
+                        << " temperature: " << temperature                       //
                         << " node_index: " << node_index                         //
-                        << " unimproved"                                         //
                         << " temperature: " << temperature_of_nodes[node_index]  //
                         << std::endl;
+                    if (temperature_of_nodes[node_index] < temperature) {
+                        skip_node(node_index);
+                    } else if (improve_node(node_index,
+                                            tmp_candidate_partitions,
+                                            tmp_partition_cold_diffs,
+                                            tmp_partition_hot_diffs,
+                                            tmp_partition_connectivity_diffs,
+                                            random,
+                                            temperature)) {
+                        improved_node(node_index);
+                    } else {
+                        unimproved_node(node_index, temperature);
+                    }
+                }
+            } else {
+                const size_t pass_stream = 1 + pass_index * nodes_count;
+                for (size_t batch_start = 0; batch_start < nodes_count; batch_start += parallel_batch_size) {
+                    const size_t batch_size = std::min(parallel_batch_size, nodes_count - batch_start);
+                    ++batch_index;
+
+                    for (size_t batch_position = 0; batch_position < batch_size; ++batch_position) {
+                        temperature *= cooldown_rate;
+                        temperature_of_batch[batch_position] = temperature;
+                    }
+
+                    parallel_loop(batch_size, [&](size_t batch_position) {
+                        const size_t node_index = tmp_indices[batch_start + batch_position];
+                        const float64_t node_temperature = temperature_of_batch[batch_position];
+                        if (temperature_of_nodes[node_index] < node_temperature) {
+                            chosen_partition_of_batch[batch_position] = SKIPPED_NODE;
+                            return;
+                        }
+
+                        TmpVectorSizeT node_size_t_raii;
+                        CandidatePartitions node_candidate_partitions(node_size_t_raii, partitions_count);
+
+                        TmpVectorFloat64 node_cold_diffs_raii;
+                        auto& node_cold_diffs = node_cold_diffs_raii.vector(partitions_count);
+
+                        TmpVectorFloat64 node_hot_diffs_raii;
+                        auto& node_hot_diffs = node_hot_diffs_raii.vector(partitions_count);
+
+                        TmpVectorFloat64 node_connectivity_diffs_raii;
+                        auto& node_connectivity_diffs = node_connectivity_diffs_raii.vector(partitions_count);
+
+                        PhiloxRandom node_random(random_seed, pass_stream + batch_start + batch_position);
+                        chosen_partition_of_batch[batch_position] = choose_partition(node_index,
+                                                                                     node_candidate_partitions,
+                                                                                     node_cold_diffs,
+                                                                                     node_hot_diffs,
+                                                                                     node_connectivity_diffs,
+                                                                                     node_random,
+                                                                                     node_temperature);
+                    });
+
+                    for (size_t batch_position = 0; batch_position < batch_size; ++batch_position) {
+                        const size_t node_index = tmp_indices[batch_start + batch_position];
+                        const float64_t node_temperature = temperature_of_batch[batch_position];
+                        int32_t chosen_partition_index = chosen_partition_of_batch[batch_position];
+                        if (chosen_partition_index == SKIPPED_NODE) {
+                            skip_node(node_index);
+                            continue;
+                        }
+
+                        const int32_t current_partition_index = partition_of_nodes[node_index];
+                        if (is_stale_choice(node_index,
+                                            current_partition_index,
+                                            chosen_partition_index,
+                                            batch_index,
+                                            batch_of_moved_nodes,
+                                            batch_of_touched_partitions)) {
+                            ++rechosen;
+                            PhiloxRandom node_random(random_seed, pass_stream + batch_start + batch_position, 1);
+                            chosen_partition_index = choose_partition(node_index,
+                                                                      tmp_candidate_partitions,
+                                                                      tmp_partition_cold_diffs,
+                                                                      tmp_partition_hot_diffs,
+                                                                      tmp_partition_connectivity_diffs,
+                                                                      node_random,
+                                                                      node_temperature);
+                        }
+
+                        if (chosen_partition_index < 0) {
+                            unimproved_node(node_index, node_temperature);
+                        } else {
+                            move_node(node_index, current_partition_index, chosen_partition_index);
+                            batch_of_moved_nodes[node_index] = batch_index;
+                            batch_of_touched_partitions[current_partition_index] = batch_index;
+                            batch_of_touched_partitions[chosen_partition_index] = batch_index;
+                            improved_node(node_index);
+                        }
+                    }
                 }
             }
+            ++pass_index;
+
             LOCATED_LOG(false)                                      //
                 << " improved: " << improved                        //
                 << " unimproved: " << unimproved                    //
@@ -521,6 +759,7 @@ struct OptimizePartitions {
             << " unimproved: " << total_unimproved                                //
             << " skipped: " << total_skipped                                      //
             << " total: " << (total_improved + total_unimproved + total_skipped)  //
+            << " rechosen: " << rechosen                                          //
             << " frozen: " << frozen_count                                        //
             << " out of: " << nodes_count                                         //
             << std::endl;
@@ -531,13 +770,116 @@ struct OptimizePartitions {
             << std::endl;
     }
 
+    // Assign the nodes to new partitions, by moving just the nodes whose partition has changed. This is much cheaper
+    // than computing the state from scratch when most nodes stay in their partition.
+    void assign_partitions(ConstArraySlice<int32_t> new_partition_of_nodes) {
+        FastAssertCompare(new_partition_of_nodes.size(), ==, nodes_count);
+
+        size_t new_partitions_count = 0;
+        for (const int32_t partition_index : new_partition_of_nodes) {
+            FastAssertCompare(partition_index, >=, 0);
+            new_partitions_count = std::max(new_partitions_count, size_t(partition_index) + 1);
+        }
+
+        if (new_partitions_count > partitions_count) {
+            size_of_partitions.resize(new_partitions_count, 0);
+            mass_of_partitions.resize(new_partitions_count, 0);
+            score_of_partitions.resize(new_partitions_count, 0);
+            partitions_count = new_partitions_count;
+        }
+
+        for (size_t node_index = 0; node_index < nodes_count; ++node_index) {
+            const int32_t from_partition_index = partition_of_nodes[node_index];
+            const int32_t to_partition_index = new_partition_of_nodes[node_index];
+            if (from_partition_index != to_partition_index) {
+                reassign_node(node_index, from_partition_index, to_partition_index);
+            }
+        }
+
+        for (size_t partition_index = 0; partition_index < partitions_count; ++partition_index) {
+            if (partition_index < new_partitions_count) {
+                FastAssertCompare(size_of_partitions[partition_index], >, 0);
+            } else {
+                FastAssertCompare(size_of_partitions[partition_index], ==, 0);
+            }
+        }
+        partitions_count = new_partitions_count;
+        size_of_partitions.resize(partitions_count);
+
+        // Recompute the (cheap) per-partition sums so the many incremental updates do not accumulate round-off errors.
+        mass_of_partitions =
+            initial_mass_of_partitions(nodes_count, partition_of_nodes, partitions_count, mass_of_nodes);
+        score_of_partitions = initial_score_of_partitions(nodes_count,
+                                                          partition_of_nodes,
+                                                          partitions_count,
+                                                          score_of_nodes_of_partitions);
+
+#if ASSERT_LEVEL > 0
+        if (g_verify) {
+            g_verify();
+        }
+#endif
+    }
+
+    // Whether a partition chosen for a node in a parallel batch may no longer be valid, because an earlier move in
+    // the batch touched the current or chosen partition, or moved one of the node's neighbors.
+    bool is_stale_choice(const size_t node_index,
+                         const int32_t current_partition_index,
+                         const int32_t chosen_partition_index,
+                         const size_t batch_index,
+                         const std::vector<size_t>& batch_of_moved_nodes,
+                         const std::vector<size_t>& batch_of_touched_partitions) const {
+        if (batch_of_touched_partitions[current_partition_index] == batch_index
+            || (chosen_partition_index >= 0 && batch_of_touched_partitions[chosen_partition_index] == batch_index)) {
+            return true;
+        }
+
+        for (const auto other_node_index : outgoing_weights.get_band_indices(node_index)) {
+            if (batch_of_moved_nodes[other_node_index] == batch_index) {
+                return true;
+            }
+        }
+
+        for (const auto other_node_index : incoming_weights.get_band_indices(node_index)) {
+            if (batch_of_moved_nodes[other_node_index] == batch_index) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
     bool improve_node(size_t node_index,
                       CandidatePartitions& tmp_candidate_partitions,
                       std::vector<float64_t>& tmp_partition_cold_diffs,
                       std::vector<float64_t>& tmp_partition_hot_diffs,
                       std::vector<float64_t>& tmp_partition_connectivity_diffs,
-                      std::minstd_rand& random,
+                      PhiloxRandom& random,
                       const float64_t temperature) {
+        const int32_t chosen_partition_index = choose_partition(node_index,
+                                                                tmp_candidate_partitions,
+                                                                tmp_partition_cold_diffs,
+                                                                tmp_partition_hot_diffs,
+                                                                tmp_partition_connectivity_diffs,
+                                                                random,
+                                                                temperature);
+        if (chosen_partition_index < 0) {
+            return false;
+        }
+
+        move_node(node_index, partition_of_nodes[node_index], chosen_partition_index);
+        return true;
+    }
+
+    // Choose a better partition for a node, or return -1 if there is none. This only reads the state so it may be
+    // invoked concurrently for different nodes (using different temporary vectors).
+    int32_t choose_partition(size_t node_index,
+                             CandidatePartitions& tmp_candidate_partitions,
+                             std::vector<float64_t>& tmp_partition_cold_diffs,
+                             std::vector<float64_t>& tmp_partition_hot_diffs,
+                             std::vector<float64_t>& tmp_partition_connectivity_diffs,
+                             PhiloxRandom& random,
+                             const float64_t temperature) {
         const auto current_partition_index = partition_of_nodes[node_index];
         LOCATED_LOG(false)                                               //
             << " node_index: " << node_index                             //
@@ -546,7 +888,7 @@ struct OptimizePartitions {
             << std::endl;
 
         if (size_of_partitions[current_partition_index] < 2) {
-            return false;
+            return -1;
         }
 
         collect_initial_partition_diffs(node_index,
@@ -566,60 +908,74 @@ struct OptimizePartitions {
             << tmp_partition_connectivity_diffs[current_partition_index]  //
             << std::endl;
 
-        const float64_t current_cold_diff = collect_candidate_partitions(node_index,
-                                                                         current_partition_index,
-                                                                         tmp_partition_cold_diffs,
-                                                                         tmp_partition_hot_diffs,
-                                                                         tmp_partition_connectivity_diffs,
-                                                                         temperature,
-                                                                         tmp_candidate_partitions);
-
-        const int32_t chosen_partition_index =
-            choose_target_partition(current_partition_index, random, tmp_candidate_partitions);
-        if (chosen_partition_index < 0) {
-            return false;
-        }
-
-        const float64_t chosen_cold_diff = tmp_partition_cold_diffs[chosen_partition_index];
-        LOCATED_LOG(false)                                //
-            << " chosen_cold_diff: " << chosen_cold_diff  //
-            << std::endl;
-
-        update_scores_of_nodes(node_index, current_partition_index, chosen_partition_index);
-
-        update_partitions_of_nodes(node_index, current_partition_index, chosen_partition_index);
-
-        update_sizes_of_partitions(current_partition_index, chosen_partition_index);
+        collect_candidate_partitions(node_index,
+                                     current_partition_index,
+                                     tmp_partition_cold_diffs,
+                                     tmp_partition_hot_diffs,
+                                     tmp_partition_connectivity_diffs,
+                                     temperature,
+                                     tmp_candidate_partitions);
 
-        update_scores_of_partition(current_partition_index,
-                                   current_cold_diff,
-                                   chosen_partition_index,
-                                   chosen_cold_diff);
+        return choose_target_partition(current_partition_index, random, tmp_candidate_partitions);
+    }
 
-        update_masses_of_partition(node_index, current_partition_index, chosen_partition_index);
+    // Move a node between partitions, updating all the scores.
+    //
+    // The partition score diffs are computed while updating the scores of the neighbor nodes, rather than taken from
+    // `choose_partition`, so they are exact even if the choice was made based on a slightly stale state.
+    void move_node(const size_t node_index, const int32_t from_partition_index, const int32_t to_partition_index) {
+        reassign_node(node_index, from_partition_index, to_partition_index);
 
 #if ASSERT_LEVEL > 0
         if (g_verify) {
             g_verify();
         }
 #endif
+    }
 
-        return true;
+    // Move a node between partitions without verifying the result, which may temporarily contain an empty partition.
+    void reassign_node(const size_t node_index, const int32_t from_partition_index, const int32_t to_partition_index) {
+        float64_t from_cold_diff = -score_of_nodes_of_partitions.get(node_index, from_partition_index).score();
+        float64_t to_cold_diff = score_of_nodes_of_partitions.get(node_index, to_partition_index).score();
+
+        update_scores_of_nodes(node_index, from_partition_index, to_partition_index, from_cold_diff, to_cold_diff);
+
+        LOCATED_LOG(false)                            //
+            << " from_cold_diff: " << from_cold_diff  //
+            << " to_cold_diff: " << to_cold_diff      //
+            << std::endl;
+
+        update_partitions_of_nodes(node_index, from_partition_index, to_partition_index);
+
+        update_sizes_of_partitions(from_partition_index, to_partition_index);
+
+        update_scores_of_partition(from_partition_index, from_cold_diff, to_partition_index, to_cold_diff);
+
+        update_masses_of_partition(node_index, from_partition_index, to_partition_index);
     }
 
     void collect_initial_partition_diffs(const size_t node_index,
                                          const int32_t current_partition_index,
                                          std::vector<float64_t>& tmp_partition_cold_diffs,
                                          std::vector<float64_t>& tmp_partition_hot_diffs) {
+        const float64_t empty_score = NodeScore().score();
+        std::fill(tmp_partition_cold_diffs.begin(), tmp_partition_cold_diffs.end(), empty_score);
+        tmp_partition_cold_diffs[current_partition_index] = -empty_score;
+
+        score_of_nodes_of_partitions.for_each_partition(
+            node_index,
+            [&](const int32_t partition_index, const NodeScore& node_score) {
+                const int direction = 1 - 2 * (partition_index == current_partition_index);
+                tmp_partition_cold_diffs[partition_index] = direction * node_score.score();
+            });
+
+        std::copy(tmp_partition_cold_diffs.begin(), tmp_partition_cold_diffs.end(), tmp_partition_hot_diffs.begin());
+
         for (size_t partition_index = 0; partition_index < partitions_count; ++partition_index) {
-            const int direction = 1 - 2 * (int32_t(partition_index) == current_partition_index);
-            const auto score = direction * score_of_nodes_of_partitions[partition_index][node_index].score();
-            tmp_partition_cold_diffs[partition_index] = score;
-            tmp_partition_hot_diffs[partition_index] = score;
-            LOCATED_LOG(false)                              //
-                << " node_index: " << node_index            //
-                << " partition_index: " << partition_index  //
-                << " initial_diff: " << score               //
+            LOCATED_LOG(false)                                                     //
+                << " node_index: " << node_index                                   //
+                << " partition_index: " << partition_index                         //
+                << " initial_diff: " << tmp_partition_cold_diffs[partition_index]  //
                 << std::endl;
         }
     }
@@ -649,7 +1005,7 @@ struct OptimizePartitions {
         auto outgoing_edge_weight = node_outgoing_weights[outgoing_position];
         auto incoming_edge_weight = node_incoming_weights[incoming_position];
 
-        const auto& current_score = score_of_nodes_of_partitions[current_partition_index][node_index];
+        const auto& current_score = score_of_nodes_of_partitions.get(node_index, current_partition_index);
         const float64_t current_connectivity = current_score.connectivity();
 
         LOCATED_LOG(false)                                              //
@@ -658,23 +1014,23 @@ struct OptimizePartitions {
             << " current_connectivity" << current_connectivity          //
             << std::endl;
 
-        for (size_t partition_index = 0; partition_index < partitions_count; ++partition_index) {
-            if (partition_index == size_t(current_partition_index)) {
-                tmp_partition_connectivity_diffs[partition_index] = 0.0;
-                continue;
-            }
-
-            const auto& partition_score = score_of_nodes_of_partitions[partition_index][node_index];
-            const float64_t partition_connectivity = partition_score.connectivity();
-
-            LOCATED_LOG(false)                                      //
-                << " node_index: " << node_index                    //
-                << " other_partition_index: " << partition_index    //
-                << " other_connectivity" << partition_connectivity  //
-                << std::endl;
+        std::fill(tmp_partition_connectivity_diffs.begin(),
+                  tmp_partition_connectivity_diffs.end(),
+                  -current_connectivity);
+        score_of_nodes_of_partitions.for_each_partition(
+            node_index,
+            [&](const int32_t partition_index, const NodeScore& partition_score) {
+                const float64_t partition_connectivity = partition_score.connectivity();
+
+                LOCATED_LOG(false)                                      //
+                    << " node_index: " << node_index                    //
+                    << " other_partition_index: " << partition_index    //
+                    << " other_connectivity" << partition_connectivity  //
+                    << std::endl;
 
-            tmp_partition_connectivity_diffs[partition_index] = partition_connectivity - current_connectivity;
-        }
+                tmp_partition_connectivity_diffs[partition_index] = partition_connectivity - current_connectivity;
+            });
+        tmp_partition_connectivity_diffs[current_partition_index] = 0.0;
 
         while (outgoing_position < outgoing_count || incoming_position < incoming_count) {
             const auto other_node_index = std::min(outgoing_node_index, incoming_node_index);
@@ -688,7 +1044,7 @@ struct OptimizePartitions {
                 << " other_partition_index: " << other_partition_index  //
                 << std::endl;
 
-            NodeScore other_score = score_of_nodes_of_partitions[other_partition_index][other_node_index];
+            NodeScore other_score = score_of_nodes_of_partitions.get(other_node_index, other_partition_index);
             const float64_t old_score = other_score.score();
             const float64_t old_connectivity = other_score.connectivity();
 
@@ -749,13 +1105,13 @@ struct OptimizePartitions {
         }
     }
 
-    float64_t collect_candidate_partitions(const size_t node_index,
-                                           const int32_t current_partition_index,
-                                           const std::vector<float64_t>& tmp_partition_cold_diffs,
-                                           const std::vector<float64_t>& tmp_partition_hot_diffs,
-                                           const std::vector<float64_t>& tmp_partition_connectivity_diffs,
-                                           const float64_t temperature,
-                                           CandidatePartitions& tmp_candidate_partitions) {
+    void collect_candidate_partitions(const size_t node_index,
+                                      const int32_t current_partition_index,
+                                      const std::vector<float64_t>& tmp_partition_cold_diffs,
+                                      const std::vector<float64_t>& tmp_partition_hot_diffs,
+                                      const std::vector<float64_t>& tmp_partition_connectivity_diffs,
+                                      const float64_t temperature,
+                                      CandidatePartitions& tmp_candidate_partitions) {
         float32_t node_mass = mass_of_nodes[node_index];
 
         const float64_t current_hot_diff = tmp_partition_hot_diffs[current_partition_index];
@@ -878,31 +1234,28 @@ struct OptimizePartitions {
                 tmp_candidate_partitions.goal_partitions.push_back(partition_index);
             }
         }
-
-        return current_cold_diff;
     }
 
     int32_t choose_target_partition(const int32_t current_partition_index,
-                                    std::minstd_rand& random,
+                                    PhiloxRandom& random,
                                     const CandidatePartitions& tmp_candidate_partitions) {
         int32_t chosen_partition_index = -1;
 
         if (tmp_candidate_partitions.both_partitions.size() > 0) {
-            chosen_partition_index = int32_t(
-                tmp_candidate_partitions.both_partitions[random() % tmp_candidate_partitions.both_partitions.size()]);
+            const auto& both_partitions = tmp_candidate_partitions.both_partitions;
+            chosen_partition_index = int32_t(both_partitions[random.below(both_partitions.size())]);
             LOCATED_LOG(false)                                                 //
                 << " chosen both partition_index: " << chosen_partition_index  //
                 << std::endl;
         } else if (tmp_candidate_partitions.connectivity_partitions.size() > 0) {
-            chosen_partition_index = int32_t(
-                tmp_candidate_partitions
-                    .connectivity_partitions[random() % tmp_candidate_partitions.connectivity_partitions.size()]);
+            const auto& connectivity_partitions = tmp_candidate_partitions.connectivity_partitions;
+            chosen_partition_index = int32_t(connectivity_partitions[random.below(connectivity_partitions.size())]);
             LOCATED_LOG(false)                                                         //
                 << " chosen connectivity partition_index: " << chosen_partition_index  //
                 << std::endl;
         } else if (tmp_candidate_partitions.goal_partitions.size() > 0) {
-            chosen_partition_index = int32_t(
-                tmp_candidate_partitions.goal_partitions[random() % tmp_candidate_partitions.goal_partitions.size()]);
+            const auto& goal_partitions = tmp_candidate_partitions.goal_partitions;
+            chosen_partition_index = int32_t(goal_partitions[random.below(goal_partitions.size())]);
             LOCATED_LOG(false)                                                 //
                 << " chosen goal partition_index: " << chosen_partition_index  //
                 << std::endl;
@@ -913,10 +1266,9 @@ struct OptimizePartitions {
 
     void update_scores_of_nodes(const size_t node_index,
                                 const int32_t from_partition_index,
-                                const int32_t to_partition_index) {
-        auto& score_of_nodes_of_from_partition = score_of_nodes_of_partitions[from_partition_index];
-        auto& score_of_nodes_of_to_partition = score_of_nodes_of_partitions[to_partition_index];
-
+                                const int32_t to_partition_index,
+                                float64_t& from_cold_diff,
+                                float64_t& to_cold_diff) {
         const auto& node_outgoing_indices = outgoing_weights.get_band_indices(node_index);
         const auto& node_incoming_indices = incoming_weights.get_band_indices(node_index);
 
@@ -944,38 +1296,54 @@ struct OptimizePartitions {
             const int is_outgoing = int(outgoing_node_index == other_node_index);
             const int is_incoming = int(incoming_node_index == other_node_index);
 
-            auto& other_node_from_score = score_of_nodes_of_from_partition[other_node_index];
-            LOCATED_LOG(false)                                        //
-                << " other_node_index: " << other_node_index          //
-                << " from_partition_index: " << from_partition_index  //
-                << " old score: " << other_node_from_score            //
+            const auto other_partition_index = partition_of_nodes[other_node_index];
+
+            LOCATED_LOG(false)                                                                              //
+                << " other_node_index: " << other_node_index                                                //
+                << " from_partition_index: " << from_partition_index                                        //
+                << " old score: " << score_of_nodes_of_partitions.get(other_node_index, from_partition_index)  //
                 << std::endl;
 
-            other_node_from_score.update_incoming(-is_outgoing, outgoing_edge_weight);
-            other_node_from_score.update_outgoing(-is_incoming, incoming_edge_weight);
-            other_node_from_score.rescore();
+            const float64_t old_from_score =
+                score_of_nodes_of_partitions.get(other_node_index, from_partition_index).score();
+            const float64_t new_from_score = score_of_nodes_of_partitions.update(other_node_index,
+                                                                                 from_partition_index,
+                                                                                 -is_outgoing,
+                                                                                 outgoing_edge_weight,
+                                                                                 -is_incoming,
+                                                                                 incoming_edge_weight);
+            if (other_partition_index == from_partition_index) {
+                from_cold_diff += new_from_score - old_from_score;
+            }
 
-            LOCATED_LOG(false)                                        //
-                << " other_node_index: " << other_node_index          //
-                << " from_partition_index: " << from_partition_index  //
-                << " new score: " << other_node_from_score            //
+            LOCATED_LOG(false)                                                                              //
+                << " other_node_index: " << other_node_index                                                //
+                << " from_partition_index: " << from_partition_index                                        //
+                << " new score: " << score_of_nodes_of_partitions.get(other_node_index, from_partition_index)  //
                 << std::endl;
 
-            auto& other_node_to_score = score_of_nodes_of_to_partition[other_node_index];
-            LOCATED_LOG(false)                                    //
-                << " other_node_index: " << other_node_index      //
-                << " to_partition_index: " << to_partition_index  //
-                << " old score: " << other_node_to_score          //
+            LOCATED_LOG(false)                                                                          //
+                << " other_node_index: " << other_node_index                                            //
+                << " to_partition_index: " << to_partition_index                                        //
+                << " old score: " << score_of_nodes_of_partitions.get(other_node_index, to_partition_index)  //
                 << std::endl;
 
-            other_node_to_score.update_incoming(+is_outgoing, outgoing_edge_weight);
-            other_node_to_score.update_outgoing(+is_incoming, incoming_edge_weight);
-            other_node_to_score.rescore();
+            const float64_t old_to_score =
+                score_of_nodes_of_partitions.get(other_node_index, to_partition_index).score();
+            const float64_t new_to_score = score_of_nodes_of_partitions.update(other_node_index,
+                                                                               to_partition_index,
+                                                                               +is_outgoing,
+                                                                               outgoing_edge_weight,
+                                                                               +is_incoming,
+                                                                               incoming_edge_weight);
+            if (other_partition_index == to_partition_index) {
+                to_cold_diff += new_to_score - old_to_score;
+            }
 
-            LOCATED_LOG(false)                                    //
-                << " other_node_index: " << other_node_index      //
-                << " to_partition_index: " << to_partition_index  //
-                << " new score: " << other_node_to_score          //
+            LOCATED_LOG(false)                                                                          //
+                << " other_node_index: " << other_node_index                                            //
+                << " to_partition_index: " << to_partition_index                                        //
+                << " new score: " << score_of_nodes_of_partitions.get(other_node_index, to_partition_index)  //
                 << std::endl;
 
             outgoing_position += is_outgoing;
@@ -1012,7 +1380,7 @@ struct OptimizePartitions {
     }
 
     void update_sizes_of_partitions(const int32_t from_partition_index, const int32_t to_partition_index) {
-        SlowAssertCompare(size_of_partitions[from_partition_index], >, 1);
+        SlowAssertCompare(size_of_partitions[from_partition_index], >, 0);
         size_of_partitions[from_partition_index] -= 1;
         ++size_of_partitions[to_partition_index];
     }
@@ -1087,7 +1455,8 @@ optimize_partitions(const pybind11::array_t<float32_t>& outgoing_weights_array,
                     float64_t cooldown_node,
                     pybind11::array_t<int32_t>& partition_of_nodes_array,
                     int32_t cold_partitions,
-                    float64_t cold_temperature) {
+                    float64_t cold_temperature,
+                    const size_t parallel_batch_size) {
     WithoutGil without_gil{};
     OptimizePartitions optimizer(outgoing_weights_array,
                                  outgoing_indices_array,
@@ -1123,7 +1492,12 @@ optimize_partitions(const pybind11::array_t<float32_t>& outgoing_weights_array,
     g_verify = nullptr;
 #endif
 
-    optimizer.optimize(random_seed, cooldown_pass, cooldown_node, cold_partitions, cold_temperature);
+    optimizer.optimize(random_seed,
+                       cooldown_pass,
+                       cooldown_node,
+                       cold_partitions,
+                       cold_temperature,
+                       parallel_batch_size);
 
     float64_t score = optimizer.score();
     LOCATED_LOG(false) << " SCORE: " << score << std::endl;
@@ -1158,12 +1532,309 @@ score_partitions(const pybind11::array_t<float32_t>& outgoing_weights_array,
     return optimizer.score(with_orphans);
 }
 
+// The part of a block-diagonal graph for the contiguous range of nodes of one pile, using a local numbering of the
+// nodes. The local indices and indptr are written into the given vectors, which must outlive the result.
+static ConstCompressedMatrix<float32_t, int32_t, int32_t>
+pile_weights(const ConstCompressedMatrix<float32_t, int32_t, int32_t>& weights,
+             const size_t start_node_index,
+             const size_t stop_node_index,
+             std::vector<int32_t>& pile_indices,
+             std::vector<int32_t>& pile_indptr,
+             const char* const name) {
+    const auto indices = weights.indices();
+    const auto indptr = weights.indptr();
+    const size_t start_position = size_t(indptr[start_node_index]);
+    const size_t stop_position = size_t(indptr[stop_node_index]);
+    const size_t pile_nodes_count = stop_node_index - start_node_index;
+
+    pile_indptr.resize(pile_nodes_count + 1);
+    for (size_t pile_node_index = 0; pile_node_index <= pile_nodes_count; ++pile_node_index) {
+        pile_indptr[pile_node_index] = int32_t(indptr[start_node_index + pile_node_index] - start_position);
+    }
+
+    pile_indices.resize(stop_position - start_position);
+    for (size_t position = start_position; position < stop_position; ++position) {
+        const int32_t node_index = indices[position];
+        FastAssertCompareWhat(size_t(node_index), >=, start_node_index, name);
+        FastAssertCompareWhat(size_t(node_index), <, stop_node_index, name);
+        pile_indices[position - start_position] = int32_t(node_index - start_node_index);
+    }
+
+    return ConstCompressedMatrix<float32_t, int32_t, int32_t>(weights.data().slice(start_position, stop_position),
+                                                              ConstArraySlice<int32_t>(pile_indices, name),
+                                                              ConstArraySlice<int32_t>(pile_indptr, name),
+                                                              pile_nodes_count,
+                                                              name);
+}
+
+/// Optimize the partitions of several piles, each in its own thread. The graph is the block-diagonal combination of
+/// the graphs of the piles, whose nodes are contiguous, such that the nodes of each pile are in the range
+/// `first_node_of_piles[pile_index] .. first_node_of_piles[pile_index + 1] - 1`. The partition of each node is within
+/// its pile, and the optimized partition of each pile is the same as optimizing it on its own.
+static void
+optimize_piles_partitions(const pybind11::array_t<float32_t>& outgoing_weights_array,
+                          const pybind11::array_t<int32_t>& outgoing_indices_array,
+                          const pybind11::array_t<int32_t>& outgoing_indptr_array,
+                          const pybind11::array_t<float32_t>& incoming_weights_array,
+                          const pybind11::array_t<int32_t>& incoming_indices_array,
+                          const pybind11::array_t<int32_t>& incoming_indptr_array,
+                          const pybind11::array_t<int32_t>& first_node_of_piles_array,
+                          const unsigned int random_seed,
+                          float64_t low_mass,
+                          float64_t target_mass,
+                          float64_t high_mass,
+                          const pybind11::array_t<float32_t>& mass_of_nodes_array,
+                          float64_t cooldown_pass,
+                          float64_t cooldown_node,
+                          pybind11::array_t<int32_t>& partition_of_nodes_array,
+                          int32_t cold_partitions,
+                          float64_t cold_temperature,
+                          const size_t parallel_batch_size,
+                          pybind11::array_t<float64_t>& score_of_piles_array) {
+    WithoutGil without_gil{};
+    const ConstCompressedMatrix<float32_t, int32_t, int32_t> outgoing_weights(
+        ConstArraySlice<float32_t>(outgoing_weights_array, "outgoing_weights_array"),
+        ConstArraySlice<int32_t>(outgoing_indices_array, "outgoing_indices_array"),
+        ConstArraySlice<int32_t>(outgoing_indptr_array, "outgoing_indptr_array"),
+        int32_t(outgoing_indptr_array.size() - 1),
+        "outgoing_weights");
+    const ConstCompressedMatrix<float32_t, int32_t, int32_t> incoming_weights(
+        ConstArraySlice<float32_t>(incoming_weights_array, "incoming_weights_array"),
+        ConstArraySlice<int32_t>(incoming_indices_array, "incoming_indices_array"),
+        ConstArraySlice<int32_t>(incoming_indptr_array, "incoming_indptr_array"),
+        int32_t(incoming_indptr_array.size() - 1),
+        "incoming_weights");
+    ConstArraySlice<int32_t> first_node_of_piles(first_node_of_piles_array, "first_node_of_piles");
+    ConstArraySlice<float32_t> mass_of_nodes(mass_of_nodes_array, "mass_of_nodes");
+    ArraySlice<int32_t> partition_of_nodes(partition_of_nodes_array, "partition_of_nodes");
+    ArraySlice<float64_t> score_of_piles(score_of_piles_array, "score_of_piles");
+
+    const size_t nodes_count = outgoing_weights.bands_count();
+    const size_t piles_count = score_of_piles.size();
+    FastAssertCompare(incoming_weights.bands_count(), ==, nodes_count);
+    FastAssertCompare(mass_of_nodes.size(), ==, nodes_count);
+    FastAssertCompare(partition_of_nodes.size(), ==, nodes_count);
+    FastAssertCompare(first_node_of_piles.size(), ==, piles_count + 1);
+    FastAssertCompare(first_node_of_piles[0], ==, 0);
+    FastAssertCompare(first_node_of_piles[piles_count], ==, nodes_count);
+    for (size_t pile_index = 0; pile_index < piles_count; ++pile_index) {
+        FastAssertCompare(first_node_of_piles[pile_index], <, first_node_of_piles[pile_index + 1]);
+    }
+
+    parallel_loop(piles_count, 1, [&](size_t pile_index) {
+        const size_t start_node_index = size_t(first_node_of_piles[pile_index]);
+        const size_t stop_node_index = size_t(first_node_of_piles[pile_index + 1]);
+
+        std::vector<int32_t> outgoing_indices;
+        std::vector<int32_t> outgoing_indptr;
+        const auto pile_outgoing_weights = pile_weights(outgoing_weights,
+                                                        start_node_index,
+                                                        stop_node_index,
+                                                        outgoing_indices,
+                                                        outgoing_indptr,
+                                                        "pile_outgoing_weights");
+
+        std::vector<int32_t> incoming_indices;
+        std::vector<int32_t> incoming_indptr;
+        const auto pile_incoming_weights = pile_weights(incoming_weights,
+                                                        start_node_index,
+                                                        stop_node_index,
+                                                        incoming_indices,
+                                                        incoming_indptr,
+                                                        "pile_incoming_weights");
+
+        const auto pile_mass_of_nodes = mass_of_nodes.slice(start_node_index, stop_node_index);
+        auto pile_partition_of_nodes = partition_of_nodes.slice(start_node_index, stop_node_index);
+
+        OptimizePartitions optimizer(pile_outgoing_weights,
+                                     pile_incoming_weights,
+                                     low_mass,
+                                     target_mass,
+                                     high_mass,
+                                     pile_mass_of_nodes,
+                                     pile_partition_of_nodes);
+
+#if ASSERT_LEVEL > 1
+        g_verify = [&]() {
+            OptimizePartitions verifier(pile_outgoing_weights,
+                                        pile_incoming_weights,
+                                        low_mass,
+                                        target_mass,
+                                        high_mass,
+                                        pile_mass_of_nodes,
+                                        pile_partition_of_nodes);
+            verifier.verify(optimizer);
+        };
+#elif ASSERT_LEVEL > 0
+        g_verify = nullptr;
+#endif
+
+        optimizer.optimize(random_seed,
+                           cooldown_pass,
+                           cooldown_node,
+                           cold_partitions,
+                           cold_temperature,
+                           parallel_batch_size);
+        score_of_piles[pile_index] = optimizer.score();
+
+#if ASSERT_LEVEL > 0
+        g_verify = nullptr;
+#endif
+    });
+}
+
+static pybind11::array_t<int32_t>
+copy_partition_of_nodes(const pybind11::array_t<int32_t>& partition_of_nodes_array) {
+    ConstArraySlice<int32_t> partition_of_nodes(partition_of_nodes_array, "partition_of_nodes");
+    pybind11::array_t<int32_t> copy_array(partition_of_nodes.size());
+    ArraySlice<int32_t> copy(copy_array, "copy_of_partition_of_nodes");
+    std::copy(partition_of_nodes.begin(), partition_of_nodes.end(), copy.begin());
+    return copy_array;
+}
+
+// A persistent partitioner of a graph, which keeps the graph and the state derived from it (most importantly, the
+// score of each node for each partition) alive between calls, to repeatedly optimize and/or score partitions of the
+// same graph without computing everything from scratch each time.
+class Partitioner {
+private:
+    const pybind11::array_t<float32_t> m_outgoing_weights_array;
+    const pybind11::array_t<int32_t> m_outgoing_indices_array;
+    const pybind11::array_t<int32_t> m_outgoing_indptr_array;
+    const pybind11::array_t<float32_t> m_incoming_weights_array;
+    const pybind11::array_t<int32_t> m_incoming_indices_array;
+    const pybind11::array_t<int32_t> m_incoming_indptr_array;
+    const float64_t m_low_mass;
+    const float64_t m_target_mass;
+    const float64_t m_high_mass;
+    const pybind11::array_t<float32_t> m_mass_of_nodes_array;
+    pybind11::array_t<int32_t> m_partition_of_nodes_array;
+    std::unique_ptr<OptimizePartitions> m_optimizer;
+
+    void set_verify() {
+#if ASSERT_LEVEL > 1
+        g_verify = [&]() {
+            LOCATED_LOG(false) << " VERIFY" << std::endl;
+            OptimizePartitions verifier(m_outgoing_weights_array,
+                                        m_outgoing_indices_array,
+                                        m_outgoing_indptr_array,
+                                        m_incoming_weights_array,
+                                        m_incoming_indices_array,
+                                        m_incoming_indptr_array,
+                                        m_low_mass,
+                                        m_target_mass,
+                                        m_high_mass,
+                                        m_mass_of_nodes_array,
+                                        m_partition_of_nodes_array);
+            LOCATED_LOG(false) << " COMPARE" << std::endl;
+            verifier.verify(*m_optimizer);
+            LOCATED_LOG(false) << " VERIFIED" << std::endl;
+        };
+#elif ASSERT_LEVEL > 0
+        g_verify = nullptr;
+#endif
+    }
+
+public:
+    Partitioner(const pybind11::array_t<float32_t>& outgoing_weights_array,
+                const pybind11::array_t<int32_t>& outgoing_indices_array,
+                const pybind11::array_t<int32_t>& outgoing_indptr_array,
+                const pybind11::array_t<float32_t>& incoming_weights_array,
+                const pybind11::array_t<int32_t>& incoming_indices_array,
+                const pybind11::array_t<int32_t>& incoming_indptr_array,
+                const float64_t low_mass,
+                const float64_t target_mass,
+                const float64_t high_mass,
+                const pybind11::array_t<float32_t>& mass_of_nodes_array,
+                const pybind11::array_t<int32_t>& partition_of_nodes_array)
+      : m_outgoing_weights_array(outgoing_weights_array)
+      , m_outgoing_indices_array(outgoing_indices_array)
+      , m_outgoing_indptr_array(outgoing_indptr_array)
+      , m_incoming_weights_array(incoming_weights_array)
+      , m_incoming_indices_array(incoming_indices_array)
+      , m_incoming_indptr_array(incoming_indptr_array)
+      , m_low_mass(low_mass)
+      , m_target_mass(target_mass)
+      , m_high_mass(high_mass)
+      , m_mass_of_nodes_array(mass_of_nodes_array)
+      , m_partition_of_nodes_array(copy_partition_of_nodes(partition_of_nodes_array)) {
+        WithoutGil without_gil{};
+        m_optimizer.reset(new OptimizePartitions(m_outgoing_weights_array,
+                                                 m_outgoing_indices_array,
+                                                 m_outgoing_indptr_array,
+                                                 m_incoming_weights_array,
+                                                 m_incoming_indices_array,
+                                                 m_incoming_indptr_array,
+                                                 m_low_mass,
+                                                 m_target_mass,
+                                                 m_high_mass,
+                                                 m_mass_of_nodes_array,
+                                                 m_partition_of_nodes_array));
+    }
+
+    /// Copy the current partition of the nodes into the output array.
+    void get_partitions(pybind11::array_t<int32_t>& output_partition_of_nodes_array) const {
+        ConstArraySlice<int32_t> partition_of_nodes(m_partition_of_nodes_array, "partition_of_nodes");
+        ArraySlice<int32_t> output_partition_of_nodes(output_partition_of_nodes_array, "output_partition_of_nodes");
+        FastAssertCompare(output_partition_of_nodes.size(), ==, partition_of_nodes.size());
+        std::copy(partition_of_nodes.begin(), partition_of_nodes.end(), output_partition_of_nodes.begin());
+    }
+
+    /// Change the partition of the nodes, only updating the state for the nodes which moved.
+    void set_partitions(const pybind11::array_t<int32_t>& new_partition_of_nodes_array) {
+        ConstArraySlice<int32_t> new_partition_of_nodes(new_partition_of_nodes_array, "new_partition_of_nodes");
+        WithoutGil without_gil{};
+        set_verify();
+        m_optimizer->assign_partitions(new_partition_of_nodes);
+    }
+
+    /// Optimize the current partition, returning its new score.
+    float64_t optimize(const unsigned int random_seed,
+                       const float64_t cooldown_pass,
+                       const float64_t cooldown_node,
+                       const int32_t cold_partitions,
+                       const float64_t cold_temperature,
+                       const size_t parallel_batch_size) {
+        WithoutGil without_gil{};
+        set_verify();
+        m_optimizer->optimize(random_seed,
+                              cooldown_pass,
+                              cooldown_node,
+                              cold_partitions,
+                              cold_temperature,
+                              parallel_batch_size);
+        return m_optimizer->score();
+    }
+
+    /// The score of the current partition.
+    float64_t score(const bool with_orphans) const { return m_optimizer->score(with_orphans); }
+};
+
 void
 register_partitions(pybind11::module& module) {
     module.def("optimize_partitions",
                &metacells::optimize_partitions,
                "Optimize the partition for computing metacells.");
+    module.def("optimize_piles_partitions",
+               &metacells::optimize_piles_partitions,
+               "Optimize the partitions of several piles for computing metacells.");
     module.def("score_partitions", &metacells::score_partitions, "Compute the quality score for metacells.");
+
+    pybind11::class_<Partitioner>(module, "Partitioner", "A persistent partitioner of a graph.")
+        .def(pybind11::init<const pybind11::array_t<float32_t>&,
+                            const pybind11::array_t<int32_t>&,
+                            const pybind11::array_t<int32_t>&,
+                            const pybind11::array_t<float32_t>&,
+                            const pybind11::array_t<int32_t>&,
+                            const pybind11::array_t<int32_t>&,
+                            const float64_t,
+                            const float64_t,
+                            const float64_t,
+                            const pybind11::array_t<float32_t>&,
+                            const pybind11::array_t<int32_t>&>())
+        .def("get_partitions", &Partitioner::get_partitions, "Copy the current partition of the nodes.")
+        .def("set_partitions", &Partitioner::set_partitions, "Change the partition of the nodes.")
+        .def("optimize", &Partitioner::optimize, "Optimize the current partition.")
+        .def("score", &Partitioner::score, "Compute the quality score of the current partition.");
 }
 
 }
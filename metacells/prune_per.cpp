@@ -27,28 +27,17 @@ prune_band(const size_t band_index,
         return;
     }
 
-    TmpVectorSizeT raii_indices;
-    auto tmp_indices = raii_indices.array_slice("tmp_indices", input_values.size());
-    std::iota(tmp_indices.begin(), tmp_indices.end(), 0);
-    std::nth_element(tmp_indices.begin(),
-                     tmp_indices.begin() + pruned_degree,
-                     tmp_indices.end(),
-                     [&](const size_t left_column_index, const size_t right_column_index) {
-                         const auto left_similarity = input_values[left_column_index];
-                         const auto right_similarity = input_values[right_column_index];
-                         return left_similarity > right_similarity;
-                     });
-
-    tmp_indices = tmp_indices.slice(0, pruned_degree);
-    std::sort(tmp_indices.begin(), tmp_indices.end());
+    TmpVector<IndexedValue<D>> raii_indexed_values;
+    auto tmp_indexed_values = raii_indexed_values.array_slice("tmp_indexed_values", input_values.size());
+    collect_indexed_values(input_values, tmp_indexed_values);
+    select_largest(tmp_indexed_values, pruned_degree);
 
 #ifdef __INTEL_COMPILER
 #    pragma simd
 #endif
     for (size_t location = 0; location < pruned_degree; ++location) {
-        size_t position = tmp_indices[location];
-        output_indices[location] = input_indices[position];
-        output_values[location] = input_values[position];
+        output_indices[location] = input_indices[tmp_indexed_values[location].index];
+        output_values[location] = tmp_indexed_values[location].value;
     }
 }
 
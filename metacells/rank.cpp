@@ -5,19 +5,7 @@ namespace metacells {
 template<typename D>
 static D
 rank_row_element(const size_t row_index, ConstMatrixSlice<D>& input, const size_t rank) {
-    const auto row_input = input.get_row(row_index);
-    TmpVectorSizeT raii_indices;
-    auto tmp_indices = raii_indices.array_slice("tmp_indices", input.columns_count());
-    std::iota(tmp_indices.begin(), tmp_indices.end(), 0);
-    std::nth_element(tmp_indices.begin(),
-                     tmp_indices.begin() + rank,
-                     tmp_indices.end(),
-                     [&](const size_t left_column_index, const size_t right_column_index) {
-                         const auto left_value = row_input[left_column_index];
-                         const auto right_value = row_input[right_column_index];
-                         return left_value < right_value;
-                     });
-    return row_input[tmp_indices[rank]];
+    return rank_value(input.get_row(row_index), rank);
 }
 
 /// See the Python `metacell.utilities.computation.rank_per` function.
@@ -41,37 +29,14 @@ rank_matrix_row(const size_t row_index, MatrixSlice<D>& matrix, bool ascending)
     auto row = matrix.get_row(row_index);
     size_t columns_count = matrix.columns_count();
 
-    TmpVectorSizeT raii_positions;
-    auto tmp_positions = raii_positions.array_slice("tmp_positions", columns_count);
+    TmpVector<IndexedValue<D>> raii_indexed_values;
+    auto tmp_indexed_values = raii_indexed_values.array_slice("tmp_indexed_values", columns_count);
 
-    TmpVectorSizeT raii_indices;
-    auto tmp_indices = raii_indices.array_slice("tmp_indices", columns_count);
+    collect_indexed_values(ConstArraySlice<D>(row), tmp_indexed_values);
+    sort_values(tmp_indexed_values, ascending);
 
-    std::iota(tmp_positions.begin(), tmp_positions.end(), 0);
-    if (ascending) {
-        std::sort(tmp_positions.begin(),
-                  tmp_positions.end(),
-                  [&](const size_t left_column_index, const size_t right_column_index) {
-                      const auto left_value = row[left_column_index];
-                      const auto right_value = row[right_column_index];
-                      return left_value < right_value;
-                  });
-    } else {
-        std::sort(tmp_positions.begin(),
-                  tmp_positions.end(),
-                  [&](const size_t left_column_index, const size_t right_column_index) {
-                      const auto left_value = row[left_column_index];
-                      const auto right_value = row[right_column_index];
-                      return left_value > right_value;
-                  });
-    }
-
-    for (size_t column_index = 0; column_index < columns_count; ++column_index) {
-        tmp_indices[tmp_positions[column_index]] = column_index;
-    }
-
-    for (size_t column_index = 0; column_index < columns_count; ++column_index) {
-        row[column_index] = D(tmp_indices[column_index] + 1);
+    for (size_t rank = 0; rank < columns_count; ++rank) {
+        row[tmp_indexed_values[rank].index] = D(rank + 1);
     }
 }
 
@@ -79,6 +44,7 @@ rank_matrix_row(const size_t row_index, MatrixSlice<D>& matrix, bool ascending)
 template<typename D>
 static void
 rank_matrix(pybind11::array_t<D>& array, const bool ascending) {
+    WithoutGil without_gil{};
     MatrixSlice<D> matrix(array, "matrix");
 
     const size_t rows_count = matrix.rows_count();
@@ -100,6 +66,7 @@ register_rank(pybind11::module& module) {
     REGISTER_D(uint16_t)
     REGISTER_D(uint32_t)
     REGISTER_D(uint64_t)
+    REGISTER_D(float16_t)
     REGISTER_D(float32_t)
     REGISTER_D(float64_t)
 }
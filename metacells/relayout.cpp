@@ -2,82 +2,34 @@
 
 namespace metacells {
 
-template<typename D, typename I, typename P>
-static void
-serial_collect_compressed_band(const size_t input_band_index,
-                               ConstArraySlice<D> input_data,
-                               ConstArraySlice<I> input_indices,
-                               ConstArraySlice<P> input_indptr,
-                               ArraySlice<D> output_data,
-                               ArraySlice<I> output_indices,
-                               ArraySlice<P> output_indptr) {
-    size_t start_input_element_offset = input_indptr[input_band_index];
-    size_t stop_input_element_offset = input_indptr[input_band_index + 1];
-
-    FastAssertCompare(0, <=, start_input_element_offset);
-    FastAssertCompare(start_input_element_offset, <=, stop_input_element_offset);
-    FastAssertCompare(stop_input_element_offset, <=, input_data.size());
-
-    size_t output_element_index = input_band_index;
-
-    for (size_t input_element_offset = start_input_element_offset; input_element_offset < stop_input_element_offset;
-         ++input_element_offset) {
-        auto input_element_index = input_indices[input_element_offset];
-        auto input_element_data = input_data[input_element_offset];
-
-        auto output_band_index = input_element_index;
-        auto output_element_data = input_element_data;
-
-        auto output_element_offset = output_indptr[output_band_index]++;
-
-        output_indices[output_element_offset] = I(output_element_index);
-        output_data[output_element_offset] = output_element_data;
-    }
-}
+/// The maximal number of chunks of input bands used by `transpose_compressed`.
+static const size_t TRANSPOSE_MAX_CHUNKS = 64;
 
-template<typename D, typename I, typename P>
-static void
-parallel_collect_compressed_band(const size_t input_band_index,
-                                 ConstArraySlice<D> input_data,
-                                 ConstArraySlice<I> input_indices,
-                                 ConstArraySlice<P> input_indptr,
-                                 ArraySlice<D> output_data,
-                                 ArraySlice<I> output_indices,
-                                 ArraySlice<P> output_indptr) {
-    size_t start_input_element_offset = input_indptr[input_band_index];
-    size_t stop_input_element_offset = input_indptr[input_band_index + 1];
-
-    FastAssertCompare(0, <=, start_input_element_offset);
-    FastAssertCompare(start_input_element_offset, <=, stop_input_element_offset);
-    FastAssertCompare(stop_input_element_offset, <=, input_data.size());
-
-    size_t output_element_index = input_band_index;
-
-    for (size_t input_element_offset = start_input_element_offset; input_element_offset < stop_input_element_offset;
-         ++input_element_offset) {
-        auto input_element_index = input_indices[input_element_offset];
-        auto input_element_data = input_data[input_element_offset];
-
-        auto output_band_index = input_element_index;
-        auto output_element_data = input_element_data;
-
-        auto atomic_output_element_offset = reinterpret_cast<std::atomic<P>*>(&output_indptr[output_band_index]);
-        auto output_element_offset = atomic_output_element_offset->fetch_add(1, std::memory_order_relaxed);
-
-        output_indices[output_element_offset] = I(output_element_index);
-        output_data[output_element_offset] = output_element_data;
-    }
-}
+/// The minimal number of elements per output band per chunk used by `transpose_compressed`, to bound the size of the
+/// offsets table (chunks times output bands) relative to the size of the data.
+static const size_t TRANSPOSE_MIN_CHUNK_DENSITY = 2;
+
+/// The number of output bands processed by each task when computing the offsets.
+static const size_t TRANSPOSE_OFFSETS_GRAIN = 4096;
 
 /// See the Python `metacell.utilities.computation._relayout_compressed` function.
+///
+/// This transposes the entries of the output bands `start_output_band .. stop_output_band - 1` from the input
+/// compressed matrix into the output compressed matrix, whose `output_indptr` was already computed. The input bands
+/// are split into consecutive chunks. We count the entries of each output band in each chunk, convert these counts to
+/// the offset of each chunk in each output band, and then each chunk scatters its entries to its own offsets. Since
+/// the chunks are ordered, and each chunk scans its input bands in order, the indices of each output band come out
+/// sorted, without needing any atomic operations or a separate sorting pass.
 template<typename D, typename I, typename P>
 static void
-collect_compressed(const pybind11::array_t<D>& input_data_array,
-                   const pybind11::array_t<I>& input_indices_array,
-                   const pybind11::array_t<P>& input_indptr_array,
-                   pybind11::array_t<D>& output_data_array,
-                   pybind11::array_t<I>& output_indices_array,
-                   pybind11::array_t<P>& output_indptr_array) {
+transpose_compressed(const pybind11::array_t<D>& input_data_array,
+                     const pybind11::array_t<I>& input_indices_array,
+                     const pybind11::array_t<P>& input_indptr_array,
+                     pybind11::array_t<D>& output_data_array,
+                     pybind11::array_t<I>& output_indices_array,
+                     const pybind11::array_t<P>& output_indptr_array,
+                     const size_t start_output_band,
+                     const size_t stop_output_band) {
     WithoutGil without_gil{};
 
     ConstArraySlice<D> input_data{ input_data_array, "input_data_array" };
@@ -89,63 +41,76 @@ collect_compressed(const pybind11::array_t<D>& input_data_array,
 
     ArraySlice<D> output_data{ output_data_array, "output_data_array" };
     ArraySlice<I> output_indices{ output_indices_array, "output_indices_array" };
-    ArraySlice<P> output_indptr{ output_indptr_array, "output_indptr_array" };
+    ConstArraySlice<P> output_indptr{ output_indptr_array, "output_indptr_array" };
 
     FastAssertCompare(output_data.size(), ==, input_data.size());
     FastAssertCompare(output_indices.size(), ==, input_indices.size());
-    FastAssertCompare(output_indptr[output_indptr.size() - 1], <=, output_data.size());
-
-    parallel_loop(
-        input_indptr.size() - 1,
-        [&](size_t input_band_index) {
-            parallel_collect_compressed_band(
-                input_band_index, input_data, input_indices, input_indptr, output_data, output_indices, output_indptr);
-        },
-        [&](size_t input_band_index) {
-            serial_collect_compressed_band(
-                input_band_index, input_data, input_indices, input_indptr, output_data, output_indices, output_indptr);
-        });
-}
+    FastAssertCompare(start_output_band, <=, stop_output_band);
+    FastAssertCompare(stop_output_band, <, output_indptr.size());
 
-// TODO: Duplicated from shuffle.
-template<typename D, typename I, typename P>
-static void
-sort_band(const size_t band_index, CompressedMatrix<D, I, P>& matrix) {
-    if (matrix.indptr()[band_index] == matrix.indptr()[band_index + 1]) {
+    const size_t input_bands_count = input_indptr.size() - 1;
+    const size_t block_bands_count = stop_output_band - start_output_band;
+    const size_t block_elements_count = output_indptr[stop_output_band] - output_indptr[start_output_band];
+    if (block_elements_count == 0) {
         return;
     }
 
-    auto band_indices = matrix.get_band_indices(band_index);
-    auto band_data = matrix.get_band_data(band_index);
-
-    TmpVectorSizeT raii_positions;
-    auto tmp_positions = raii_positions.array_slice("tmp_positions", band_indices.size());
-
-    TmpVectorSizeT raii_indices;
-    auto tmp_indices = raii_indices.array_slice("tmp_indices", band_indices.size());
-
-    TmpVectorFloat64 raii_values;
-    auto tmp_values = raii_values.array_slice("tmp_values", band_indices.size());
-
-    std::iota(tmp_positions.begin(), tmp_positions.end(), 0);
-    std::sort(tmp_positions.begin(), tmp_positions.end(), [&](const size_t left_position, const size_t right_position) {
-        auto left_index = band_indices[left_position];
-        auto right_index = band_indices[right_position];
-        return left_index < right_index;
+    const size_t chunks_count =
+        std::max(size_t(1),
+                 std::min({ TRANSPOSE_MAX_CHUNKS,
+                            input_bands_count,
+                            block_elements_count / (block_bands_count * TRANSPOSE_MIN_CHUNK_DENSITY) }));
+
+    std::vector<size_t> offsets(chunks_count * block_bands_count, 0);
+
+    const auto for_each_entry = [&](const size_t chunk_index, const auto& body) {
+        const size_t start_input_band = (input_bands_count * chunk_index) / chunks_count;
+        const size_t stop_input_band = (input_bands_count * (chunk_index + 1)) / chunks_count;
+        size_t* const chunk_offsets = &offsets[chunk_index * block_bands_count];
+        for (size_t input_band_index = start_input_band; input_band_index < stop_input_band; ++input_band_index) {
+            const size_t start_input_element_offset = input_indptr[input_band_index];
+            const size_t stop_input_element_offset = input_indptr[input_band_index + 1];
+            for (size_t input_element_offset = start_input_element_offset;
+                 input_element_offset < stop_input_element_offset;
+                 ++input_element_offset) {
+                const size_t output_band_index = size_t(input_indices[input_element_offset]);
+                if (start_output_band <= output_band_index && output_band_index < stop_output_band) {
+                    size_t& output_element_offset = chunk_offsets[output_band_index - start_output_band];
+                    body(input_band_index, input_element_offset, output_element_offset++);
+                }
+            }
+        }
+    };
+
+    parallel_loop(chunks_count, 1, [&](const size_t chunk_index) {
+        for_each_entry(chunk_index, [](size_t, size_t, size_t) {});
     });
 
-#ifdef __INTEL_COMPILER
-#    pragma simd
-#endif
-    const size_t tmp_size = tmp_positions.size();
-    for (size_t location = 0; location < tmp_size; ++location) {
-        size_t position = tmp_positions[location];
-        tmp_indices[location] = band_indices[position];
-        tmp_values[location] = float64_t(band_data[position]);
-    }
+    const size_t offsets_tasks_count = (block_bands_count + TRANSPOSE_OFFSETS_GRAIN - 1) / TRANSPOSE_OFFSETS_GRAIN;
+    parallel_loop(offsets_tasks_count, 1, [&](const size_t task_index) {
+        const size_t start_block_band = task_index * TRANSPOSE_OFFSETS_GRAIN;
+        const size_t stop_block_band = std::min(start_block_band + TRANSPOSE_OFFSETS_GRAIN, block_bands_count);
+        for (size_t block_band_index = start_block_band; block_band_index < stop_block_band; ++block_band_index) {
+            size_t offset = output_indptr[start_output_band + block_band_index];
+            for (size_t chunk_index = 0; chunk_index < chunks_count; ++chunk_index) {
+                size_t& chunk_offset = offsets[chunk_index * block_bands_count + block_band_index];
+                const size_t count = chunk_offset;
+                chunk_offset = offset;
+                offset += count;
+            }
+            FastAssertCompare(offset, ==, output_indptr[start_output_band + block_band_index + 1]);
+        }
+    });
 
-    std::copy(tmp_indices.begin(), tmp_indices.end(), band_indices.begin());
-    std::copy(tmp_values.begin(), tmp_values.end(), band_data.begin());
+    parallel_loop(chunks_count, 1, [&](const size_t chunk_index) {
+        for_each_entry(chunk_index,
+                       [&](const size_t input_band_index,
+                           const size_t input_element_offset,
+                           const size_t output_element_offset) {
+                           output_indices[output_element_offset] = I(input_band_index);
+                           output_data[output_element_offset] = input_data[input_element_offset];
+                       });
+    });
 }
 
 /// See the Python `metacell.utilities.computation._relayout_compressed` function.
@@ -171,9 +136,9 @@ typedef bool bool_t;
 void
 register_relayout(pybind11::module& module) {
 #define REGISTER_D_I_P(D, I, P)                             \
-    module.def("collect_compressed_" #D "_" #I "_" #P,      \
-               &collect_compressed<D, I, P>,                \
-               "Collect compressed data for relayout.");    \
+    module.def("transpose_compressed_" #D "_" #I "_" #P,    \
+               &transpose_compressed<D, I, P>,              \
+               "Transpose compressed data for relayout.");  \
     module.def("sort_compressed_indices_" #D "_" #I "_" #P, \
                &sort_compressed_indices<D, I, P>,           \
                "Sort indices in a compressed matrix.");
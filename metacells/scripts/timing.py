@@ -61,6 +61,9 @@ def main() -> None:
         The data in the sum file is presented in seconds and billions of instructions, to make it
         easier to follow.
 
+        Steps which collected native counters also report them, as well as the native parallelism
+        (the average number of threads busy executing parallel loop bodies during the step).
+
         The output is sorted in descending elapsed time order.
 
         You can pipe the output through "column -t -s," to make it more legible.
@@ -191,6 +194,18 @@ def _combine_main(input_path: str, output_path: Optional[str]) -> None:
                     output_file.write(process_line)
 
 
+#: The native counters fields which may follow the elapsed and CPU time (see ``timed_step``).
+NATIVE_FIELDS = [
+    "native_busy_ns",
+    "native_max_busy_ns",
+    "native_iterations",
+    "native_steals",
+    "native_remote_steals",
+    "native_array_bytes",
+    "native_tmp_allocations",
+]
+
+
 def _sum_main(input_path: Optional[str], output_path: Optional[str]) -> None:
     data_by_name = _collect_data_by_name(input_path, True)
 
@@ -208,15 +223,20 @@ def _sum_main(input_path: Optional[str], output_path: Optional[str]) -> None:
     else:
         output_file = open(output_path, "w", encoding="utf8")  # pylint: disable=consider-using-with
 
-    fields = ["invocations", "elapsed_s", "cpu_s"]
+    fields = ["invocations", "elapsed_s", "cpu_s"] + [field.replace("_ns", "_s") for field in NATIVE_FIELDS]
     for name, data in sorted(data_by_name.items(), key=lambda data: data[1][1], reverse=True):
         text = [name]
         for field, value in zip(fields, data):
+            if field.startswith("native_") and value == 0:
+                continue
             text.append(field)
-            if field == "invocations":
-                text.append(str(value))
-            else:
+            if field.endswith("_s"):
                 text.append(str(value / 1_000_000_000))
+            else:
+                text.append(str(int(value)))
+        if data[3] > 0 and data[1] > 0:
+            text.append("native_parallelism")
+            text.append(f"{data[3] / data[1]:.2f}")
         output_file.write(",".join(text))
         output_file.write("\n")
 
@@ -263,12 +283,16 @@ def _collect_data_by_name(input_path: Optional[str], split: bool) -> Dict[str, L
 
         data = data_by_name.get(name)
         if data is None:
-            data = [0, 0, 0]
+            data = [0] * (3 + len(NATIVE_FIELDS))
             data_by_name[name] = data
         data[0] += 1
         data[1] += elapsed_ns
         data[2] += cpu_ns
 
+        for field, value in zip(row[5::2], row[6::2]):
+            if field in NATIVE_FIELDS:
+                data[3 + NATIVE_FIELDS.index(field)] += float(value)
+
     return data_by_name
 
 
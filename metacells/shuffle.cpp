@@ -2,47 +2,6 @@
 
 namespace metacells {
 
-// TODO: Duplicated from relayout.
-template<typename D, typename I, typename P>
-static void
-sort_band(const size_t band_index, CompressedMatrix<D, I, P>& matrix) {
-    if (matrix.indptr()[band_index] == matrix.indptr()[band_index + 1]) {
-        return;
-    }
-
-    auto band_indices = matrix.get_band_indices(band_index);
-    auto band_data = matrix.get_band_data(band_index);
-
-    TmpVectorSizeT raii_positions;
-    auto tmp_positions = raii_positions.array_slice("tmp_positions", band_indices.size());
-
-    TmpVectorSizeT raii_indices;
-    auto tmp_indices = raii_indices.array_slice("tmp_indices", band_indices.size());
-
-    TmpVectorFloat64 raii_values;
-    auto tmp_values = raii_values.array_slice("tmp_values", band_indices.size());
-
-    std::iota(tmp_positions.begin(), tmp_positions.end(), 0);
-    std::sort(tmp_positions.begin(), tmp_positions.end(), [&](const size_t left_position, const size_t right_position) {
-        auto left_index = band_indices[left_position];
-        auto right_index = band_indices[right_position];
-        return left_index < right_index;
-    });
-
-#ifdef __INTEL_COMPILER
-#    pragma simd
-#endif
-    const size_t tmp_size = tmp_positions.size();
-    for (size_t location = 0; location < tmp_size; ++location) {
-        size_t position = tmp_positions[location];
-        tmp_indices[location] = band_indices[position];
-        tmp_values[location] = float64_t(band_data[position]);
-    }
-
-    std::copy(tmp_indices.begin(), tmp_indices.end(), band_indices.begin());
-    std::copy(tmp_values.begin(), tmp_values.end(), band_data.begin());
-}
-
 template<typename D, typename I, typename P>
 static void
 shuffle_band(const size_t band_index, CompressedMatrix<D, I, P>& matrix, const size_t random_seed) {
@@ -50,8 +9,8 @@ shuffle_band(const size_t band_index, CompressedMatrix<D, I, P>& matrix, const s
     auto tmp_indices = raii_indices.array_slice("tmp_indices", matrix.elements_count());
     std::iota(tmp_indices.begin(), tmp_indices.end(), 0);
 
-    std::minstd_rand random(random_seed);
-    std::shuffle(tmp_indices.begin(), tmp_indices.end(), random);
+    PhiloxRandom random(random_seed, band_index);
+    random.shuffle(tmp_indices.begin(), tmp_indices.end());
 
     auto band_indices = matrix.get_band_indices(band_index);
     tmp_indices = tmp_indices.slice(0, band_indices.size());
@@ -75,17 +34,16 @@ shuffle_compressed(pybind11::array_t<D>& data_array,
                                      "compressed");
 
     parallel_loop(matrix.bands_count(), [&](size_t band_index) {
-        size_t band_seed = random_seed == 0 ? 0 : random_seed + band_index * 997;
-        shuffle_band(band_index, matrix, band_seed);
+        shuffle_band(band_index, matrix, random_seed);
     });
 }
 
 template<typename D>
 static void
 shuffle_row(const size_t row_index, MatrixSlice<D>& matrix, const size_t random_seed) {
-    std::minstd_rand random(random_seed);
+    PhiloxRandom random(random_seed, row_index);
     auto row = matrix.get_row(row_index);
-    std::shuffle(row.begin(), row.end(), random);
+    random.shuffle(row.begin(), row.end());
 }
 
 /// See the Python `metacell.utilities.computation.shuffle_matrix` function.
@@ -96,8 +54,7 @@ shuffle_dense(pybind11::array_t<D>& matrix_array, const size_t random_seed) {
     MatrixSlice<D> matrix(matrix_array, "matrix");
 
     parallel_loop(matrix.rows_count(), [&](size_t row_index) {
-        size_t row_seed = random_seed == 0 ? 0 : random_seed + row_index * 997;
-        shuffle_row(row_index, matrix, row_seed);
+        shuffle_row(row_index, matrix, random_seed);
     });
 }
 
@@ -12,6 +12,7 @@ from typing import Tuple
 from typing import Union
 
 import numpy as np
+import scipy.sparse as sp  # type: ignore
 from anndata import AnnData  # type: ignore
 
 import metacells.parameters as pr
@@ -24,7 +25,10 @@ __all__ = [
     "compute_candidate_metacells",
     "choose_seeds",
     "optimize_partitions",
+    "optimize_extended_partitions",
+    "optimize_piles_partitions",
     "score_partitions",
+    "Partitioner",
 ]
 
 
@@ -42,6 +46,7 @@ def compute_candidate_metacells(  # pylint: disable=too-many-statements
     cooldown_pass: float = pr.cooldown_pass,
     cooldown_node: float = pr.cooldown_node,
     cooldown_phase: float = pr.cooldown_phase,
+    parallel_batch_size: int = pr.parallel_batch_size,
     min_split_size_factor: float = pr.candidates_min_split_size_factor,
     max_merge_size_factor: float = pr.candidates_max_merge_size_factor,
     min_metacell_cells: Optional[int] = pr.candidates_min_metacell_cells,
@@ -89,7 +94,8 @@ def compute_candidate_metacells(  # pylint: disable=too-many-statements
        maximizing the "stability" of the solution (probability of starting at a random node and
        moving either forward or backward in the graph and staying within the same metacell, divided
        by the probability of staying in the metacell if the edges connected random nodes). We pass
-       it the ``cooldown_pass`` {cooldown_pass}) and ``cooldown_node`` (default: {cooldown_node}).
+       it the ``cooldown_pass`` {cooldown_pass}), ``cooldown_node`` (default: {cooldown_node}) and
+       ``parallel_batch_size`` (default: {parallel_batch_size}).
 
     4. If ``min_split_size_factor`` (default: {min_split_size_factor}) is specified, randomly split
        to two each community whose size is partition method on each community whose size is at least
@@ -115,6 +121,7 @@ def compute_candidate_metacells(  # pylint: disable=too-many-statements
     assert 0.0 < cooldown_pass < 1.0
     assert 0.0 <= cooldown_node <= 1.0
     assert 0.0 < cooldown_phase <= 1.0
+    assert parallel_batch_size >= 0
 
     edge_weights = ut.get_oo_proper(adata, what, layout="row_major")
     assert edge_weights.shape[0] == edge_weights.shape[1]
@@ -171,6 +178,16 @@ def compute_candidate_metacells(  # pylint: disable=too-many-statements
     ut.set_o_data(adata, "seed", community_of_nodes, formatter=ut.groups_description)
     community_of_nodes = community_of_nodes.copy()
 
+    partitioner = Partitioner(
+        edge_weights=outgoing_edge_weights,
+        incoming_edge_weights=incoming_edge_weights,
+        community_of_nodes=community_of_nodes,
+        low_partition_size=min_metacell_size,
+        target_partition_size=target_metacell_size,
+        high_partition_size=max_metacell_size,
+        node_sizes=node_sizes,
+    )
+
     np.random.seed(random_seed)
 
     cold_temperature = 1 - cooldown_pass
@@ -185,6 +202,7 @@ def compute_candidate_metacells(  # pylint: disable=too-many-statements
         cold_temperature, score = _reduce_communities(
             outgoing_edge_weights=outgoing_edge_weights,
             incoming_edge_weights=incoming_edge_weights,
+            partitioner=partitioner,
             community_of_nodes=community_of_nodes,
             node_sizes=node_sizes,
             target_metacell_size=target_metacell_size,
@@ -200,6 +218,7 @@ def compute_candidate_metacells(  # pylint: disable=too-many-statements
             cooldown_pass=cooldown_pass,
             cooldown_node=cooldown_node,
             cooldown_phase=cooldown_phase,
+            parallel_batch_size=parallel_batch_size,
             kept_communities_count=kept_communities_count,
             cold_temperature=cold_temperature,
             atomic_candidates=atomic_candidates,
@@ -257,6 +276,7 @@ def compute_candidate_metacells(  # pylint: disable=too-many-statements
 def _reduce_communities(
     outgoing_edge_weights: ut.CompressedMatrix,
     incoming_edge_weights: ut.CompressedMatrix,
+    partitioner: "Partitioner",
     community_of_nodes: ut.NumpyVector,
     node_sizes: ut.NumpyVector,
     target_metacell_size: float,
@@ -272,6 +292,7 @@ def _reduce_communities(
     cooldown_pass: float,
     cooldown_node: float,
     cooldown_phase: float,
+    parallel_batch_size: int,
     kept_communities_count: int,
     cold_temperature: float,
     atomic_candidates: Set[Tuple[int, ...]],
@@ -279,20 +300,16 @@ def _reduce_communities(
     np.random.seed(random_seed)
     while True:
         ut.log_calc("cold_temperature", cold_temperature)
-        score = _optimize_partitions(
-            outgoing_edge_weights=outgoing_edge_weights,
-            incoming_edge_weights=incoming_edge_weights,
-            community_of_nodes=community_of_nodes,
-            low_partition_size=min_metacell_size,
-            target_partition_size=target_metacell_size,
-            high_partition_size=max_metacell_size,
-            node_sizes=node_sizes,
+        partitioner.set_partitions(community_of_nodes)
+        score = partitioner.optimize(
             random_seed=random_seed,
             cooldown_pass=cooldown_pass,
             cooldown_node=cooldown_node,
             cold_communities_count=kept_communities_count,
             cold_temperature=cold_temperature,
+            parallel_batch_size=parallel_batch_size,
         )
+        partitioner.get_partitions(community_of_nodes)
 
         cold_temperature = cold_temperature * (1 - cooldown_phase)
         ut.log_calc("communities", community_of_nodes, formatter=ut.groups_description)
@@ -668,6 +685,7 @@ def optimize_partitions(
     node_sizes: ut.NumpyVector,
     cooldown_pass: float = pr.cooldown_pass,
     cooldown_node: float = pr.cooldown_node,
+    parallel_batch_size: int = pr.parallel_batch_size,
     random_seed: int,
 ) -> float:
     """
@@ -701,6 +719,13 @@ def optimize_partitions(
 
     This simulated-annealing-like behavior helps the algorithm to escape local maximums, although of
     course no claim is made of achieving the global maximum of the goal function.
+
+    If ``parallel_batch_size`` (default: {parallel_batch_size}) is more than one, we choose the new
+    community of each batch of this many nodes in parallel, based on the state at the start of the
+    batch, and then apply these moves one at a time. If an earlier move in the batch modified the
+    current or chosen community of a node, or moved one of its neighbors, we choose its community
+    again. This gives results of a comparable (but not identical) quality, which do not depend on
+    the number of threads.
     """
     outgoing_edge_weights = ut.mustbe_compressed_matrix(edge_weights)
     assert ut.is_layout(outgoing_edge_weights, "row_major")
@@ -721,6 +746,7 @@ def optimize_partitions(
         community_of_nodes=community_of_nodes,
         cold_communities_count=0,
         cold_temperature=cooldown_pass,
+        parallel_batch_size=parallel_batch_size,
     )
 
 
@@ -739,6 +765,7 @@ def _optimize_partitions(
     cooldown_node: float,
     cold_communities_count: int,
     cold_temperature: float,
+    parallel_batch_size: int,
     random_seed: int,
 ) -> float:
     assert community_of_nodes.dtype == "int32"
@@ -760,6 +787,7 @@ def _optimize_partitions(
         community_of_nodes,
         cold_communities_count,
         cold_temperature,
+        parallel_batch_size,
     )
     ut.log_calc("score", score)
     ut.log_calc("partitions", community_of_nodes, formatter=ut.groups_description)
@@ -767,6 +795,182 @@ def _optimize_partitions(
     return score
 
 
+@ut.logged()
+@ut.timed_call()
+@ut.expand_doc()
+def optimize_extended_partitions(
+    *,
+    edge_weights: ut.CompressedMatrix,
+    community_of_nodes: ut.NumpyVector,
+    low_partition_size: float,
+    target_partition_size: float,
+    high_partition_size: float,
+    node_sizes: ut.NumpyVector,
+    cooldown_pass: float = pr.cooldown_pass,
+    cooldown_node: float = pr.cooldown_node,
+    parallel_batch_size: int = pr.parallel_batch_size,
+    random_seed: int,
+) -> float:
+    """
+    Optimize the partition to candidate metacells (communities) of a graph which was extended with
+    some new nodes (e.g., by :py:func:`metacells.tools.knn_graph.extend_obs_obs_knn_graph`), by
+    warm-starting from the existing partition instead of choosing seeds from scratch.
+
+    Returns the score of the optimized partition.
+
+    The ``community_of_nodes`` contains the existing community of each node, and ``-1`` for each
+    new node, and is modified in-place. Each new node is first added to the community it is most
+    strongly connected to (in either direction). New nodes only connected to other new nodes follow
+    them, and if all the remaining new nodes are only connected to each other, they are placed in a
+    single new community.
+
+    We then invoke :py:func:`optimize_partitions` (with the same ``cooldown_pass`` (default:
+    {cooldown_pass}), ``cooldown_node`` (default: {cooldown_node}) and ``parallel_batch_size``
+    (default: {parallel_batch_size})), where only the nodes of the "affected" communities (which
+    contain a new node or a neighbor of a new node) start hot. The nodes of the rest of the
+    communities start frozen (at a zero temperature), so they are only considered in the final
+    hill-climbing phase. The communities are renumbered if any of them becomes empty.
+    """
+    outgoing_edge_weights = ut.mustbe_compressed_matrix(edge_weights)
+    assert ut.is_layout(outgoing_edge_weights, "row_major")
+    assert 0 < low_partition_size < target_partition_size < high_partition_size
+    assert community_of_nodes.dtype == "int32"
+
+    incoming_edge_weights = ut.mustbe_compressed_matrix(ut.to_layout(outgoing_edge_weights, layout="column_major"))
+    assert ut.is_layout(incoming_edge_weights, "column_major")
+
+    size = len(community_of_nodes)
+    is_new = community_of_nodes < 0
+    ut.log_calc("new nodes", is_new)
+    assert np.any(~is_new)
+
+    connections = sp.csr_matrix(outgoing_edge_weights + outgoing_edge_weights.transpose())
+    is_affected = is_new.copy()
+    is_affected[connections[np.where(is_new)[0], :].indices] = True
+
+    while np.any(is_new):
+        new_indices = np.where(is_new)[0]
+        old_indices = np.where(~is_new)[0]
+        communities_count = np.max(community_of_nodes) + 1
+        community_indicators = sp.csr_matrix(
+            (np.ones(len(old_indices), dtype="float32"), (old_indices, community_of_nodes[old_indices])),
+            shape=(size, communities_count),
+        )
+        strength_of_communities = sp.csr_matrix(connections[new_indices, :] @ community_indicators)
+        is_connected = strength_of_communities.getnnz(axis=1) > 0
+        if not np.any(is_connected):
+            community_of_nodes[new_indices] = communities_count
+            break
+        connected_indices = new_indices[is_connected]
+        community_of_nodes[connected_indices] = ut.to_numpy_vector(
+            strength_of_communities[is_connected, :].argmax(axis=1)
+        )
+        is_new[connected_indices] = False
+
+    affected_communities = np.unique(community_of_nodes[is_affected])
+    cold_communities = np.setdiff1d(np.unique(community_of_nodes), affected_communities)
+    cold_communities_count = len(cold_communities)
+    ut.log_calc("cold communities", cold_communities_count)
+    ut.log_calc("affected communities", len(affected_communities))
+
+    community_of_ordered = np.concatenate([cold_communities, affected_communities]).astype("int32")
+    ordered_of_community = np.full(np.max(community_of_nodes) + 1, -1, dtype="int32")
+    ordered_of_community[community_of_ordered] = np.arange(len(community_of_ordered), dtype="int32")
+    ordered_of_nodes = ordered_of_community[community_of_nodes]
+
+    score = _optimize_partitions(
+        outgoing_edge_weights=outgoing_edge_weights,
+        incoming_edge_weights=incoming_edge_weights,
+        random_seed=random_seed,
+        low_partition_size=low_partition_size,
+        target_partition_size=target_partition_size,
+        high_partition_size=high_partition_size,
+        node_sizes=node_sizes,
+        cooldown_pass=cooldown_pass,
+        cooldown_node=cooldown_node,
+        community_of_nodes=ordered_of_nodes,
+        cold_communities_count=cold_communities_count,
+        cold_temperature=0.0,
+        parallel_batch_size=parallel_batch_size,
+    )
+
+    community_of_nodes[:] = ut.compress_indices(community_of_ordered[ordered_of_nodes])
+    return score
+
+
+@ut.logged()
+@ut.timed_call()
+@ut.expand_doc()
+def optimize_piles_partitions(
+    *,
+    edge_weights: ut.CompressedMatrix,
+    pile_of_nodes: ut.NumpyVector,
+    community_of_nodes: ut.NumpyVector,
+    low_partition_size: float,
+    target_partition_size: float,
+    high_partition_size: float,
+    node_sizes: ut.NumpyVector,
+    cooldown_pass: float = pr.cooldown_pass,
+    cooldown_node: float = pr.cooldown_node,
+    parallel_batch_size: int = pr.parallel_batch_size,
+    random_seed: int,
+) -> ut.NumpyVector:
+    """
+    Optimize the partition to candidate metacells (communities) of several piles in a single call.
+
+    This is equivalent to invoking :py:func:`optimize_partitions` for each pile on its own, but
+    does all the work in one call which optimizes the piles in parallel, instead of paying the
+    overhead of a separate call for each (possibly small) pile.
+
+    The ``pile_of_nodes`` must be sorted, so each pile is a contiguous range of nodes, and the
+    ``edge_weights`` must only connect nodes of the same pile. The ``community_of_nodes`` contains
+    the initial (and, in-place, the optimized) community of each node within its pile, where the
+    communities of each pile are numbered from zero.
+
+    Returns the score of the optimized partition of each pile.
+    """
+    outgoing_edge_weights = ut.mustbe_compressed_matrix(edge_weights)
+    assert ut.is_layout(outgoing_edge_weights, "row_major")
+    assert 0 < low_partition_size < target_partition_size < high_partition_size
+    assert community_of_nodes.dtype == "int32"
+    assert node_sizes.dtype == "float32"
+
+    assert np.all(np.diff(pile_of_nodes) >= 0)
+    nodes_count_of_piles = np.bincount(pile_of_nodes)
+    assert np.min(nodes_count_of_piles) > 0
+    piles_count = len(nodes_count_of_piles)
+    first_node_of_piles = np.zeros(piles_count + 1, dtype="int32")
+    np.cumsum(nodes_count_of_piles, out=first_node_of_piles[1:])
+
+    incoming_edge_weights = ut.mustbe_compressed_matrix(ut.to_layout(outgoing_edge_weights, layout="column_major"))
+    assert ut.is_layout(incoming_edge_weights, "column_major")
+
+    score_of_piles = np.empty(piles_count, dtype="float64")
+    xt.optimize_piles_partitions(
+        outgoing_edge_weights.data,
+        outgoing_edge_weights.indices,
+        outgoing_edge_weights.indptr,
+        incoming_edge_weights.data,
+        incoming_edge_weights.indices,
+        incoming_edge_weights.indptr,
+        first_node_of_piles,
+        random_seed,
+        low_partition_size,
+        target_partition_size,
+        high_partition_size,
+        node_sizes,
+        cooldown_pass,
+        cooldown_node,
+        community_of_nodes,
+        0,
+        cooldown_pass,
+        parallel_batch_size,
+        score_of_piles,
+    )
+    ut.log_calc("score_of_piles", score_of_piles)
+    return score_of_piles
+
+
 @ut.logged()
 @ut.timed_call()
 def score_partitions(
@@ -818,3 +1022,122 @@ def score_partitions(
 
     ut.log_calc("score", score)
     return score
+
+
+class Partitioner:
+    """
+    A persistent partitioner of the nodes of a graph with ``edge_weights``, for repeatedly optimizing and/or scoring
+    partitions of the same graph.
+
+    Creating the partitioner computes the state derived from the graph and the initial ``community_of_nodes`` (most
+    importantly, the score of each node for each community its neighbors belong to). This state is kept between the
+    calls, so :py:meth:`set_partitions` only pays for the nodes that changed their community, and :py:meth:`score` only
+    pays for the number of communities, instead of re-computing everything from scratch as done by
+    :py:func:`optimize_partitions` and :py:func:`score_partitions`.
+
+    If the (column-major) ``incoming_edge_weights`` are already available, they may be passed to avoid re-computing
+    them. The ``low_partition_size``, ``target_partition_size``, ``high_partition_size`` and ``node_sizes`` are as for
+    :py:func:`optimize_partitions`.
+    """
+
+    def __init__(
+        self,
+        *,
+        edge_weights: ut.CompressedMatrix,
+        incoming_edge_weights: Optional[ut.CompressedMatrix] = None,
+        community_of_nodes: ut.NumpyVector,
+        low_partition_size: float,
+        target_partition_size: float,
+        high_partition_size: float,
+        node_sizes: ut.NumpyVector,
+    ) -> None:
+        outgoing_edge_weights = ut.mustbe_compressed_matrix(edge_weights)
+        assert ut.is_layout(outgoing_edge_weights, "row_major")
+        assert 0 < low_partition_size < target_partition_size < high_partition_size
+        assert community_of_nodes.dtype == "int32"
+        assert np.min(community_of_nodes) == 0
+        assert node_sizes.dtype == "float32"
+
+        if incoming_edge_weights is None:
+            incoming_edge_weights = ut.to_layout(outgoing_edge_weights, layout="column_major")
+        incoming_edge_weights = ut.mustbe_compressed_matrix(incoming_edge_weights)
+        assert ut.is_layout(incoming_edge_weights, "column_major")
+
+        self.nodes_count = len(community_of_nodes)
+        with ut.timed_step(".setup"):
+            self._partitioner = xt.Partitioner(
+                outgoing_edge_weights.data,
+                outgoing_edge_weights.indices,
+                outgoing_edge_weights.indptr,
+                incoming_edge_weights.data,
+                incoming_edge_weights.indices,
+                incoming_edge_weights.indptr,
+                low_partition_size,
+                target_partition_size,
+                high_partition_size,
+                node_sizes,
+                community_of_nodes,
+            )
+
+    def get_partitions(self, community_of_nodes: Optional[ut.NumpyVector] = None) -> ut.NumpyVector:
+        """
+        Return the current community of each node.
+
+        If ``community_of_nodes`` is specified, it is modified in-place and returned.
+        """
+        if community_of_nodes is None:
+            community_of_nodes = np.empty(self.nodes_count, dtype="int32")
+        assert community_of_nodes.dtype == "int32"
+        with ut.unfrozen(community_of_nodes):
+            self._partitioner.get_partitions(community_of_nodes)
+        return community_of_nodes
+
+    def set_partitions(self, community_of_nodes: ut.NumpyVector) -> None:
+        """
+        Change the community of the nodes, only updating the state for the nodes whose community has changed.
+
+        Every node must be assigned to a community, and all the communities must be non-empty.
+        """
+        assert community_of_nodes.dtype == "int32"
+        assert np.min(community_of_nodes) == 0
+        with ut.timed_step(".set_partitions"):
+            self._partitioner.set_partitions(community_of_nodes)
+
+    @ut.timed_call()
+    @ut.expand_doc()
+    def optimize(
+        self,
+        *,
+        random_seed: int,
+        cooldown_pass: float = pr.cooldown_pass,
+        cooldown_node: float = pr.cooldown_node,
+        cold_communities_count: int = 0,
+        cold_temperature: Optional[float] = None,
+        parallel_batch_size: int = pr.parallel_batch_size,
+    ) -> float:
+        """
+        Optimize the current partition as described in :py:func:`optimize_partitions`, and return its score.
+
+        The ``cooldown_pass`` (default: {cooldown_pass}), ``cooldown_node`` (default: {cooldown_node}) and
+        ``parallel_batch_size`` (default: {parallel_batch_size}) are as for :py:func:`optimize_partitions`. The nodes
+        of the first ``cold_communities_count`` (default: {cold_communities_count}) communities start at the
+        ``cold_temperature`` (by default, ``cooldown_pass``).
+        """
+        if cold_temperature is None:
+            cold_temperature = cooldown_pass
+        score = self._partitioner.optimize(
+            random_seed,
+            cooldown_pass,
+            cooldown_node,
+            cold_communities_count,
+            cold_temperature,
+            parallel_batch_size,
+        )
+        ut.log_calc("score", score)
+        return score
+
+    def score(self, with_orphans: bool = True) -> float:
+        """
+        Return the score of the current partition, as described in :py:func:`score_partitions`.
+        """
+        return self._partitioner.score(with_orphans)
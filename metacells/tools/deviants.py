@@ -153,7 +153,14 @@ def find_deviant_cells(  # pylint: disable=too-many-statements,too-many-branches
 
     umis_per_gene_per_cell = ut.get_vo_proper(adata, what, layout="row_major")
 
-    fold_per_gene_per_cell = np.zeros(adata.shape, dtype="float32")
+    # Without noisy genes, the ``max`` policy only needs the top fold factor of each cell.
+    max_fold_per_cell: Optional[ut.NumpyVector] = None
+    fold_per_gene_per_cell: Optional[ut.NumpyMatrix] = None
+    if policy == "max" and noisy_genes_mask is None:
+        max_fold_per_cell = np.zeros(cells_count, dtype="float32")
+    else:
+        fold_per_gene_per_cell = np.zeros(adata.shape, dtype="float32")
+
     for candidate_index in range(candidates_count):
         candidate_cell_indices = np.where(candidate_of_cells == candidate_index)[0]
 
@@ -194,7 +201,21 @@ def find_deviant_cells(  # pylint: disable=too-many-statements,too-many-branches
                     median_fraction_per_gene,
                 )
 
-            fold_per_gene_per_cell[candidate_cell_indices, :] = compressed
+            if max_fold_per_cell is not None:
+                max_fold_per_cell[candidate_cell_indices] = ut.max_per(compressed, per="row")
+            else:
+                assert fold_per_gene_per_cell is not None
+                fold_per_gene_per_cell[candidate_cell_indices, :] = compressed
+
+        elif max_fold_per_cell is not None:
+            assert dense is not None
+            _, top_fold_per_grouped = ut.top_distinct_fold_factors(
+                dense,
+                total_per_row=total_umis_per_grouped,
+                fraction_per_column=median_fraction_per_gene,
+                distinct_count=1,
+            )
+            max_fold_per_cell[candidate_cell_indices] = top_fold_per_grouped[:, 0]
 
         else:
             assert dense is not None
@@ -209,22 +230,30 @@ def find_deviant_cells(  # pylint: disable=too-many-statements,too-many-branches
                     median_fraction_per_gene,
                 )
 
+            assert fold_per_gene_per_cell is not None
             fold_per_gene_per_cell[candidate_cell_indices, :] = dense
 
-    effective_fold_per_gene_per_cell = np.abs(fold_per_gene_per_cell)
-    effective_fold_per_gene_per_cell -= min_gene_fold_factor
-    if noisy_genes_mask is not None:
-        effective_fold_per_gene_per_cell[:, noisy_genes_mask] -= min_noisy_gene_fold_factor
-    effective_fold_per_gene_per_cell[effective_fold_per_gene_per_cell < 0] = 0
-
-    if policy == "count":
-        policy_per_cell = ut.sum_per(effective_fold_per_gene_per_cell > 0, per="row")
-    elif policy == "sum":
-        policy_per_cell = ut.sum_per(effective_fold_per_gene_per_cell, per="row")
-    elif policy == "max":
-        policy_per_cell = ut.max_per(effective_fold_per_gene_per_cell, per="row")
+    if max_fold_per_cell is not None:
+        max_fold_per_cell -= min_gene_fold_factor
+        max_fold_per_cell[max_fold_per_cell < 0] = 0
+        policy_per_cell = max_fold_per_cell
+
     else:
-        assert False
+        assert fold_per_gene_per_cell is not None
+        effective_fold_per_gene_per_cell = np.abs(fold_per_gene_per_cell)
+        effective_fold_per_gene_per_cell -= min_gene_fold_factor
+        if noisy_genes_mask is not None:
+            effective_fold_per_gene_per_cell[:, noisy_genes_mask] -= min_noisy_gene_fold_factor
+        effective_fold_per_gene_per_cell[effective_fold_per_gene_per_cell < 0] = 0
+
+        if policy == "count":
+            policy_per_cell = ut.sum_per(effective_fold_per_gene_per_cell > 0, per="row")
+        elif policy == "sum":
+            policy_per_cell = ut.sum_per(effective_fold_per_gene_per_cell, per="row")
+        elif policy == "max":
+            policy_per_cell = ut.max_per(effective_fold_per_gene_per_cell, per="row")
+        else:
+            assert False
     ut.log_calc(f"{policy}_per_gene_per_cell", policy_per_cell)
 
     if max_cell_fraction is None or max_cell_fraction == 1.0:
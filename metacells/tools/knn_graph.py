@@ -16,8 +16,13 @@ import metacells.utilities as ut
 __all__ = [
     "compute_obs_obs_knn_graph",
     "compute_var_var_knn_graph",
+    "extend_obs_obs_knn_graph",
 ]
 
+#: How many new observations to correlate with all the observations at a time when extending a
+#: K-Nearest-Neighbors graph. This bounds the size of the temporary dense correlations.
+EXTEND_BATCH_SIZE = 1024
+
 
 @ut.logged()
 @ut.timed_call()
@@ -189,6 +194,218 @@ def compute_var_var_knn_graph(
     )
 
 
+@ut.logged()
+@ut.timed_call()
+@ut.expand_doc()
+def extend_obs_obs_knn_graph(  # pylint: disable=too-many-locals,too-many-statements
+    adata: AnnData,
+    what: Union[str, ut.Matrix] = "__x__",
+    *,
+    pruned_ranks: ut.CompressedMatrix,
+    method: str = pr.similarity_method,
+    k: int,
+    balanced_ranks_factor: float = pr.knn_balanced_ranks_factor,
+    incoming_degree_factor: float = pr.knn_incoming_degree_factor,
+    outgoing_degree_factor: float = pr.knn_outgoing_degree_factor,
+    inplace: bool = True,
+) -> Optional[ut.PandasFrame]:
+    """
+    Extend a directed K-Nearest-Neighbors graph, previously computed by
+    :py:func:`compute_obs_obs_knn_graph`, with some new observations (cells), without re-computing
+    the similarity between the existing observations.
+
+    **Input**
+
+    Annotated ``adata``, where the observations are cells and the variables are genes, where the
+    first observations are the existing ones and the rest are the new ones, and where ``what``
+    (default: {what}) is a per-variable-per-observation matrix or the name of a
+    per-variable-per-observation annotation containing such a matrix, from which the ``pearson`` or
+    ``abs_pearson`` similarity ``method`` (default: {method}) is computed, as in
+    :py:func:`metacells.tools.similarity.compute_obs_obs_similarity`.
+
+    The ``pruned_ranks`` must be the ``obs_pruned_ranks`` computed by
+    :py:func:`compute_obs_obs_knn_graph` for the existing observations, using the same ``k``,
+    ``balanced_ranks_factor`` (default: {balanced_ranks_factor}), ``incoming_degree_factor``
+    (default: {incoming_degree_factor}) and ``outgoing_degree_factor`` (default:
+    {outgoing_degree_factor}).
+
+    **Returns**
+
+    Observations-Pair Annotations
+        ``obs_pruned_ranks``
+            The pruned ranks of all the observations (always stored in the data).
+
+        ``obs_outgoing_weights``
+            A sparse square matrix where each non-zero entry is the weight of an edge between a pair
+            of cells, where the sum of the weights of the outgoing edges for each element is 1
+            (there is always at least one such edge).
+
+    If ``inplace`` (default: {inplace}), this is written to the data, and the function returns
+    ``None``. Otherwise this is returned as a pandas data frame (indexed by the observation names).
+
+    **Computation Parameters**
+
+    1. Prepare the rows of all the observations using
+       :py:func:`metacells.utilities.computation.prepare_corrcoef_rows`, and correlate just the rows
+       of the new observations with them (in batches of ``EXTEND_BATCH_SIZE``), and convert these to
+       outgoing ranks (in descending order), as in :py:func:`compute_obs_obs_knn_graph`.
+
+    2. Compute the balanced ranks of the edges from the new observations. For edges between two
+       new observations, this is the geomean of the outgoing ranks of both, as in
+       :py:func:`compute_obs_obs_knn_graph`. For edges between a new and an existing observation,
+       the outgoing rank of the existing observation is not known (computing it would require the
+       similarity of the existing observation with all the others), so it is assumed to be the same
+       as the outgoing rank of the new observation.
+
+       .. note::
+
+            Only the outgoing ranks between new observations which may give a non-negative balanced
+            rank (that is, up to ``(k * balanced_ranks_factor + 1) ** 2``) are kept, in a sparse
+            matrix. Therefore the temporary dense data is bounded by ``EXTEND_BATCH_SIZE`` times the
+            number of observations, regardless of the number of new observations.
+
+    3. Merge the new balanced edges (in both directions) into the existing pruned ranks, and prune
+       only the "affected" observations (the new ones, and the existing ones with a new edge) as in
+       :py:func:`compute_obs_obs_knn_graph`, while ensuring that the highest-ranked outgoing edge of
+       each observation is preserved. The edges of the other existing observations are kept as-is,
+       so the result is an approximation of the graph that would be computed from scratch, which
+       gets worse as the fraction of the new observations grows.
+
+    4. Normalize the outgoing edge weights, as in :py:func:`compute_obs_obs_knn_graph`.
+    """
+    assert method in ("pearson", "abs_pearson"), f"invalid similarity method for extending: {method}"
+    assert balanced_ranks_factor > 0.0
+    assert incoming_degree_factor > 0.0
+    assert outgoing_degree_factor > 0.0
+
+    pruned_ranks = ut.mustbe_compressed_matrix(pruned_ranks)
+    _assert_proper_compressed(pruned_ranks, "csr")
+
+    size = adata.n_obs
+    existing_size = pruned_ranks.shape[0]
+    new_size = size - existing_size
+    assert pruned_ranks.shape == (existing_size, existing_size)
+    assert existing_size > 0
+    assert new_size > 0
+    ut.log_calc("existing_size", existing_size)
+    ut.log_calc("new_size", new_size)
+
+    data = ut.to_numpy_matrix(ut.get_vo_proper(adata, what, layout="row_major"))
+    prepared = ut.prepare_corrcoef_rows(data)
+
+    max_rank = k * balanced_ranks_factor
+    ut.log_calc("max_rank", max_rank)
+
+    max_new_rank = (max_rank + 1) * (max_rank + 1)
+    new_new_ranks = []
+    new_existing_balanced_ranks = []
+    best_existing_balanced_ranks = np.empty(new_size, dtype="float32")
+    best_existing_indices = np.empty(new_size, dtype="int32")
+
+    for batch_start in range(0, new_size, EXTEND_BATCH_SIZE):
+        batch_stop = min(batch_start + EXTEND_BATCH_SIZE, new_size)
+        batch_positions = np.arange(batch_stop - batch_start)
+
+        similarity = ut.prepared_cross_corrcoef_rows(
+            prepared, data[existing_size + batch_start : existing_size + batch_stop, :]
+        )
+        if method == "abs_pearson":
+            np.absolute(similarity, out=similarity)
+        similarity[batch_positions, existing_size + batch_start + batch_positions] = ut.min_matrix(similarity) - 1
+        outgoing_ranks = ut.rank_matrix_by_layout(similarity, ascending=False)
+
+        batch_new_ranks = outgoing_ranks[:, existing_size:].copy()
+        batch_new_ranks[batch_new_ranks > max_new_rank] = 0
+        batch_new_ranks[batch_positions, batch_start + batch_positions] = 0
+        new_new_ranks.append(sp.csr_matrix(batch_new_ranks))
+
+        existing_balanced_ranks = outgoing_ranks[:, :existing_size]
+        existing_balanced_ranks *= -1
+        existing_balanced_ranks += max_rank + 1
+        best_existing_indices[batch_start:batch_stop] = np.argmax(existing_balanced_ranks, axis=1)
+        best_existing_balanced_ranks[batch_start:batch_stop] = existing_balanced_ranks[
+            batch_positions, best_existing_indices[batch_start:batch_stop]
+        ]
+        existing_balanced_ranks[existing_balanced_ranks < 0] = 0
+        new_existing_balanced_ranks.append(sp.csr_matrix(existing_balanced_ranks))
+
+    with ut.timed_step(".new_balanced_ranks"):
+        ut.timed_parameters(size=new_size)
+        new_new_outgoing_ranks = sp.vstack(new_new_ranks, format="csr")
+        new_new_balanced_ranks = sp.csr_matrix(new_new_outgoing_ranks.multiply(new_new_outgoing_ranks.transpose()))
+        ut.sort_compressed_indices(new_new_balanced_ranks)
+        balanced_data = new_new_balanced_ranks.data
+        np.sqrt(balanced_data, out=balanced_data)
+        balanced_data *= -1
+        balanced_data += max_rank + 1
+
+        # Rows without any kept new-new edge will preserve their best existing edge.
+        best_new_indices = np.zeros(new_size, dtype="int32")
+        best_new_balanced_ranks = np.full(new_size, -np.inf, dtype="float32")
+        has_new_edges = np.diff(new_new_balanced_ranks.indptr) > 0
+        if np.any(has_new_edges):
+            best_new_balanced_ranks[has_new_edges] = np.maximum.reduceat(
+                balanced_data, new_new_balanced_ranks.indptr[:-1][has_new_edges]
+            )
+            row_of_entries = np.repeat(np.arange(new_size), np.diff(new_new_balanced_ranks.indptr))
+            is_best_entry = balanced_data == best_new_balanced_ranks[row_of_entries]
+            best_rows, first_best_positions = np.unique(row_of_entries[is_best_entry], return_index=True)
+            best_new_indices[best_rows] = new_new_balanced_ranks.indices[is_best_entry][first_best_positions]
+
+        balanced_data[balanced_data < 0] = 0
+        new_new_balanced_ranks.eliminate_zeros()
+
+    is_best_existing = best_existing_balanced_ranks >= best_new_balanced_ranks
+    preserved_column_indices = np.where(is_best_existing, best_existing_indices, existing_size + best_new_indices)
+    preserved_balanced_ranks = np.maximum(best_existing_balanced_ranks, best_new_balanced_ranks)
+    preserved_balanced_ranks[preserved_balanced_ranks < 1] = 1
+    preserved_matrix = sp.csr_matrix(
+        (preserved_balanced_ranks, (np.arange(new_size), preserved_column_indices)), shape=(new_size, size)
+    )
+
+    new_balanced_ranks = sp.hstack(
+        [sp.vstack(new_existing_balanced_ranks, format="csr"), new_new_balanced_ranks], format="csr"
+    )
+    new_balanced_ranks = new_balanced_ranks.maximum(preserved_matrix)
+
+    merged_ranks = sp.vstack(
+        [sp.hstack([pruned_ranks, new_balanced_ranks[:, :existing_size].transpose()]), new_balanced_ranks],
+        format="csr",
+    )
+    ut.sort_compressed_indices(merged_ranks)
+
+    is_affected = np.zeros(size, dtype="bool")
+    is_affected[existing_size:] = True
+    is_affected[new_balanced_ranks.indices] = True
+    ut.log_calc("affected", is_affected)
+
+    pruned_ranks = _prune_affected_ranks(merged_ranks, is_affected, k, incoming_degree_factor, outgoing_degree_factor)
+    ut.set_oo_data(
+        adata,
+        "obs_pruned_ranks",
+        pruned_ranks,
+        formatter=lambda matrix: ut.ratio_description(
+            matrix.shape[0] * matrix.shape[1], "element", matrix.nnz, "nonzero"
+        ),
+    )
+
+    outgoing_weights = _weigh_edges(pruned_ranks)
+
+    if inplace:
+        ut.set_oo_data(
+            adata,
+            "obs_outgoing_weights",
+            outgoing_weights,
+            formatter=lambda matrix: ut.ratio_description(
+                matrix.shape[0] * matrix.shape[1], "element", matrix.nnz, "nonzero"
+            ),
+        )
+        return None
+
+    ut.log_return("obs_outgoing_weights", outgoing_weights)
+    return ut.to_pandas_frame(outgoing_weights, index=adata.obs_names, columns=adata.obs_names)
+
+
 def _compute_elements_knn_graph(
     adata: AnnData,
     elements: str,
@@ -368,6 +585,71 @@ def _prune_ranks(
     return pruned_ranks
 
 
+@ut.timed_call()
+def _prune_affected_ranks(
+    merged_ranks: ut.CompressedMatrix,
+    is_affected: ut.NumpyVector,
+    k: int,
+    incoming_degree_factor: float,
+    outgoing_degree_factor: float,
+) -> ut.CompressedMatrix:
+    size = merged_ranks.shape[0]
+
+    incoming_degree = int(round(k * incoming_degree_factor))
+    incoming_degree = min(incoming_degree, size - 1)
+    ut.log_calc("incoming_degree", incoming_degree)
+
+    outgoing_degree = int(round(k * outgoing_degree_factor))
+    outgoing_degree = min(outgoing_degree, size - 1)
+    ut.log_calc("outgoing_degree", outgoing_degree)
+
+    with ut.timed_step("numpy.argmax"):
+        ut.timed_parameters(results=size, elements=merged_ranks.nnz / size)
+        max_index_of_each = ut.to_numpy_vector(merged_ranks.argmax(axis=1))
+
+    all_indices = np.arange(size)
+    preserved_balanced_ranks = ut.to_numpy_vector(merged_ranks[all_indices, max_index_of_each])
+    assert np.min(preserved_balanced_ranks) > 0
+    preserved_matrix = sp.coo_matrix(
+        (preserved_balanced_ranks, (all_indices, max_index_of_each)), shape=merged_ranks.shape
+    )
+    preserved_matrix.has_canonical_format = True
+
+    affected_mask = sp.diags(is_affected.astype("float32"), format="csr")
+    unaffected_mask = sp.diags((~is_affected).astype("float32"), format="csr")
+
+    incoming_ranks = ut.mustbe_compressed_matrix(merged_ranks @ affected_mask)
+    incoming_ranks.eliminate_zeros()
+    ut.sort_compressed_indices(incoming_ranks)
+    incoming_ranks = ut.mustbe_compressed_matrix(ut.to_layout(incoming_ranks, "column_major"))
+    _assert_proper_compressed(incoming_ranks, "csc")
+
+    incoming_ranks = ut.prune_per(incoming_ranks, incoming_degree)
+    _assert_proper_compressed(incoming_ranks, "csc")
+    pruned_ranks = merged_ranks @ unaffected_mask + ut.to_layout(incoming_ranks, "row_major")
+
+    outgoing_ranks = ut.mustbe_compressed_matrix(affected_mask @ pruned_ranks)
+    outgoing_ranks.eliminate_zeros()
+    ut.sort_compressed_indices(outgoing_ranks)
+    _assert_proper_compressed(outgoing_ranks, "csr")
+
+    outgoing_ranks = ut.prune_per(outgoing_ranks, outgoing_degree)
+    _assert_proper_compressed(outgoing_ranks, "csr")
+    pruned_ranks = unaffected_mask @ pruned_ranks + outgoing_ranks
+
+    with ut.timed_step("sparse.maximum"):
+        ut.timed_parameters(collected=pruned_ranks.nnz, preserved=preserved_matrix.nnz)
+        pruned_ranks = pruned_ranks.maximum(preserved_matrix)
+        pruned_ranks = pruned_ranks.maximum(preserved_matrix.transpose())
+
+    pruned_ranks.eliminate_zeros()
+    ut.sort_compressed_indices(pruned_ranks)
+
+    pruned_ranks = ut.mustbe_compressed_matrix(pruned_ranks)
+    _assert_proper_compressed(pruned_ranks, "csr")
+    return pruned_ranks
+
+
 @ut.timed_call()
 def _weigh_edges(pruned_ranks: ut.CompressedMatrix) -> ut.CompressedMatrix:
     size = pruned_ranks.shape[0]
@@ -204,7 +204,18 @@ def _compute_elements_similarity(  # pylint: disable=too-many-branches
     dense = ut.to_numpy_matrix(data)
 
     similarity: ut.ProperMatrix
-    if method in ("logistics", "logistics_pearson", "logistics_abs_pearson"):
+    if (
+        method == "pearson"
+        and reproducible
+        and top is not None
+        and bottom is None
+        and top < dense.shape[0]
+        and str(dense.dtype) in ut.CORRELATE_DTYPES
+    ):
+        similarity = ut.corrcoef_top_per(dense, top, per=per)
+        top = None  # Already collected the top similarities.
+
+    elif method in ("logistics", "logistics_pearson", "logistics_abs_pearson"):
         similarity = ut.logistics(dense, location=logistics_location, slope=logistics_slope, per=per)
         similarity *= -1
         similarity += 1
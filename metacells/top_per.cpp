@@ -16,50 +16,39 @@ collect_top_row(const size_t row_index,
     const size_t start_position = row_index * degree;
     const size_t stop_position = start_position + degree;
 
-    TmpVectorSizeT raii_positions;
-    auto tmp_positions = raii_positions.array_slice("tmp_positions", columns_count);
-    std::iota(tmp_positions.begin(), tmp_positions.end(), 0);
-
-    std::nth_element(tmp_positions.begin(),
-                     tmp_positions.begin() + degree,
-                     tmp_positions.end(),
-                     [&](const size_t left_column_index, const size_t right_column_index) {
-                         D left_similarity = row_similarities[left_column_index];
-                         D right_similarity = row_similarities[right_column_index];
-                         return left_similarity > right_similarity;
-                     });
+    TmpVector<IndexedValue<D>> raii_indexed_similarities;
+    auto tmp_indexed_similarities = raii_indexed_similarities.array_slice("tmp_indexed_similarities", columns_count);
+    collect_indexed_values(row_similarities, tmp_indexed_similarities);
+    select_largest(tmp_indexed_similarities, degree);
 
     auto row_data = output_data.slice(start_position, stop_position);
     auto row_indices = output_indices.slice(start_position, stop_position);
-    std::copy(tmp_positions.begin(), tmp_positions.begin() + degree, row_indices.begin());
-    std::sort(row_indices.begin(), row_indices.end());
 
     if (!ranks) {
 #ifdef __INTEL_COMPILER
 #    pragma simd
 #endif
         for (size_t location = 0; location < degree; ++location) {
-            size_t index = row_indices[location];
-            row_data[location] = row_similarities[index];
+            row_indices[location] = tmp_indexed_similarities[location].index;
+            row_data[location] = tmp_indexed_similarities[location].value;
         }
 
         return;
     }
 
-    tmp_positions = tmp_positions.slice(0, degree);
-    std::iota(tmp_positions.begin(), tmp_positions.end(), 0);
-    std::sort(tmp_positions.begin(), tmp_positions.end(), [&](const size_t left_position, const size_t right_position) {
-        D left_similarity = row_similarities[row_indices[left_position]];
-        D right_similarity = row_similarities[row_indices[right_position]];
-        return left_similarity < right_similarity;
-    });
-
+    tmp_indexed_similarities = tmp_indexed_similarities.slice(0, degree);
 #ifdef __INTEL_COMPILER
 #    pragma simd
 #endif
     for (size_t location = 0; location < degree; ++location) {
-        size_t position = tmp_positions[location];
-        row_data[position] = D(location + 1);
+        row_indices[location] = tmp_indexed_similarities[location].index;
+        tmp_indexed_similarities[location].index = int32_t(location);
+    }
+
+    sort_values(tmp_indexed_similarities, true);
+
+    for (size_t rank = 0; rank < degree; ++rank) {
+        row_data[tmp_indexed_similarities[rank].index] = D(rank + 1);
     }
 }
 
@@ -103,6 +92,7 @@ register_top_per(pybind11::module& module) {
     REGISTER_D(uint16_t)
     REGISTER_D(uint32_t)
     REGISTER_D(uint64_t)
+    REGISTER_D(float16_t)
     REGISTER_D(float32_t)
     REGISTER_D(float64_t)
 }
@@ -18,6 +18,7 @@ analysis pipeline.
 """
 
 import re
+import struct
 import sys
 from math import ceil
 from math import floor
@@ -56,9 +57,19 @@ __all__ = [
     "allow_inefficient_layout",
     "to_layout",
     "sort_compressed_indices",
+    "write_mapped_compressed",
+    "read_mapped_compressed",
+    "prefetch_mapped_bands",
+    "stream_downsample_mapped",
+    "stream_fold_factors_mapped",
+    "CORRELATE_DTYPES",
     "corrcoef",
     "cross_corrcoef_rows",
     "pairs_corrcoef_rows",
+    "corrcoef_top_per",
+    "prepare_corrcoef_rows",
+    "prepared_cross_corrcoef_rows",
+    "prepared_top_corrcoef_rows",
     "logistics",
     "cross_logistics_rows",
     "pairs_logistics_rows",
@@ -104,6 +115,8 @@ __all__ = [
     "downsample_matrix",
     "downsample_vector",
     "matrix_rows_folds_and_aurocs",
+    "matrix_rows_folds_and_aurocs_of_groups",
+    "top_distinct_fold_factors",
     "sliding_window_function",
     "patterns_matches",
     "compress_indices",
@@ -139,23 +152,31 @@ def allow_inefficient_layout(allow: bool) -> bool:
 
 
 @overload
-def to_layout(matrix: utt.CompressedMatrix, layout: str, *, symmetric: bool = False) -> utt.CompressedMatrix:
+def to_layout(
+    matrix: utt.CompressedMatrix, layout: str, *, symmetric: bool = False, max_block_elements: Optional[int] = None
+) -> utt.CompressedMatrix:
     ...
 
 
 @overload
-def to_layout(matrix: utt.NumpyMatrix, layout: str, *, symmetric: bool = False) -> utt.NumpyMatrix:
+def to_layout(
+    matrix: utt.NumpyMatrix, layout: str, *, symmetric: bool = False, max_block_elements: Optional[int] = None
+) -> utt.NumpyMatrix:
     ...
 
 
 @overload
-def to_layout(matrix: utt.ImproperMatrix, layout: str, *, symmetric: bool = False) -> utt.ProperMatrix:
+def to_layout(
+    matrix: utt.ImproperMatrix, layout: str, *, symmetric: bool = False, max_block_elements: Optional[int] = None
+) -> utt.ProperMatrix:
     ...
 
 
 @utm.timed_call()
 @utd.expand_doc()
-def to_layout(matrix: utt.Matrix, layout: str, *, symmetric: bool = False) -> utt.ProperMatrix:
+def to_layout(
+    matrix: utt.Matrix, layout: str, *, symmetric: bool = False, max_block_elements: Optional[int] = None
+) -> utt.ProperMatrix:
     """
     Return the ``matrix`` in a specific ``layout`` for efficient processing.
 
@@ -177,6 +198,9 @@ def to_layout(matrix: utt.Matrix, layout: str, *, symmetric: bool = False) -> ut
     elements to their proper place. This uses a C++ extension to deal with compressed data (the builtin implementation
     is much slower). Even so this operation is costly; still, it makes the following processing **much** more efficient,
     so it is typically a net performance gain overall.
+
+    If ``max_block_elements`` is specified, compressed data is converted in blocks of up to (about) this number of
+    elements at a time, to limit the size of the temporary data used for the conversion.
     """
     assert layout in utt.LAYOUT_OF_AXIS
 
@@ -212,7 +236,7 @@ def to_layout(matrix: utt.Matrix, layout: str, *, symmetric: bool = False) -> ut
         to_format = utt.SPARSE_FAST_FORMAT[layout]
         from_format = utt.SPARSE_SLOW_FORMAT[layout]
         assert compressed.getformat() == from_format
-        compressed = _relayout_compressed(compressed)
+        compressed = _relayout_compressed(compressed, max_block_elements)
         assert compressed.getformat() == to_format
         result = compressed
 
@@ -251,9 +275,16 @@ def _relayout_dense(dense: utt.NumpyMatrix, layout: str, block_size: int) -> utt
 
 
 @utm.timed_call()
-def _relayout_compressed(compressed: utt.CompressedMatrix) -> utt.CompressedMatrix:
+def _relayout_compressed(
+    compressed: utt.CompressedMatrix, max_block_elements: Optional[int] = None
+) -> utt.CompressedMatrix:
     """
     Efficient parallel conversion of a CSR/CSC ``matrix`` to a CSC/CSR matrix.
+
+    The result is computed directly with sorted indices. If ``max_block_elements`` is specified, the
+    result is computed in blocks of consecutive bands containing up to (about) this number of
+    elements. Each block requires another pass over the input, but this reduces the size of the
+    temporary offsets table, which is proportional to the number of bands in a block.
     """
     axis = ("csr", "csc").index(compressed.getformat())
 
@@ -270,15 +301,15 @@ def _relayout_compressed(compressed: utt.CompressedMatrix) -> utt.CompressedMatr
 
         nnz_elements_of_output_bands = bincount_vector(compressed.indices, minlength=matrix_elements_count)
         output_indptr = np.empty(output_bands_count + 1, dtype=compressed.indptr.dtype)
-        output_indptr[0:2] = 0
+        output_indptr[0] = 0
         with utm.timed_step("numpy.cumsum"):
-            utm.timed_parameters(elements=nnz_elements_of_output_bands.size - 1)
-            np.cumsum(nnz_elements_of_output_bands[:-1], out=output_indptr[2:])
+            utm.timed_parameters(elements=nnz_elements_of_output_bands.size)
+            np.cumsum(nnz_elements_of_output_bands, out=output_indptr[1:])
 
         output_indices = np.empty(compressed.nnz, dtype=compressed.indices.dtype)
         output_data = np.empty(compressed.nnz, dtype=compressed.data.dtype)
 
-        extension_name = "collect_compressed_%s_t_%s_t_%s_t" % (  # pylint: disable=consider-using-f-string
+        extension_name = "transpose_compressed_%s_t_%s_t_%s_t" % (  # pylint: disable=consider-using-f-string
             compressed.data.dtype,
             compressed.indices.dtype,
             compressed.indptr.dtype,
@@ -286,20 +317,35 @@ def _relayout_compressed(compressed: utt.CompressedMatrix) -> utt.CompressedMatr
         extension = getattr(xt, extension_name)
 
         assert matrix_bands_count == compressed.indptr.size - 1
+        assert compressed.indptr[-1] == compressed.data.size
+        assert output_indptr[-1] == compressed.indptr[-1]
 
-        with utm.timed_step("extensions.collect_compressed"):
-            utm.timed_parameters(results=output_bands_count, elements=matrix_bands_count)
-            assert compressed.indptr[-1] == compressed.data.size
-            extension(
-                compressed.data, compressed.indices, compressed.indptr, output_data, output_indices, output_indptr[1:]
+        if max_block_elements is None or max_block_elements >= compressed.nnz:
+            block_bands = np.array([0, output_bands_count])
+        else:
+            blocks_count = int(ceil(compressed.nnz / max_block_elements))
+            block_bands = np.searchsorted(
+                output_indptr, np.linspace(0, compressed.nnz, blocks_count + 1)[1:-1], side="right"
             )
-
-        assert output_indptr[-1] == compressed.indptr[-1]
+            block_bands = np.unique(np.concatenate([[0], block_bands, [output_bands_count]]))
+
+        with utm.timed_step("extensions.transpose_compressed"):
+            utm.timed_parameters(results=output_bands_count, elements=matrix_bands_count, blocks=block_bands.size - 1)
+            for start_output_band, stop_output_band in zip(block_bands[:-1], block_bands[1:]):
+                extension(
+                    compressed.data,
+                    compressed.indices,
+                    compressed.indptr,
+                    output_data,
+                    output_indices,
+                    output_indptr,
+                    int(start_output_band),
+                    int(stop_output_band),
+                )
 
         constructor = (sp.csr_matrix, sp.csc_matrix)[1 - axis]
         compressed = constructor((output_data, output_indices, output_indptr), shape=compressed.shape)
-
-        sort_compressed_indices(compressed, force=True)
+        compressed.has_sorted_indices = True
 
     compressed.has_canonical_format = True
 
@@ -331,6 +377,169 @@ def sort_compressed_indices(matrix: utt.CompressedMatrix, force: bool = False) -
     matrix.has_sorted_indices = True
 
 
+#: The header of a memory-mapped compressed matrix file (see ``mapped.cpp``).
+MAPPED_HEADER = struct.Struct("<8s16s16s16s16s6Q")
+
+#: The magic bytes at the start of a memory-mapped compressed matrix file.
+MAPPED_MAGIC = b"MCCSR\0\0\1"
+
+#: The alignment of the arrays in a memory-mapped compressed matrix file.
+MAPPED_ALIGNMENT = 4096
+
+
+def write_mapped_compressed(path: str, matrix: utt.CompressedMatrix) -> None:
+    """
+    Write a CSR/CSC ``matrix`` to a file at ``path`` so it can be memory-mapped by
+    :py:func:`read_mapped_compressed`.
+
+    The file contains a small header followed by the raw data, indices and indptr arrays (each
+    aligned to a page), so the mapped arrays can be passed as-is to all the compressed extensions.
+    """
+    assert matrix.getformat() in ("csr", "csc")
+    if matrix.getformat() == "csr":
+        layout = "row_major"
+        bands_count, elements_count = matrix.shape
+    else:
+        layout = "column_major"
+        elements_count, bands_count = matrix.shape
+    arrays = [np.ascontiguousarray(array) for array in (matrix.data, matrix.indices, matrix.indptr)]
+    assert arrays[2].size == bands_count + 1
+
+    offsets: List[int] = []
+    offset = MAPPED_HEADER.size
+    for array in arrays:
+        offset = ceil(offset / MAPPED_ALIGNMENT) * MAPPED_ALIGNMENT
+        offsets.append(offset)
+        offset += array.nbytes
+
+    with open(path, "wb") as file:
+        file.write(
+            MAPPED_HEADER.pack(
+                MAPPED_MAGIC,
+                layout.encode(),
+                *[str(array.dtype).encode() for array in arrays],
+                bands_count,
+                elements_count,
+                matrix.nnz,
+                *offsets,
+            )
+        )
+        for array, offset in zip(arrays, offsets):
+            file.write(b"\0" * (offset - file.tell()))
+            array.tofile(file)
+
+
+@utm.timed_call()
+def read_mapped_compressed(path: str) -> utt.CompressedMatrix:
+    """
+    Memory-map a CSR/CSC matrix from a file at ``path`` written by :py:func:`write_mapped_compressed`.
+
+    The data, indices and indptr of the result are views of the (copy-on-write) mapping, so the
+    matrix may be larger than the available RAM. The mapping is released when all of them are
+    garbage collected.
+    """
+    mapped = xt.MappedCompressed(path)
+    if mapped.layout == "row_major":
+        compressed = sp.csr_matrix((mapped.bands_count, mapped.elements_count), dtype=mapped.data.dtype)
+    else:
+        assert mapped.layout == "column_major"
+        compressed = sp.csc_matrix((mapped.elements_count, mapped.bands_count), dtype=mapped.data.dtype)
+
+    # Assign the arrays directly, as the constructor may copy them to a common index type.
+    compressed.data = mapped.data
+    compressed.indices = mapped.indices
+    compressed.indptr = mapped.indptr
+    return compressed
+
+
+def prefetch_mapped_bands(matrix: utt.CompressedMatrix, start_band: int, stop_band: int) -> None:
+    """
+    Advise the OS to read ahead the bands (rows of CSR, columns of CSC) from ``start_band`` up to
+    ``stop_band`` of a ``matrix`` returned by :py:func:`read_mapped_compressed`.
+
+    This does nothing if the ``matrix`` is not memory-mapped.
+    """
+    mapped = matrix.data.base
+    if isinstance(mapped, xt.MappedCompressed):
+        mapped.prefetch_bands(start_band, stop_band)
+
+
+#: The default memory budget (in bytes) for streaming a memory-mapped compressed matrix.
+MAPPED_MEMORY_BUDGET = 1 << 30
+
+
+@utm.timed_call()
+@utd.expand_doc()
+def stream_downsample_mapped(
+    input_path: str,
+    output_path: str,
+    *,
+    samples: Union[int, utt.Vector],
+    hypergeometric: bool = False,
+    random_seed: int,
+    memory_budget: int = MAPPED_MEMORY_BUDGET,
+) -> None:
+    """
+    Downsample each band (row of CSR, column of CSC) of a memory-mapped compressed matrix at
+    ``input_path`` such that the sum of each one becomes ``samples``, writing the results to a new
+    memory-mapped compressed matrix at ``output_path``.
+
+    This gives the same results as :py:func:`downsample_matrix` (with ``eliminate_zeros=False``),
+    but processes the bands in chunks using at most about ``memory_budget`` (default:
+    {memory_budget}) bytes, so the matrix may be much larger than the available RAM. The next
+    chunk is read and the previous one is written while the current one is being computed.
+    """
+    mapped = xt.MappedCompressed(input_path)
+    if isinstance(samples, (int, float)):
+        samples = np.full(mapped.bands_count, samples, dtype="int32")
+    else:
+        assert len(samples) == mapped.bands_count
+        samples = utt.to_numpy_vector(samples).astype("int32")
+
+    extension_name = f"stream_downsample_compressed_{mapped.data.dtype}_t_{mapped.indptr.dtype}_t_{mapped.data.dtype}_t"
+    extension = getattr(xt, extension_name)
+
+    with utm.timed_step("extensions.stream_downsample_compressed"):
+        utm.timed_parameters(results=mapped.bands_count, elements=mapped.elements_count, samples=np.mean(samples))
+        extension(mapped, output_path, samples, random_seed, hypergeometric, memory_budget)
+
+
+@utm.timed_call()
+@utd.expand_doc()
+def stream_fold_factors_mapped(
+    input_path: str,
+    output_path: str,
+    *,
+    total_per_band: utt.Vector,
+    fraction_per_element: utt.Vector,
+    memory_budget: int = MAPPED_MEMORY_BUDGET,
+) -> None:
+    """
+    Compute the fold factors of each entry of a memory-mapped compressed matrix at ``input_path``
+    of fractions, relative to the expected ``fraction_per_element`` scaled by the ``total_per_band``,
+    writing the results to a new memory-mapped compressed matrix at ``output_path``.
+
+    The fold factor is the absolute value of the ``log2`` of the actual (total times fraction) plus
+    one divided by the expected value plus one. The bands are processed in chunks using at most
+    about ``memory_budget`` (default: {memory_budget}) bytes, as in :py:func:`stream_downsample_mapped`.
+    """
+    mapped = xt.MappedCompressed(input_path)
+    dtype = _accumulator_dtype(mapped.data.dtype)
+    total_per_band = utt.to_numpy_vector(total_per_band).astype(dtype)
+    fraction_per_element = utt.to_numpy_vector(fraction_per_element).astype(dtype)
+    assert total_per_band.size == mapped.bands_count
+    assert fraction_per_element.size == mapped.elements_count
+
+    extension_name = (
+        f"stream_fold_factor_compressed_{mapped.data.dtype}_t_{mapped.indices.dtype}_t_{mapped.indptr.dtype}_t"
+    )
+    extension = getattr(xt, extension_name)
+
+    with utm.timed_step("extensions.stream_fold_factor_compressed"):
+        utm.timed_parameters(results=mapped.bands_count, elements=mapped.elements_count)
+        extension(mapped, output_path, total_per_band, fraction_per_element, memory_budget)
+
+
 def _ensure_per(matrix: utt.Matrix, per: Optional[str]) -> str:
     if per is not None:
         assert per in ("row", "column")
@@ -389,6 +598,11 @@ def _get_dense_for(operation: str, matrix: utt.Matrix, per: Optional[str]) -> Tu
     return per, dense
 
 
+#: The element data types of matrices supported by the reproducible correlation functions. The
+#: compact ``float16`` and ``uint16`` data is widened to ``float32`` when computing the correlations.
+CORRELATE_DTYPES = ("float16", "uint16", "float32", "float64")
+
+
 @utm.timed_call()
 def corrcoef(
     matrix: utt.Matrix,
@@ -401,7 +615,9 @@ def corrcoef(
     ``reproducible`` regardless of the number of cores used (at the cost of some slowdown). It only
     works for matrices with a float or double element data type.
 
-    If ``reproducible``, a slower (still parallel) but reproducible algorithm will be used.
+    If ``reproducible``, a slower (still parallel) but reproducible algorithm will be used. In this
+    case, if the ``matrix`` is compressed in the appropriate layout, the correlations are computed
+    directly from the non-zero values, without creating a dense copy of the data.
 
     Unlike ``numpy.corrcoef``, if given a row with identical values, instead of complaining about
     division by zero, this will report a zero correlation. This makes sense for the intended usage
@@ -417,9 +633,15 @@ def corrcoef(
 
         The result is always dense, as even for sparse data, the correlation is rarely exactly zero.
     """
+    compressed = utt.maybe_compressed_matrix(matrix)
+    if compressed is not None and reproducible and str(compressed.dtype) in CORRELATE_DTYPES:
+        per = _ensure_per(compressed, per)
+        if utt.is_layout(compressed, f"{per}_major"):
+            return _corrcoef_compressed(compressed, per)
+
     per, dense = _get_dense_for("corrcoef", matrix, per)
 
-    if not reproducible or str(dense.dtype) not in ("float", "double", "float32", "float64"):
+    if not reproducible or str(dense.dtype) not in ("float", "double") + CORRELATE_DTYPES:
         return _corrcoef_fast(dense, per)
 
     return _corrcoef_reproducible(dense, per)
@@ -470,10 +692,71 @@ def _corrcoef_reproducible(
     return result
 
 
+@utm.timed_call(".compressed")
+def _corrcoef_compressed(
+    compressed: utt.CompressedMatrix,
+    per: str,
+) -> utt.NumpyMatrix:
+    axis = utt.PER_OF_AXIS.index(per)
+    utm.timed_parameters(results=compressed.shape[axis], elements=compressed.shape[1 - axis], nnz=compressed.nnz)
+    extension_name = _compressed_extension_name("correlate", compressed)
+    result = np.empty((compressed.shape[axis], compressed.shape[axis]), dtype="float32")
+    extension = getattr(xt, extension_name)
+    extension(compressed.data, compressed.indices, compressed.indptr, compressed.shape[1 - axis], result)
+    return result
+
+
+def _compressed_rows_pair(
+    first_matrix: utt.ProperMatrix, second_matrix: utt.ProperMatrix
+) -> Optional[Tuple[utt.CompressedMatrix, utt.CompressedMatrix]]:
+    first_compressed = utt.maybe_compressed_matrix(first_matrix)
+    second_compressed = utt.maybe_compressed_matrix(second_matrix)
+    if first_compressed is None or second_compressed is None:
+        return None
+
+    assert utt.is_layout(first_compressed, "row_major")
+    assert utt.is_layout(second_compressed, "row_major")
+    assert first_compressed.shape[1] == second_compressed.shape[1]
+    assert first_compressed.dtype == second_compressed.dtype
+
+    if (
+        second_compressed.indices.dtype != first_compressed.indices.dtype
+        or second_compressed.indptr.dtype != first_compressed.indptr.dtype
+    ):
+        second_compressed = sp.csr_matrix(
+            (
+                second_compressed.data,
+                second_compressed.indices.astype(first_compressed.indices.dtype),
+                second_compressed.indptr.astype(first_compressed.indptr.dtype),
+            ),
+            shape=second_compressed.shape,
+        )
+
+    return first_compressed, second_compressed
+
+
+def _accumulator_dtype(dtype: Any) -> str:
+    # The extensions widen the compact ``float16`` and ``uint16`` data to ``float32`` (see ``AccumulatorType``), so
+    # per-row totals (which easily overflow ``float16``) must be given in this type.
+    dtype = str(dtype)
+    if dtype in ("float16", "uint16"):
+        return "float32"
+    return dtype
+
+
+def _compressed_extension_name(operation: str, compressed: utt.CompressedMatrix) -> str:
+    return "%s_compressed_%s_t_%s_t_%s_t" % (  # pylint: disable=consider-using-f-string
+        operation,
+        compressed.data.dtype,
+        compressed.indices.dtype,
+        compressed.indptr.dtype,
+    )
+
+
 @utm.timed_call()
 def cross_corrcoef_rows(
-    first_matrix: utt.NumpyMatrix,
-    second_matrix: utt.NumpyMatrix,
+    first_matrix: utt.ProperMatrix,
+    second_matrix: utt.ProperMatrix,
     *,
     reproducible: bool,  # pylint: disable=unused-argument
 ) -> utt.NumpyMatrix:
@@ -481,8 +764,8 @@ def cross_corrcoef_rows(
     Similar to for ``numpy.corrcoef``, but computes the correlations between each row of the
     ``first_matrix`` and each row of the ``second_matrix``. The result matrix contains one row per
     row of the first matrix and one column per row of the second matrix. Both matrices must be
-    dense, in row-major layout, have the same (float or double) element data type, and contain the
-    same number of columns.
+    either dense or compressed, in row-major layout, have the same (float or double) element data
+    type, and contain the same number of columns.
 
     If ``reproducible``, a slower (still parallel) but reproducible algorithm will be used.
 
@@ -499,6 +782,24 @@ def cross_corrcoef_rows(
 
         Implement a fast algorithm for the non-reproducible case.
     """
+    compressed_pair = _compressed_rows_pair(first_matrix, second_matrix)
+    if compressed_pair is not None:
+        first_compressed, second_compressed = compressed_pair
+        extension_name = _compressed_extension_name("cross_correlate", first_compressed)
+        result = np.empty((first_compressed.shape[0], second_compressed.shape[0]), dtype="float32")
+        extension = getattr(xt, extension_name)
+        extension(
+            first_compressed.data,
+            first_compressed.indices,
+            first_compressed.indptr,
+            second_compressed.data,
+            second_compressed.indices,
+            second_compressed.indptr,
+            first_compressed.shape[1],
+            result,
+        )
+        return result
+
     first_matrix = utt.mustbe_numpy_matrix(first_matrix)
     second_matrix = utt.mustbe_numpy_matrix(second_matrix)
     assert utt.is_layout(first_matrix, "row_major")
@@ -530,15 +831,16 @@ def cross_corrcoef_rows(
 
 @utm.timed_call()
 def pairs_corrcoef_rows(
-    first_matrix: utt.NumpyMatrix,
-    second_matrix: utt.NumpyMatrix,
+    first_matrix: utt.ProperMatrix,
+    second_matrix: utt.ProperMatrix,
     *,
     reproducible: bool,  # pylint: disable=unused-argument
 ) -> utt.NumpyVector:
     """
     Similar to for ``numpy.corrcoef``, but computes the correlations between each row of the
-    ``first_matrix`` and each matching row of the ``second_matrix``. Both matrices must be dense, in
-    row-major layout, have the same (float or double) element data type, and the same shape.
+    ``first_matrix`` and each matching row of the ``second_matrix``. Both matrices must be either
+    dense or compressed, in row-major layout, have the same (float or double) element data type, and
+    the same shape.
 
     If ``reproducible``, a slower (still parallel) but reproducible algorithm will be used.
 
@@ -555,6 +857,25 @@ def pairs_corrcoef_rows(
 
         Implement a fast algorithm for the non-reproducible case.
     """
+    compressed_pair = _compressed_rows_pair(first_matrix, second_matrix)
+    if compressed_pair is not None:
+        first_compressed, second_compressed = compressed_pair
+        assert first_compressed.shape == second_compressed.shape
+        extension_name = _compressed_extension_name("pairs_correlate", first_compressed)
+        result = np.empty(first_compressed.shape[0], dtype="float32")
+        extension = getattr(xt, extension_name)
+        extension(
+            first_compressed.data,
+            first_compressed.indices,
+            first_compressed.indptr,
+            second_compressed.data,
+            second_compressed.indices,
+            second_compressed.indptr,
+            first_compressed.shape[1],
+            result,
+        )
+        return result
+
     first_matrix = utt.mustbe_numpy_matrix(first_matrix)
     second_matrix = utt.mustbe_numpy_matrix(second_matrix)
     assert utt.is_layout(first_matrix, "row_major")
@@ -579,7 +900,124 @@ def pairs_corrcoef_rows(
 
 
 @utm.timed_call()
-def logistics(matrix: utt.NumpyMatrix, *, location: float, slope: float, per: Optional[str]) -> utt.NumpyMatrix:
+def corrcoef_top_per(matrix: utt.Matrix, top: int, *, per: Optional[str]) -> utt.CompressedMatrix:
+    """
+    Compute the ``top`` highest correlations ``per`` (``row`` or ``column``) of some ``matrix``, as
+    a compressed ``per``-major matrix.
+
+    This gives the same results as ``top_per(corrcoef(matrix, per=per, reproducible=True), top,
+    per="row")`` (including the correlation of each row with itself), but without ever creating the
+    full correlations matrix, so it only needs memory proportional to the number of results. It
+    only works for matrices with one of the ``CORRELATE_DTYPES`` element data types.
+
+    If ``per`` is ``None``, the matrix must be square and is assumed to be symmetric, so the most
+    efficient direction is used based on the matrix layout. Otherwise it must be one of ``row`` or
+    ``column``, and the matrix must be in the appropriate layout (``row_major`` operating on rows,
+    ``column_major`` for operating on columns).
+    """
+    per, dense = _get_dense_for("corrcoef", matrix, per)
+    if per == "column":
+        dense = dense.transpose()
+
+    size = dense.shape[0]
+    assert 0 < top < size
+    assert str(dense.dtype) in CORRELATE_DTYPES
+
+    indptr = np.arange(size + 1, dtype="int64")
+    indptr *= top
+    indices = np.empty(top * size, dtype="int32")
+    data = np.empty(top * size, dtype="float32")
+
+    with utm.timed_step("extensions.correlate_top_dense"):
+        utm.timed_parameters(results=size, elements=dense.shape[1], keep=top)
+        extension_name = f"correlate_top_dense_{dense.dtype}_t"
+        extension = getattr(xt, extension_name)
+        extension(top, dense, indices, data)
+
+    top_data = sp.csr_matrix((data, indices, indptr), shape=(size, size))
+    top_data.has_sorted_indices = True
+    top_data.has_canonical_format = True
+    return top_data
+
+
+@utm.timed_call()
+def prepare_corrcoef_rows(matrix: utt.NumpyMatrix) -> Any:
+    """
+    Prepare the rows of a dense row-major ``matrix`` (typically, the metacells of an atlas) for
+    computing their correlations with many batches of other rows, using
+    ``prepared_cross_corrcoef_rows`` and ``prepared_top_corrcoef_rows``. It only works for matrices
+    with one of the ``CORRELATE_DTYPES`` element data types.
+
+    The rows are centered and normalized once, and the result keeps its own copy of them, so each
+    batch only pays for correlating its own rows with the prepared ones, and the ``matrix`` may be
+    modified or discarded afterwards.
+    """
+    matrix = utt.mustbe_numpy_matrix(matrix)
+    assert utt.is_layout(matrix, "row_major")
+    assert str(matrix.dtype) in CORRELATE_DTYPES
+
+    with utm.timed_step("extensions.prepare_rows"):
+        utm.timed_parameters(results=matrix.shape[0], elements=matrix.shape[1])
+        return getattr(xt, f"PreparedRows_{matrix.dtype}_t")(matrix)
+
+
+@utm.timed_call()
+def prepared_cross_corrcoef_rows(prepared: Any, matrix: utt.NumpyMatrix) -> utt.NumpyMatrix:
+    """
+    Given the result of ``prepare_corrcoef_rows``, compute the correlations between each row of a
+    dense row-major ``matrix`` and each of the ``prepared`` rows.
+
+    This gives the same results as ``cross_corrcoef_rows(matrix, prepared_matrix, reproducible=True)``
+    (up to float32 rounding), and the ``matrix`` must have the same element data type and number of
+    columns as the prepared one.
+    """
+    matrix = utt.mustbe_numpy_matrix(matrix)
+    assert utt.is_layout(matrix, "row_major")
+    assert matrix.shape[1] == prepared.columns_count
+
+    result = np.empty((matrix.shape[0], prepared.rows_count), dtype="float32")
+    with utm.timed_step("extensions.prepared_cross_correlate"):
+        utm.timed_parameters(results=matrix.shape[0], elements=matrix.shape[1], prepared=prepared.rows_count)
+        prepared.cross_correlate(matrix, result)
+    return result
+
+
+@utm.timed_call()
+def prepared_top_corrcoef_rows(prepared: Any, matrix: utt.NumpyMatrix, top: int) -> utt.CompressedMatrix:
+    """
+    Given the result of ``prepare_corrcoef_rows``, compute the ``top`` highest correlations of each
+    row of a dense row-major ``matrix`` with the ``prepared`` rows, as a compressed row-major matrix
+    with one column per prepared row.
+
+    This gives the same results as ``top_per(prepared_cross_corrcoef_rows(prepared, matrix), top,
+    per="row")``, but without ever creating the full correlations matrix.
+    """
+    matrix = utt.mustbe_numpy_matrix(matrix)
+    assert utt.is_layout(matrix, "row_major")
+    assert matrix.shape[1] == prepared.columns_count
+
+    size = matrix.shape[0]
+    assert 0 < top <= prepared.rows_count
+
+    indptr = np.arange(size + 1, dtype="int64")
+    indptr *= top
+    indices = np.empty(top * size, dtype="int32")
+    data = np.empty(top * size, dtype="float32")
+
+    with utm.timed_step("extensions.prepared_correlate_top"):
+        utm.timed_parameters(results=size, elements=matrix.shape[1], prepared=prepared.rows_count, keep=top)
+        prepared.correlate_top(top, matrix, indices, data)
+
+    top_data = sp.csr_matrix((data, indices, indptr), shape=(size, prepared.rows_count))
+    top_data.has_sorted_indices = True
+    top_data.has_canonical_format = True
+    return top_data
+
+
+@utm.timed_call()
+def logistics(
+    matrix: utt.NumpyMatrix, *, location: float, slope: float, per: Optional[str], fast: bool = False
+) -> utt.NumpyMatrix:
     """
     Compute a matrix of distances between each pair of rows in a dense (float or double) matrix
     using the logistics function.
@@ -595,6 +1033,10 @@ def logistics(matrix: utt.NumpyMatrix, *, location: float, slope: float, per: Op
     ``column``, and the matrix must be in the appropriate layout (``row_major`` operating on rows,
     ``column_major`` for operating on columns).
 
+    If ``fast``, use a single-precision polynomial approximation of ``exp``. This is several times
+    faster, and each result is within ``2e-7`` of the raw value computed using the exact ``exp``
+    (before normalization).
+
     .. todo::
 
         This always uses the dense implementation. Possibly a sparse implementation might be faster.
@@ -614,7 +1056,7 @@ def logistics(matrix: utt.NumpyMatrix, *, location: float, slope: float, per: Op
     extension_name = f"logistics_dense_{dense.dtype}_t"
     result = np.empty((dense.shape[0], dense.shape[0]), dtype="float32")
     extension = getattr(xt, extension_name)
-    extension(dense, result, location, slope)
+    extension(dense, result, location, slope, fast)
     return result
 
 
@@ -625,6 +1067,7 @@ def cross_logistics_rows(
     *,
     location: float,
     slope: float,
+    fast: bool = False,
 ) -> utt.NumpyMatrix:
     """
     Similar to for :py:func:`logistics`, but computes the distances between each row of the
@@ -643,7 +1086,7 @@ def cross_logistics_rows(
     extension_name = f"cross_logistics_dense_{first_matrix.dtype}_t"
     result = np.empty((first_matrix.shape[0], second_matrix.shape[0]), dtype="float32")
     extension = getattr(xt, extension_name)
-    extension(first_matrix, second_matrix, location, slope, result)
+    extension(first_matrix, second_matrix, location, slope, result, fast)
     return result
 
 
@@ -654,6 +1097,7 @@ def pairs_logistics_rows(
     *,
     location: float,
     slope: float,
+    fast: bool = False,
 ) -> utt.NumpyVector:
     """
     Similar to for :py:func:`logistics`, but computes the distances between each row of the
@@ -670,7 +1114,7 @@ def pairs_logistics_rows(
     extension_name = f"pairs_logistics_dense_{first_matrix.dtype}_t"
     result = np.empty(first_matrix.shape[0], dtype="float32")
     extension = getattr(xt, extension_name)
-    extension(first_matrix, second_matrix, location, slope, result)
+    extension(first_matrix, second_matrix, location, slope, result, fast)
     return result
 
 
@@ -753,6 +1197,7 @@ def downsample_matrix(
     samples: Union[int, utt.Vector],
     eliminate_zeros: bool = True,
     inplace: bool = False,
+    hypergeometric: bool = False,
     random_seed: int,
 ) -> utt.ProperMatrix:
     """
@@ -767,6 +1212,12 @@ def downsample_matrix(
     If ``inplace`` (default: {inplace}), modify the matrix in-place, otherwise, return a modified
     copy.
 
+    If ``hypergeometric`` (default: {hypergeometric}), sample the count of each element in turn from
+    the hypergeometric distribution conditioned on the counts of the previous elements. This gives
+    the same distribution of results as the default (sampling the items one at a time), but takes
+    time proportional to the number of elements instead of the number of samples times the log of
+    the number of elements. The results for a specific ``random_seed`` are different, though.
+
     A non-zero ``random_seed`` will make the operation replicable.
     """
     assert per in ("row", "column")
@@ -779,14 +1230,21 @@ def downsample_matrix(
     _, dense, compressed = utt.to_proper_matrices(matrix)
 
     if dense is not None:
-        return _downsample_dense_matrix(dense, per, samples, inplace, random_seed)
+        return _downsample_dense_matrix(dense, per, samples, inplace, hypergeometric, random_seed)
 
     assert compressed is not None
-    return _downsample_compressed_matrix(compressed, per, samples, eliminate_zeros, inplace, random_seed)
+    return _downsample_compressed_matrix(
+        compressed, per, samples, eliminate_zeros, inplace, hypergeometric, random_seed
+    )
 
 
 def _downsample_dense_matrix(
-    matrix: utt.NumpyMatrix, per: str, samples: utt.NumpyVector, inplace: bool, random_seed: int
+    matrix: utt.NumpyMatrix,
+    per: str,
+    samples: utt.NumpyVector,
+    inplace: bool,
+    hypergeometric: bool,
+    random_seed: int,
 ) -> utt.NumpyMatrix:
     if inplace:
         output = matrix
@@ -834,13 +1292,13 @@ def _downsample_dense_matrix(
         extension = getattr(xt, extension_name)
         with utm.timed_step("extensions.downsample_array"):
             utm.timed_parameters(elements=input_array.size, samples=np.mean(samples))
-            extension(input_array, output_array, samples, random_seed)
+            extension(input_array, output_array, samples, random_seed, hypergeometric)
     else:
         extension_name = f"downsample_dense_{matrix.dtype}_t_{output.dtype}_t"
         extension = getattr(xt, extension_name)
         with utm.timed_step("extensions.downsample_dense_matrix"):
             utm.timed_parameters(results=results_count, elements=elements_count, samples=np.mean(samples))
-            extension(matrix, output, samples, random_seed)
+            extension(matrix, output, samples, random_seed, hypergeometric)
 
     if per == "column":
         output = np.transpose(output)
@@ -855,6 +1313,7 @@ def _downsample_compressed_matrix(
     samples: utt.NumpyVector,
     eliminate_zeros: bool,
     inplace: bool,
+    hypergeometric: bool,
     random_seed: int,
 ) -> utt.CompressedMatrix:
     axis = utt.PER_OF_AXIS.index(per)
@@ -890,7 +1349,7 @@ def _downsample_compressed_matrix(
 
     with utm.timed_step("extensions.downsample_sparse_matrix"):
         utm.timed_parameters(results=results_count, elements=elements_count, samples=np.mean(samples))
-        extension(matrix.data, matrix.indptr, output.data, samples, random_seed)
+        extension(matrix.data, matrix.indptr, output.data, samples, random_seed, hypergeometric)
 
     if eliminate_zeros:
         utt.eliminate_zeros(output)
@@ -905,6 +1364,7 @@ def downsample_vector(
     samples: int,
     *,
     output: Optional[utt.NumpyVector] = None,
+    hypergeometric: bool = False,
     random_seed: int,
 ) -> None:
     """
@@ -918,6 +1378,9 @@ def downsample_vector(
 
     * An optional numpy array ``output`` to hold the results (otherwise, the input is overwritten).
 
+    * Whether to use the ``hypergeometric`` sampling (default: {hypergeometric}), see
+      :py:func:`downsample_matrix`.
+
     * A ``random_seed`` (non-zero for reproducible results).
 
     The arrays may have any of the data types: {data_types}.
@@ -944,7 +1407,7 @@ def downsample_vector(
 
     with utm.timed_step("extensions.downsample_array"):
         utm.timed_parameters(elements=array.size, samples=samples)
-        extension(array, output, samples, random_seed)
+        extension(array, output, samples, random_seed, hypergeometric)
 
 
 @utm.timed_call()
@@ -1012,6 +1475,139 @@ def matrix_rows_folds_and_aurocs(
     return (rows_folds, rows_auroc)
 
 
+@utm.timed_call()
+def matrix_rows_folds_and_aurocs_of_groups(
+    matrix: utt.Matrix,
+    *,
+    columns_groups: utt.NumpyVector,
+    groups_count: Optional[int] = None,
+    columns_scale: Optional[utt.NumpyVector] = None,
+    normalization: float,
+) -> Tuple[utt.NumpyMatrix, utt.NumpyMatrix]:
+    """
+    Given a matrix and the group of each of the columns, return two matrices with a row for each row
+    of the matrix and a column for each group. The first contains the fold factor and the second
+    contains the AUROC of the row for the columns of the group (compared to the rest of the columns),
+    as computed by :py:func:`matrix_rows_folds_and_aurocs`.
+
+    This is much faster than computing the results for each group separately, as it only sorts the
+    (non-zero) values of each row once.
+
+    Columns whose group is negative are not part of any group (but are counted in the rest of the
+    columns for each group). If ``groups_count`` is not specified, it is one plus the maximal group.
+
+    If ``columns_scale`` is specified, the data is divided by this scale before computing the AUROC.
+    """
+    proper, dense, compressed = utt.to_proper_matrices(matrix)
+    rows_count, columns_count = proper.shape
+
+    if columns_scale is None:
+        columns_scale = np.full(columns_count, 1.0, dtype="float32")
+    else:
+        columns_scale = columns_scale.astype("float32")
+        assert columns_scale.size == columns_count
+
+    columns_groups = utt.to_numpy_vector(columns_groups).astype("int32")
+    assert columns_groups.size == columns_count
+    if groups_count is None:
+        groups_count = int(np.max(columns_groups)) + 1
+    assert np.max(columns_groups) < groups_count
+
+    rows_folds = np.empty((rows_count, groups_count), dtype="float64")
+    rows_aurocs = np.empty((rows_count, groups_count), dtype="float64")
+
+    if dense is not None:
+        extension_name = f"auroc_groups_dense_matrix_{dense.dtype}_t"
+        extension = getattr(xt, extension_name)
+        extension(dense, columns_groups, columns_scale, normalization, rows_folds, rows_aurocs)
+    else:
+        assert compressed is not None
+        assert compressed.has_sorted_indices
+        extension_name = "auroc_groups_compressed_matrix_%s_t_%s_t_%s_t" % (  # pylint: disable=consider-using-f-string
+            compressed.data.dtype,
+            compressed.indices.dtype,
+            compressed.indptr.dtype,
+        )
+        extension = getattr(xt, extension_name)
+        extension(
+            compressed.data,
+            compressed.indices,
+            compressed.indptr,
+            columns_count,
+            columns_groups,
+            columns_scale,
+            normalization,
+            rows_folds,
+            rows_aurocs,
+        )
+
+    return (rows_folds, rows_aurocs)
+
+
+@utm.timed_call()
+@utd.expand_doc()
+def top_distinct_fold_factors(
+    matrix: utt.Matrix,
+    *,
+    total_per_row: utt.Vector,
+    fraction_per_column: utt.Vector,
+    distinct_count: int,
+    inplace: bool = False,
+) -> Tuple[utt.NumpyMatrix, utt.NumpyMatrix]:
+    """
+    Given a ``row_major`` matrix of fractions, the total of each row and the expected fraction of
+    each column, return two matrices with a row for each row of the matrix and ``distinct_count``
+    columns. The first contains the (``int32``) indices of the columns with the highest absolute
+    fold factor ``log2((total * fraction + 1) / (total * expected + 1))`` in the row, and the second
+    contains the (``float32``) fold factors, sorted in decreasing order.
+
+    This computes the fold factors and picks the top ones in a single pass over the data. If
+    ``inplace`` (default: {inplace}), the (absolute) fold factors are also written back into the
+    matrix, which must then be a proper (numpy or compressed) matrix. For a compressed matrix, only
+    the stored elements are written.
+    """
+    proper, dense, compressed = utt.to_proper_matrices(matrix)
+    assert utt.is_layout(proper, "row_major")
+    rows_count, columns_count = proper.shape
+    assert 0 < distinct_count < columns_count
+    assert not inplace or proper is matrix
+
+    dtype = _accumulator_dtype(proper.dtype)
+    total_per_row = utt.to_numpy_vector(total_per_row).astype(dtype)
+    fraction_per_column = utt.to_numpy_vector(fraction_per_column).astype(dtype)
+    assert total_per_row.size == rows_count
+    assert fraction_per_column.size == columns_count
+
+    gene_indices = np.empty((rows_count, distinct_count), dtype="int32")
+    gene_folds = np.empty((rows_count, distinct_count), dtype="float32")
+
+    if dense is not None:
+        extension_name = f"top_distinct_fold_factor_dense_{dense.dtype}_t"
+        extension = getattr(xt, extension_name)
+        with utm.timed_step("extensions.top_distinct_fold_factor_dense"):
+            extension(gene_indices, gene_folds, dense, total_per_row, fraction_per_column, inplace)
+    else:
+        assert compressed is not None
+        extension_name = (
+            f"top_distinct_fold_factor_compressed_{compressed.data.dtype}_t_"
+            f"{compressed.indices.dtype}_t_{compressed.indptr.dtype}_t"
+        )
+        extension = getattr(xt, extension_name)
+        with utm.timed_step("extensions.top_distinct_fold_factor_compressed"):
+            extension(
+                gene_indices,
+                gene_folds,
+                compressed.data,
+                compressed.indices,
+                compressed.indptr,
+                total_per_row,
+                fraction_per_column,
+                inplace,
+            )
+
+    return (gene_indices, gene_folds)
+
+
 @utm.timed_call()
 def median_per(matrix: utt.Matrix, *, per: Optional[str]) -> utt.NumpyVector:
     """
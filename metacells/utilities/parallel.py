@@ -39,6 +39,10 @@ threads. So, when we use multi-processing, we limit each sub-process to use less
 such that the total will be at most 50. This very sub-optimal, but at least it doesn't bring the
 server to its knees trying to deal with a total load of 2500 processes.
 
+Since the C++ extensions release the GIL while they work, it is also possible to :py:func:`submit`
+a function which mostly uses them to run in a background thread, overlapping it with other work in
+the main thread, without the costs of multi-processing.
+
 A final twist on all this is that hyper-threading is (worse than) useless for heavy compute threads.
 We therefore by default only use one thread per physical cores. We get the number pf physical cores
 using the ``psutil`` package.
@@ -51,6 +55,8 @@ using the ``psutil`` package.
 import ctypes
 import os
 import sys
+from concurrent.futures import Future
+from concurrent.futures import ThreadPoolExecutor
 from math import ceil
 from multiprocessing import Value
 from multiprocessing import get_context
@@ -78,11 +84,14 @@ __all__ = [
     "set_processors_count",
     "get_processors_count",
     "parallel_map",
+    "submit",
 ]
 
 
 PROCESSORS_COUNT = 0
 
+AFFINITY = "none"
+
 MAIN_PROCESS_PID = os.getpid()
 
 IS_MAIN_PROCESS: Optional[bool] = True
@@ -94,6 +103,8 @@ PROCESSES_COUNT = 0
 NEXT_PROCESS_INDEX = Value(ctypes.c_int32, lock=True)
 PARALLEL_FUNCTION: Optional[Callable[[int], Any]] = None
 
+SUBMIT_EXECUTOR: Optional[ThreadPoolExecutor] = None
+
 
 def is_main_process() -> bool:
     """
@@ -103,7 +114,7 @@ def is_main_process() -> bool:
     return bool(IS_MAIN_PROCESS)
 
 
-def set_processors_count(processors: int) -> None:
+def set_processors_count(processors: int, *, affinity: Optional[str] = None) -> None:
     """
     Set the (maximal) number of processors to use in parallel.
 
@@ -115,6 +126,29 @@ def set_processors_count(processors: int) -> None:
     Otherwise, the value is the actual (positive) number of processors to use. Override this by
     setting the ``METACELLS_PROCESSORS_COUNT`` environment variable or by invoking this function
     from the main thread.
+
+    If ``affinity`` is specified, it controls how the threads of the C++ extensions are pinned to
+    processors, which matters on multi-socket (NUMA) machines. Override this by setting the
+    ``METACELLS_AFFINITY`` environment variable. The options are:
+
+    ``none`` (the default)
+        Do not pin the threads; the operating system places (and moves) them.
+
+    ``compact``
+        Pin each thread to a single processor, filling up each socket before moving to the next.
+        Since each parallel loop is initially split into one contiguous part per thread, most of the
+        memory a kernel writes (and therefore, first touches) is local to the socket which later
+        processes it.
+
+    ``scatter``
+        Pin each thread to a single processor, placing consecutive threads on different sockets,
+        to use the memory bandwidth of all the sockets even when using only a few threads.
+
+    ``socket``
+        Like ``compact``, but allow each thread to run on any of the processors of its socket.
+
+    The sub-processes of :py:func:`parallel_map` pin their threads to disjoint sets of processors.
+    The per-socket utilization is reported by ``metacells.extensions.get_native_counters``.
     """
     assert IS_MAIN_PROCESS
 
@@ -122,18 +156,26 @@ def set_processors_count(processors: int) -> None:
         processors = psutil.cpu_count(logical=False)
 
     assert processors > 0
+    assert affinity in (None, "none", "compact", "scatter", "socket")
 
     global PROCESSORS_COUNT
     PROCESSORS_COUNT = processors
 
+    global AFFINITY
+    if affinity is not None:
+        AFFINITY = affinity
+
     threadpool_limits(limits=PROCESSORS_COUNT)
-    xt.set_threads_count(PROCESSORS_COUNT)
+    xt.set_threads_count(PROCESSORS_COUNT, AFFINITY)
     os.environ["OMP_NUM_THREADS"] = str(PROCESSORS_COUNT)
     os.environ["MKL_NUM_THREADS"] = str(PROCESSORS_COUNT)
 
 
 if "sphinx" not in sys.argv[0]:
-    set_processors_count(int(os.environ.get("METACELLS_PROCESSORS_COUNT", "0")))
+    set_processors_count(
+        int(os.environ.get("METACELLS_PROCESSORS_COUNT", "0")),
+        affinity=os.environ.get("METACELLS_AFFINITY", "none"),
+    )
 
 
 def get_processors_count() -> int:
@@ -252,10 +294,42 @@ def _invocation(index: int) -> Tuple[int, Any]:
         assert PROCESSORS_COUNT > 0
         utl.logger().debug("PROCESSORS: %s", PROCESSORS_COUNT)
         threadpool_limits(limits=PROCESSORS_COUNT)
-        xt.set_threads_count(PROCESSORS_COUNT)
+        xt.set_threads_count(PROCESSORS_COUNT, AFFINITY, start_processor_index)
         os.environ["OMP_NUM_THREADS"] = str(PROCESSORS_COUNT)
         os.environ["MKL_NUM_THREADS"] = str(PROCESSORS_COUNT)
 
     assert PARALLEL_FUNCTION is not None
     result = PARALLEL_FUNCTION(index)
     return index, result
+
+
+def submit(function: Callable[..., T], *args: Any, **kwargs: Any) -> "Future[T]":
+    """
+    Submit an invocation of the ``function`` with the ``args`` and ``kwargs`` to run in the
+    background, and return a ``concurrent.futures.Future`` for its result.
+
+    This is meant for functions which spend most of their time in the C++ extensions, such as
+    :py:func:`metacells.utilities.computation.downsample_matrix`. The submitted invocations are
+    executed one at a time, in order, by a single background thread. The extensions release the GIL
+    while running their parallel loops (on the same threads as the extension calls of the caller),
+    so the caller can meanwhile continue with other work, without using Python multi-processing. For
+    example, the downsampling of the next pile can be submitted before computing the metacells of
+    the current one.
+
+    The caller must not modify the data used by the function (and vice versa) until the result is
+    obtained. The native counters (see :py:func:`metacells.utilities.timing.collect_timing`) of steps
+    which run at the same time are mixed together.
+    """
+    global SUBMIT_EXECUTOR
+    if SUBMIT_EXECUTOR is None:
+        SUBMIT_EXECUTOR = ThreadPoolExecutor(max_workers=1, thread_name_prefix="submit")
+    return SUBMIT_EXECUTOR.submit(function, *args, **kwargs)
+
+
+def _forget_submit_executor() -> None:
+    # The child process of a fork does not have the background thread, so a fresh one is needed.
+    global SUBMIT_EXECUTOR
+    SUBMIT_EXECUTOR = None
+
+
+os.register_at_fork(after_in_child=_forget_submit_executor)
@@ -10,6 +10,7 @@ irrelevant data.
 """
 
 import os
+import sys
 from contextlib import contextmanager
 from functools import wraps
 from threading import current_thread
@@ -87,6 +88,13 @@ def collect_timing(
 
     This may be followed by a series of ``name,value`` pairs describing parameters of interest for
     this context, such as data sizes and layouts, to help understand the performance of the code.
+
+    If the C++ extensions were compiled with ``NATIVE_COUNTERS``, the steps invoking them (whose
+    names start with ``extensions.``) are also given the ``native_*`` counters collected by the
+    extensions during the step: the total and maximal (per-thread) time spent executing parallel loop
+    bodies, the number of executed loop iterations and of ranges stolen between threads, the size of
+    the wrapped numpy arrays, the number of allocations of temporary vectors, and the maximal
+    per-thread size of the temporary vectors.
     """
     global TIMING_PATH
     global TIMING_MODE
@@ -329,6 +337,7 @@ def timed_step(name: str) -> Iterator[None]:  # pylint: disable=too-many-branche
     if LOG_ALL_STEPS:
         utl.logger().debug(f"{{[( {step_timing.context}")  # pylint: disable=logging-fstring-interpolation
 
+    native_start = _native_counters(name)
     yield_point = Counters.now()
     try:
         yield None
@@ -358,12 +367,54 @@ def timed_step(name: str) -> Iterator[None]:  # pylint: disable=too-many-branche
 
         total_times -= step_timing.total_nested
 
+        if native_start is not None:
+            native_stop = _native_counters(name)
+            assert native_stop is not None
+            step_timing.parameters.extend(_native_parameters(native_start, native_stop))
+
         _print_timing(step_timing.context, total_times, step_timing.parameters)
 
         assert total_times.elapsed_ns >= 0
         assert total_times.cpu_ns >= 0
 
 
+def _native_counters(name: str) -> Optional[Dict[str, Any]]:
+    if not name.startswith("extensions."):
+        return None
+    extensions = sys.modules.get("metacells.extensions")
+    if extensions is None:
+        return None
+    counters = extensions.get_native_counters()
+    if not counters["enabled"]:
+        return None
+    return counters
+
+
+def _native_parameters(start: Dict[str, Any], stop: Dict[str, Any]) -> List[str]:
+    busy_ns = [stop_ns - start_ns for start_ns, stop_ns in zip(start["thread_busy_ns"], stop["thread_busy_ns"])]
+    iterations = sum(stop["thread_iterations"]) - sum(start["thread_iterations"])
+    steals = sum(stop["thread_steals"]) - sum(start["thread_steals"])
+    remote_steals = sum(stop["thread_remote_steals"]) - sum(start["thread_remote_steals"])
+    return [
+        "native_busy_ns",
+        str(sum(busy_ns)),
+        "native_max_busy_ns",
+        str(max(busy_ns, default=0)),
+        "native_iterations",
+        str(iterations),
+        "native_steals",
+        str(steals),
+        "native_remote_steals",
+        str(remote_steals),
+        "native_array_bytes",
+        str(stop["array_bytes"] - start["array_bytes"]),
+        "native_tmp_allocations",
+        str(stop["tmp_allocations"] - start["tmp_allocations"]),
+        "native_tmp_high_water_bytes",
+        str(stop["tmp_high_water_bytes"]),
+    ]
+
+
 def _print_timing(
     invocation_context: str,
     total_times: Counters,
@@ -11,7 +11,10 @@ if os.name == "nt":
         "install Windows Subsystem for Linux, and metacells within it."
     )
 
-DEFINE_MACROS = [("ASSERT_LEVEL", 1)]  # 0 for none, 1 for fast, 2 for slow.
+DEFINE_MACROS = [
+    ("ASSERT_LEVEL", 1),  # 0 for none, 1 for fast, 2 for slow.
+    ("NATIVE_COUNTERS", 0),  # 0 for none, 1 for collecting the counters reported by get_native_counters.
+]
 COMPILE_ARGS = [f"-I{os.getcwd()}", "-std=c++14"]
 # COMPILE_ARGS += ["-fsanitize=address", "-fno-omit-frame-pointer"]
 # COMPILE_ARGS += ["-fopt-info-vec-all", "-fopt-info-loop-optimized"]
@@ -23,8 +26,8 @@ with open("metacells/should_check_avx2.py", "w") as file:
         COMPILE_ARGS += ["-march=native", "-mtune=native"]
         file.write("SHOULD_CHECK_AVX2 = False\n")
     elif platform.processor() == "x86_64":
+        # Only a few kernels choose their SIMD instructions at run time, the rest still require AVX2.
         COMPILE_ARGS += ["-march=haswell", "-mtune=broadwell"]
-        DEFINE_MACROS.append(("USE_AVX2", 1))
         file.write("SHOULD_CHECK_AVX2 = True\n")
     else:
         file.write("SHOULD_CHECK_AVX2 = False\n")
@@ -74,6 +77,7 @@ setup(
                 "metacells/folds.cpp",
                 "metacells/gaps.cpp",
                 "metacells/logistics.cpp",
+                "metacells/mapped.cpp",
                 "metacells/partitions.cpp",
                 "metacells/prune_per.cpp",
                 "metacells/rank.cpp",
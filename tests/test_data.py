@@ -90,3 +90,43 @@ def test_direct_pipeline() -> None:
         # mc.ut.log_calc('EXPECT', expected_results)
         # mc.ut.log_calc('ACTUAL', actual_results)
         assert np.allclose([expected_results], [actual_results])
+
+
+def test_extend_knn_graph() -> None:
+    for path in glob("../metacells-test-data/*.h5ad"):
+        adata, _expected = _load(path)
+
+        pdata = adata[range(3000), :].copy()
+        total_umis_of_genes = mc.ut.sum_per(mc.ut.get_vo_proper(pdata, layout="column_major"), per="column")
+        pdata = pdata[:, np.argsort(total_umis_of_genes)[-500:]].copy()
+        log_umis = mc.ut.to_numpy_matrix(mc.ut.get_vo_proper(pdata, layout="row_major")).astype("float32")
+        log_umis += 1
+        np.log2(log_umis, out=log_umis)
+        mc.ut.set_vo_data(pdata, "log_umis", log_umis)
+
+        edata = pdata[range(2500), :].copy()
+        mc.tl.compute_obs_obs_similarity(edata, "log_umis", reproducible=True)
+        mc.tl.compute_obs_obs_knn_graph(edata, k=30)
+        mc.tl.compute_candidate_metacells(edata, target_metacell_size=96, cell_sizes=None, random_seed=123456)
+
+        existing_pruned_ranks = mc.ut.get_oo_proper(edata, "obs_pruned_ranks", layout="row_major")
+        mc.tl.extend_obs_obs_knn_graph(pdata, "log_umis", pruned_ranks=existing_pruned_ranks, k=30)
+
+        outgoing_weights = mc.ut.get_oo_proper(pdata, "obs_outgoing_weights", layout="row_major")
+        assert outgoing_weights.shape == (3000, 3000)
+        assert np.allclose(mc.ut.sum_per(outgoing_weights, per="row"), 1)
+        assert np.all(mc.ut.sum_per(outgoing_weights, per="column") > 0)
+
+        community_of_nodes = np.full(3000, -1, dtype="int32")
+        community_of_nodes[:2500] = mc.ut.get_o_numpy(edata, "candidate")
+        mc.tl.optimize_extended_partitions(
+            edge_weights=outgoing_weights,
+            community_of_nodes=community_of_nodes,
+            low_partition_size=48,
+            target_partition_size=96,
+            high_partition_size=192,
+            node_sizes=np.full(3000, 1.0, dtype="float32"),
+            random_seed=123456,
+        )
+        assert np.min(community_of_nodes) == 0
+        assert np.all(np.bincount(community_of_nodes) > 0)
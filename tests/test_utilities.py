@@ -3,15 +3,20 @@ Test the utility functions.
 """
 
 import os
+import struct
 from glob import glob
+from tempfile import TemporaryDirectory
 from typing import Any
 from typing import List
 
 import numpy as np
+from anndata import AnnData  # type: ignore
 from scipy import sparse  # type: ignore
 from scipy import stats
 from sklearn.metrics import roc_auc_score  # type: ignore
 
+import metacells.extensions as xt  # type: ignore
+import metacells.tools as tl
 import metacells.utilities as ut
 
 ut.allow_inefficient_layout(False)
@@ -68,6 +73,39 @@ def test_corrcoef() -> None:
         assert np.max(zeros_correlation) == 0
 
 
+def test_corrcoef_tiled() -> None:
+    np.random.seed(123456)
+    dense = ut.to_layout(sparse.rand(301, 1001, density=0.1, format="csr").toarray(), layout="row_major")
+    dense[7, :] = 1
+    numpy_correlation = np.corrcoef(dense)
+    numpy_correlation[np.isnan(numpy_correlation)] = 0
+    np.fill_diagonal(numpy_correlation, 1)
+
+    for dtype in ("float32", "float64"):
+        tiled_correlation = ut.corrcoef(dense.astype(dtype), per="row", reproducible=True)
+        assert tiled_correlation.shape == (301, 301)
+        assert np.min(np.diag(tiled_correlation)) == 1
+        assert np.max(np.diag(tiled_correlation)) == 1
+        assert np.allclose(tiled_correlation, numpy_correlation, atol=1e-5)
+
+
+def test_corrcoef_top_per() -> None:
+    np.random.seed(123456)
+    dense = ut.to_layout(sparse.rand(301, 1001, density=0.1, format="csr").toarray(), layout="row_major")
+    full_correlation = ut.corrcoef(dense, per="row", reproducible=True)
+
+    for top in (1, 5):
+        top_correlation = ut.corrcoef_top_per(dense, top, per="row")
+        assert top_correlation.shape == (301, 301)
+        assert top_correlation.getformat() == "csr"
+        expected_correlation = ut.top_per(full_correlation, top, per="row")
+        assert np.allclose(np.sort(top_correlation.data), np.sort(expected_correlation.data), atol=1e-6)
+        for row in range(301):
+            row_indices = top_correlation.indices[top_correlation.indptr[row] : top_correlation.indptr[row + 1]]
+            row_data = top_correlation.data[top_correlation.indptr[row] : top_correlation.indptr[row + 1]]
+            assert np.allclose(row_data, full_correlation[row, row_indices], atol=1e-6)
+
+
 def test_cross_corrcoef() -> None:
     np.random.seed(123456)
     first_matrix = ut.to_numpy_matrix(sparse.rand(51, 10101, density=0.1, format="csr"))
@@ -86,6 +124,38 @@ def test_cross_corrcoef() -> None:
     assert fast_results.shape == slow_results.shape
     assert np.allclose(fast_results, slow_results, atol=1e-6)
 
+    compressed_results = ut.cross_corrcoef_rows(
+        sparse.csr_matrix(first_dense), sparse.csr_matrix(second_dense), reproducible=True
+    )
+    assert compressed_results.shape == slow_results.shape
+    assert np.allclose(compressed_results, slow_results, atol=1e-6)
+
+
+def test_prepared_corrcoef_rows() -> None:
+    np.random.seed(123456)
+    atlas_dense = ut.to_layout(sparse.rand(101, 1001, density=0.1, format="csr").toarray(), layout="row_major")
+    prepared = ut.prepare_corrcoef_rows(atlas_dense)
+    assert prepared.rows_count == 101
+    assert prepared.columns_count == 1001
+
+    for rows_count in (1, 51, 301):
+        query_dense = ut.to_layout(
+            sparse.rand(rows_count, 1001, density=0.1, format="csr").toarray(), layout="row_major"
+        )
+        expected_results = ut.cross_corrcoef_rows(query_dense, atlas_dense, reproducible=True)
+        prepared_results = ut.prepared_cross_corrcoef_rows(prepared, query_dense)
+        assert prepared_results.shape == (rows_count, 101)
+        assert np.allclose(prepared_results, expected_results, atol=1e-6)
+
+        top_results = ut.prepared_top_corrcoef_rows(prepared, query_dense, 5)
+        assert top_results.shape == (rows_count, 101)
+        expected_top = ut.top_per(prepared_results, 5, per="row")
+        assert np.allclose(np.sort(top_results.data), np.sort(expected_top.data), atol=1e-6)
+        for row in range(rows_count):
+            row_indices = top_results.indices[top_results.indptr[row] : top_results.indptr[row + 1]]
+            row_data = top_results.data[top_results.indptr[row] : top_results.indptr[row + 1]]
+            assert np.all(row_data == prepared_results[row, row_indices])
+
 
 def test_pairs_corrcoef() -> None:
     np.random.seed(123456)
@@ -104,6 +174,12 @@ def test_pairs_corrcoef() -> None:
     assert fast_results.shape == slow_results.shape
     assert np.allclose(fast_results, slow_results, atol=1e-6)
 
+    compressed_results = ut.pairs_corrcoef_rows(
+        sparse.csr_matrix(first_dense), sparse.csr_matrix(second_dense), reproducible=True
+    )
+    assert compressed_results.shape == slow_results.shape
+    assert np.allclose(compressed_results, slow_results, atol=1e-6)
+
 
 def test_logistics() -> None:
     matrix = np.array([[0, 0, 0, 0, 0, 0], [1, 1, 1, 1, 1, 1], [0, 0, 0, 1, 1, 1]], dtype="float64")
@@ -151,6 +227,24 @@ def test_pairs_logistics() -> None:
     assert np.allclose(results[1], normalized_value / 2)
 
 
+def test_fast_logistics() -> None:
+    for dtype in ("float32", "float64"):
+        first_matrix = np.random.rand(30, 1001).astype(dtype) * 4
+        second_matrix = np.random.rand(70, 1001).astype(dtype) * 4
+
+        exact_results = ut.logistics(first_matrix, per="row", location=0.8, slope=5)
+        fast_results = ut.logistics(first_matrix, per="row", location=0.8, slope=5, fast=True)
+        assert np.allclose(fast_results, exact_results, atol=1e-6)
+
+        exact_results = ut.cross_logistics_rows(first_matrix, second_matrix, location=0.8, slope=5)
+        fast_results = ut.cross_logistics_rows(first_matrix, second_matrix, location=0.8, slope=5, fast=True)
+        assert np.allclose(fast_results, exact_results, atol=1e-6)
+
+        exact_results = ut.pairs_logistics_rows(first_matrix, second_matrix[:30, :], location=0.8, slope=5)
+        fast_results = ut.pairs_logistics_rows(first_matrix, second_matrix[:30, :], location=0.8, slope=5, fast=True)
+        assert np.allclose(fast_results, exact_results, atol=1e-6)
+
+
 def test_relayout_matrix() -> None:
     rvs = stats.poisson(10, loc=10).rvs
     csr_matrix = sparse.random(20, 20, format="csr", dtype="int32", random_state=123456, data_rvs=rvs)
@@ -176,6 +270,114 @@ def test_relayout_matrix() -> None:
     assert np.all(metacells_csr_matrix.toarray() == scipy_csr_matrix.toarray())
 
 
+def test_relayout_matrix_blocks() -> None:
+    rvs = stats.poisson(10, loc=10).rvs
+    csr_matrix = sparse.random(200, 300, format="csr", dtype="float32", random_state=123456, data_rvs=rvs)
+    scipy_csc_matrix = csr_matrix.tocsc()
+    scipy_csc_matrix.sort_indices()
+
+    for max_block_elements in (None, 1, 100, 1000):
+        metacells_csc_matrix = ut.to_layout(csr_matrix, layout="column_major", max_block_elements=max_block_elements)
+        assert metacells_csc_matrix.getformat() == "csc"
+        assert metacells_csc_matrix.has_sorted_indices
+        assert np.all(metacells_csc_matrix.indptr == scipy_csc_matrix.indptr)
+        assert np.all(metacells_csc_matrix.indices == scipy_csc_matrix.indices)
+        assert np.all(metacells_csc_matrix.data == scipy_csc_matrix.data)
+
+
+def test_mapped_compressed() -> None:
+    rvs = stats.poisson(10, loc=10).rvs
+    csr_matrix = sparse.random(200, 300, format="csr", dtype="float32", random_state=123456, data_rvs=rvs)
+    csr_matrix.indptr = csr_matrix.indptr.astype("int64")
+
+    with TemporaryDirectory() as directory:
+        for compressed_matrix in (csr_matrix, csr_matrix.tocsc()):
+            path = os.path.join(directory, "matrix.mccsr")
+            ut.write_mapped_compressed(path, compressed_matrix)
+            mapped_matrix = ut.read_mapped_compressed(path)
+
+            assert mapped_matrix.getformat() == compressed_matrix.getformat()
+            assert mapped_matrix.shape == compressed_matrix.shape
+            assert mapped_matrix.indptr.dtype == compressed_matrix.indptr.dtype
+            assert np.all(mapped_matrix.toarray() == compressed_matrix.toarray())
+
+            ut.prefetch_mapped_bands(mapped_matrix, 0, mapped_matrix.indptr.size - 1)
+            per = "row" if ut.matrix_layout(compressed_matrix) == "row_major" else "column"
+            other_layout = "column_major" if per == "row" else "row_major"
+            assert np.all(ut.to_layout(mapped_matrix, layout=other_layout).toarray() == compressed_matrix.toarray())
+            assert np.allclose(ut.median_per(mapped_matrix, per=per), ut.median_per(compressed_matrix, per=per))
+
+            del mapped_matrix
+
+
+def test_corrupt_mapped_compressed() -> None:
+    rvs = stats.poisson(10, loc=10).rvs
+    csr_matrix = sparse.random(200, 300, format="csr", dtype="float32", random_state=123456, data_rvs=rvs)
+    csr_matrix.indptr = csr_matrix.indptr.astype("int64")
+
+    with TemporaryDirectory() as directory:
+        path = os.path.join(directory, "matrix.mccsr")
+        ut.write_mapped_compressed(path, csr_matrix)
+        with open(path, "rb") as file:
+            valid_bytes = file.read()
+
+        # The header is the magic, layout and dtypes (72 bytes), the counts, and the offsets of the arrays.
+        bands_count, _elements_count, nnz = struct.unpack_from("<QQQ", valid_bytes, 72)
+        indptr_offset = struct.unpack_from("<QQQ", valid_bytes, 96)[2]
+
+        corruptions = [
+            (56, b"bogus".ljust(16, b"\0")),
+            (72, struct.pack("<Q", 2**64 - 1)),
+            (indptr_offset, struct.pack("<q", 1)),
+            (indptr_offset + 8 * 100, struct.pack("<q", nnz + 1)),
+            (indptr_offset + 8 * bands_count, struct.pack("<q", nnz - 1)),
+        ]
+        for offset, corrupt_bytes in corruptions:
+            with open(path, "wb") as file:
+                file.write(valid_bytes[:offset] + corrupt_bytes + valid_bytes[offset + len(corrupt_bytes) :])
+            try:
+                ut.read_mapped_compressed(path)
+            except RuntimeError:
+                continue
+            assert False, f"accepted a mapped compressed matrix corrupted at: {offset}"
+
+
+def test_stream_mapped() -> None:
+    rvs = stats.poisson(10, loc=10).rvs
+    csr_matrix = sparse.random(200, 300, format="csr", dtype="float32", random_state=123456, data_rvs=rvs)
+    total_per_row = ut.sum_per(csr_matrix, per="row")
+    fraction_per_column = ut.sum_per(ut.to_layout(csr_matrix, layout="column_major"), per="column") / csr_matrix.sum()
+    fraction_matrix = sparse.csr_matrix(csr_matrix / total_per_row[:, np.newaxis])
+
+    with TemporaryDirectory() as directory:
+        input_path = os.path.join(directory, "input.mccsr")
+        output_path = os.path.join(directory, "output.mccsr")
+
+        for memory_budget in (1, 1000, 1000000):
+            ut.write_mapped_compressed(input_path, csr_matrix)
+            ut.stream_downsample_mapped(
+                input_path, output_path, samples=50, random_seed=123456, memory_budget=memory_budget
+            )
+            downsampled_matrix = ut.downsample_matrix(
+                csr_matrix, per="row", samples=50, eliminate_zeros=False, random_seed=123456
+            )
+            assert np.all(ut.read_mapped_compressed(output_path).toarray() == downsampled_matrix.toarray())
+
+            ut.write_mapped_compressed(input_path, fraction_matrix)
+            ut.stream_fold_factors_mapped(
+                input_path,
+                output_path,
+                total_per_band=total_per_row,
+                fraction_per_element=fraction_per_column,
+                memory_budget=memory_budget,
+            )
+            expected = total_per_row[:, np.newaxis] * fraction_per_column[np.newaxis, :]
+            actual = total_per_row[:, np.newaxis] * fraction_matrix.toarray()
+            folds = np.abs(np.log2((actual + 1) / (expected + 1)))
+            folds[fraction_matrix.toarray() == 0] = 0
+            assert np.allclose(ut.read_mapped_compressed(output_path).toarray(), folds, atol=1e-5)
+
+
 def test_downsample_vector_inplace() -> None:
     size = 10
     samples = 20
@@ -206,20 +408,80 @@ def test_downsample_vector_too_few() -> None:
 
 def test_downsample_matrix() -> None:
     rvs = stats.poisson(10, loc=10).rvs
-    matrix = sparse.random(1000, 10000, format="csr", dtype="int32", random_state=123456, data_rvs=rvs)
-    assert matrix.nnz == matrix.shape[0] * matrix.shape[1] * 0.01
-    old_row_sums = ut.sum_per(matrix, per="row")
+    sparse_matrix = sparse.random(1000, 10000, format="csr", dtype="int32", random_state=123456, data_rvs=rvs)
+    assert sparse_matrix.nnz == sparse_matrix.shape[0] * sparse_matrix.shape[1] * 0.01
+    old_row_sums = ut.sum_per(sparse_matrix, per="row")
     min_sum = np.min(old_row_sums)
-    result = ut.downsample_matrix(matrix, per="row", samples=int(min_sum), random_seed=123456)
-    assert result.shape == matrix.shape
-    new_row_sums = ut.sum_per(result, per="row")
-    assert np.all(new_row_sums == min_sum)
+    dense_matrix = sparse_matrix.toarray()
+
+    for hypergeometric in (False, True):
+        for matrix in (sparse_matrix, dense_matrix):
+            result = ut.downsample_matrix(
+                matrix, per="row", samples=int(min_sum), hypergeometric=hypergeometric, random_seed=123456
+            )
+            assert result.shape == matrix.shape
+            new_row_sums = ut.sum_per(result, per="row")
+            assert np.all(new_row_sums == min_sum)
+            assert np.all(ut.to_numpy_matrix(result) <= dense_matrix)
+
+
+def test_random_independent_of_threads() -> None:
+    rvs = stats.poisson(10, loc=10).rvs
+    matrix = sparse.random(100, 1000, format="csr", dtype="int32", random_state=123456, data_rvs=rvs)
+    min_sum = int(np.min(ut.sum_per(matrix, per="row")))
+
+    processors_count = ut.get_processors_count()
+    results = []
+    try:
+        for processors in (1, 4):
+            ut.set_processors_count(processors)
+            downsampled = ut.downsample_matrix(matrix, per="row", samples=min_sum, random_seed=123456)
+            shuffled = matrix.copy()
+            ut.shuffle_matrix(shuffled, per="row", random_seed=123456)
+            results.append((downsampled.toarray(), shuffled.toarray()))
+    finally:
+        ut.set_processors_count(processors_count)
+
+    assert np.all(results[0][0] == results[1][0])
+    assert np.all(results[0][1] == results[1][1])
+
+
+def test_submit() -> None:
+    rvs = stats.poisson(10, loc=10).rvs
+    matrix = sparse.random(300, 1000, format="csr", dtype="int32", random_state=123456, data_rvs=rvs)
+    min_sum = int(np.min(ut.sum_per(matrix, per="row")))
+    dense = matrix.toarray().astype("float32")
 
-    matrix = matrix.toarray()
-    result = ut.downsample_matrix(matrix, per="row", samples=int(min_sum), random_seed=123456)
-    assert result.shape == matrix.shape
-    new_row_sums = ut.sum_per(result, per="row")
-    assert np.all(new_row_sums == min_sum)
+    expected_downsampled = ut.downsample_matrix(matrix, per="row", samples=min_sum, random_seed=123456)
+    expected_correlation = ut.corrcoef(dense, per="row", reproducible=True)
+
+    future = ut.submit(ut.downsample_matrix, matrix, per="row", samples=min_sum, random_seed=123456)
+    correlation = ut.corrcoef(dense, per="row", reproducible=True)
+    downsampled = future.result()
+
+    assert np.all(downsampled.toarray() == expected_downsampled.toarray())
+    assert np.all(correlation == expected_correlation)
+
+    failed = ut.submit(ut.downsample_matrix, matrix, per="row", samples=min_sum, random_seed=123456, eps=1)
+    try:
+        failed.result()
+        assert False
+    except TypeError:
+        pass
+
+
+def test_downsample_hypergeometric_distribution() -> None:
+    data = np.array([0, 1, 3, 50, 2, 400, 7, 0, 1000, 5], dtype="int32")
+    samples = 300
+    total = np.sum(data)
+    runs = 2000
+    results = np.empty((runs, data.size), dtype="int32")
+    for run in range(runs):
+        ut.downsample_vector(data, samples, output=results[run, :], hypergeometric=True, random_seed=run + 1)
+    assert np.all(np.sum(results, axis=1) == samples)
+    expected_means = data * samples / total
+    expected_variances = expected_means * (total - data) / total * (total - samples) / (total - 1)
+    assert np.allclose(np.mean(results, axis=0), expected_means, atol=4 * np.sqrt(expected_variances / runs) + 1e-6)
 
 
 def test_matrix_rows_folds_and_aurocs() -> None:
@@ -262,6 +524,223 @@ def test_matrix_rows_folds_and_aurocs() -> None:
     assert np.allclose(sparse_rows_folds, builtin_rows_folds)
 
 
+def test_matrix_rows_folds_and_aurocs_of_groups() -> None:
+    np.random.seed(123456)
+
+    groups = np.random.randint(-1, 5, size=100)
+    dense = np.random.rand(20, 100)
+    dense[dense < 0.5] = 0
+    dense[:, groups == 1] *= 2
+    dense[::3, :] -= 0.5
+
+    dense_rows_folds, dense_rows_aurocs = ut.matrix_rows_folds_and_aurocs_of_groups(
+        dense, columns_groups=groups, normalization=1e-4
+    )
+    compressed = sparse.csr_matrix(dense)
+    sparse_rows_folds, sparse_rows_aurocs = ut.matrix_rows_folds_and_aurocs_of_groups(
+        compressed, columns_groups=groups, normalization=1e-4
+    )
+    assert dense_rows_folds.shape == (20, 5)
+    assert sparse_rows_aurocs.shape == (20, 5)
+
+    for group in range(5):
+        group_rows_folds, group_rows_aurocs = ut.matrix_rows_folds_and_aurocs(
+            dense, columns_subset=groups == group, normalization=1e-4
+        )
+        assert np.allclose(dense_rows_aurocs[:, group], group_rows_aurocs)
+        assert np.allclose(dense_rows_folds[:, group], group_rows_folds)
+        assert np.allclose(sparse_rows_aurocs[:, group], group_rows_aurocs)
+        assert np.allclose(sparse_rows_folds[:, group], group_rows_folds)
+
+
+def test_top_distinct_fold_factors() -> None:
+    np.random.seed(123456)
+
+    fractions = np.random.rand(20, 100).astype("float32")
+    fractions[fractions < 0.5] = 0
+    fractions[0, :] = 0
+    fractions[0, :2] = 1
+    fractions /= np.sum(fractions, axis=1)[:, np.newaxis]
+    totals = np.random.randint(100, 1000, size=20).astype("float32")
+    expected = np.mean(fractions, axis=0)
+
+    folds = np.abs(
+        np.log2((totals[:, np.newaxis] * fractions + 1) / (totals[:, np.newaxis] * expected[np.newaxis, :] + 1))
+    )
+    top_folds = -np.sort(-folds, axis=1)[:, :5]
+
+    for matrix in (fractions.copy(), sparse.csr_matrix(fractions)):
+        gene_indices, gene_folds = ut.top_distinct_fold_factors(
+            matrix, total_per_row=totals, fraction_per_column=expected, distinct_count=5, inplace=True
+        )
+        assert gene_indices.shape == (20, 5)
+        assert np.allclose(gene_folds, top_folds)
+        assert np.allclose(np.take_along_axis(folds, gene_indices, axis=1), top_folds)
+        assert np.allclose(ut.to_numpy_matrix(matrix)[fractions > 0], folds[fractions > 0])
+
+    compressed = sparse.csr_matrix(fractions)
+    compressed_indices, compressed_folds = ut.top_distinct_fold_factors(
+        compressed, total_per_row=totals, fraction_per_column=expected, distinct_count=5
+    )
+    densified_indices, densified_folds = ut.top_distinct_fold_factors(
+        ut.to_numpy_matrix(compressed), total_per_row=totals, fraction_per_column=expected, distinct_count=5
+    )
+    assert np.allclose(compressed_folds, densified_folds)
+    assert np.allclose(
+        np.take_along_axis(folds, compressed_indices, axis=1), np.take_along_axis(folds, densified_indices, axis=1)
+    )
+    assert np.any(np.take_along_axis(fractions, compressed_indices, axis=1)[0, :] == 0)
+
+
+def _reference_gap(ranked_logs: np.ndarray, first_rank: int, gap_skip_cells: int, min_gap: Any) -> Any:
+    full_gap = ranked_logs[first_rank + gap_skip_cells] - ranked_logs[first_rank] - min_gap
+    start_gap = np.float32(2.0 * float(ranked_logs[first_rank + 1] - ranked_logs[first_rank]) - float(min_gap))
+    return full_gap, gap_skip_cells > 1 and start_gap < full_gap
+
+
+def _reference_cell_gaps(  # pylint: disable=too-many-locals
+    umis: np.ndarray,
+    log_fractions: np.ndarray,
+    candidate_per_cell: np.ndarray,
+    deviant_per_cell: np.ndarray,
+    active_per_cell: np.ndarray,
+    min_gap_per_gene: np.ndarray,
+    candidates_count: int,
+    gap_skip_cells: int,
+    max_deviant_cells_count: int,
+    max_deviant_cells_fraction: float,
+    min_compare_umis: float,
+) -> np.ndarray:
+    max_gap_per_cell = np.zeros(umis.shape[0], dtype="float32")
+    for candidate_index in range(candidates_count):
+        if not np.any(active_per_cell[candidate_per_cell == candidate_index]):
+            continue
+        cell_indices = np.where((candidate_per_cell == candidate_index) & ~deviant_per_cell)[0]
+        cells_count = len(cell_indices)
+        if cells_count < 4:
+            continue
+        max_deviant_count = min(
+            cells_count - gap_skip_cells,
+            max(max_deviant_cells_count, int(max_deviant_cells_fraction * cells_count + 0.5)),
+        )
+        max_cell_rank = min((cells_count - 1) // 2, max_deviant_count)
+        for gene_index in range(umis.shape[1]):
+            if not np.any(umis[cell_indices, gene_index] * 2 + 1e-6 > min_compare_umis):
+                continue
+            order = np.argsort(log_fractions[cell_indices, gene_index], kind="stable")
+            ranked_cells = cell_indices[order]
+            ranked_umis = umis[ranked_cells, gene_index]
+            ranked_logs = log_fractions[ranked_cells, gene_index]
+            min_gap = min_gap_per_gene[gene_index]
+
+            for cell_rank in range(max_cell_rank):
+                if ranked_umis[cell_rank] + ranked_umis[cell_rank + gap_skip_cells] + 1e-6 < min_compare_umis:
+                    continue
+                full_gap, is_wide = _reference_gap(ranked_logs, cell_rank, gap_skip_cells, min_gap)
+                if full_gap >= 0:
+                    gap_cells = ranked_cells[: cell_rank + 2 + int(is_wide)]
+                    max_gap_per_cell[gap_cells] = np.maximum(max_gap_per_cell[gap_cells], full_gap)
+
+            for cell_offset in range(max_cell_rank):
+                cell_rank = cells_count - 1 - cell_offset - gap_skip_cells
+                if ranked_umis[cell_rank] + ranked_umis[cell_rank + gap_skip_cells] < min_compare_umis:
+                    continue
+                full_gap, is_wide = _reference_gap(ranked_logs, cell_rank, gap_skip_cells, min_gap)
+                if full_gap > 0:
+                    gap_cells = ranked_cells[cell_rank + 1 + int(is_wide) :]
+                    max_gap_per_cell[gap_cells] = np.maximum(max_gap_per_cell[gap_cells], full_gap)
+
+    return max_gap_per_cell
+
+
+def test_compute_cell_gaps() -> None:
+    np.random.seed(123456)
+
+    # Candidates 0 and 1 are regular, 2 is inactive, 3 is empty and 4 is too small; some cells are outliers.
+    candidate_per_cell = np.array([0] * 40 + [1] * 30 + [2] * 20 + [4] * 3 + [-1] * 5, dtype="int32")
+    cells_count = len(candidate_per_cell)
+    candidates_count = 5
+    deviant_per_cell = np.zeros(cells_count, dtype="bool")
+    deviant_per_cell[[3, 17, 45]] = True
+    active_per_cell = np.random.rand(cells_count) < 0.5
+    active_per_cell[candidate_per_cell == 2] = False
+    active_per_cell[[0, 40, 90]] = True
+
+    # Few distinct UMI counts and a fixed total, so there are many ties in the log fractions.
+    umis = np.random.randint(0, 4, size=(cells_count, 12)).astype("float32")
+    umis[:, 1] = np.random.randint(20, 30, size=cells_count)
+    for candidate_index in range(candidates_count):
+        cell_indices = np.where(candidate_per_cell == candidate_index)[0]
+        if len(cell_indices) > 0:
+            umis[np.random.choice(cell_indices, 3, replace=False), 0] = 40
+            umis[np.random.choice(cell_indices, 3, replace=False), 1] = 0
+    umis[:, -1] = 200 - np.sum(umis[:, :-1], axis=1)
+    fractions = umis / 200
+    log_fractions = np.log2(fractions + 1 / 200)
+    min_gap_per_gene = np.full(12, 1.0, dtype="float32")
+
+    for gap_skip_cells in (1, 2, 3):
+        max_gap_per_cell = np.zeros(cells_count, dtype="float32")
+        xt.compute_cell_gaps(
+            umis,
+            fractions,
+            log_fractions,
+            candidate_per_cell,
+            deviant_per_cell,
+            active_per_cell,
+            min_gap_per_gene,
+            candidates_count,
+            gap_skip_cells,
+            3,
+            0.1,
+            8.0,
+            max_gap_per_cell,
+        )
+        expected = _reference_cell_gaps(
+            umis,
+            log_fractions,
+            candidate_per_cell,
+            deviant_per_cell,
+            active_per_cell,
+            min_gap_per_gene,
+            candidates_count,
+            gap_skip_cells,
+            3,
+            0.1,
+            8.0,
+        )
+        assert np.any(expected > 0)
+        assert np.allclose(max_gap_per_cell, expected)
+        assert np.all(max_gap_per_cell[(candidate_per_cell >= 2) | (candidate_per_cell < 0) | deviant_per_cell] == 0)
+
+
+def test_compact_dtypes() -> None:
+    np.random.seed(123456)
+    counts = np.random.poisson(2.0, size=(300, 200)).astype("float32")
+
+    correlation = ut.corrcoef(counts, per="row", reproducible=True)
+    for dtype in ("uint16", "float16"):
+        assert np.allclose(ut.corrcoef(counts.astype(dtype), per="row", reproducible=True), correlation, atol=1e-5)
+
+    samples = int(np.min(ut.sum_per(counts, per="row")))
+    downsampled = ut.downsample_matrix(counts, per="row", samples=samples, random_seed=123456)
+    for dtype in ("uint16", "float16"):
+        compact = ut.downsample_matrix(counts.astype(dtype), per="row", samples=samples, random_seed=123456)
+        assert compact.dtype == dtype
+        assert np.all(compact == downsampled)
+
+    totals = np.sum(counts, axis=1) * 1000
+    fractions = counts / np.sum(counts, axis=1)[:, np.newaxis]
+    expected = np.mean(fractions, axis=0)
+    _, top_folds = ut.top_distinct_fold_factors(
+        fractions, total_per_row=totals, fraction_per_column=expected, distinct_count=5
+    )
+    _, compact_folds = ut.top_distinct_fold_factors(
+        fractions.astype("float16"), total_per_row=totals, fraction_per_column=expected, distinct_count=5
+    )
+    assert np.allclose(compact_folds, top_folds, atol=1e-2)
+
+
 def test_bincount_vector() -> None:
     array = np.array(np.random.rand(100000) * 100, dtype="int32")
     numpy_bincount = np.bincount(array)
@@ -404,6 +883,48 @@ def test_parallel_map() -> None:
         os.remove(path)
 
 
+def test_native_counters() -> None:
+    xt.reset_native_counters()
+    counters = xt.get_native_counters()
+    if not counters["enabled"]:
+        return
+    assert counters["loops"] == 0
+    assert sum(counters["thread_iterations"]) == 0
+
+    matrix = np.random.randint(0, 10, size=(100, 200)).astype("float32")
+    ut.downsample_matrix(matrix, per="row", samples=10, random_seed=123456)
+
+    counters = xt.get_native_counters()
+    assert counters["loops"] > 0
+    assert counters["array_bytes"] >= matrix.nbytes
+    assert sum(counters["thread_iterations"]) >= matrix.shape[0]
+
+
+def test_thread_affinity() -> None:
+    nodes = xt.numa_nodes()
+    assert all(len(cpus) > 0 for cpus in nodes)
+
+    rvs = stats.poisson(10, loc=10).rvs
+    matrix = sparse.random(100, 1000, format="csr", dtype="int32", random_state=123456, data_rvs=rvs)
+    min_sum = int(np.min(ut.sum_per(matrix, per="row")))
+    correlation = ut.corrcoef(matrix.toarray().astype("float32"), per="row", reproducible=True)
+
+    processors_count = ut.get_processors_count()
+    try:
+        for affinity in ("none", "compact", "scatter", "socket"):
+            ut.set_processors_count(4, affinity=affinity)
+            downsampled = ut.downsample_matrix(matrix, per="row", samples=min_sum, random_seed=123456)
+            assert np.all(ut.sum_per(downsampled, per="row") == min_sum)
+            affine_correlation = ut.corrcoef(matrix.toarray().astype("float32"), per="row", reproducible=True)
+            assert np.all(affine_correlation == correlation)
+            counters = xt.get_native_counters()
+            if counters["enabled"]:
+                assert len(counters["node_busy_ns"]) == len(nodes)
+                assert all(node == -1 for node in counters["thread_nodes"]) == (affinity == "none" or not nodes)
+    finally:
+        ut.set_processors_count(processors_count, affinity="none")
+
+
 def test_sum_groups() -> None:
     expected_sums = np.array([[5, 7, 2], [10, 8, 13]])
     expected_sizes = np.array([2, 2])
@@ -468,6 +989,381 @@ def test_rank_matrix() -> None:
     assert np.allclose(result, expected)
 
 
+def test_select_float32_rows() -> None:
+    np.random.seed(123456)
+    columns_count = 4001
+    min_pivot_row = 1 + np.random.rand(columns_count)
+    min_pivot_row[[0, columns_count // 2, columns_count - 1]] = 0.5
+    dense = np.vstack(
+        [
+            np.random.rand(columns_count),
+            np.random.randint(0, 4, size=columns_count),
+            np.where(np.random.rand(columns_count) < 0.9, 0, np.random.rand(columns_count)),
+            np.full(columns_count, 7),
+            min_pivot_row,
+        ]
+    ).astype("float32")
+    even_dense = np.ascontiguousarray(dense[:, 1:])
+
+    dispatched_level = xt.simd_level()
+    try:
+        for simd_level in ("generic", dispatched_level):
+            xt.set_simd_level(simd_level)
+            assert xt.simd_level() == simd_level
+            for rank in (0, 1, columns_count // 3, columns_count // 2, columns_count - 1):
+                assert np.all(ut.rank_per(dense, rank, per="row") == np.partition(dense, rank, axis=1)[:, rank])
+            for matrix in (dense, even_dense):
+                medians = ut.median_per(sparse.csr_matrix(matrix), per="row")
+                assert np.allclose(medians, np.median(matrix, axis=1))
+    finally:
+        xt.set_simd_level(dispatched_level)
+
+
+def _clustered_edge_weights(nodes_count: int = 600, *, degree: int = 10, cluster_size: int = 50) -> sparse.csr_matrix:
+    np.random.seed(123456)
+    sources = np.repeat(np.arange(nodes_count), degree)
+    first_of_clusters = sources - sources % cluster_size
+    targets = first_of_clusters + np.random.randint(0, cluster_size, size=len(sources))
+    is_random = np.random.rand(len(sources)) < 0.2
+    targets[is_random] = np.random.randint(0, nodes_count, size=np.sum(is_random))
+    # Ensure every node has incoming edges.
+    targets[::degree] = first_of_clusters[::degree] + (sources[::degree] % cluster_size + 1) % cluster_size
+    is_edge = sources != targets
+    edge_weights = sparse.csr_matrix(
+        (np.ones(np.sum(is_edge), dtype="float32"), (sources[is_edge], targets[is_edge])),
+        shape=(nodes_count, nodes_count),
+    )
+    edge_weights.sum_duplicates()
+    edge_weights.data /= np.repeat(ut.sum_per(edge_weights, per="row"), np.diff(edge_weights.indptr)).astype("float32")
+    return edge_weights
+
+
+def _initial_partitions(nodes_count: int = 600, partitions_count: int = 12) -> ut.NumpyVector:
+    np.random.seed(123456)
+    community_of_nodes = np.random.randint(0, partitions_count, size=nodes_count).astype("int32")
+    community_of_nodes[:partitions_count] = np.arange(partitions_count)
+    return community_of_nodes
+
+
+def test_optimize_partitions_parallel_batches() -> None:
+    edge_weights = _clustered_edge_weights()
+    node_sizes = np.ones(600, dtype="float32")
+
+    processors_count = ut.get_processors_count()
+    results = {}
+    try:
+        for parallel_batch_size in (0, 16):
+            for processors in (1, 4):
+                ut.set_processors_count(processors)
+                community_of_nodes = _initial_partitions()
+                score = tl.optimize_partitions(
+                    edge_weights=edge_weights,
+                    community_of_nodes=community_of_nodes,
+                    low_partition_size=30,
+                    target_partition_size=50,
+                    high_partition_size=100,
+                    node_sizes=node_sizes,
+                    parallel_batch_size=parallel_batch_size,
+                    random_seed=123456,
+                )
+                results[(parallel_batch_size, processors)] = (score, community_of_nodes)
+    finally:
+        ut.set_processors_count(processors_count)
+
+    for parallel_batch_size in (0, 16):
+        single_score, single_partitions = results[(parallel_batch_size, 1)]
+        multi_score, multi_partitions = results[(parallel_batch_size, 4)]
+        assert single_score == multi_score
+        assert np.all(single_partitions == multi_partitions)
+
+    serial_score = results[(0, 1)][0]
+    batched_score = results[(16, 1)][0]
+    assert abs(batched_score - serial_score) < 0.2 * abs(serial_score)
+
+
+def _mass_factor(mass: float, low_mass: float, target_mass: float, high_mass: float) -> float:
+    inner_slope = 0.02
+    outer_slope = 0.5
+    if mass < low_mass:
+        return np.log2((1 - inner_slope) * low_mass / (low_mass + (1 / (1 - outer_slope) - 1) * (low_mass - mass)))
+    if mass < target_mass:
+        return np.log2(1 - inner_slope * (target_mass - mass) / (target_mass - low_mass))
+    if mass < high_mass:
+        return np.log2(1 - inner_slope * (mass - target_mass) / (high_mass - target_mass))
+    return np.log2((1 - inner_slope) * low_mass / (low_mass + (1 / (1 - outer_slope) - 1) * (mass - high_mass)))
+
+
+def _dense_partitions_score(
+    edge_weights: sparse.csr_matrix,
+    community_of_nodes: ut.NumpyVector,
+    node_sizes: ut.NumpyVector,
+    low_mass: float,
+    target_mass: float,
+    high_mass: float,
+) -> float:
+    dense = edge_weights.toarray().astype("float64")
+    nodes_count = len(community_of_nodes)
+    nodes_indices = np.arange(nodes_count)
+    community_indicators = np.zeros((nodes_count, np.max(community_of_nodes) + 1))
+    community_indicators[nodes_indices, community_of_nodes] = 1
+    outgoing_weights = (dense @ community_indicators)[nodes_indices, community_of_nodes]
+    incoming_weights = (dense.T @ community_indicators)[nodes_indices, community_of_nodes]
+
+    score = nodes_count * np.log2(nodes_count) - np.sum(np.log2(np.sum(dense, axis=0)))
+    score += np.sum(np.log2(1e-6 + outgoing_weights * incoming_weights) / 2)
+    size_of_communities = np.bincount(community_of_nodes)
+    mass_of_communities = np.bincount(community_of_nodes, weights=node_sizes)
+    for size, mass in zip(size_of_communities, mass_of_communities):
+        score += size * (_mass_factor(mass, low_mass, target_mass, high_mass) - np.log2(size))
+    return score / nodes_count
+
+
+def test_score_partitions() -> None:
+    edge_weights = _clustered_edge_weights()
+    np.random.seed(123456)
+    node_sizes = np.random.randint(1, 3, size=600).astype("float32")
+
+    community_of_nodes = _initial_partitions()
+    initial_score = tl.score_partitions(
+        low_partition_size=45,
+        target_partition_size=75,
+        high_partition_size=150,
+        node_sizes=node_sizes,
+        edge_weights=edge_weights,
+        partition_of_nodes=community_of_nodes,
+    )
+    expected_score = _dense_partitions_score(edge_weights, community_of_nodes, node_sizes, 45, 75, 150)
+    assert np.isclose(initial_score, expected_score, rtol=1e-6)
+
+    for parallel_batch_size in (0, 16):
+        community_of_nodes = _initial_partitions()
+        optimized_score = tl.optimize_partitions(
+            edge_weights=edge_weights,
+            community_of_nodes=community_of_nodes,
+            low_partition_size=45,
+            target_partition_size=75,
+            high_partition_size=150,
+            node_sizes=node_sizes,
+            parallel_batch_size=parallel_batch_size,
+            random_seed=123456,
+        )
+        assert optimized_score > initial_score
+        expected_score = _dense_partitions_score(edge_weights, community_of_nodes, node_sizes, 45, 75, 150)
+        assert np.isclose(optimized_score, expected_score, rtol=1e-6)
+        rescored_score = tl.score_partitions(
+            low_partition_size=45,
+            target_partition_size=75,
+            high_partition_size=150,
+            node_sizes=node_sizes,
+            edge_weights=edge_weights,
+            partition_of_nodes=community_of_nodes,
+        )
+        assert np.isclose(rescored_score, expected_score, rtol=1e-6)
+
+
+def test_partitioner() -> None:
+    edge_weights = _clustered_edge_weights()
+    node_sizes = np.ones(600, dtype="float32")
+    initial_partitions = _initial_partitions()
+
+    expected_partitions = initial_partitions.copy()
+    expected_score = tl.optimize_partitions(
+        edge_weights=edge_weights,
+        community_of_nodes=expected_partitions,
+        low_partition_size=30,
+        target_partition_size=50,
+        high_partition_size=100,
+        node_sizes=node_sizes,
+        random_seed=123456,
+    )
+
+    partitioner = tl.Partitioner(
+        edge_weights=edge_weights,
+        community_of_nodes=initial_partitions,
+        low_partition_size=30,
+        target_partition_size=50,
+        high_partition_size=100,
+        node_sizes=node_sizes,
+    )
+    initial_score = tl.score_partitions(
+        low_partition_size=30,
+        target_partition_size=50,
+        high_partition_size=100,
+        node_sizes=node_sizes,
+        edge_weights=edge_weights,
+        partition_of_nodes=initial_partitions,
+    )
+    assert np.isclose(partitioner.score(), initial_score, rtol=1e-9)
+
+    for _ in range(2):
+        assert np.isclose(partitioner.optimize(random_seed=123456), expected_score, rtol=1e-9)
+        assert np.all(partitioner.get_partitions() == expected_partitions)
+        assert np.isclose(partitioner.score(), expected_score, rtol=1e-9)
+        partitioner.set_partitions(initial_partitions)
+        assert np.all(partitioner.get_partitions() == initial_partitions)
+        assert np.isclose(partitioner.score(), initial_score, rtol=1e-9)
+
+
+def test_optimize_piles_partitions() -> None:
+    nodes_count_of_piles = [600, 300, 450]
+    edge_weights_of_piles = [_clustered_edge_weights(nodes_count) for nodes_count in nodes_count_of_piles]
+    partitions_of_piles = [_initial_partitions(nodes_count, nodes_count // 50) for nodes_count in nodes_count_of_piles]
+
+    edge_weights = sparse.block_diag(edge_weights_of_piles, format="csr")
+    pile_of_nodes = np.repeat(np.arange(3), nodes_count_of_piles).astype("int32")
+    community_of_nodes = np.concatenate(partitions_of_piles).astype("int32")
+    node_sizes = np.ones(len(community_of_nodes), dtype="float32")
+
+    score_of_piles = tl.optimize_piles_partitions(
+        edge_weights=edge_weights,
+        pile_of_nodes=pile_of_nodes,
+        community_of_nodes=community_of_nodes,
+        low_partition_size=30,
+        target_partition_size=50,
+        high_partition_size=100,
+        node_sizes=node_sizes,
+        parallel_batch_size=16,
+        random_seed=123456,
+    )
+    assert score_of_piles.shape == (3,)
+
+    for pile_index, (pile_edge_weights, pile_partitions) in enumerate(zip(edge_weights_of_piles, partitions_of_piles)):
+        pile_score = tl.optimize_partitions(
+            edge_weights=pile_edge_weights,
+            community_of_nodes=pile_partitions,
+            low_partition_size=30,
+            target_partition_size=50,
+            high_partition_size=100,
+            node_sizes=np.ones(len(pile_partitions), dtype="float32"),
+            parallel_batch_size=16,
+            random_seed=123456,
+        )
+        assert np.isclose(score_of_piles[pile_index], pile_score, rtol=1e-9)
+        assert np.all(community_of_nodes[pile_of_nodes == pile_index] == pile_partitions)
+
+
+def test_choose_seeds() -> None:
+    edge_weights = _clustered_edge_weights()
+
+    processors_count = ut.get_processors_count()
+    results = []
+    try:
+        for processors in (1, 4):
+            ut.set_processors_count(processors)
+            results.append(tl.choose_seeds(edge_weights=edge_weights, max_seeds_count=12, random_seed=123456))
+    finally:
+        ut.set_processors_count(processors_count)
+
+    seed_of_cells = results[0]
+    assert np.all(results[1] == seed_of_cells)
+    assert np.min(seed_of_cells) == 0
+    assert np.max(seed_of_cells) == 11
+    assert np.all(np.bincount(seed_of_cells) > 0)
+
+    partial_seed_of_cells = np.full(600, -1, dtype="int32")
+    partial_seed_of_cells[:3] = np.arange(3)
+    tl.choose_seeds(
+        edge_weights=edge_weights, seed_of_cells=partial_seed_of_cells, max_seeds_count=12, random_seed=123456
+    )
+    assert np.all(partial_seed_of_cells[:3] == np.arange(3))
+    assert np.min(partial_seed_of_cells) == 0
+    assert np.max(partial_seed_of_cells) == 11
+    assert np.all(np.bincount(partial_seed_of_cells) > 0)
+
+
+def test_cover_coordinates() -> None:
+    np.random.seed(123456)
+    x_coordinates = np.random.rand(2000)
+    y_coordinates = np.random.rand(2000)
+    diameter = ut.cover_diameter(
+        points_count=2000,
+        area=float(np.ptp(x_coordinates) * np.ptp(y_coordinates)),
+        cover_fraction=1 / 3,
+    )
+
+    processors_count = ut.get_processors_count()
+    results = []
+    try:
+        for processors in (1, 4):
+            ut.set_processors_count(processors)
+            results.append(ut.cover_coordinates(x_coordinates, y_coordinates, noise_fraction=0, random_seed=123456))
+    finally:
+        ut.set_processors_count(processors_count)
+
+    spaced_x_coordinates, spaced_y_coordinates = results[0]
+    assert np.all(results[1][0] == spaced_x_coordinates)
+    assert np.all(results[1][1] == spaced_y_coordinates)
+
+    locations = np.unique(np.vstack([spaced_x_coordinates, spaced_y_coordinates]), axis=1)
+    assert locations.shape == (2, 2000)
+
+    distances = np.hypot(spaced_x_coordinates - x_coordinates, spaced_y_coordinates - y_coordinates)
+    assert np.max(distances) < 4 * diameter
+
+
+def _clustered_cells(cluster_of_cells: ut.NumpyVector, *, genes_count: int = 96, markers_count: int = 8) -> AnnData:
+    umis_per_gene_per_cell = np.random.poisson(1.0, size=(len(cluster_of_cells), genes_count))
+    for cell_index, cluster_index in enumerate(cluster_of_cells):
+        marker_genes = slice(cluster_index * markers_count, (cluster_index + 1) * markers_count)
+        umis_per_gene_per_cell[cell_index, marker_genes] += np.random.poisson(20.0, size=markers_count)
+    return AnnData(X=np.log2(umis_per_gene_per_cell + 1).astype("float32"))
+
+
+def test_extend_obs_obs_knn_graph() -> None:
+    np.random.seed(123456)
+    cluster_of_existing = np.repeat(np.arange(12), 50)
+    cluster_of_new = np.repeat(np.arange(2), 20)
+    cluster_of_cells = np.concatenate([cluster_of_existing, cluster_of_new])
+    adata = _clustered_cells(cluster_of_cells)
+    existing_size = len(cluster_of_existing)
+    size = len(cluster_of_cells)
+
+    edata = adata[range(existing_size), :].copy()
+    tl.compute_obs_obs_similarity(edata, reproducible=True)
+    tl.compute_obs_obs_knn_graph(edata, k=10)
+    existing_pruned_ranks = sparse.csr_matrix(ut.get_oo_proper(edata, "obs_pruned_ranks", layout="row_major"))
+
+    tl.extend_obs_obs_knn_graph(adata, pruned_ranks=existing_pruned_ranks, k=10)
+    extended_pruned_ranks = sparse.csr_matrix(ut.get_oo_proper(adata, "obs_pruned_ranks", layout="row_major"))
+    extended_weights = sparse.csr_matrix(ut.get_oo_proper(adata, "obs_outgoing_weights", layout="row_major"))
+    assert extended_weights.shape == (size, size)
+    assert np.allclose(ut.sum_per(extended_weights, per="row"), 1)
+
+    # The clusters without new cells are not connected to the new cells, so their rows are not affected.
+    unaffected_indices = np.where(cluster_of_existing >= 2)[0]
+    unaffected_existing_ranks = existing_pruned_ranks[unaffected_indices, :]
+    assert (unaffected_existing_ranks != extended_pruned_ranks[unaffected_indices, :existing_size]).nnz == 0
+    assert extended_pruned_ranks[unaffected_indices, existing_size:].nnz == 0
+
+    fdata = adata.copy()
+    tl.compute_obs_obs_similarity(fdata, reproducible=True)
+    tl.compute_obs_obs_knn_graph(fdata, k=10)
+    full_weights = sparse.csr_matrix(ut.get_oo_proper(fdata, "obs_outgoing_weights", layout="row_major"))
+    extended_edges = extended_weights.astype("bool")
+    full_edges = full_weights.astype("bool")
+    assert (extended_edges[unaffected_indices, :] != full_edges[unaffected_indices, :]).nnz == 0
+    assert extended_edges.multiply(full_edges).nnz > 0.8 * full_edges.nnz
+
+    community_of_nodes = np.full(size, -1, dtype="int32")
+    community_of_nodes[:existing_size] = cluster_of_existing
+    tl.optimize_extended_partitions(
+        edge_weights=extended_weights,
+        community_of_nodes=community_of_nodes,
+        low_partition_size=25,
+        target_partition_size=50,
+        high_partition_size=100,
+        node_sizes=np.ones(size, dtype="float32"),
+        random_seed=123456,
+    )
+    assert np.min(community_of_nodes) == 0
+    assert np.all(np.bincount(community_of_nodes) > 0)
+    for cluster_index in range(2, 12):
+        cluster_indices = np.where(cluster_of_cells == cluster_index)[0]
+        cluster_community = community_of_nodes[cluster_indices[0]]
+        assert np.all(community_of_nodes[cluster_indices] == cluster_community)
+        assert np.sum(community_of_nodes == cluster_community) == len(cluster_indices)
+
+
 def test_random_piles() -> None:
     result = ut.random_piles(10, target_pile_size=3, random_seed=123456)
     expected = np.array([2, 2, 1, 1, 1, 0, 0, 2, 0, 0])